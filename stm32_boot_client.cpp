@@ -2,9 +2,10 @@
 /brief This file contains all needed algorithms to operate with in-build STM32 bootloaders.
 */
 #include "stm32_boot_client.hpp"
+#include "stm32_boot_client_impl.hpp"
 #include "stm32_io.hpp"
 // TODO Find out how many SRAM in STM32F1xxx
-const Stm32BootClient::McuDescription_t Stm32BootClient::m_mcuDescription[] = {
+const Stm32BootBase::McuDescription_t Stm32BootBase::m_mcuDescription[] = {
     {   /// Stm32F05xxx_F030x8
         0x20000800,
         0x20001fff,
@@ -91,55 +92,8 @@ const Stm32BootClient::McuDescription_t Stm32BootClient::m_mcuDescription[] = {
     },
 
 };
-/*!
- * Function: init 
- * Initializes client serial port and other things.
- * 
- * @return Stm32BootClient::ErrorCode 
- */
-Stm32BootClient::ErrorCode Stm32BootClient::init() {
-    ErrorCode result = Stm32BootLowIo::init();
-    if (result == ErrorCode::OK) {
-        Stm32BootLowIo::delay(BOOT_READY_DELAY);
-    }
-    return result;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::deinit() {
-    auto result = Stm32BootLowIo::deinit();
-    return result;
-}
-/*!
- * Function: checkMcuPresence 
- * Sends 0x7f to MCU that must have been connected to serial port, then waits for ACK
- * 
- * @return Stm32BootClient::ErrorCode 
- */
-Stm32BootClient::ErrorCode Stm32BootClient::checkMcuPresence() {
-    ErrorCode result;
-    uint8_t txbuff[] = {ACK_ASK_CODE};
-    size_t writtern;
-    Stm32BootLowIo::setBootLine(true);
-    ResetMCU();
-    Stm32BootLowIo::setBootLine(false);
-    result = Stm32BootLowIo::write(txbuff, sizeof( txbuff ), &writtern);
-    if (result == ErrorCode::OK) {
-        result = ( writtern == sizeof( txbuff ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-        if (result == ErrorCode::OK) {
-            uint8_t rxbuff[1] = {0};
-            size_t count;
-            result = Stm32BootLowIo::read(rxbuff, sizeof( rxbuff ), &count);
-            if (result == ErrorCode::OK) {
-                result = ( count == sizeof( rxbuff ) ) ? ErrorCode::OK : ErrorCode::SERIAL_RD_SIZE;
-                if (result == ErrorCode::OK) {
-                    result = ( rxbuff[0] == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
-                }
-            }
-        }
-    }
-    return result;
-}
-std::string Stm32BootClient::errorCode2String( ErrorCode _errcode ) {
-    std::string msgs[] = {
+const char * Stm32BootBase::errorCode2String( ErrorCode _errcode ) {
+    static constexpr const char * msgs[] = {
         "OK",
         "Generic Error",
         "ACK has been received",
@@ -150,14 +104,17 @@ std::string Stm32BootClient::errorCode2String( ErrorCode _errcode ) {
         "Can't write N bytes to serial port",
         "Can't read N bytes from serail port",
         "Low level IO: write failed",
-        "Low level IO: read failed"
+        "Low level IO: read failed",
+        "Verification failed",
+        "File operation failed",
+        "Cancelled"
     };
     size_t idx = static_cast<int>(_errcode);
     configASSERT(idx < ARRAY_SIZE(msgs));
     return msgs[idx];
 }
-std::string Stm32BootClient::mcuType2String( McuType _type ) {
-    static const std::string name[] = {
+const char * Stm32BootBase::mcuType2String( McuType _type ) {
+    static constexpr const char * name[] = {
         "STM32F05xxx or STM32F030x8",
         "STM32F09xxx",
         "Stm32F10xxx_lowDensity",
@@ -166,7 +123,7 @@ std::string Stm32BootClient::mcuType2String( McuType _type ) {
         "Stm32F10xxx_mediumDensityVl",
         "Stm32F10xxx_highDensityVl",
     };
-    std::string result = "Unknown";
+    const char * result = "Unknown";
     size_t idx = static_cast<size_t>(_type);
     if (idx != 0xff) {
         configASSERT(idx < ARRAY_SIZE(name));
@@ -174,7 +131,48 @@ std::string Stm32BootClient::mcuType2String( McuType _type ) {
     }
     return result;
 }
-Stm32BootClient::McuDescription_t Stm32BootClient::mcuType2Description( McuType _type ) {
+const char * Stm32BootBase::phase2String( Phase _phase ) {
+    static constexpr const char * name[] = {
+        "idle",
+        "erase",
+        "write",
+        "verify",
+        "read",
+    };
+    size_t idx = static_cast<size_t>(_phase);
+    configASSERT(idx < ARRAY_SIZE(name));
+    return name[idx];
+}
+/*!
+ * Function: bootVer2String 
+ * Formats the bootloader version byte as "major.minor" into the caller's buffer.
+ * 
+ * @param _bootVer version byte, major in the high nibble.
+ * @param _buf destination, BOOT_VER_STR_SIZE bytes are always enough.
+ * @param _size size of _buf.
+ * 
+ * @return const char* _buf, empty string if it is too small.
+ */
+const char * Stm32BootBase::bootVer2String( uint8_t _bootVer, char * _buf, size_t _size ) {
+    configASSERT(_buf && _size);
+    uint8_t part[] = { static_cast<uint8_t>(_bootVer >> 4), static_cast<uint8_t>(_bootVer & 0x0f)};
+    char tmp[BOOT_VER_STR_SIZE];
+    size_t len = 0;
+    for ( size_t i = 0; i < ARRAY_SIZE(part); i++ ) {
+        if (part[i] > 9)
+            tmp[len++] = '1';
+        tmp[len++] = static_cast<char>('0' + part[i] % 10);
+        tmp[len++] = '.';
+    }
+    tmp[len - 1] = 0;
+    if (len <= _size) {
+        memcpy(_buf, tmp, len);
+    } else {
+        _buf[0] = 0;
+    }
+    return _buf;
+}
+Stm32BootBase::McuDescription_t Stm32BootBase::mcuType2Description( McuType _type ) {
     McuDescription_t result;
     memset(&result, 0xff, sizeof( result ));
     if (_type != McuType::Unknown) {
@@ -184,7 +182,16 @@ Stm32BootClient::McuDescription_t Stm32BootClient::mcuType2Description( McuType
     }
     return result;
 }
-Stm32BootClient::McuType Stm32BootClient::chipId2McuType( uint16_t _chipid ) {
+/*!
+ * Function: mcuTypeCount 
+ * Known MCU types are numbered from 0 to mcuTypeCount() - 1.
+ * 
+ * @return size_t 
+ */
+size_t Stm32BootBase::mcuTypeCount() {
+    return ARRAY_SIZE(m_mcuDescription);
+}
+Stm32BootBase::McuType Stm32BootBase::chipId2McuType( uint16_t _chipid ) {
     Stm32BootClient::McuType result = McuType::Unknown;
     switch (_chipid) {
     case 0x0440:
@@ -214,386 +221,77 @@ Stm32BootClient::McuType Stm32BootClient::chipId2McuType( uint16_t _chipid ) {
     return result;
 
 }
-void Stm32BootClient::ResetMCU() {
-    Stm32BootLowIo::setResetLine(false);
-    Stm32BootLowIo::delay(100);
-    Stm32BootLowIo::setResetLine(true);
-    Stm32BootLowIo::delay(100);
-}
 /*!
- * Function: commandGet 
- * Get Command function
+ * Function: assembleWriteFrame 
+ * Prepares everything Write Memory command sends after the command byte, 
+ * so a frame can be built long before it is sent.
  * 
- * @param _resp 
+ * @param _frame result.
+ * @param _src data to be written.
+ * @param _addr destination address.
+ * @param _size size of data, up to 256 bytes, multiple of 4.
+ */
+void Stm32BootBase::assembleWriteFrame( WriteFrame_t &_frame, const void * _src, uint32_t _addr, size_t _size ) {
+    configASSERT(_src);
+    configASSERT(_size && _size <= MAX_WRITE_BLOCK_SIZE && !( _size % 4 ));
+    _frame.addr = _addr;
+    addr32_to_byte(_addr, _frame.addrPhase);
+    _frame.addrPhase[4] = calculateXor(_frame.addrPhase, 4);
+    uint8_t sz = static_cast<uint8_t>(_size - 1);
+    _frame.dataPhase[0] = sz;
+    if (_src != &_frame.dataPhase[1]) // data can be placed into the frame in advance
+        memcpy(&_frame.dataPhase[1], _src, _size);
+    _frame.dataPhase[_size + 1] = calculateXor(static_cast<const uint8_t *>(_src), _size) ^ sz;
+    _frame.dataPhaseSize = static_cast<uint16_t>(_size + 2);
+}
+/*!
+ * Function: fillStreamFrame 
+ * Pulls up to 256 bytes from the source right into the frame and assembles it. 
+ * The tail is padded with 0xff up to a word.
  * 
- * @return Stm32BootClient::ErrorCode 
+ * @return size_t number of bytes pulled, 0 at the end of the data.
  */
-Stm32BootClient::ErrorCode Stm32BootClient::commandGet( CommandGetResponse_t &_resp ) {
-    ErrorCode err;
-    size_t written;
-    static const uint8_t cmd = static_cast<uint8_t>(Command::Get);
-    uint8_t txBuff[] = { cmd, static_cast<uint8_t>(~cmd)};
-    err = Stm32BootLowIo::write(txBuff, sizeof( txBuff ), &written);
-    if (err == ErrorCode::OK) {
-        err = ( written == sizeof( txBuff ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-        if (err == ErrorCode::OK) {
-            size_t rd;
-            uint8_t ackCode;
-            err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-            if (err == ErrorCode::OK) {
-                err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                if (err == ErrorCode::OK) {
-                    err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
-                    if (err == ErrorCode::ACK_OK) {
-                        err = Stm32BootLowIo::read(&_resp, sizeof( CommandGetResponse_t ), &rd);
-                        if (err == ErrorCode::OK) {
-                            err = ( rd == sizeof( _resp ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                            if (err == ErrorCode::OK) {
-                                err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-                                if (err == ErrorCode::OK) {
-                                    err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                                    if (err == ErrorCode::OK) {
-                                        err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::OK : ErrorCode::ACK_FAILED;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+size_t Stm32BootBase::fillStreamFrame( WriteFrame_t &_frame, ReadSource_t _source, void * _ctx, uint32_t _addr ) {
+    uint8_t * data = &_frame.dataPhase[1];
+    size_t size = 0;
+    size_t rd;
+    do {
+        rd = _source(_ctx, data + size, MAX_WRITE_BLOCK_SIZE - size);
+        size += rd;
+    } while (rd && size < MAX_WRITE_BLOCK_SIZE);
+    if (size) {
+        size_t padded = ( size + 3 ) & ~static_cast<size_t>(3);
+        memset(data + size, 0xff, padded - size);
+        assembleWriteFrame(_frame, data, _addr, padded);
     }
-    return err;
+    return size;
 }
+// if _pagenumarray == nullptr then we do global erase
 /*!
- * Function: commandGvRps 
- * Get Version & Read Protection Status Command function.
+ * Function: calculateCrc32 
+ * CRC32 the same way as STM32 CRC unit does it in default configuration: 
+ * polynomial 0x04C11DB7, 32-bit little-endian words, no reflection, no final XOR.
  * 
- * @param _resp 
+ * @param _src pointer to data.
+ * @param _size size in bytes, multiple of 4.
+ * @param _crc initial value or CRC of the previous part.
  * 
- * @return Stm32BootClient::ErrorCode 
+ * @return uint32_t 
  */
-Stm32BootClient::ErrorCode Stm32BootClient::commandGvRps( CommandGvRpsResponse_t &_resp ) {
-    ErrorCode err;
-    size_t written;
-    static const uint8_t cmd = static_cast<uint8_t>(Command::GvRps);
-    uint8_t txBuff[] = { cmd, static_cast<uint8_t>(~cmd)};
-    err = Stm32BootLowIo::write(txBuff, sizeof( txBuff ), &written);
-    if (err == ErrorCode::OK) {
-        err = ( written == sizeof( txBuff ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-        if (err == ErrorCode::OK) {
-            size_t rd;
-            uint8_t ackCode;
-            err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-            if (err == ErrorCode::OK) {
-                err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                if (err == ErrorCode::OK) {
-                    err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
-                    if (err == ErrorCode::ACK_OK) {
-                        err = Stm32BootLowIo::read(&_resp, sizeof( _resp ), &rd);
-                        if (err == ErrorCode::OK) {
-                            err = ( rd == sizeof( _resp ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                            if (err == ErrorCode::OK) {
-                                err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-                                if (err == ErrorCode::OK) {
-                                    err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                                    if (err == ErrorCode::OK) {
-                                        err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::OK : ErrorCode::ACK_FAILED;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    return err;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::commandGetId( CommandGetIdResponse_t &_resp ) {
-    ErrorCode err;
-    size_t written;
-    static const uint8_t cmd = static_cast<uint8_t>(Command::Getid);
-    uint8_t txBuff[] = { cmd, static_cast<uint8_t>(~cmd)};
-    err = Stm32BootLowIo::write(txBuff, sizeof( txBuff ), &written);
-    if (err == ErrorCode::OK) {
-        err = ( written == sizeof( txBuff ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-        if (err == ErrorCode::OK) {
-            size_t rd;
-            uint8_t ackCode;
-            err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-            if (err == ErrorCode::OK) {
-                err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                if (err == ErrorCode::OK) {
-                    err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
-                    if (err == ErrorCode::ACK_OK) {
-                        err = Stm32BootLowIo::read(&_resp, sizeof( _resp ), &rd);
-                        if (err == ErrorCode::OK) {
-                            err = ( rd == sizeof( _resp ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                            if (err == ErrorCode::OK) {
-                                err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-                                if (err == ErrorCode::OK) {
-                                    err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                                    if (err == ErrorCode::OK) {
-                                        err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::OK : ErrorCode::ACK_FAILED;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    return err;
-}
-// TODO Check with RDP is active, must be twon NACKS
-Stm32BootClient::ErrorCode Stm32BootClient::commandReadMemory( void * _dst, uint32_t _addr, size_t _size ) {
-    configASSERT(_dst);
-    configASSERT(_size && _size <= 0x100);
-    ErrorCode err;
-    size_t written;
-    err = commandGenericSend(Command::ReadMemory);
-    if (err == ErrorCode::ACK_OK) {
-        err = genericSendAddr(_addr);
-        if (err == ErrorCode::ACK_OK) {
-            uint8_t sz = static_cast<uint8_t>(_size - 1);
-            uint8_t numarr[] = {sz, static_cast<uint8_t>(~sz)};
-            err = Stm32BootLowIo::write(numarr, sizeof( numarr ), &written);
-            if (err == ErrorCode::OK) {
-                err = ( written == sizeof( numarr ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                if (err == ErrorCode::OK) {
-                    uint8_t ackCode;
-                    size_t rd;
-                    err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-                    if (err == ErrorCode::OK) {
-                        err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                        if (err == ErrorCode::OK) {
-                            err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
-                            if (err == ErrorCode::ACK_OK) {
-                                err = Stm32BootLowIo::read(_dst, _size, &rd);
-                                if (err == ErrorCode::OK && rd != _size)
-                                    err = ErrorCode::FAILED;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    return err;
-}
-// TODO doesn't run uc(((( Using reset instead
-Stm32BootClient::ErrorCode Stm32BootClient::commandGo( uint32_t _addr ) {
-    ErrorCode err = commandGenericSend(Command::Go);
-    if (err == ErrorCode::ACK_OK) {
-        err = genericSendAddr(_addr);
-        if (err == ErrorCode::ACK_OK) {
-            err = ErrorCode::OK;
-        }
-    }
-    if (err != ErrorCode::OK) {
-        Stm32BootLowIo::flush();
-    }
-    return err;
-}
-// TODO check out of range memory address
-Stm32BootClient::ErrorCode Stm32BootClient::commandWriteMemory( const void * _src, uint32_t _addr, size_t _size ) {
+uint32_t Stm32BootBase::calculateCrc32( const void * _src, size_t _size, uint32_t _crc ) {
     configASSERT(_src);
-    configASSERT(_size && _size <= 0x100 && !( _size % 4 ));
-    ErrorCode err = commandGenericSend(Command::WriteMem);
-    if (err == ErrorCode::ACK_OK) {
-        err = genericSendAddr(_addr);
-        if (err == ErrorCode::ACK_OK) {
-            uint8_t sz = static_cast<uint8_t>(_size - 1);
-            uint8_t xor_cs = calculateXor(static_cast<const uint8_t *>(_src), _size) ^ sz;
-            size_t written;
-            err = Stm32BootLowIo::write(&sz, sizeof( sz ), &written);
-            if (err == ErrorCode::OK) {
-                err = ( written == sizeof( sz ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                if (err == ErrorCode::OK) {
-                    err = Stm32BootLowIo::write(_src, _size, &written);
-                    if (err == ErrorCode::OK) {
-                        err = ( written == _size ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                        if (err == ErrorCode::OK) {
-                            err = Stm32BootLowIo::write(&xor_cs, sizeof( xor_cs ), &written);
-                            if (err == ErrorCode::OK) {
-                                err = ( written == sizeof( xor_cs ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                                if (err == ErrorCode::OK) {
-                                    uint8_t ackCode;
-                                    size_t rd;
-                                    err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-                                    if (err == ErrorCode::OK) {
-                                        err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                                        if (err == ErrorCode::OK) {
-                                            err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::OK : ErrorCode::ACK_FAILED;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    return err;
-}
-// if _pagenumarray == nullptr then we do global erase
-Stm32BootClient::ErrorCode Stm32BootClient::commandErase( const uint8_t * _pagenumarray, size_t _count ) {
-    auto err = commandGenericSend(Command::Erase);
-    if (err == ErrorCode::ACK_OK) {
-        size_t written;
-        if (_pagenumarray == nullptr) {
-            uint8_t txarr[] = {0xff, 0};
-            err = Stm32BootLowIo::write(txarr, sizeof( txarr ), &written);
-            if (err == ErrorCode::OK) {
-                err = ( written == sizeof( txarr ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-            }
-        } else {
-            uint8_t sz = static_cast<uint8_t>(_count);
-            uint8_t xor_cs = calculateXor(_pagenumarray, _count) ^ sz;
-            err = Stm32BootLowIo::write(&sz, sizeof( sz ), &written);
-            if (err == ErrorCode::OK) {
-                err = ( written == sizeof( sz ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                if (err == ErrorCode::OK) {
-                    err = Stm32BootLowIo::write(_pagenumarray, _count, &written);
-                    if (err == ErrorCode::OK) {
-                        err = ( written == _count ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                        if (err == ErrorCode::OK) {
-                            err = Stm32BootLowIo::write(&xor_cs, sizeof( xor_cs ), &written);
-                            if (err == ErrorCode::OK) {
-                                err = ( written == sizeof( xor_cs ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        if (err == ErrorCode::OK) {
-            uint8_t ackCode;
-            size_t rd;
-            err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-            if (err == ErrorCode::OK) {
-                err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::FAILED;
-                if (err == ErrorCode::OK) {
-                    err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::OK : ErrorCode::ACK_FAILED;
-                }
-            }
-        }
-    }
-    return err;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::commandExtendedErase( const uint16_t * _pagenumarray, uint16_t _count ) {
-    auto err = commandGenericSend(Command::ExtErase);
-    if (err == ErrorCode::ACK_OK) {
-        size_t written;
-        if (_count == EXT_MASS_ERASE || _count == EXT_BANK1_ERASE || _count == EXT_BANK2_ERASE) {
-            uint16_t txarray[] = {_count, static_cast<uint16_t>(~_count)};
-            err = Stm32BootLowIo::write(txarray, sizeof( txarray ), &written);
-            if (err == ErrorCode::OK) {
-                err = ( written == sizeof( txarray ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-            }
-        } else {
-            uint16_t sz = _count;
-            sz--;
-            uint8_t xor_cs = calculateXor(reinterpret_cast<const uint8_t *>(_pagenumarray), 2 * _count);
-            xor_cs = xor_cs ^ calculateXor(reinterpret_cast<const uint8_t *>(&sz), sizeof( sz ));
-            err = serialWrite16(&_count, 1, &written);
-            if (err == ErrorCode::OK) {
-                err = ( written == 1 ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                if (err == ErrorCode::OK) {
-                    err = serialWrite16(_pagenumarray, _count, &written);
-                    if (err == ErrorCode::OK) {
-                        err = ( written == _count ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                        if (err == ErrorCode::OK) {
-                            err = Stm32BootLowIo::write(&xor_cs, sizeof( xor_cs ), &written);
-                            if (err == ErrorCode::OK) {
-                                err = ( written == sizeof( xor_cs ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        if (err == ErrorCode::OK) {
-            uint8_t ackCode;
-            size_t rd;
-            err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-            if (err == ErrorCode::OK) {
-                err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::SERIAL_RD_SIZE;
-                if (err == ErrorCode::OK) {
-                    err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::OK : ErrorCode::ACK_FAILED;
-                }
-            }
+    configASSERT(!( _size % 4 ));
+    const uint8_t * p = static_cast<const uint8_t *>(_src);
+    for ( size_t i = 0; i < _size; i += 4 ) {
+        _crc ^= static_cast<uint32_t>(p[i]) | static_cast<uint32_t>(p[i + 1]) << 8 |
+            static_cast<uint32_t>(p[i + 2]) << 16 | static_cast<uint32_t>(p[i + 3]) << 24;
+        for ( int bit = 0; bit < 32; bit++ ) {
+            _crc = ( _crc & 0x80000000 ) ? ( _crc << 1 ) ^ 0x04c11db7 : _crc << 1;
         }
     }
-    return err;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::commandReadoutUnprotect() {
-    auto err = commandGenericSend(Command::ReadoutUnprotect);
-    if (err != ErrorCode::ACK_OK)
-        return err;
-    uint8_t ack;
-    size_t rd;
-    while (1) {
-        err = Stm32BootLowIo::read(&ack, sizeof( ack ), &rd);
-        if (err == ErrorCode::OK && rd == sizeof( ack )) {
-            return ( ack == ACK_RESP_CODE ) ?  ErrorCode::OK : ErrorCode::FAILED;
-        }
-    }
-}
-Stm32BootClient::ErrorCode Stm32BootClient::genericSendAddr( uint32_t _addr ) {
-    ErrorCode err;
-    uint8_t addr_array[4];
-    addr32_to_byte(_addr, addr_array);
-    //std::cout << std::hex << (int)addr_array[0] << " " << (int)addr_array[1] << " " << (int)addr_array[2] << " " << (int)addr_array[3];
-    size_t written;
-    err = Stm32BootLowIo::write(addr_array, sizeof( addr_array ), &written);
-    if (err == ErrorCode::OK && written == sizeof( addr_array )) {
-        uint8_t xor_cs = calculateXor(reinterpret_cast<uint8_t *>(&_addr), sizeof( _addr ));
-        err = Stm32BootLowIo::write(&xor_cs, sizeof( xor_cs ), &written);
-        if (err == ErrorCode::OK) {
-            err = ( written == sizeof( xor_cs ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-            if (err == ErrorCode::OK) {
-                uint8_t ackCode;
-                size_t rd;
-                err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-                if (err == ErrorCode::OK) {
-                    err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::SERIAL_RD_SIZE;
-                    if (err == ErrorCode::OK) {
-                        /// TODO Maby two NACKs
-                        err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
-                    }
-                }
-            }
-        }
-    }
-    return err;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::readMcuSpecificInfo( uint16_t _chipid, McuSpecificInfo_t &_info ) {
-    ErrorCode err;
-    McuType mcu = chipId2McuType(_chipid);
-    if (mcu == McuType::Unknown)
-        err = ErrorCode::UNKNOWN_MCU;
-    else {
-        McuDescription_t descr = mcuType2Description(mcu);
-        if (descr.blRamBegin == 0xffffffff)
-            err = ErrorCode::UNKNOWN_MCU;
-        else {
-            _info.flashSize = 0; // upper two bytest are not used in commandReadMemory and can contain any garbage
-            err = commandReadMemory(&_info.flashSize, descr.flashSizeReg, 2);
-            if (err == ErrorCode::OK) {
-                _info.flashSize *= 1024; /// as size of the device expressed in Kbytes
-            }
-        }
-    }
-    if (err != ErrorCode::OK) {
-        Stm32BootLowIo::flush(); // if two NACKs (RDP active) sent
-    }
-    return err;
+    return _crc;
 }
-uint8_t Stm32BootClient::calculateXor( const uint8_t * _src, size_t _size ) {
+uint8_t Stm32BootBase::calculateXor( const uint8_t * _src, size_t _size ) {
     configASSERT(_src);
     configASSERT(_size);
     uint8_t result = *_src++;
@@ -605,101 +303,12 @@ uint8_t Stm32BootClient::calculateXor( const uint8_t * _src, size_t _size ) {
     return result;
     ;
 }
-Stm32BootClient::ErrorCode Stm32BootClient::commandGenericSend( Command _cmd ) {
-    ErrorCode err;
-    size_t written;
-    uint8_t cmd = static_cast<uint8_t>(_cmd);
-    uint8_t txBuff[] = { cmd, static_cast<uint8_t>(~cmd)};
-    err = Stm32BootLowIo::write(txBuff, sizeof( txBuff ), &written);
-    if (err == ErrorCode::OK) {
-        err = ( written == sizeof( txBuff ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-        if (err == ErrorCode::OK) {
-            size_t rd;
-            uint8_t ackCode;
-            err = Stm32BootLowIo::read(&ackCode, sizeof( ackCode ), &rd);
-            if (err == ErrorCode::OK) {
-                err = ( rd == sizeof( ackCode ) ) ? ErrorCode::OK : ErrorCode::SERIAL_RD_SIZE;
-                if (err == ErrorCode::OK) {
-                    err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
-                }
-            }
-        }
-    }
-    return err;
-}
-void Stm32BootClient::addr32_to_byte( uint32_t _addr, uint8_t * _array ) {
+void Stm32BootBase::addr32_to_byte( uint32_t _addr, uint8_t * _array ) {
     configASSERT(_array);
     for ( size_t addr_b_count = 0; addr_b_count < sizeof( _addr ) && _array; addr_b_count++ ) {
         *_array++ = static_cast<uint8_t>(_addr >> ( 24 - addr_b_count * 8 ));
     }
 }
-/*!
- * Function: serialWrite16 
- * Sends an array of uint16_t, MSB first.
- * 
- * @param _src pointer to data.
- * @param _size size in half-words (2 bytes).
- * @param _written a number of half-words written to serial port.
- * 
- * @return Stm32BootClient::ErrorCode 
- */
-Stm32BootClient::ErrorCode Stm32BootClient::serialWrite16( const uint16_t * _src, size_t _size, size_t * _written ) {
-    auto err = ErrorCode::OK;
-    configASSERT(_src);
-    if (_written)
-        *_written = 0;
-    while (_size-- && err == ErrorCode::OK) {
-        uint8_t txarr[] = {static_cast<uint8_t>(( *_src >> 8 ) & 0xff), static_cast<uint8_t>(*_src & 0xff)};
-        _src++;
-        size_t written;
-        err = Stm32BootLowIo::write(txarr, sizeof( txarr ), &written);
-        if (err == ErrorCode::OK) {
-            err = ( written == sizeof( txarr ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
-            if (err == ErrorCode::OK)
-                ( *_written )++;
-        }
-    }
-    return err;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::readMemory( void * _dst, uint32_t _addr, size_t _size ) {
-    configASSERT(_dst);
-    auto err = ErrorCode::OK;
-    while (_size && err == ErrorCode::OK) {
-        size_t bytes_to_send = ( _size > 256 ) ? 256 : _size;
-        _size -= bytes_to_send;
-        err = commandReadMemory(_dst, _addr, bytes_to_send);
-        if (err == ErrorCode::OK) {
-            uint8_t * pArithm = static_cast<uint8_t *>(_dst);
-            pArithm += bytes_to_send;
-            _dst = pArithm;
-            _addr += static_cast<uint32_t>(bytes_to_send);
-        }
-    }
-    return err;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::writeMemory( const void * _src, uint32_t _addr, size_t _size ) {
-    configASSERT(_src);
-    auto err = ErrorCode::OK;
-    const uint8_t * pData = static_cast<const uint8_t *>(_src);
-    while (_size && err == ErrorCode::OK) {
-        size_t bytes_to_send = ( _size > MAX_WRITE_BLOCK_SIZE ) ? MAX_WRITE_BLOCK_SIZE : _size;
-        _size -= bytes_to_send;
-        err = commandWriteMemory(pData, _addr, bytes_to_send);
-        pData += bytes_to_send;
-        _addr += static_cast<uint32_t>(bytes_to_send);
-    }
-    return err;
-}
-Stm32BootClient::ErrorCode Stm32BootClient::eraseAllMemory() {
-    CommandGetResponse_t getresp;
-    auto err = commandGet(getresp);
-    if (err == ErrorCode::OK) {
-        bool isExtendedSupport = false;
-        for ( size_t cmd = 0; cmd < getresp.getCommandListSize(); cmd++ ) {
-            if (getresp.getCommand(cmd) == Command::ExtErase)
-                isExtendedSupport = true;
-        }
-        err = isExtendedSupport ? commandExtendedErase(nullptr, EXT_MASS_ERASE) : commandErase();
-    }
-    return err;
-}
+/// The default client over the platform serial port
+template class Stm32BootClientT<Stm32BootLowIo>;
+
@@ -1,8 +1,15 @@
 #pragma once
 #ifdef __cplusplus
 #include <inttypes.h>
-#include <string>
-class Stm32BootClient {
+#include <stddef.h>
+#include <atomic>
+/*!
+ * The core never allocates and throws nothing: strings come from static tables,
+ * buffers are static or provided by the caller. It builds with -fno-exceptions
+ * -fno-rtti and is the same code on the FreeRTOS target and on the host.
+ * Stm32BootBase holds the types, tables and helpers that don't need a transport.
+ */
+class Stm32BootBase {
 public:
     typedef __packed struct McuDescription_t {
         uint32_t blRamBegin;
@@ -39,6 +46,9 @@ public:
         SERIAL_RD_SIZE = 0x08,      /// Cant read N bytes
         SERIAL_WR_FAILED = 0x09,    /// Cant write at low level IO
         SERIAL_RD_FAILED = 0x0a,    /// Cant read at low level IO
+        VERIFY_FAILED = 0x0b,       /// Memory content differs from the source
+        FILE_FAILED = 0x0c,         /// Can't read, write or parse a file
+        CANCELLED = 0x0d,           /// Stopped by cancel() between two commands
     };
     enum class Command : uint8_t {
         Get = 0x00,                 /// Get the version and allowed commands
@@ -48,25 +58,41 @@ public:
         Go = 0x21,                    /// Execute the downloaded code777
         WriteMem = 0x31,            /// Write memory up to 256 bytes
         Erase = 0x43,               ///  Erase from one to all the Flash pages
+        WriteMemNs = 0x32,          /// No-Stretch Write memory (I2C only)
         ExtErase = 0x44,            /// Erases from one to all pages using two-byte addressing mode
+        ExtEraseNs = 0x45,          /// No-Stretch Erase memory (I2C only)
         ReadoutUnprotect = 0x92,    /// Disables the read protection
+        GetChecksum = 0xa1,         /// Get CRC of a memory area (bootloader v3.x and later)
+    };
+    enum class ProtocolVariant : uint8_t {
+        Usart = 0x00,               /// AN3155
+        I2c,                        /// AN4221
+        Spi,                        /// AN4286
+        Can,                        /// AN3154
     };
     static const uint16_t EXT_MASS_ERASE = 0xffff;
     static const uint16_t EXT_BANK1_ERASE = 0xfffe;
     static const uint16_t EXT_BANK2_ERASE = 0xfffd;
+    static const uint16_t CAN_SYNC_ID = 0x79;       /// sync frame and its ACK
+    static const uint16_t CAN_DATA_ID = 0x04;       /// Write Memory data frames
+    /// A CAN transport takes and gives whole frames of this layout: standard ID, DLC and payload (AN3154)
+    typedef __packed struct CanFrame_t {
+        uint16_t id;
+        uint8_t dlc;
+        uint8_t data[8];
+    }
+    CanFrame_t;
     typedef __packed struct CommandGetResponse_t {
     public:
         void getBootVer( uint8_t &_high, uint8_t &_low ){
             _high = static_cast<uint8_t>( bootver >> 4 );
             _low = bootver & 0x0f;
         }
-        std::string getBootVerStr( ){
-            uint8_t high, low;
-            getBootVer( high, low );
-            return std::to_string( high )+ "." + std::to_string( low );
+        const char * getBootVerStr( char * _buf, size_t _size ){
+            return bootVer2String( bootver, _buf, _size );
         }
         size_t getCommandListSize( )const {
-            return sizeof( supportedCommands );
+            return ( bytenum < sizeof( supportedCommands ) ) ? bytenum : sizeof( supportedCommands );
         }
         Command getCommand( size_t _idx ){
             //    configASSERT(_idx < sizeof( supportedCommands ));
@@ -79,7 +105,7 @@ public:
     private:
         uint8_t bytenum;
         uint8_t bootver;
-        uint8_t supportedCommands[11];
+        uint8_t supportedCommands[32];  /// bytenum tells how many are valid
     }
     CommandGetResponse_t;
     typedef __packed struct CommandGvRpsResponse_t {
@@ -88,10 +114,8 @@ public:
             _high = static_cast<uint8_t>( bootver >> 4 );
             _low = bootver & 0x0f;
         }
-        std::string getBootVerStr( ){
-            uint8_t high, low;
-            getBootVer( high, low );
-            return std::to_string( high )+ "." + std::to_string( low );
+        const char * getBootVerStr( char * _buf, size_t _size ){
+            return bootVer2String( bootver, _buf, _size );
         }
     protected:
         uint8_t bootver;
@@ -110,48 +134,195 @@ public:
         uint8_t pid2;
     }
     CommandGetIdResponse_t;
+    static const auto MAX_WRITE_BLOCK_SIZE = 256;
+    /// Write Memory command payload ready to be sent, see assembleWriteFrame()
+    typedef struct WriteFrame_t {
+        uint32_t addr;
+        uint16_t dataPhaseSize;
+        uint8_t addrPhase[5];                           /// address MSB first and its checksum
+        uint8_t dataPhase[MAX_WRITE_BLOCK_SIZE + 2];    /// N - 1, N bytes of data and checksum
+    }
+    WriteFrame_t;
+    /// Pull-based data source: puts up to _size bytes to _dst, returns their number, 0 at the end of the data
+    typedef size_t ( * ReadSource_t )( void * _ctx, uint8_t * _dst, size_t _size );
     typedef __packed struct McuSpecificInfo_t {
         uint32_t flashSize;     /// in bytes
     }
     McuSpecificInfo_t;
-    static Stm32BootClient * instance() {
-        static Stm32BootClient * __self = new Stm32BootClient;
-        return __self;
+    /// Everything we have learned about the connected bootloader, built once per session by negotiateCaps()
+    typedef struct SessionCaps_t {
+    public:
+        bool isCommandSupported( Command _cmd )const {
+            uint8_t code = static_cast<uint8_t>( _cmd );
+            return ( commandMask[code >> 5] >> ( code & 0x1f ) ) & 1;
+        }
+        void addCommand( Command _cmd ){
+            uint8_t code = static_cast<uint8_t>( _cmd );
+            commandMask[code >> 5] |= 1u << ( code & 0x1f );
+        }
+        bool valid;
+        uint8_t bootVer;
+        uint32_t commandMask[8];    /// one bit per command code
+        uint16_t chipId;
+        McuType mcuType;
+        uint32_t flashSize;         /// in bytes, 0 if it can't be read (RDP)
+        bool rdpActive;
+        ProtocolVariant variant;
+    }
+    SessionCaps_t;
+    enum class Phase : uint8_t {
+        Idle = 0,
+        Erase,
+        Write,
+        Verify,
+        Read,
+    };
+    /*!
+     * What the running long operation has done. The client task stores, any
+     * task loads at any rate without locks. Each counter is exact, a few of
+     * them loaded one after another may be a block apart.
+     */
+    typedef struct Progress_t {
+        std::atomic<uint8_t> phase;         /// Phase
+        std::atomic<uint32_t> done;         /// bytes, pages while erasing
+        std::atomic<uint32_t> total;        /// the same unit, 0 if not known in advance (stream)
+        std::atomic<uint32_t> blocks;       /// commands completed
+        std::atomic<uint32_t> retries;      /// blocks repaired by writeMemoryVerified()
+        std::atomic<uint32_t> address;      /// where the operation goes on, or would after a cancel; a page while erasing
+    }
+    Progress_t;
+    static const size_t BOOT_VER_STR_SIZE = 6;     /// "15.15" and the terminator
+    static const char * errorCode2String( ErrorCode _errcode );
+    static const char * mcuType2String( McuType _type );
+    static const char * phase2String( Phase _phase );
+    static const char * bootVer2String( uint8_t _bootVer, char * _buf, size_t _size );
+    static McuType chipId2McuType( uint16_t _chipid );
+    static McuDescription_t mcuType2Description( McuType _type );
+    static size_t mcuTypeCount();
+    static void assembleWriteFrame( WriteFrame_t &_frame, const void * _src, uint32_t _addr, size_t _size );
+    static uint32_t calculateCrc32( const void * _src, size_t _size, uint32_t _crc = 0xffffffff );
+protected:
+    static const McuDescription_t m_mcuDescription[];
+    static const uint8_t ACK_ASK_CODE = 0x7f;
+    static const uint8_t ACK_RESP_CODE = 0x79;
+    static const uint8_t NACK_RESP_CODE = 0x1f;
+    static const uint8_t BUSY_RESP_CODE = 0x76;
+    static const uint32_t ACK_TIMEOUT_MS = 1000;        /// BUSY of an ordinary command, polled SPI ACKs
+    static const uint32_t ERASE_ACK_TIMEOUT_MS = 40000; /// mass erase of the largest flash, Readout Unprotect
+    static const uint32_t ACK_POLL_DELAY_MS = 1;
+    static const uint32_t ACK_POLL_SPINS = 16;          /// back to back polls before the delays start
+    static const size_t BOOT_READY_DELAY = 777;
+    static const uint8_t SPI_SOF_CODE = 0x5a;       /// starts SPI sync and every SPI command frame
+    static const size_t STREAM_RING_FRAMES = 2;
+    static const size_t VERIFY_RETRIES = 2;
+    static const size_t MAX_PAGE_SIZE = 2048;
+
+    static uint8_t calculateXor( const uint8_t * _src, size_t _size );
+    static void addr32_to_byte( uint32_t _addr, uint8_t * _array );
+    static size_t fillStreamFrame( WriteFrame_t &_frame, ReadSource_t _source, void * _ctx, uint32_t _addr );
+};
+/*!
+ * The client bound to a transport at compile time. Io is a class of static
+ * functions shaped like Stm32BootLowIo: init(), deinit(), write(), read(),
+ * flush(), setResetLine(), setBootLine(), delay() and getTickMs(), and its PROTOCOL_VARIANT
+ * constant selects the framing: USART, I2C, SPI or CAN. A CAN transport
+ * reads and writes whole CanFrame_t records instead of bytes. IO calls are resolved
+ * statically and can be inlined, and every instantiation keeps its own session
+ * state, so clients for several links can live in one binary.
+ * Member definitions are in stm32_boot_client_impl.hpp; include it in one
+ * translation unit and instantiate the client there for a new transport:
+ * template class Stm32BootClientT<MyIo>;
+ */
+template<class Io>
+class Stm32BootClientT : public Stm32BootBase {
+public:
+    typedef Io Transport;       /// for tools talking to code started with Go, see Stm32RamTest
+    static Stm32BootClientT * instance() {
+        static Stm32BootClientT self;
+        return &self;
     }
     static ErrorCode init();
     static ErrorCode deinit();
     static ErrorCode checkMcuPresence();
-    static std::string errorCode2String( ErrorCode _errcode );
-    static std::string mcuType2String( McuType _type );
-    static McuType chipId2McuType( uint16_t _chipid );
-    static McuDescription_t mcuType2Description( McuType _type );
     static ErrorCode commandGet( CommandGetResponse_t &_resp );
     static ErrorCode commandGvRps( CommandGvRpsResponse_t &_resp );
     static ErrorCode commandGetId( CommandGetIdResponse_t &_resp );
     static ErrorCode commandReadMemory( void * _dst, uint32_t _addr, size_t _size );
     static ErrorCode commandGo( uint32_t _addr );
     static ErrorCode commandWriteMemory( const void * _src, uint32_t _addr, size_t _size );
+    static ErrorCode commandWriteFrame( const WriteFrame_t &_frame );
     static ErrorCode commandErase( const uint8_t * _pagenumarray = nullptr, size_t _count = 0 );
     static ErrorCode commandExtendedErase( const uint16_t * _pagenumarray, uint16_t _count );
     static ErrorCode commandReadoutUnprotect();
+    static ErrorCode commandGetChecksum( uint32_t _addr, uint32_t _size, uint32_t &_crc );
+    static ErrorCode negotiateCaps();
+    static const SessionCaps_t & getCaps();
+    static void invalidateCaps();
+    /// Changes whenever the session record is dropped, so caches of target state know they are stale
+    static uint32_t sessionId() {
+        return m_sessionId;
+    }
     static ErrorCode readMcuSpecificInfo( uint16_t _chipid, McuSpecificInfo_t &_info );
     static ErrorCode readMemory( void * _dst, uint32_t _addr, size_t _size );
     static ErrorCode writeMemory( const void * _src, uint32_t _addr, size_t _size );
+    static ErrorCode writeMemoryStream( ReadSource_t _source, void * _ctx, uint32_t _addr, size_t * _written = nullptr );
+    static ErrorCode writeMemoryVerified( const void * _src, uint32_t _addr, size_t _size );
+    static ErrorCode verifyMemory( const void * _src, uint32_t _addr, size_t _size );
+    static ErrorCode writeFrames( const WriteFrame_t * _frames, size_t _count, bool _verify );
+    static ErrorCode erasePages( const uint16_t * _pages, size_t _count );
     static ErrorCode eraseAllMemory();
     static void ResetMCU();
+    static const Progress_t & progress() {
+        return m_progress;
+    }
+    /*!
+     * Stops the long operations at the next block boundary with CANCELLED,
+     * from any task or a signal handler. The command in flight completes, so
+     * the bootloader is left waiting for the next one and progress().address
+     * tells where to resume. Stays set until clearCancel().
+     */
+    static void cancel() {
+        m_cancel.store(true, std::memory_order_relaxed);
+    }
+    static void clearCancel() {
+        m_cancel.store(false, std::memory_order_relaxed);
+    }
 protected:
 private:
-    static const McuDescription_t m_mcuDescription[];
-    static const uint8_t ACK_ASK_CODE = 0x7f;
-    static const uint8_t ACK_RESP_CODE = 0x79;
-    static const uint8_t NACK_RESP_CODE = 0x1f;
-    static const auto MAX_WRITE_BLOCK_SIZE = 256;
-    static const size_t BOOT_READY_DELAY = 777;
+    static SessionCaps_t m_caps;
+    static Progress_t m_progress;
+    static std::atomic<bool> m_cancel;
+    static uint8_t m_progressDepth;     /// long operations nested in each other, the outer one reports
+    static uint32_t m_sessionId;
+    static bool m_rdpTwoNacks;
+    static WriteFrame_t m_streamRing[STREAM_RING_FRAMES];
+    static CanFrame_t m_canRx;
+    static uint8_t m_canRxPos;
+    static uint16_t m_canReplyId;
 
-    static uint8_t calculateXor( const uint8_t * _src, size_t _size );
     static ErrorCode commandGenericSend( Command _cmd );
+    static ErrorCode canCommandSend( Command _cmd, const uint8_t * _args, uint8_t _size );
+    static ErrorCode canSendData( uint16_t _id, const uint8_t * _src, size_t _size );
     static ErrorCode genericSendAddr( uint32_t _addr );
-    static void addr32_to_byte( uint32_t _addr, uint8_t * _array );
-    static ErrorCode serialWrite16( const uint16_t * _src, size_t _size, size_t * _written );
+    static ErrorCode sendPageList16( const uint16_t * _pages, size_t _count );
+    static ErrorCode readAck( bool _twoNacks = false, uint32_t _timeoutMs = 0 );
+    static ErrorCode readAckByte( uint8_t &_code, uint32_t _timeoutMs = 0 );
+    static ErrorCode readData( void * _dst, size_t _size );
+    static ErrorCode readRaw( void * _dst, size_t _size );
+    static ErrorCode readAckPolling( uint32_t _timeoutMs = ACK_TIMEOUT_MS );
+    static ErrorCode readFrame( void * _dst, size_t _size );
+    static Command selectCommand( Command _cmd, Command _noStretch );
+    static ErrorCode writeFrameBegin( const WriteFrame_t &_frame, Command &_cmd );
+    static ErrorCode writeFrameEnd( Command _cmd );
+    static ErrorCode rewritePages( const uint8_t * _src, uint32_t _srcAddr, size_t _srcSize, uint32_t _addr );
+    static bool isFlashAddress( uint32_t _addr );
+    static ErrorCode padTail( WriteFrame_t &_frame, uint32_t _addr, size_t _size );
+    static ErrorCode progressBegin( Phase _phase, uint32_t _addr, size_t _total );
+    static ErrorCode progressStep( uint32_t _addr, size_t _done, size_t _left );
+    static void progressEnd();
 };
+class Stm32BootLowIo;
+/// The default client over the platform serial port, see stm32_io.hpp
+typedef Stm32BootClientT<Stm32BootLowIo> Stm32BootClient;
+extern template class Stm32BootClientT<Stm32BootLowIo>;
 #endif
@@ -0,0 +1,1322 @@
+#pragma once
+/*!
+/brief Definitions of Stm32BootClientT members. Include it only where the
+client is instantiated for a transport, see stm32_boot_client.hpp.
+*/
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "included_macro.hpp"
+#include "stm32_trace.hpp"
+template<class Io>
+Stm32BootBase::SessionCaps_t Stm32BootClientT<Io>::m_caps;
+template<class Io>
+uint32_t Stm32BootClientT<Io>::m_sessionId = 0;
+template<class Io>
+Stm32BootBase::Progress_t Stm32BootClientT<Io>::m_progress;
+template<class Io>
+std::atomic<bool> Stm32BootClientT<Io>::m_cancel(false);
+template<class Io>
+uint8_t Stm32BootClientT<Io>::m_progressDepth = 0;
+template<class Io>
+bool Stm32BootClientT<Io>::m_rdpTwoNacks = false;
+template<class Io>
+Stm32BootBase::WriteFrame_t Stm32BootClientT<Io>::m_streamRing[STREAM_RING_FRAMES];
+template<class Io>
+Stm32BootBase::CanFrame_t Stm32BootClientT<Io>::m_canRx;
+template<class Io>
+uint8_t Stm32BootClientT<Io>::m_canRxPos = 0;
+template<class Io>
+uint16_t Stm32BootClientT<Io>::m_canReplyId = 0;
+/*!
+ * Function: init 
+ * Initializes client serial port and other things.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::init() {
+    ErrorCode result = Io::init();
+    if (result == ErrorCode::OK) {
+        Io::delay(BOOT_READY_DELAY);
+    }
+    return result;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::deinit() {
+    auto result = Io::deinit();
+    return result;
+}
+/*!
+ * Function: checkMcuPresence 
+ * Resets MCU into the bootloader and syncs: 0x7f on USART, 0x5a on SPI, an 
+ * empty frame with ID 0x79 on CAN, all answered with ACK. I2C has no sync byte, 
+ * there a complete Get reply proves the bootloader is listening.
+ * 
+ * @return Stm32BootClient::ErrorCode ACK_OK if the bootloader answered.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::checkMcuPresence() {
+    ErrorCode result;
+    invalidateCaps(); // new sync is a new session
+    Io::setBootLine(true);
+    ResetMCU();
+    Io::setBootLine(false);
+    STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Sync, 0);
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::I2c) {
+        CommandGetResponse_t resp;
+        result = commandGet(resp);
+        if (result == ErrorCode::OK)
+            result = ErrorCode::ACK_OK;
+    } else if (Io::PROTOCOL_VARIANT == ProtocolVariant::Can) {
+        CanFrame_t sync = {CAN_SYNC_ID, 0, {0}};
+        size_t written;
+        m_canReplyId = CAN_SYNC_ID;
+        m_canRx.dlc = m_canRxPos = 0;
+        result = Io::write(&sync, sizeof( sync ), &written);
+        if (result == ErrorCode::OK) {
+            result = ( written == sizeof( sync ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+            if (result == ErrorCode::OK) {
+                result = readAck();
+            }
+        }
+    } else {
+        uint8_t txbuff[] = {( Io::PROTOCOL_VARIANT == ProtocolVariant::Spi ) ? SPI_SOF_CODE : ACK_ASK_CODE};
+        size_t writtern;
+        result = Io::write(txbuff, sizeof( txbuff ), &writtern);
+        if (result == ErrorCode::OK) {
+            result = ( writtern == sizeof( txbuff ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+            if (result == ErrorCode::OK) {
+                result = readAck();
+            }
+        }
+    }
+    if (result != ErrorCode::ACK_OK)
+        STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Error, result);
+    return result;
+}
+template<class Io>
+void Stm32BootClientT<Io>::ResetMCU() {
+    Io::setResetLine(false);
+    Io::delay(100);
+    Io::setResetLine(true);
+    Io::delay(100);
+}
+/*!
+ * Function: commandGet 
+ * Get Command function
+ * 
+ * @param _resp 
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandGet( CommandGetResponse_t &_resp ) {
+    ErrorCode err = commandGenericSend(Command::Get);
+    if (err == ErrorCode::ACK_OK) {
+        err = readFrame(&_resp, sizeof( _resp ));
+        if (err == ErrorCode::OK) {
+            err = readAck();
+            if (err == ErrorCode::ACK_OK) {
+                err = ErrorCode::OK;
+            }
+        }
+    }
+    return err;
+}
+/*!
+ * Function: commandGvRps 
+ * Get Version & Read Protection Status Command function.
+ * 
+ * @param _resp 
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandGvRps( CommandGvRpsResponse_t &_resp ) {
+    ErrorCode err = commandGenericSend(Command::GvRps);
+    if (err == ErrorCode::ACK_OK) {
+        err = readData(&_resp, sizeof( _resp )); // the only reply without a length byte
+        if (err == ErrorCode::OK) {
+            err = readAck();
+            if (err == ErrorCode::ACK_OK) {
+                err = ErrorCode::OK;
+            }
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandGetId( CommandGetIdResponse_t &_resp ) {
+    ErrorCode err = commandGenericSend(Command::Getid);
+    if (err == ErrorCode::ACK_OK) {
+        err = readFrame(&_resp, sizeof( _resp ));
+        if (err == ErrorCode::OK) {
+            err = readAck();
+            if (err == ErrorCode::ACK_OK) {
+                err = ErrorCode::OK;
+            }
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandReadMemory( void * _dst, uint32_t _addr, size_t _size ) {
+    configASSERT(_dst);
+    configASSERT(_size && _size <= 0x100);
+    ErrorCode err;
+    size_t written;
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Can) {
+        // address and N go in the command frame, data comes in 8 byte frames followed by ACK
+        uint8_t args[5];
+        addr32_to_byte(_addr, args);
+        args[4] = static_cast<uint8_t>(_size - 1);
+        err = canCommandSend(Command::ReadMemory, args, sizeof( args ));
+        if (err == ErrorCode::ACK_OK) {
+            err = readData(_dst, _size);
+            if (err == ErrorCode::OK) {
+                err = readAck();
+                if (err == ErrorCode::ACK_OK) {
+                    err = ErrorCode::OK;
+                }
+            }
+        }
+        return err;
+    }
+    err = commandGenericSend(Command::ReadMemory);
+    if (err == ErrorCode::ACK_OK) {
+        err = genericSendAddr(_addr);
+        if (err == ErrorCode::ACK_OK) {
+            uint8_t sz = static_cast<uint8_t>(_size - 1);
+            uint8_t numarr[] = {sz, static_cast<uint8_t>(~sz)};
+            err = Io::write(numarr, sizeof( numarr ), &written);
+            if (err == ErrorCode::OK) {
+                err = ( written == sizeof( numarr ) ) ? ErrorCode::OK : ErrorCode::FAILED;
+                if (err == ErrorCode::OK) {
+                    err = readAck();
+                    if (err == ErrorCode::ACK_OK) {
+                        err = readData(_dst, _size);
+                    }
+                }
+            }
+        }
+    }
+    return err;
+}
+/*!
+ * Function: commandGo 
+ * Go command: the bootloader ACKs the command, then the address, and jumps. 
+ * The address is the vector table of the code to run: the stack pointer is 
+ * loaded from it and the reset handler from the word after it, so it must be 
+ * flashBegin of the family or the base of a RAM stub, not the entry point. 
+ * The session ends with the second ACK, whatever the target sends after it 
+ * comes from the started code. 
+ * 
+ * @param _addr vector table address.
+ * 
+ * @return Stm32BootClient::ErrorCode ACK_FAILED if the address was refused.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandGo( uint32_t _addr ) {
+    ErrorCode err;
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Can) {
+        uint8_t args[4];
+        addr32_to_byte(_addr, args);
+        err = canCommandSend(Command::Go, args, sizeof( args ));
+    } else {
+        err = commandGenericSend(Command::Go);
+        if (err == ErrorCode::ACK_OK) {
+            err = genericSendAddr(_addr);
+        }
+    }
+    if (err == ErrorCode::ACK_OK) {
+        err = ErrorCode::OK;
+        invalidateCaps(); // the bootloader is gone
+    }
+    return err;
+}
+// TODO check out of range memory address
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandWriteMemory( const void * _src, uint32_t _addr, size_t _size ) {
+    WriteFrame_t frame;
+    assembleWriteFrame(frame, _src, _addr, _size);
+    return commandWriteFrame(frame);
+}
+/*!
+ * Function: commandWriteFrame 
+ * Write Memory command with a prepared frame: every phase goes in one write.
+ * 
+ * @param _frame prepared by assembleWriteFrame().
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandWriteFrame( const WriteFrame_t &_frame ) {
+    Command cmd;
+    ErrorCode err = writeFrameBegin(_frame, cmd);
+    if (err == ErrorCode::OK) {
+        err = writeFrameEnd(cmd);
+    }
+    return err;
+}
+/*!
+ * Function: writeFrameBegin 
+ * Sends the whole Write Memory frame but doesn't wait for the final ACK, 
+ * so the host can do something useful while the MCU is programming flash.
+ * 
+ * @param _frame prepared by assembleWriteFrame().
+ * @param _cmd command variant used, to be passed to writeFrameEnd().
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::writeFrameBegin( const WriteFrame_t &_frame, Command &_cmd ) {
+    _cmd = selectCommand(Command::WriteMem, Command::WriteMemNs);
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Can) {
+        // address and N in the command frame, then all data frames back to back
+        uint8_t args[5];
+        memcpy(args, _frame.addrPhase, 4);
+        args[4] = _frame.dataPhase[0];
+        ErrorCode err = canCommandSend(_cmd, args, sizeof( args ));
+        if (err == ErrorCode::ACK_OK) {
+            err = canSendData(CAN_DATA_ID, &_frame.dataPhase[1], _frame.dataPhase[0] + 1u);
+        }
+        return err;
+    }
+    ErrorCode err = commandGenericSend(_cmd);
+    if (err == ErrorCode::ACK_OK) {
+        size_t written;
+        err = Io::write(_frame.addrPhase, sizeof( _frame.addrPhase ), &written);
+        if (err == ErrorCode::OK) {
+            err = ( written == sizeof( _frame.addrPhase ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+            if (err == ErrorCode::OK) {
+                err = readAck();
+                if (err == ErrorCode::ACK_OK) {
+                    err = Io::write(_frame.dataPhase, _frame.dataPhaseSize, &written);
+                    if (err == ErrorCode::OK) {
+                        err = ( written == _frame.dataPhaseSize ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+                    }
+                }
+            }
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::writeFrameEnd( Command _cmd ) {
+    ErrorCode err;
+    if (_cmd == Command::WriteMemNs) {
+        err = readAckPolling();
+    } else {
+        err = readAck();
+        if (err == ErrorCode::ACK_OK) {
+            err = ErrorCode::OK;
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandErase( const uint8_t * _pagenumarray, size_t _count ) {
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Can) {
+        // 0xff or N in the command frame, page numbers follow in data frames, ACK after the erase
+        configASSERT(_pagenumarray == nullptr || ( _count && _count <= 0xff ));
+        uint8_t arg = _pagenumarray ? static_cast<uint8_t>(_count - 1) : 0xff;
+        auto err = canCommandSend(Command::Erase, &arg, sizeof( arg ));
+        if (err == ErrorCode::ACK_OK && _pagenumarray) {
+            err = canSendData(static_cast<uint16_t>(Command::Erase), _pagenumarray, _count);
+        }
+        if (err == ErrorCode::ACK_OK || err == ErrorCode::OK) {
+            err = readAck(false, ERASE_ACK_TIMEOUT_MS);
+            if (err == ErrorCode::ACK_OK) {
+                err = ErrorCode::OK;
+            }
+        }
+        return err;
+    }
+    auto err = commandGenericSend(Command::Erase);
+    if (err == ErrorCode::ACK_OK) {
+        size_t written;
+        if (_pagenumarray == nullptr) {
+            uint8_t txarr[] = {0xff, 0};
+            err = Io::write(txarr, sizeof( txarr ), &written);
+            if (err == ErrorCode::OK) {
+                err = ( written == sizeof( txarr ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+            }
+        } else {
+            configASSERT(_count && _count <= 0xff);
+            uint8_t txarr[0x100 + 2]; // N - 1, page numbers and checksum in one write
+            txarr[0] = static_cast<uint8_t>(_count - 1);
+            memcpy(&txarr[1], _pagenumarray, _count);
+            txarr[_count + 1] = calculateXor(txarr, _count + 1);
+            err = Io::write(txarr, _count + 2, &written);
+            if (err == ErrorCode::OK) {
+                err = ( written == _count + 2 ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+            }
+        }
+        if (err == ErrorCode::OK) {
+            err = readAck(false, ERASE_ACK_TIMEOUT_MS);
+            if (err == ErrorCode::ACK_OK) {
+                err = ErrorCode::OK;
+            }
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandExtendedErase( const uint16_t * _pagenumarray, uint16_t _count ) {
+    Command cmd = selectCommand(Command::ExtErase, Command::ExtEraseNs);
+    auto err = commandGenericSend(cmd);
+    if (err == ErrorCode::ACK_OK) {
+        size_t written;
+        if (_count == EXT_MASS_ERASE || _count == EXT_BANK1_ERASE || _count == EXT_BANK2_ERASE) {
+            uint8_t hi = static_cast<uint8_t>(_count >> 8);
+            uint8_t lo = static_cast<uint8_t>(_count);
+            uint8_t txarray[] = {hi, lo, static_cast<uint8_t>(hi ^ lo)};
+            err = Io::write(txarray, sizeof( txarray ), &written);
+            if (err == ErrorCode::OK) {
+                err = ( written == sizeof( txarray ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+            }
+        } else {
+            err = sendPageList16(_pagenumarray, _count);
+        }
+        if (err == ErrorCode::OK && cmd == Command::ExtEraseNs) {
+            err = readAckPolling(ERASE_ACK_TIMEOUT_MS);
+        } else if (err == ErrorCode::OK) {
+            err = readAck(false, ERASE_ACK_TIMEOUT_MS);
+            if (err == ErrorCode::ACK_OK) {
+                err = ErrorCode::OK;
+            }
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandReadoutUnprotect() {
+    auto err = commandGenericSend(Command::ReadoutUnprotect);
+    if (err != ErrorCode::ACK_OK)
+        return err;
+    invalidateCaps(); // MCU performs system reset after unprotect
+    uint8_t ack = 0;
+    // the second ACK comes after the mass erase, a dead link must not keep us here forever
+    err = readAckByte(ack, ERASE_ACK_TIMEOUT_MS);
+    if (err == ErrorCode::OK) {
+        err = ( ack == ACK_RESP_CODE ) ?  ErrorCode::OK : ErrorCode::FAILED;
+    }
+    return err;
+}
+/*!
+ * Function: commandGetChecksum 
+ * Get Checksum Command function. Bootloader calculates CRC32 of the memory area 
+ * with its CRC unit in default configuration (see calculateCrc32). 
+ * 
+ * @param _addr start address, word aligned.
+ * @param _size size of the area in bytes, multiple of 4.
+ * @param _crc calculated CRC.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandGetChecksum( uint32_t _addr, uint32_t _size, uint32_t &_crc ) {
+    configASSERT(_size && !( _size % 4 ) && !( _addr % 4 ));
+    ErrorCode err = commandGenericSend(Command::GetChecksum);
+    if (err == ErrorCode::ACK_OK) {
+        err = genericSendAddr(_addr);
+        if (err == ErrorCode::ACK_OK) {
+            err = genericSendAddr(_size); // the size goes in the same format as an address
+            if (err == ErrorCode::ACK_OK) {
+                err = readAckPolling();
+                if (err == ErrorCode::OK) {
+                    uint8_t rxarr[5];
+                    err = readData(rxarr, sizeof( rxarr ));
+                    if (err == ErrorCode::OK) {
+                        err = ( calculateXor(rxarr, 4) == rxarr[4] ) ? ErrorCode::OK : ErrorCode::FAILED;
+                        if (err == ErrorCode::OK) {
+                            _crc = static_cast<uint32_t>(rxarr[0]) << 24 | static_cast<uint32_t>(rxarr[1]) << 16 |
+                                static_cast<uint32_t>(rxarr[2]) << 8 | rxarr[3];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return err;
+}
+/*!
+ * Function: negotiateCaps 
+ * Runs Get, Get ID and reads flash size once after sync and keeps the results 
+ * for the rest of the session. Other functions consult the record instead of 
+ * asking the bootloader again. 
+ * 
+ * @return Stm32BootClient::ErrorCode OK if the record is valid, even when RDP 
+ *         prevents reading the flash size.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::negotiateCaps() {
+    invalidateCaps();
+    CommandGetResponse_t getresp;
+    ErrorCode err = commandGet(getresp);
+    if (err == ErrorCode::OK) {
+        uint8_t high, low;
+        getresp.getBootVer(high, low);
+        m_caps.bootVer = static_cast<uint8_t>(( high << 4 ) | low);
+        for ( size_t i = 0; i < getresp.getCommandListSize(); i++ ) {
+            m_caps.addCommand(getresp.getCommand(i));
+        }
+        CommandGetIdResponse_t chipid;
+        err = commandGetId(chipid);
+        if (err == ErrorCode::OK) {
+            m_caps.chipId = chipid.getId();
+            m_caps.mcuType = chipId2McuType(m_caps.chipId);
+            m_caps.valid = true;
+            McuSpecificInfo_t spec;
+            err = readMcuSpecificInfo(m_caps.chipId, spec);
+            if (err == ErrorCode::OK) {
+                m_caps.flashSize = spec.flashSize;
+            } else if (err == ErrorCode::ACK_FAILED) {
+                m_caps.rdpActive = true; // memory read is NACKed only when RDP is active
+                err = ErrorCode::OK;
+            }
+        }
+    }
+    return err;
+}
+template<class Io>
+const Stm32BootBase::SessionCaps_t & Stm32BootClientT<Io>::getCaps() {
+    return m_caps;
+}
+template<class Io>
+void Stm32BootClientT<Io>::invalidateCaps() {
+    memset(&m_caps, 0, sizeof( m_caps ));
+    m_caps.mcuType = McuType::Unknown;
+    m_caps.variant = Io::PROTOCOL_VARIANT;
+    m_rdpTwoNacks = false;
+    m_sessionId++;
+}
+/*!
+ * Function: selectCommand 
+ * Picks No-Stretch variant of a command if the bootloader has announced it.
+ * 
+ * @param _cmd regular command.
+ * @param _noStretch No-Stretch variant.
+ * 
+ * @return Stm32BootClient::Command 
+ */
+template<class Io>
+Stm32BootBase::Command Stm32BootClientT<Io>::selectCommand( Command _cmd, Command _noStretch ) {
+    return ( m_caps.valid && m_caps.isCommandSupported(_noStretch) ) ? _noStretch : _cmd;
+}
+/*!
+ * Function: readAckPolling 
+ * Reads ACK of a No-Stretch command, bootloader answers BUSY until the 
+ * operation is completed. A busy I2C target may NACK its address instead, 
+ * the read comes back short; both are polled again until the deadline. 
+ * 
+ * @param _timeoutMs how long the operation may take.
+ * 
+ * @return Stm32BootClient::ErrorCode ACK_FAILED if still BUSY at the deadline.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readAckPolling( uint32_t _timeoutMs ) {
+    ErrorCode err;
+    uint8_t ackCode = BUSY_RESP_CODE;
+    uint32_t start = Io::getTickMs();
+    uint32_t polls = 0;
+    bool busy;
+    do {
+        err = readAckByte(ackCode);
+        busy = ( err == ErrorCode::OK && ackCode == BUSY_RESP_CODE ) || err == ErrorCode::SERIAL_RD_SIZE;
+        if (busy && Io::getTickMs() - start < _timeoutMs) {
+            Io::delay(ACK_POLL_DELAY_MS);
+            polls++;
+        } else {
+            busy = false;
+        }
+    } while (busy);
+    if (err == ErrorCode::OK) {
+        err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::OK : ErrorCode::ACK_FAILED;
+        if (err == ErrorCode::OK)
+            STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Ack, polls);
+        else
+            STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Nack, 0);
+    } else {
+        STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Error, err);
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::genericSendAddr( uint32_t _addr ) {
+    ErrorCode err;
+    uint8_t addr_array[5]; // the address and its checksum go in one write
+    addr32_to_byte(_addr, addr_array);
+    addr_array[4] = calculateXor(addr_array, 4);
+    size_t written;
+    err = Io::write(addr_array, sizeof( addr_array ), &written);
+    if (err == ErrorCode::OK) {
+        err = ( written == sizeof( addr_array ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+        if (err == ErrorCode::OK) {
+            err = readAck();
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readMcuSpecificInfo( uint16_t _chipid, McuSpecificInfo_t &_info ) {
+    ErrorCode err;
+    McuType mcu = chipId2McuType(_chipid);
+    if (mcu == McuType::Unknown)
+        err = ErrorCode::UNKNOWN_MCU;
+    else {
+        McuDescription_t descr = mcuType2Description(mcu);
+        if (descr.blRamBegin == 0xffffffff)
+            err = ErrorCode::UNKNOWN_MCU;
+        else {
+            m_rdpTwoNacks = descr.rdpActive2Nack && Io::PROTOCOL_VARIANT == ProtocolVariant::Usart;
+            _info.flashSize = 0; // upper two bytest are not used in commandReadMemory and can contain any garbage
+            err = commandReadMemory(&_info.flashSize, descr.flashSizeReg, 2);
+            if (err == ErrorCode::OK) {
+                _info.flashSize *= 1024; /// as size of the device expressed in Kbytes
+            }
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::commandGenericSend( Command _cmd ) {
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Can)
+        return canCommandSend(_cmd, nullptr, 0);
+    ErrorCode err;
+    size_t written;
+    uint8_t cmd = static_cast<uint8_t>(_cmd);
+    uint8_t txBuff[] = { SPI_SOF_CODE, cmd, static_cast<uint8_t>(~cmd)};
+    size_t skip = ( Io::PROTOCOL_VARIANT == ProtocolVariant::Spi ) ? 0 : 1; // only SPI frames start with SOF
+    STM32_TRACE_BUS(Stm32TraceBus<Io>::value, CommandSent, cmd);
+    err = Io::write(txBuff + skip, sizeof( txBuff ) - skip, &written);
+    if (err == ErrorCode::OK) {
+        err = ( written == sizeof( txBuff ) - skip ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+        if (err == ErrorCode::OK) {
+            // only commands touching the memory are refused under RDP
+            bool twoNacks = m_rdpTwoNacks && _cmd != Command::Get && _cmd != Command::GvRps && _cmd != Command::Getid;
+            err = readAck(twoNacks);
+        }
+    }
+    return err;
+}
+/*!
+ * Function: canCommandSend 
+ * Sends a CAN command frame, its ID is the command code and the payload holds 
+ * the arguments, then reads the ACK. Replies carry the same ID.
+ * 
+ * @param _cmd command.
+ * @param _args arguments, up to 8 bytes, may be nullptr if _size is 0.
+ * @param _size number of argument bytes.
+ * 
+ * @return Stm32BootClient::ErrorCode ACK_OK, ACK_FAILED or IO error.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::canCommandSend( Command _cmd, const uint8_t * _args, uint8_t _size ) {
+    configASSERT(_size <= sizeof( m_canRx.data ));
+    CanFrame_t frame;
+    memset(&frame, 0, sizeof( frame )); // no stack garbage on the wire, logs and replays stay byte exact
+    frame.id = static_cast<uint16_t>(_cmd);
+    frame.dlc = _size;
+    if (_size)
+        memcpy(frame.data, _args, _size);
+    m_canReplyId = frame.id;
+    m_canRx.dlc = m_canRxPos = 0; // whatever is left belongs to the previous command
+    STM32_TRACE_BUS(Stm32TraceBus<Io>::value, CommandSent, frame.id);
+    size_t written;
+    ErrorCode err = Io::write(&frame, sizeof( frame ), &written);
+    if (err == ErrorCode::OK) {
+        err = ( written == sizeof( frame ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+        if (err == ErrorCode::OK) {
+            err = readAck();
+        }
+    }
+    return err;
+}
+/*!
+ * Function: canSendData 
+ * Splits the data into 8 byte frames and hands all of them to the transport 
+ * in one write, so it can put them on the bus back to back.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::canSendData( uint16_t _id, const uint8_t * _src, size_t _size ) {
+    configASSERT(_src && _size && _size <= MAX_WRITE_BLOCK_SIZE);
+    CanFrame_t frames[MAX_WRITE_BLOCK_SIZE / sizeof( m_canRx.data )];
+    size_t count = 0;
+    for ( size_t pos = 0; pos < _size; pos += sizeof( m_canRx.data ) ) {
+        size_t dlc = ( _size - pos < sizeof( m_canRx.data ) ) ? _size - pos : sizeof( m_canRx.data );
+        memset(&frames[count], 0, sizeof( frames[count] ));
+        frames[count].id = _id;
+        frames[count].dlc = static_cast<uint8_t>(dlc);
+        memcpy(frames[count].data, _src + pos, dlc);
+        count++;
+    }
+    size_t written;
+    ErrorCode err = Io::write(frames, count * sizeof( CanFrame_t ), &written);
+    if (err == ErrorCode::OK) {
+        err = ( written == count * sizeof( CanFrame_t ) ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+    }
+    return err;
+}
+/*!
+ * Function: readAck 
+ * Reads ACK/NACK byte. Some bootloaders send two NACKs when RDP is active, 
+ * the second one is consumed here so it doesn't stay in the FIFO.
+ * 
+ * @param _twoNacks true if the second NACK is expected after a NACK.
+ * @param _timeoutMs see readAckByte.
+ * 
+ * @return Stm32BootClient::ErrorCode ACK_OK, ACK_FAILED or IO error.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readAck( bool _twoNacks, uint32_t _timeoutMs ) {
+    uint8_t ackCode;
+    ErrorCode err = readAckByte(ackCode, _timeoutMs);
+    if (err == ErrorCode::OK) {
+        err = ( ackCode == ACK_RESP_CODE ) ? ErrorCode::ACK_OK : ErrorCode::ACK_FAILED;
+        if (err == ErrorCode::ACK_OK)
+            STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Ack, 0);
+        else
+            STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Nack, 0);
+        if (ackCode == NACK_RESP_CODE && _twoNacks) {
+            size_t rd;
+            err = Io::read(&ackCode, sizeof( ackCode ), &rd);
+            if (err == ErrorCode::OK) {
+                err = ( rd == sizeof( ackCode ) ) ? ErrorCode::ACK_FAILED : ErrorCode::SERIAL_RD_SIZE;
+                if (err == ErrorCode::ACK_FAILED)
+                    STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Nack, 1);
+            }
+        }
+    }
+    if (err != ErrorCode::ACK_OK && err != ErrorCode::ACK_FAILED)
+        STM32_TRACE_BUS(Stm32TraceBus<Io>::value, Error, err);
+    return err;
+}
+/*!
+ * Function: readAckByte 
+ * Gets the ACK, NACK or BUSY byte. USART and I2C just read it, a slow command 
+ * reads again after each read timeout until _timeoutMs. SPI clocks a dummy 
+ * byte out first, then polls until ACK or NACK shows up and confirms it with 
+ * an ACK of its own (AN4286); the polls are spaced by ACK_POLL_DELAY_MS after 
+ * the first ACK_POLL_SPINS and give up after _timeoutMs, at least ACK_TIMEOUT_MS.
+ * 
+ * @param _code the byte received.
+ * @param _timeoutMs how long the command may take, 0 for a single read.
+ * 
+ * @return Stm32BootClient::ErrorCode OK or IO error, SERIAL_RD_SIZE at the deadline.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readAckByte( uint8_t &_code, uint32_t _timeoutMs ) {
+    size_t rd;
+    ErrorCode err;
+    uint32_t start = Io::getTickMs();
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Spi) {
+        uint32_t timeoutMs = _timeoutMs;
+        if (timeoutMs < ACK_TIMEOUT_MS)
+            timeoutMs = ACK_TIMEOUT_MS;
+        uint32_t polls = 0;
+        bool answered = false;
+        err = Io::read(&_code, sizeof( _code ), &rd); // dummy
+        while (err == ErrorCode::OK && !answered) {
+            err = Io::read(&_code, sizeof( _code ), &rd);
+            answered = _code == ACK_RESP_CODE || _code == NACK_RESP_CODE;
+            if (err == ErrorCode::OK && !answered) {
+                if (Io::getTickMs() - start >= timeoutMs) {
+                    err = ErrorCode::SERIAL_RD_SIZE;
+                } else if (++polls > ACK_POLL_SPINS) {
+                    Io::delay(ACK_POLL_DELAY_MS);
+                }
+            }
+        }
+        if (err == ErrorCode::OK) {
+            uint8_t confirm = ACK_RESP_CODE;
+            err = Io::write(&confirm, sizeof( confirm ), &rd);
+        }
+    } else {
+        err = readRaw(&_code, sizeof( _code ));
+        while (err == ErrorCode::SERIAL_RD_SIZE && Io::getTickMs() - start < _timeoutMs) {
+            Io::delay(ACK_POLL_DELAY_MS);
+            err = readRaw(&_code, sizeof( _code ));
+        }
+    }
+    return err;
+}
+/*!
+ * Function: readData 
+ * Reads exactly _size bytes of a reply. On SPI a dummy byte precedes the data.
+ * 
+ * @return Stm32BootClient::ErrorCode OK, SERIAL_RD_SIZE or IO error.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readData( void * _dst, size_t _size ) {
+    size_t rd;
+    ErrorCode err = ErrorCode::OK;
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Spi) {
+        uint8_t dummy;
+        err = Io::read(&dummy, sizeof( dummy ), &rd);
+    }
+    if (err == ErrorCode::OK) {
+        err = readRaw(_dst, _size);
+    }
+    return err;
+}
+/*!
+ * Function: readRaw 
+ * Reads exactly _size bytes of a reply. On CAN they are gathered from the 
+ * payloads of the reply frames, frames with a foreign ID are skipped.
+ * 
+ * @return Stm32BootClient::ErrorCode OK, SERIAL_RD_SIZE or IO error.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readRaw( void * _dst, size_t _size ) {
+    size_t rd;
+    ErrorCode err = ErrorCode::OK;
+    if (Io::PROTOCOL_VARIANT == ProtocolVariant::Can) {
+        uint8_t * p = static_cast<uint8_t *>(_dst);
+        while (err == ErrorCode::OK && _size) {
+            if (m_canRxPos < m_canRx.dlc) {
+                size_t chunk = m_canRx.dlc - m_canRxPos;
+                chunk = ( chunk < _size ) ? chunk : _size;
+                memcpy(p, &m_canRx.data[m_canRxPos], chunk);
+                m_canRxPos = static_cast<uint8_t>(m_canRxPos + chunk);
+                p += chunk;
+                _size -= chunk;
+            } else {
+                m_canRxPos = 0;
+                err = Io::read(&m_canRx, sizeof( m_canRx ), &rd);
+                if (err == ErrorCode::OK)
+                    err = ( rd == sizeof( m_canRx ) ) ? ErrorCode::OK : ErrorCode::SERIAL_RD_SIZE;
+                if (err != ErrorCode::OK || m_canRx.id != m_canReplyId || m_canRx.dlc > sizeof( m_canRx.data ))
+                    m_canRx.dlc = 0;
+            }
+        }
+    } else {
+        err = Io::read(_dst, _size, &rd);
+        if (err == ErrorCode::OK) {
+            err = ( rd == _size ) ? ErrorCode::OK : ErrorCode::SERIAL_RD_SIZE;
+        }
+    }
+    return err;
+}
+/*!
+ * Function: readFrame 
+ * Reads a length-prefixed reply: the first byte N tells that N + 1 bytes follow. 
+ * Exactly N + 2 bytes are consumed, so nothing depends on the port timeout. 
+ * If the reply doesn't fit into _dst the rest is read out and dropped.
+ * 
+ * @param _dst destination, the length byte is stored at _dst[0].
+ * @param _size size of _dst.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readFrame( void * _dst, size_t _size ) {
+    configASSERT(_dst);
+    configASSERT(_size > 1);
+    uint8_t * p = static_cast<uint8_t *>(_dst);
+    ErrorCode err = readData(p, 1);
+    if (err == ErrorCode::OK) {
+        size_t left = static_cast<size_t>(p[0]) + 1;
+        size_t room = _size - 1;
+        p++;
+        while (err == ErrorCode::OK && left) {
+            uint8_t drop[8];
+            size_t chunk;
+            uint8_t * dst;
+            if (room) {
+                chunk = ( left < room ) ? left : room;
+                dst = p;
+            } else {
+                chunk = ( left < sizeof( drop ) ) ? left : sizeof( drop );
+                dst = drop;
+            }
+            err = readRaw(dst, chunk);
+            if (err == ErrorCode::OK) {
+                left -= chunk;
+                if (room) {
+                    room -= chunk;
+                    p += chunk;
+                }
+            }
+        }
+    }
+    return err;
+}
+/*!
+ * Function: sendPageList16 
+ * Sends the page list phase of Extended Erase: N - 1, page numbers MSB first 
+ * and the checksum. The phase is packed into as few writes as possible, a 
+ * list of up to 127 pages goes in a single write.
+ * 
+ * @param _pages page numbers.
+ * @param _count number of pages.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::sendPageList16( const uint16_t * _pages, size_t _count ) {
+    configASSERT(_pages && _count && _count <= 0x10000);
+    auto err = ErrorCode::OK;
+    uint8_t txarr[MAX_WRITE_BLOCK_SIZE + 2];
+    size_t len = 0;
+    uint8_t xor_cs = 0;
+    for ( size_t i = 0; i <= _count && err == ErrorCode::OK; i++ ) {
+        uint16_t word = i ? _pages[i - 1] : static_cast<uint16_t>(_count - 1);
+        txarr[len++] = static_cast<uint8_t>(word >> 8);
+        txarr[len++] = static_cast<uint8_t>(word);
+        xor_cs = static_cast<uint8_t>(xor_cs ^ txarr[len - 2] ^ txarr[len - 1]);
+        if (i == _count)
+            txarr[len++] = xor_cs;
+        if (i == _count || len + 3 > sizeof( txarr )) {
+            size_t written;
+            err = Io::write(txarr, len, &written);
+            if (err == ErrorCode::OK) {
+                err = ( written == len ) ? ErrorCode::OK : ErrorCode::SERIAL_WR_SIZE;
+            }
+            len = 0;
+        }
+    }
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::readMemory( void * _dst, uint32_t _addr, size_t _size ) {
+    configASSERT(_dst);
+    auto err = progressBegin(Phase::Read, _addr, _size);
+    while (_size && err == ErrorCode::OK) {
+        size_t bytes_to_send = ( _size > 256 ) ? 256 : _size;
+        _size -= bytes_to_send;
+        err = commandReadMemory(_dst, _addr, bytes_to_send);
+        if (err == ErrorCode::OK) {
+            uint8_t * pArithm = static_cast<uint8_t *>(_dst);
+            pArithm += bytes_to_send;
+            _dst = pArithm;
+            _addr += static_cast<uint32_t>(bytes_to_send);
+            err = progressStep(_addr, bytes_to_send, _size);
+        }
+    }
+    progressEnd();
+    return err;
+}
+/*!
+ * Function: writeMemory 
+ * Writes a buffer of any size in blocks of MAX_WRITE_BLOCK_SIZE. A tail which 
+ * is not a whole number of words is padded, see padTail. 
+ * 
+ * @param _src a pointer to the source buffer.
+ * @param _addr start address, word aligned.
+ * @param _size number of bytes to be written.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::writeMemory( const void * _src, uint32_t _addr, size_t _size ) {
+    configASSERT(_src && !( _addr % 4 ));
+    auto err = progressBegin(Phase::Write, _addr, _size);
+    const uint8_t * pData = static_cast<const uint8_t *>(_src);
+    while (_size && err == ErrorCode::OK) {
+        size_t bytes_to_send = ( _size > MAX_WRITE_BLOCK_SIZE ) ? MAX_WRITE_BLOCK_SIZE : _size;
+        _size -= bytes_to_send;
+        if (bytes_to_send % 4) {
+            WriteFrame_t frame;
+            memcpy(&frame.dataPhase[1], pData, bytes_to_send);
+            err = padTail(frame, _addr, bytes_to_send);
+            if (err == ErrorCode::OK)
+                err = commandWriteFrame(frame);
+        } else {
+            err = commandWriteMemory(pData, _addr, bytes_to_send);
+        }
+        pData += bytes_to_send;
+        _addr += static_cast<uint32_t>(bytes_to_send);
+        if (err == ErrorCode::OK)
+            err = progressStep(_addr, bytes_to_send, _size);
+    }
+    progressEnd();
+    return err;
+}
+/*!
+ * Function: isFlashAddress 
+ * Tells flash from other memory by the family and the flash size of the 
+ * session. Without them nothing is taken for flash. 
+ * 
+ * @param _addr 
+ * 
+ * @return bool true if _addr is in the flash of the MCU.
+ */
+template<class Io>
+bool Stm32BootClientT<Io>::isFlashAddress( uint32_t _addr ) {
+    bool flash = false;
+    if (m_caps.valid && m_caps.mcuType != McuType::Unknown && m_caps.flashSize) {
+        McuDescription_t descr = mcuType2Description(m_caps.mcuType);
+        flash = _addr >= descr.flashBegin && _addr - descr.flashBegin < m_caps.flashSize;
+    }
+    return flash;
+}
+/*!
+ * Function: padTail 
+ * Pads the data in the frame up to a whole word and assembles the frame. In 
+ * flash the padding is 0xff, the erased value; elsewhere it is what the 
+ * memory holds there, read back first, so RAM past the data keeps its contents. 
+ * 
+ * @param _frame the data starts at dataPhase[1].
+ * @param _addr destination address, word aligned.
+ * @param _size number of data bytes.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::padTail( WriteFrame_t &_frame, uint32_t _addr, size_t _size ) {
+    auto err = ErrorCode::OK;
+    size_t whole = _size & ~static_cast<size_t>(3);
+    if (whole != _size) {
+        uint8_t word[4];
+        uint32_t tailAddr = _addr + static_cast<uint32_t>(whole);
+        memset(word, 0xff, sizeof( word ));
+        if (!isFlashAddress(tailAddr))
+            err = commandReadMemory(word, tailAddr, sizeof( word ));
+        memcpy(&_frame.dataPhase[1 + _size], &word[_size - whole], whole + sizeof( word ) - _size);
+        whole += sizeof( word );
+    }
+    if (err == ErrorCode::OK)
+        assembleWriteFrame(_frame, &_frame.dataPhase[1], _addr, whole);
+    return err;
+}
+/*!
+ * Function: writeMemoryStream 
+ * Writes data pulled from the source through a small ring of frames, memory 
+ * use doesn't depend on the image size. The next frame is pulled and assembled 
+ * while the MCU is programming the current one. The last frame is padded 
+ * like in writeMemory. 
+ * 
+ * @param _source returns up to _size bytes, 0 at the end of the data.
+ * @param _ctx passed to the source as is.
+ * @param _addr destination address.
+ * @param _written optional, number of bytes written.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::writeMemoryStream( ReadSource_t _source, void * _ctx, uint32_t _addr, size_t * _written ) {
+    configASSERT(_source);
+    auto err = progressBegin(Phase::Write, _addr, 0);
+    size_t total = 0;
+    size_t cur = 0;
+    size_t size = fillStreamFrame(m_streamRing[cur], _source, _ctx, _addr);
+    while (size && err == ErrorCode::OK) {
+        Command cmd;
+        if (size % 4)
+            err = padTail(m_streamRing[cur], _addr, size); // the last frame, there is nothing to overlap with
+        if (err == ErrorCode::OK)
+            err = writeFrameBegin(m_streamRing[cur], cmd);
+        if (err == ErrorCode::OK) {
+            size_t next = ( cur + 1 ) % STREAM_RING_FRAMES;
+            size_t nextSize = ( size == MAX_WRITE_BLOCK_SIZE ) ?
+                fillStreamFrame(m_streamRing[next], _source, _ctx, _addr + MAX_WRITE_BLOCK_SIZE) : 0;
+            err = writeFrameEnd(cmd);
+            if (err == ErrorCode::OK) {
+                total += size;
+                _addr += MAX_WRITE_BLOCK_SIZE;
+                cur = next;
+                err = progressStep(_addr, size, nextSize);
+                size = nextSize;
+            }
+        }
+    }
+    progressEnd();
+    if (_written)
+        *_written = total;
+    return err;
+}
+/*!
+ * Function: writeMemoryVerified 
+ * Single pass program and verify. Every block is checked (Get Checksum or 
+ * read back) right after it is programmed, the expected value is calculated 
+ * while the MCU is busy programming. A block that doesn't match is repaired 
+ * at once by rewritePages(), not after the whole image.
+ * 
+ * @param _src data to be written.
+ * @param _addr destination address.
+ * @param _size size in bytes, multiple of 4.
+ * 
+ * @return Stm32BootClient::ErrorCode VERIFY_FAILED if a block can't be repaired.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::writeMemoryVerified( const void * _src, uint32_t _addr, size_t _size ) {
+    configASSERT(_src);
+    auto err = progressBegin(Phase::Write, _addr, _size);
+    const uint8_t * pData = static_cast<const uint8_t *>(_src);
+    const uint8_t * pBegin = pData;
+    uint32_t addrBegin = _addr;
+    while (_size && err == ErrorCode::OK) {
+        size_t bytes_to_send = ( _size > MAX_WRITE_BLOCK_SIZE ) ? MAX_WRITE_BLOCK_SIZE : _size;
+        WriteFrame_t frame;
+        Command cmd;
+        assembleWriteFrame(frame, pData, _addr, bytes_to_send);
+        err = writeFrameBegin(frame, cmd);
+        if (err == ErrorCode::OK) {
+            bool useChecksum = m_caps.valid && m_caps.isCommandSupported(Command::GetChecksum);
+            uint32_t crc = useChecksum ? calculateCrc32(pData, bytes_to_send) : 0;
+            err = writeFrameEnd(cmd);
+            if (err == ErrorCode::OK) {
+                if (useChecksum) {
+                    uint32_t mcuCrc;
+                    err = commandGetChecksum(_addr, static_cast<uint32_t>(bytes_to_send), mcuCrc);
+                    if (err == ErrorCode::OK && mcuCrc != crc)
+                        err = ErrorCode::VERIFY_FAILED;
+                } else {
+                    err = verifyMemory(pData, _addr, bytes_to_send);
+                }
+            }
+            for ( size_t retry = 0; retry < VERIFY_RETRIES && err == ErrorCode::VERIFY_FAILED; retry++ ) {
+                m_progress.retries.store(m_progress.retries.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                err = rewritePages(pBegin, addrBegin, static_cast<size_t>(pData - pBegin) + bytes_to_send, _addr);
+            }
+        }
+        _size -= bytes_to_send;
+        pData += bytes_to_send;
+        _addr += static_cast<uint32_t>(bytes_to_send);
+        if (err == ErrorCode::OK)
+            err = progressStep(_addr, bytes_to_send, _size);
+    }
+    progressEnd();
+    return err;
+}
+/*!
+ * Function: rewritePages 
+ * Repairs the pages under the block at _addr: reads each page back, puts the 
+ * data written so far over it, erases the page and programs it again. Data 
+ * out of the image in these pages is kept. Only flash pages are rewritten, a 
+ * failed block in RAM or the option bytes stays VERIFY_FAILED.
+ * 
+ * @param _src data written so far.
+ * @param _srcAddr where _src starts.
+ * @param _srcSize how many bytes of _src have been written, the failed block included.
+ * @param _addr address of the block which failed.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::rewritePages( const uint8_t * _src, uint32_t _srcAddr, size_t _srcSize, uint32_t _addr ) {
+    static uint8_t page[MAX_PAGE_SIZE];
+    auto err = ErrorCode::VERIFY_FAILED;
+    if (m_caps.valid && m_caps.mcuType != McuType::Unknown) {
+        McuDescription_t descr = mcuType2Description(m_caps.mcuType);
+        configASSERT(descr.flashPageSize <= sizeof( page ));
+        uint32_t blockEnd = _srcAddr + static_cast<uint32_t>(_srcSize);
+        uint32_t pageAddr = _addr - ( _addr - descr.flashBegin ) % descr.flashPageSize;
+        err = isFlashAddress(_addr) ? ErrorCode::OK : ErrorCode::VERIFY_FAILED;
+        while (pageAddr < blockEnd && err == ErrorCode::OK) {
+            uint16_t pageNum = static_cast<uint16_t>(( pageAddr - descr.flashBegin ) / descr.flashPageSize);
+            // a block running past the end of flash is not repaired there
+            err = isFlashAddress(pageAddr) ? readMemory(page, pageAddr, descr.flashPageSize) : ErrorCode::VERIFY_FAILED;
+            if (err == ErrorCode::OK) {
+                uint32_t from = ( pageAddr > _srcAddr ) ? pageAddr : _srcAddr;
+                uint32_t to = ( pageAddr + descr.flashPageSize < blockEnd ) ? pageAddr + descr.flashPageSize : blockEnd;
+                memcpy(&page[from - pageAddr], &_src[from - _srcAddr], to - from);
+                err = erasePages(&pageNum, 1);
+                for ( uint32_t offset = 0; offset < descr.flashPageSize && err == ErrorCode::OK; offset += MAX_WRITE_BLOCK_SIZE ) {
+                    bool blank = true;
+                    for ( size_t i = 0; i < MAX_WRITE_BLOCK_SIZE && blank; i++ ) {
+                        blank = page[offset + i] == 0xff;
+                    }
+                    if (!blank)
+                        err = commandWriteMemory(&page[offset], pageAddr + offset, MAX_WRITE_BLOCK_SIZE);
+                }
+                if (err == ErrorCode::OK)
+                    err = verifyMemory(page, pageAddr, descr.flashPageSize);
+            }
+            pageAddr += descr.flashPageSize;
+        }
+    }
+    return err;
+}
+/*!
+ * Function: verifyMemory 
+ * Compares memory with the source buffer. Uses Get Checksum if the bootloader 
+ * supports it, reads the memory back otherwise. The reads go one after another, 
+ * the bootloader takes a command only after it has answered the previous one, 
+ * so reading back costs about as much link time as the write did.
+ * 
+ * @param _src reference data.
+ * @param _addr start address.
+ * @param _size size in bytes.
+ * 
+ * @return Stm32BootClient::ErrorCode OK or VERIFY_FAILED on mismatch.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::verifyMemory( const void * _src, uint32_t _addr, size_t _size ) {
+    configASSERT(_src);
+    auto err = progressBegin(Phase::Verify, _addr, _size);
+    const uint8_t * pData = static_cast<const uint8_t *>(_src);
+    if (err != ErrorCode::OK) {
+        // cancelled before it started
+    } else if (m_caps.valid && m_caps.isCommandSupported(Command::GetChecksum) && _size && !( _size % 4 ) && !( _addr % 4 )) {
+        uint32_t crc;
+        err = commandGetChecksum(_addr, static_cast<uint32_t>(_size), crc);
+        if (err == ErrorCode::OK) {
+            err = ( crc == calculateCrc32(pData, _size) ) ? ErrorCode::OK : ErrorCode::VERIFY_FAILED;
+        }
+        if (err == ErrorCode::OK)
+            err = progressStep(_addr + static_cast<uint32_t>(_size), _size, 0);
+    } else {
+        uint8_t rxbuff[MAX_WRITE_BLOCK_SIZE];
+        while (_size && err == ErrorCode::OK) {
+            size_t bytes_to_read = ( _size > sizeof( rxbuff ) ) ? sizeof( rxbuff ) : _size;
+            _size -= bytes_to_read;
+            err = commandReadMemory(rxbuff, _addr, bytes_to_read);
+            if (err == ErrorCode::OK) {
+                err = memcmp(rxbuff, pData, bytes_to_read) ? ErrorCode::VERIFY_FAILED : ErrorCode::OK;
+            }
+            pData += bytes_to_read;
+            _addr += static_cast<uint32_t>(bytes_to_read);
+            if (err == ErrorCode::OK)
+                err = progressStep(_addr, bytes_to_read, _size);
+        }
+    }
+    progressEnd();
+    return err;
+}
+/*!
+ * Function: erasePages 
+ * Erases listed pages with Extended Erase if the bootloader supports it, 
+ * with Erase otherwise.
+ * 
+ * @param _pages page numbers.
+ * @param _count number of pages.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::erasePages( const uint16_t * _pages, size_t _count ) {
+    configASSERT(_pages);
+    configASSERT(_count && _count < EXT_BANK2_ERASE);
+    auto err = progressBegin(Phase::Erase, _pages[0], _count);
+    if (err == ErrorCode::OK && !m_caps.valid)
+        err = negotiateCaps();
+    if (err == ErrorCode::CANCELLED) {
+        // nothing erased
+    } else if (m_caps.valid) {
+        if (m_caps.isCommandSupported(Command::ExtErase) || m_caps.isCommandSupported(Command::ExtEraseNs)) {
+            err = commandExtendedErase(_pages, static_cast<uint16_t>(_count));
+            if (err == ErrorCode::OK)
+                err = progressStep(_pages[_count - 1], _count, 0);
+        } else {
+            err = ErrorCode::OK;
+            uint8_t pages[32];
+            while (_count && err == ErrorCode::OK) {
+                size_t chunk = ( _count > sizeof( pages ) ) ? sizeof( pages ) : _count;
+                for ( size_t i = 0; i < chunk; i++ ) {
+                    configASSERT(_pages[i] <= 0xff);
+                    pages[i] = static_cast<uint8_t>(_pages[i]);
+                }
+                err = commandErase(pages, chunk);
+                _pages += chunk;
+                _count -= chunk;
+                if (err == ErrorCode::OK)
+                    err = progressStep(_count ? _pages[0] : _pages[-1], chunk, _count);
+            }
+        }
+    }
+    progressEnd();
+    return err;
+}
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::eraseAllMemory() {
+    auto err = progressBegin(Phase::Erase, 0, 1);
+    if (err == ErrorCode::OK && !m_caps.valid)
+        err = negotiateCaps();
+    if (err != ErrorCode::CANCELLED && m_caps.valid) { // flash size is not needed here, so UNKNOWN_MCU doesn't matter
+        err = m_caps.isCommandSupported(Command::ExtErase) || m_caps.isCommandSupported(Command::ExtEraseNs) ?
+            commandExtendedErase(nullptr, EXT_MASS_ERASE) : commandErase();
+        if (err == ErrorCode::OK)
+            err = progressStep(0, 1, 0);
+    }
+    progressEnd();
+    return err;
+}
+/*!
+ * Function: writeFrames 
+ * Writes frames assembled in advance (Stm32PreparedImage), as one operation 
+ * for progress() and cancel(). 
+ * 
+ * @param _frames frames in the order to be written.
+ * @param _count number of frames.
+ * @param _verify check every frame right after it is written, see writeMemoryVerified().
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::writeFrames( const WriteFrame_t * _frames, size_t _count, bool _verify ) {
+    configASSERT(_frames || !_count);
+    size_t total = 0;
+    for ( size_t i = 0; i < _count; i++ ) {
+        total += _frames[i].dataPhaseSize - 2u;
+    }
+    auto err = progressBegin(Phase::Write, _count ? _frames[0].addr : 0, total);
+    for ( size_t i = 0; i < _count && err == ErrorCode::OK; i++ ) {
+        const WriteFrame_t & frame = _frames[i];
+        size_t size = frame.dataPhaseSize - 2u;
+        err = _verify ? writeMemoryVerified(&frame.dataPhase[1], frame.addr, size) : commandWriteFrame(frame);
+        if (err == ErrorCode::OK)
+            err = progressStep(( i + 1 < _count ) ? _frames[i + 1].addr : frame.addr + static_cast<uint32_t>(size), size,
+                               _count - i - 1);
+    }
+    progressEnd();
+    return err;
+}
+/*!
+ * Function: progressBegin 
+ * Starts reporting a long operation unless it runs inside another one. 
+ * 
+ * @return Stm32BootClient::ErrorCode CANCELLED if cancel() is pending, the 
+ * operation must not send anything then; progress() still tells where the 
+ * cancelled one stopped. 
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::progressBegin( Phase _phase, uint32_t _addr, size_t _total ) {
+    auto err = ErrorCode::OK;
+    if (m_progressDepth++ == 0 && m_cancel.load(std::memory_order_relaxed)) {
+        err = ErrorCode::CANCELLED;
+    } else if (m_progressDepth == 1) {
+        m_progress.phase.store(static_cast<uint8_t>(_phase), std::memory_order_relaxed);
+        m_progress.done.store(0, std::memory_order_relaxed);
+        m_progress.total.store(static_cast<uint32_t>(_total), std::memory_order_relaxed);
+        m_progress.blocks.store(0, std::memory_order_relaxed);
+        m_progress.retries.store(0, std::memory_order_relaxed);
+        m_progress.address.store(_addr, std::memory_order_relaxed);
+    }
+    return err;
+}
+/*!
+ * Function: progressStep 
+ * Accounts a completed block of the outer operation; this is its block 
+ * boundary, where cancel() takes effect. 
+ * 
+ * @param _addr where the operation goes on.
+ * @param _done bytes or pages of the block.
+ * @param _left what remains, nothing is cancelled after the last block.
+ * 
+ * @return Stm32BootClient::ErrorCode CANCELLED to stop the operation.
+ */
+template<class Io>
+Stm32BootBase::ErrorCode Stm32BootClientT<Io>::progressStep( uint32_t _addr, size_t _done, size_t _left ) {
+    auto err = ErrorCode::OK;
+    if (m_progressDepth == 1) {
+        // one writer, a plain store is enough and never locks
+        m_progress.done.store(m_progress.done.load(std::memory_order_relaxed) + static_cast<uint32_t>(_done),
+                              std::memory_order_relaxed);
+        m_progress.blocks.store(m_progress.blocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_progress.address.store(_addr, std::memory_order_relaxed);
+        if (_left && m_cancel.load(std::memory_order_relaxed))
+            err = ErrorCode::CANCELLED;
+    }
+    return err;
+}
+template<class Io>
+void Stm32BootClientT<Io>::progressEnd() {
+    configASSERT(m_progressDepth);
+    if (--m_progressDepth == 0)
+        m_progress.phase.store(static_cast<uint8_t>(Phase::Idle), std::memory_order_relaxed);
+}
+#endif
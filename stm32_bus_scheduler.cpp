@@ -0,0 +1,83 @@
+/*!
+/brief Concurrent updates of the units on several buses, see stm32_bus_scheduler.hpp.
+*/
+#include "stm32_bus_scheduler.hpp"
+
+Stm32BusScheduler::Stm32BusScheduler()
+    : m_startMs(0)
+    , m_endMs(0) {
+    for ( auto & slot : m_slots ) {
+        slot.job = nullptr;
+        slot.ctx = nullptr;
+        slot.result = ErrorCode::OK;
+        slot.startMs = 0;
+        slot.endMs = 0;
+    }
+}
+/*!
+ * Function: submit
+ * Sets the job of a bus for the next run(), one per bus.
+ *
+ * @param _bus where the job runs; it must use the client of this bus only.
+ * @param _job the job, it gets _ctx.
+ * @param _ctx passed to the job.
+ *
+ * @return Stm32BootClient::ErrorCode FAILED if the bus has a job already.
+ */
+Stm32BootBase::ErrorCode Stm32BusScheduler::submit( Stm32BootLowIo::Bus _bus, Job_t _job, void * _ctx ) {
+    auto idx = static_cast<int>(_bus);
+    configASSERT(_job);
+    configASSERT(idx > -1 && idx < static_cast<int>(MAX_BUSES));
+    Slot_t & slot = m_slots[idx];
+    auto err = ErrorCode::FAILED;
+    if (!slot.job) {
+        slot.job = _job;
+        slot.ctx = _ctx;
+        slot.result = ErrorCode::OK;
+        err = ErrorCode::OK;
+    }
+    return err;
+}
+/*!
+ * Function: run
+ * Starts a worker for every submitted job and waits for all of them. The
+ * slots are free for the next run afterwards, their results and times stay
+ * readable through slot() until then.
+ *
+ * @return Stm32BootClient::ErrorCode the first failure by bus order, OK if
+ * every job succeeded.
+ */
+Stm32BootBase::ErrorCode Stm32BusScheduler::run() {
+    bool started[MAX_BUSES] = {};
+    auto err = ErrorCode::OK;
+    m_startMs = Stm32BootLowIo::getTickMs();
+    for ( size_t i = 0; i < MAX_BUSES; i++ ) {
+        if (m_slots[i].job)
+            started[i] = startWorker(i, work, &m_slots[i]);
+    }
+    for ( size_t i = 0; i < MAX_BUSES; i++ ) {
+        if (m_slots[i].job && !started[i])
+            work(&m_slots[i]); // no worker, at least the job isn't lost
+    }
+    for ( size_t i = 0; i < MAX_BUSES; i++ ) {
+        if (started[i])
+            joinWorker(i);
+        if (m_slots[i].job && err == ErrorCode::OK)
+            err = m_slots[i].result;
+        m_slots[i].job = nullptr;
+    }
+    m_endMs = Stm32BootLowIo::getTickMs();
+    return err;
+}
+const Stm32BusScheduler::Slot_t & Stm32BusScheduler::slot( Stm32BootLowIo::Bus _bus ) const {
+    auto idx = static_cast<int>(_bus);
+    configASSERT(idx > -1 && idx < static_cast<int>(MAX_BUSES));
+    return m_slots[idx];
+}
+/// Worker body: runs the job of a slot and times it
+void Stm32BusScheduler::work( void * _slot ) {
+    Slot_t * slot = static_cast<Slot_t *>(_slot);
+    slot->startMs = Stm32BootLowIo::getTickMs();
+    slot->result = slot->job(slot->ctx);
+    slot->endMs = Stm32BootLowIo::getTickMs();
+}
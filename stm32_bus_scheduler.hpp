@@ -0,0 +1,43 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_io.hpp"
+/*!
+ * Runs one job per bus at the same time, so a unit waiting out a multi-second
+ * mass erase doesn't hold the other one up: updating both takes as long as
+ * the slower one, not the sum. Jobs talk to their bus through their own
+ * client (Stm32BootBus0Client, Stm32BootBus1Client), sessions stay per bus.
+ * Every job gets a worker, a FreeRTOS task on the target and a thread on the
+ * host, started and joined by the platform IO (stm32_io_*.cpp); while one
+ * worker blocks on its link waiting for an ACK, the other one runs. Like the
+ * core it never allocates.
+ */
+class Stm32BusScheduler {
+public:
+    typedef Stm32BootBase::ErrorCode ErrorCode;
+    typedef ErrorCode ( *Job_t )( void * _ctx );
+    static const size_t MAX_BUSES = 2;
+    typedef struct Slot_t {
+        Job_t job;                  /// nullptr: the bus is idle
+        void * ctx;
+        ErrorCode result;
+        uint32_t startMs;           /// Stm32BootLowIo::getTickMs()
+        uint32_t endMs;
+    }
+    Slot_t;
+    Stm32BusScheduler();
+    ErrorCode submit( Stm32BootLowIo::Bus _bus, Job_t _job, void * _ctx );
+    ErrorCode run();
+    const Slot_t & slot( Stm32BootLowIo::Bus _bus ) const;
+    uint32_t elapsedMs() const {
+        return m_endMs - m_startMs;
+    }
+    /// Platform IO: runs _entry(_arg) on worker _idx, false if it can't, then the job runs inline
+    static bool startWorker( size_t _idx, void ( *_entry )( void * ), void * _arg );
+    static void joinWorker( size_t _idx );
+private:
+    static void work( void * _slot );
+    Slot_t m_slots[MAX_BUSES];
+    uint32_t m_startMs;
+    uint32_t m_endMs;
+};
+#endif
@@ -0,0 +1,315 @@
+/*!
+/brief Programming daemon on a Unix domain socket, see stm32_daemon.hpp.
+*/
+#include "stm32_daemon.hpp"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+Stm32SocketBuf::Stm32SocketBuf( int _fd )
+    : m_fd(_fd)
+    , m_broken(false) {
+    setp(m_buffer, m_buffer + BUFFER_SIZE);
+}
+Stm32SocketBuf::~Stm32SocketBuf() {
+    send();
+}
+Stm32SocketBuf::int_type Stm32SocketBuf::overflow( int_type _c ) {
+    send();
+    if (!traits_type::eq_int_type(_c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(_c);
+        pbump(1);
+    }
+    return m_broken ? traits_type::eof() : traits_type::not_eof(_c);
+}
+int Stm32SocketBuf::sync() {
+    send();
+    return m_broken ? -1 : 0;
+}
+void Stm32SocketBuf::send() {
+    const char * src = pbase();
+    size_t size = static_cast<size_t>(pptr() - pbase());
+    while (size && !m_broken) {
+        ssize_t sent = ::send(m_fd, src, size, MSG_NOSIGNAL);
+        if (sent > 0) {
+            src += sent;
+            size -= static_cast<size_t>(sent);
+        } else if (sent < 0 && errno != EINTR) {
+            m_broken = true; // the job goes on, its status is lost
+        }
+    }
+    setp(m_buffer, m_buffer + BUFFER_SIZE);
+}
+Stm32Daemon::Stm32Daemon( const std::string &_cacheDir )
+    : m_fd(-1)
+    , m_cache(_cacheDir)
+    , m_uses(0) {}
+Stm32Daemon::~Stm32Daemon() {
+    close();
+}
+/*!
+ * Function: open
+ * Starts listening on the socket path. A socket file left behind by a daemon
+ * which is gone is replaced, one which still accepts connections is not.
+ *
+ * @param _path of the socket.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32Daemon::open( const std::string &_path ) {
+    struct sockaddr_un addr;
+    auto err = Stm32BootClient::ErrorCode::FAILED;
+    close();
+    memset(&addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    if (!_path.empty() && _path.size() < sizeof( addr.sun_path )) {
+        memcpy(addr.sun_path, _path.c_str(), _path.size());
+        m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+    if (m_fd >= 0) {
+        if (connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof( addr )) != 0) {
+            unlink(_path.c_str());
+            ::close(m_fd);
+            m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (m_fd >= 0 && bind(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof( addr )) == 0 &&
+                listen(m_fd, LISTEN_BACKLOG) == 0) {
+                m_path = _path;
+                err = Stm32BootClient::ErrorCode::OK;
+            }
+        }
+        if (err != Stm32BootClient::ErrorCode::OK && m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+    return err;
+}
+void Stm32Daemon::close() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        unlink(m_path.c_str());
+        m_path.clear();
+    }
+}
+/*!
+ * Function: serve
+ * Accepts clients and runs their requests until one asks for shutdown.
+ *
+ * @param _handler runs the jobs.
+ *
+ * @return Stm32BootClient::ErrorCode OK after a shutdown request.
+ */
+Stm32BootClient::ErrorCode Stm32Daemon::serve( const Handler_t &_handler ) {
+    auto err = ( m_fd >= 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+    bool running = true;
+    while (running && err == Stm32BootClient::ErrorCode::OK) {
+        int fd = accept(m_fd, nullptr, nullptr);
+        if (fd >= 0) {
+            running = serveConnection(fd, _handler);
+            ::close(fd);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            err = Stm32BootClient::ErrorCode::FAILED;
+        }
+    }
+    return err;
+}
+/*!
+ * Function: serveConnection
+ * Runs the requests of one client in the order they come.
+ *
+ * @return bool false if the client asked for shutdown.
+ */
+bool Stm32Daemon::serveConnection( int _fd, const Handler_t &_handler ) {
+    Stm32SocketBuf buf(_fd);
+    std::ostream out(&buf);
+    std::string line;
+    bool running = true;
+    bool connected = true;
+    while (running && connected && readLine(_fd, line)) {
+        std::vector<std::string> args = split(line);
+        int result = 0;
+        if (args.empty()) {
+            continue;
+        } else if (args[0] == "quit") {
+            connected = false;
+        } else if (args[0] == "shutdown") {
+            running = false;
+        } else {
+            result = _handler(args, out);
+        }
+        out << "END " << result << std::endl;
+        connected = connected && !buf.isBroken();
+    }
+    return running;
+}
+/*!
+ * Function: readLine
+ * Reads one request byte by byte, nothing of the next one is consumed.
+ *
+ * @return bool false if the client hung up or the line is too long.
+ */
+bool Stm32Daemon::readLine( int _fd, std::string &_line ) {
+    bool ok = true;
+    bool done = false;
+    _line.clear();
+    while (ok && !done) {
+        char c;
+        ssize_t rd = recv(_fd, &c, 1, 0);
+        if (rd == 1) {
+            if (c == '\n') {
+                done = true;
+            } else if (c != '\r') {
+                _line += c;
+                ok = _line.size() < MAX_REQUEST_SIZE;
+            }
+        } else if (rd == 0 || errno != EINTR) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+/*!
+ * Function: split
+ * Splits a request into words at spaces and tabs out of double quotes. A
+ * backslash takes the next character as it is, in quotes and out of them.
+ *
+ * @return std::vector<std::string> the words, without quotes and backslashes.
+ */
+std::vector<std::string> Stm32Daemon::split( const std::string &_line ) {
+    std::vector<std::string> words;
+    size_t pos = _line.find_first_not_of(" \t");
+    while (pos != std::string::npos) {
+        std::string word;
+        bool quoted = false;
+        for ( ; pos < _line.size() && ( quoted || ( _line[pos] != ' ' && _line[pos] != '\t' ) ); pos++ ) {
+            if (_line[pos] == '"') {
+                quoted = !quoted;
+            } else {
+                if (_line[pos] == '\\' && pos + 1 < _line.size())
+                    pos++;
+                word += _line[pos];
+            }
+        }
+        words.push_back(word);
+        pos = _line.find_first_not_of(" \t", pos);
+    }
+    return words;
+}
+/*!
+ * Function: join
+ * Makes a request split() takes apart into the same words. A word with a
+ * line break can't be sent, the line would end there.
+ *
+ * @return std::string the request, empty if a word has a line break.
+ */
+std::string Stm32Daemon::join( const std::vector<std::string> &_words ) {
+    std::string line;
+    bool ok = true;
+    for ( size_t i = 0; i < _words.size() && ok; i++ ) {
+        const std::string & word = _words[i];
+        ok = word.find_first_of("\r\n") == std::string::npos;
+        line += i ? " \"" : "\"";
+        for ( char c : word ) {
+            if (c == '"' || c == '\\')
+                line += '\\';
+            line += c;
+        }
+        line += '"';
+    }
+    return ok ? line : std::string();
+}
+/*!
+ * Function: prepareImage
+ * Returns the prepared image of the file, prepared again only if the file
+ * has changed since. The least recently used image makes room for a new one.
+ *
+ * @param _fname image file, a relative path is taken from the working directory of the daemon.
+ * @param _image result, valid until the next call.
+ * @param _kept set to true if the image was in memory already.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32Daemon::prepareImage( const std::string &_fname, const Stm32PreparedImage * &_image, bool &_kept ) {
+    struct stat st;
+    auto err = ( stat(_fname.c_str(), &st) == 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+    _image = nullptr;
+    _kept = false;
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        int64_t mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        auto found = m_images.find(_fname);
+        if (found != m_images.end() && found->second.mtimeNs == mtimeNs && found->second.size == st.st_size) {
+            _kept = true;
+        } else {
+            if (found == m_images.end() && m_images.size() >= MAX_IMAGES) {
+                auto oldest = m_images.begin();
+                for ( auto it = m_images.begin(); it != m_images.end(); ++it ) {
+                    if (it->second.lastUse < oldest->second.lastUse)
+                        oldest = it;
+                }
+                m_images.erase(oldest);
+            }
+            Image_t & entry = m_images[_fname];
+            entry.mtimeNs = mtimeNs;
+            entry.size = st.st_size;
+            entry.prepared.reset(new Stm32PreparedImage);
+            err = entry.prepared->prepare(_fname, Stm32Image::DEFAULT_BIN_BASE, m_cache);
+            if (err != Stm32BootClient::ErrorCode::OK)
+                m_images.erase(_fname);
+            found = m_images.find(_fname);
+        }
+        if (err == Stm32BootClient::ErrorCode::OK) {
+            found->second.lastUse = ++m_uses;
+            _image = found->second.prepared.get();
+        }
+    }
+    return err;
+}
+/*!
+ * Function: submit
+ * Client side: sends one request to a daemon and copies its status lines to
+ * _out until the END line.
+ *
+ * @param _path of the daemon socket.
+ * @param _args job options, paths absolute.
+ * @param _out gets the status lines.
+ * @param _result the result of the job.
+ *
+ * @return Stm32BootClient::ErrorCode FAILED if the daemon can't be reached,
+ *         hung up before the end of the job or an option has a line break.
+ */
+Stm32BootClient::ErrorCode Stm32Daemon::submit( const std::string &_path, const std::vector<std::string> &_args,
+                                                std::ostream &_out, int &_result ) {
+    struct sockaddr_un addr;
+    auto err = Stm32BootClient::ErrorCode::FAILED;
+    int fd = -1;
+    std::string request = join(_args);
+    memset(&addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    if (!request.empty() && !_path.empty() && _path.size() < sizeof( addr.sun_path )) {
+        memcpy(addr.sun_path, _path.c_str(), _path.size());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+    if (fd >= 0) {
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof( addr )) == 0) {
+            Stm32SocketBuf buf(fd);
+            std::ostream out(&buf);
+            out << request << std::endl;
+            std::string line;
+            while (err != Stm32BootClient::ErrorCode::OK && !buf.isBroken() && readLine(fd, line)) {
+                if (line.compare(0, 4, "END ") == 0) {
+                    _result = static_cast<int>(strtol(line.c_str() + 4, nullptr, 10));
+                    err = Stm32BootClient::ErrorCode::OK;
+                } else {
+                    _out << line << std::endl;
+                }
+            }
+        }
+        ::close(fd);
+    }
+    return err;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "stm32_prepare.hpp"
+#include "stm32_image_cache.hpp"
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+/*!
+ * Host side only: an output stream over a connected socket, a line goes out
+ * when it is flushed. A client that went away breaks the stream, the daemon
+ * gets no SIGPIPE.
+ */
+class Stm32SocketBuf : public std::streambuf {
+public:
+    explicit Stm32SocketBuf( int _fd );
+    ~Stm32SocketBuf();
+    bool isBroken() const {
+        return m_broken;
+    }
+protected:
+    int_type overflow( int_type _c );
+    int sync();
+private:
+    static const size_t BUFFER_SIZE = 256;
+    void send();
+    int m_fd;
+    bool m_broken;
+    char m_buffer[BUFFER_SIZE];
+};
+/*!
+ * Host side only: the programming daemon (--daemon). It listens on a Unix
+ * domain socket and serves local clients one after another, the others wait
+ * in the listen backlog. A request is one line: stm32bootpc job options
+ * separated by spaces, "quit" to hang up or "shutdown" to stop the daemon.
+ * A word with spaces is put in double quotes, a backslash takes the next
+ * character as it is. Paths are resolved against the working directory of
+ * the daemon, --submit sends them absolute.
+ * The reply is the status lines of the job as they come, then "END <result>",
+ * 0 on success. A client may send the next request after the END line.
+ * Prepared images are kept in memory until their file changes.
+ */
+class Stm32Daemon {
+public:
+    /// Runs one job, prints its status to _out and returns 0 on success
+    typedef std::function<int( const std::vector<std::string> &_args, std::ostream &_out )> Handler_t;
+    static const size_t MAX_IMAGES = 8;
+    static const size_t MAX_REQUEST_SIZE = 4096;
+    explicit Stm32Daemon( const std::string &_cacheDir );
+    ~Stm32Daemon();
+    Stm32BootClient::ErrorCode open( const std::string &_path );
+    void close();
+    Stm32BootClient::ErrorCode serve( const Handler_t &_handler );
+    Stm32BootClient::ErrorCode prepareImage( const std::string &_fname, const Stm32PreparedImage * &_image, bool &_kept );
+    static Stm32BootClient::ErrorCode submit( const std::string &_path, const std::vector<std::string> &_args,
+                                              std::ostream &_out, int &_result );
+    static std::vector<std::string> split( const std::string &_line );
+    static std::string join( const std::vector<std::string> &_words );
+private:
+    Stm32Daemon( const Stm32Daemon & );
+    Stm32Daemon & operator=( const Stm32Daemon & );
+    typedef struct Image_t {
+        int64_t mtimeNs;
+        int64_t size;
+        uint64_t lastUse;
+        std::unique_ptr<Stm32PreparedImage> prepared;
+    }
+    Image_t;
+    static const int LISTEN_BACKLOG = 16;
+    static bool readLine( int _fd, std::string &_line );
+    bool serveConnection( int _fd, const Handler_t &_handler );
+    std::string m_path;
+    int m_fd;
+    Stm32ImageCache m_cache;
+    std::map<std::string, Image_t> m_images;
+    uint64_t m_uses;
+};
+#endif
@@ -0,0 +1,425 @@
+/*!
+/brief Compressed firmware input decoded on a pipeline thread.
+*/
+#include "stm32_decompress.hpp"
+#include <string.h>
+#include <strings.h>
+#ifdef STM32_BOOT_GZIP
+#include <zlib.h>
+#endif
+#ifdef STM32_BOOT_ZSTD
+#include <zstd.h>
+#endif
+#ifdef STM32_BOOT_XZ
+#include <lzma.h>
+#endif
+
+namespace {
+const size_t IN_CHUNK_SIZE = 16 * 1024;
+const uint8_t GZIP_MAGIC[] = { 0x1f, 0x8b };
+const uint8_t ZSTD_MAGIC[] = { 0x28, 0xb5, 0x2f, 0xfd };
+const uint8_t XZ_MAGIC[] = { 0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00 };
+const char * const SUFFIXES[] = { ".gz", ".zst", ".xz" };
+
+bool hasMagic( const uint8_t * _head, size_t _size, const uint8_t * _magic, size_t _magicSize ) {
+    return _size >= _magicSize && !memcmp(_head, _magic, _magicSize);
+}
+
+/*!
+ * One decoder step over whatever input and output room there is. Codecs
+ * differ only here, the pipeline loop around it is common.
+ */
+class Decoder {
+public:
+    explicit Decoder( Stm32Decompressor::Codec _codec )
+        : m_codec(_codec)
+        , m_ready(false)
+        , m_streamEnded(false) {
+#ifdef STM32_BOOT_GZIP
+        memset(&m_zs, 0, sizeof( m_zs ));
+        if (m_codec == Stm32Decompressor::Codec::Gzip)
+            m_ready = inflateInit2(&m_zs, 15 + 32) == Z_OK; // 32 - gzip header is detected
+#endif
+#ifdef STM32_BOOT_ZSTD
+        m_zds = nullptr;
+        if (m_codec == Stm32Decompressor::Codec::Zstd) {
+            m_zds = ZSTD_createDStream();
+            m_ready = m_zds && !ZSTD_isError(ZSTD_initDStream(m_zds));
+        }
+#endif
+#ifdef STM32_BOOT_XZ
+        lzma_stream init = LZMA_STREAM_INIT;
+        m_xz = init;
+        if (m_codec == Stm32Decompressor::Codec::Xz)
+            m_ready = lzma_stream_decoder(&m_xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+#endif
+        if (m_codec == Stm32Decompressor::Codec::None)
+            m_ready = true;
+    }
+    ~Decoder() {
+#ifdef STM32_BOOT_GZIP
+        if (m_codec == Stm32Decompressor::Codec::Gzip && m_ready)
+            inflateEnd(&m_zs);
+#endif
+#ifdef STM32_BOOT_ZSTD
+        if (m_zds)
+            ZSTD_freeDStream(m_zds);
+#endif
+#ifdef STM32_BOOT_XZ
+        lzma_end(&m_xz);
+#endif
+    }
+    bool ready() const {
+        return m_ready;
+    }
+    /*!
+     * Function: step
+     * Decodes from _in into _out.
+     *
+     * @param _eof no input follows _in.
+     * @param _used how many input bytes were consumed.
+     * @param _made how many output bytes were produced.
+     * @param _finished the last stream in the file has ended.
+     *
+     * @return Stm32BootClient::ErrorCode FILE_FAILED on corrupt input.
+     */
+    Stm32BootClient::ErrorCode step( const uint8_t * _in, size_t _inSize, bool _eof,
+                                     uint8_t * _out, size_t _outSize,
+                                     size_t &_used, size_t &_made, bool &_finished ) {
+        auto err = Stm32BootClient::ErrorCode::FILE_FAILED;
+        _used = _made = 0;
+        _finished = false;
+        if (_eof && !_inSize && m_streamEnded) {
+            _finished = true; // the file ends right after a stream
+            return Stm32BootClient::ErrorCode::OK;
+        }
+        if (m_codec == Stm32Decompressor::Codec::None) {
+            _used = _made = ( _inSize < _outSize ) ? _inSize : _outSize;
+            memcpy(_out, _in, _made);
+            _finished = _eof && _used == _inSize;
+            err = Stm32BootClient::ErrorCode::OK;
+        }
+#ifdef STM32_BOOT_GZIP
+        if (m_codec == Stm32Decompressor::Codec::Gzip) {
+            m_zs.next_in = const_cast<Bytef *>(_in);
+            m_zs.avail_in = static_cast<uInt>(_inSize);
+            m_zs.next_out = _out;
+            m_zs.avail_out = static_cast<uInt>(_outSize);
+            int ret = inflate(&m_zs, Z_NO_FLUSH);
+            _used = _inSize - m_zs.avail_in;
+            _made = _outSize - m_zs.avail_out;
+            if (ret == Z_STREAM_END) {
+                // gzip allows members back to back, like cat a.gz b.gz
+                _finished = _eof && _used == _inSize;
+                if (_finished || inflateReset(&m_zs) == Z_OK)
+                    err = Stm32BootClient::ErrorCode::OK;
+            } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+                err = Stm32BootClient::ErrorCode::OK;
+            }
+            m_streamEnded = ret == Z_STREAM_END || ( m_streamEnded && !_used );
+        }
+#endif
+#ifdef STM32_BOOT_ZSTD
+        if (m_codec == Stm32Decompressor::Codec::Zstd) {
+            ZSTD_inBuffer in = { _in, _inSize, 0 };
+            ZSTD_outBuffer out = { _out, _outSize, 0 };
+            size_t ret = ZSTD_decompressStream(m_zds, &out, &in);
+            _used = in.pos;
+            _made = out.pos;
+            if (!ZSTD_isError(ret)) {
+                // 0 - a frame is complete and flushed, frames may follow
+                _finished = !ret && _eof && _used == _inSize;
+                err = Stm32BootClient::ErrorCode::OK;
+            }
+            m_streamEnded = ( !ZSTD_isError(ret) && !ret ) || ( m_streamEnded && !_used );
+        }
+#endif
+#ifdef STM32_BOOT_XZ
+        if (m_codec == Stm32Decompressor::Codec::Xz) {
+            m_xz.next_in = _in;
+            m_xz.avail_in = _inSize;
+            m_xz.next_out = _out;
+            m_xz.avail_out = _outSize;
+            lzma_ret ret = lzma_code(&m_xz, _eof ? LZMA_FINISH : LZMA_RUN);
+            _used = _inSize - m_xz.avail_in;
+            _made = _outSize - m_xz.avail_out;
+            if (ret == LZMA_STREAM_END) {
+                _finished = true;
+                err = Stm32BootClient::ErrorCode::OK;
+            } else if (ret == LZMA_OK || ret == LZMA_BUF_ERROR) {
+                err = Stm32BootClient::ErrorCode::OK;
+            }
+        }
+#endif
+        (void)_in;
+        (void)_out;
+        return err;
+    }
+private:
+    Decoder( const Decoder & );
+    Decoder & operator=( const Decoder & );
+    Stm32Decompressor::Codec m_codec;
+    bool m_ready;
+    bool m_streamEnded;     /// a gzip member or zstd frame has ended, no next one has started
+#ifdef STM32_BOOT_GZIP
+    z_stream m_zs;
+#endif
+#ifdef STM32_BOOT_ZSTD
+    ZSTD_DStream * m_zds;
+#endif
+#ifdef STM32_BOOT_XZ
+    lzma_stream m_xz;
+#endif
+};
+}
+
+Stm32Decompressor::Stm32Decompressor()
+    : m_file(nullptr)
+    , m_codec(Codec::None)
+    , m_head(0)
+    , m_tail(0)
+    , m_count(0)
+    , m_readPos(0)
+    , m_done(true)
+    , m_cancel(false)
+    , m_status(Stm32BootClient::ErrorCode::OK) {}
+Stm32Decompressor::~Stm32Decompressor() {
+    close();
+}
+/*!
+ * Function: open
+ * Opens the file, tells the codec by its first bytes and starts the pipeline
+ * thread.
+ *
+ * @param _fname compressed or plain file.
+ *
+ * @return Stm32BootClient::ErrorCode FILE_FAILED if the file can't be opened
+ * or its codec is not compiled in.
+ */
+Stm32BootClient::ErrorCode Stm32Decompressor::open( const std::string &_fname ) {
+    auto err = Stm32BootClient::ErrorCode::FILE_FAILED;
+    close();
+    m_file = fopen(_fname.c_str(), "rb");
+    if (m_file) {
+        uint8_t head[sizeof( XZ_MAGIC )];
+        size_t got = fread(head, 1, sizeof( head ), m_file);
+        m_codec = detect(head, got);
+        if (isSupported(m_codec) && fseek(m_file, 0, SEEK_SET) == 0) {
+            if (m_ring.size() != RING_CHUNKS)
+                m_ring.resize(RING_CHUNKS);
+            m_head = m_tail = m_count = m_readPos = 0;
+            m_done = m_cancel = false;
+            m_status = Stm32BootClient::ErrorCode::OK;
+            m_thread = std::thread(&Stm32Decompressor::run, this);
+            err = Stm32BootClient::ErrorCode::OK;
+        } else {
+            close();
+        }
+    }
+    return err;
+}
+/*!
+ * Function: close
+ * Stops the pipeline thread, also in the middle of the file.
+ */
+void Stm32Decompressor::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancel = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+    if (m_file) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    m_done = true;
+}
+/*!
+ * Function: read
+ * Takes decoded bytes out of the ring, waiting for the pipeline thread if
+ * the ring is empty.
+ *
+ * @param _dst a pointer to the destination buffer.
+ * @param _size number of bytes wanted.
+ *
+ * @return size_t fewer than _size only at the end of the data, see status().
+ */
+size_t Stm32Decompressor::read( uint8_t * _dst, size_t _size ) {
+    size_t done = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (done < _size) {
+        while (!m_count && !m_done)
+            m_cv.wait(lock);
+        if (!m_count)
+            break;
+        Chunk_t &chunk = m_ring[m_head];
+        size_t n = chunk.size - m_readPos;
+        if (n > _size - done)
+            n = _size - done;
+        memcpy(_dst + done, chunk.data + m_readPos, n);
+        m_readPos += n;
+        done += n;
+        if (m_readPos == chunk.size) {
+            m_head = ( m_head + 1 ) % RING_CHUNKS;
+            m_count--;
+            m_readPos = 0;
+            m_cv.notify_all();
+        }
+    }
+    return done;
+}
+/*!
+ * Function: status
+ * @return Stm32BootClient::ErrorCode FILE_FAILED if the file turned out
+ * truncated or corrupt, meaningful once read() came up short.
+ */
+Stm32BootClient::ErrorCode Stm32Decompressor::status() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_status;
+}
+/// ReadSource_t over a Stm32Decompressor passed as _ctx
+size_t Stm32Decompressor::source( void * _ctx, uint8_t * _dst, size_t _size ) {
+    return static_cast<Stm32Decompressor *>(_ctx)->read(_dst, _size);
+}
+/*!
+ * Function: detect
+ * @param _head the first bytes of a file.
+ * @return Codec None for anything without a known magic.
+ */
+Stm32Decompressor::Codec Stm32Decompressor::detect( const uint8_t * _head, size_t _size ) {
+    Codec codec = Codec::None;
+    if (hasMagic(_head, _size, GZIP_MAGIC, sizeof( GZIP_MAGIC )))
+        codec = Codec::Gzip;
+    else if (hasMagic(_head, _size, ZSTD_MAGIC, sizeof( ZSTD_MAGIC )))
+        codec = Codec::Zstd;
+    else if (hasMagic(_head, _size, XZ_MAGIC, sizeof( XZ_MAGIC )))
+        codec = Codec::Xz;
+    return codec;
+}
+bool Stm32Decompressor::isSupported( Codec _codec ) {
+    bool supported = _codec == Codec::None;
+#ifdef STM32_BOOT_GZIP
+    supported = supported || _codec == Codec::Gzip;
+#endif
+#ifdef STM32_BOOT_ZSTD
+    supported = supported || _codec == Codec::Zstd;
+#endif
+#ifdef STM32_BOOT_XZ
+    supported = supported || _codec == Codec::Xz;
+#endif
+    return supported;
+}
+/*!
+ * Function: plainName
+ * Drops a compression suffix, so fw.hex.gz is still taken for Intel HEX.
+ */
+std::string Stm32Decompressor::plainName( const std::string &_fname ) {
+    std::string name = _fname;
+    for ( const char * suffix : SUFFIXES ) {
+        size_t len = strlen(suffix);
+        if (name.size() > len && !strcasecmp(name.c_str() + name.size() - len, suffix)) {
+            name.resize(name.size() - len);
+            break;
+        }
+    }
+    return name;
+}
+/*!
+ * Function: readAll
+ * Decodes a whole file into memory, for callers that parse it anyway.
+ *
+ * @param _content the decoded bytes, replaced.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32Decompressor::readAll( const std::string &_fname, std::vector<uint8_t> &_content ) {
+    Stm32Decompressor input;
+    auto err = input.open(_fname);
+    _content.clear();
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        size_t got = 0;
+        do {
+            size_t pos = _content.size();
+            _content.resize(pos + CHUNK_SIZE);
+            got = input.read(_content.data() + pos, CHUNK_SIZE);
+            _content.resize(pos + got);
+        } while (got == CHUNK_SIZE);
+        err = input.status();
+    }
+    return err;
+}
+/*!
+ * Function: acquireChunk
+ * Waits for a free chunk at the tail of the ring.
+ *
+ * @return Chunk_t * nullptr if close() was called meanwhile.
+ */
+Stm32Decompressor::Chunk_t * Stm32Decompressor::acquireChunk() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_count == RING_CHUNKS && !m_cancel)
+        m_cv.wait(lock);
+    return m_cancel ? nullptr : &m_ring[m_tail];
+}
+void Stm32Decompressor::publishChunk() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tail = ( m_tail + 1 ) % RING_CHUNKS;
+        m_count++;
+    }
+    m_cv.notify_all();
+}
+/*!
+ * Function: run
+ * The pipeline thread: reads the file in IN_CHUNK_SIZE pieces and decodes
+ * straight into ring chunks, a chunk is published when full or at the end.
+ * Decoding runs outside the lock, the reader only waits for a whole chunk.
+ */
+void Stm32Decompressor::run() {
+    Decoder decoder(m_codec);
+    auto err = decoder.ready() ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+    std::vector<uint8_t> in(IN_CHUNK_SIZE);
+    size_t inSize = 0;
+    size_t inPos = 0;
+    bool eof = false;
+    bool finished = false;
+    Chunk_t * out = nullptr;
+    while (err == Stm32BootClient::ErrorCode::OK && !finished) {
+        if (inPos == inSize && !eof) {
+            inSize = fread(in.data(), 1, in.size(), m_file);
+            inPos = 0;
+            eof = !inSize; // a read of 0 bytes, the file may end on an IN_CHUNK_SIZE boundary
+            if (ferror(m_file))
+                err = Stm32BootClient::ErrorCode::FILE_FAILED;
+        }
+        if (!out) {
+            out = acquireChunk();
+            if (!out)
+                break;
+            out->size = 0;
+        }
+        size_t used = 0;
+        size_t made = 0;
+        if (err == Stm32BootClient::ErrorCode::OK)
+            err = decoder.step(in.data() + inPos, inSize - inPos, eof, out->data + out->size,
+                               CHUNK_SIZE - out->size, used, made, finished);
+        inPos += used;
+        out->size += made;
+        if (out->size == CHUNK_SIZE) {
+            publishChunk();
+            out = nullptr;
+        }
+        // no progress with all input in hand - the file ends in the middle of a stream
+        if (err == Stm32BootClient::ErrorCode::OK && !finished && !used && !made && eof && inPos == inSize)
+            err = Stm32BootClient::ErrorCode::FILE_FAILED;
+    }
+    if (out && out->size)
+        publishChunk();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_status = err;
+        m_done = true;
+    }
+    m_cv.notify_all();
+}
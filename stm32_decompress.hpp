@@ -0,0 +1,67 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+/*!
+ * Host side only: firmware input that may be compressed. The codec is told by
+ * the magic bytes, not by the name: gzip (-DSTM32_BOOT_GZIP, -lz), zstd
+ * (-DSTM32_BOOT_ZSTD, -lzstd) and xz (-DSTM32_BOOT_XZ, -llzma); plain files
+ * pass through. A pipeline thread reads and decodes the file into a ring of
+ * RING_CHUNKS chunks, the reader takes bytes out of it, so at most the ring
+ * is in memory and decoding overlaps with the link.
+ */
+class Stm32Decompressor {
+public:
+    enum class Codec : uint8_t {
+        None,
+        Gzip,
+        Zstd,
+        Xz,
+    };
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    static const size_t RING_CHUNKS = 4;
+    Stm32Decompressor();
+    ~Stm32Decompressor();
+    Stm32BootClient::ErrorCode open( const std::string &_fname );
+    void close();
+    size_t read( uint8_t * _dst, size_t _size );
+    Stm32BootClient::ErrorCode status();
+    Codec codec() const {
+        return m_codec;
+    }
+    static size_t source( void * _ctx, uint8_t * _dst, size_t _size );
+    static Codec detect( const uint8_t * _head, size_t _size );
+    static bool isSupported( Codec _codec );
+    static std::string plainName( const std::string &_fname );
+    static Stm32BootClient::ErrorCode readAll( const std::string &_fname, std::vector<uint8_t> &_content );
+private:
+    Stm32Decompressor( const Stm32Decompressor & );
+    Stm32Decompressor & operator=( const Stm32Decompressor & );
+    typedef struct Chunk_t {
+        size_t size;
+        uint8_t data[CHUNK_SIZE];
+    }
+    Chunk_t;
+    void run();
+    Chunk_t * acquireChunk();
+    void publishChunk();
+    FILE * m_file;
+    Codec m_codec;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<Chunk_t> m_ring;
+    size_t m_head;          /// chunk being read
+    size_t m_tail;          /// chunk being filled
+    size_t m_count;         /// chunks ready to be read
+    size_t m_readPos;       /// in the head chunk
+    bool m_done;
+    bool m_cancel;
+    Stm32BootClient::ErrorCode m_status;
+};
+#endif
@@ -0,0 +1,367 @@
+/*!
+/brief Fault injection between the client and the software bootloader, and the recovery campaign on top of it.
+*/
+#include "stm32_fault.hpp"
+#include "stm32_boot_client_impl.hpp"
+#include <algorithm>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t ACK_CODE = 0x79;
+static const uint8_t NACK_CODE = 0x1f;
+static const uint8_t SPI_DUMMY_CODE = 0xa5;
+static const uint32_t PERMILLE = 1000;
+static const uint32_t DEFAULT_RUNS = 100;
+static const uint32_t DEFAULT_READ_TIMEOUT_MS = 100;
+static const uint16_t CAMPAIGN_PAGE = 1;    /// erased and written over and over, page 0 stays as it is
+
+Stm32FaultInjector::Stm32FaultInjector( Stm32MockTarget &_target, ProtocolVariant _variant )
+    : m_target(_target)
+    , m_variant(_variant)
+    , m_unit(( _variant == ProtocolVariant::Can ) ? sizeof( Stm32BootClient::CanFrame_t ) : 1)
+    , m_readTimeoutMs(DEFAULT_READ_TIMEOUT_MS) {
+    memset(&m_rates, 0, sizeof( m_rates ));
+    resetCounts();
+}
+void Stm32FaultInjector::resetCounts() {
+    memset(m_injected, 0, sizeof( m_injected ));
+}
+/*!
+ * Function: write
+ * Passes the host bytes on, maybe cut off, dropped, doubled or flipped. The
+ * host is told that everything went unless the link broke off.
+ *
+ * @return Stm32BootClient::ErrorCode OK or SERIAL_WR_FAILED.
+ */
+Stm32BootClient::ErrorCode Stm32FaultInjector::write( const uint8_t * _src, size_t _size, size_t * _written ) {
+    configASSERT(_src);
+    auto err = Stm32BootClient::ErrorCode::OK;
+    std::vector<uint8_t> buf(_src, _src + _size);
+    size_t written = _size;
+    if (draw(Fault::Reset))
+        reset();
+    if (buf.size() >= m_unit && draw(Fault::Disconnect)) {
+        written = pick(buf.size() / m_unit) * m_unit;
+        buf.resize(written);
+        err = Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
+    } else {
+        mangle(buf);
+    }
+    if (!buf.empty())
+        m_target.write(buf.data(), buf.size());
+    if (_written)
+        *_written = written;
+    return err;
+}
+/*!
+ * Function: read
+ * Late bytes of an earlier reply come first, then what the target has. A read
+ * that ends short has waited for the read timeout.
+ *
+ * @return Stm32BootClient::ErrorCode OK or SERIAL_RD_FAILED.
+ */
+Stm32BootClient::ErrorCode Stm32FaultInjector::read( uint8_t * _dst, size_t _size, size_t * _read ) {
+    configASSERT(_dst);
+    auto err = Stm32BootClient::ErrorCode::OK;
+    std::vector<uint8_t> buf;
+    if (draw(Fault::Reset))
+        reset();
+    buf.swap(m_late);
+    if (buf.size() < _size) {
+        size_t have = buf.size();
+        buf.resize(_size);
+        buf.resize(have + m_target.read(&buf[have], _size - have));
+    }
+    mangle(buf);
+    size_t ack = findAck(buf);
+    if (ack < buf.size() && draw(Fault::Nack)) {
+        buf[( m_variant == ProtocolVariant::Can ) ? ack + offsetof(Stm32BootClient::CanFrame_t, data) : ack] = NACK_CODE;
+    } else if (ack < buf.size() && draw(Fault::DelayAck)) {
+        m_late.assign(buf.begin() + static_cast<long>(ack), buf.end());
+        buf.resize(ack);
+    }
+    if (buf.size() > _size) {
+        m_late.insert(m_late.begin(), buf.begin() + static_cast<long>(_size), buf.end());
+        buf.resize(_size);
+    }
+    if (buf.size() >= m_unit && draw(Fault::Disconnect)) {
+        buf.resize(pick(buf.size() / m_unit) * m_unit);
+        err = Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
+    }
+    if (m_variant == ProtocolVariant::Spi) {
+        buf.resize(_size, SPI_DUMMY_CODE); // the master clocks what it asks for
+    } else if (buf.size() < _size) {
+        m_target.addDelay(m_readTimeoutMs);
+    }
+    if (!buf.empty())
+        memcpy(_dst, buf.data(), buf.size());
+    if (_read)
+        *_read = buf.size();
+    return err;
+}
+void Stm32FaultInjector::flush() {
+    m_target.flush();
+    m_late.clear();
+}
+/// RESET line or a reset fault: the target starts over and nothing in flight arrives
+void Stm32FaultInjector::reset() {
+    m_target.reset();
+    m_late.clear();
+}
+const char * Stm32FaultInjector::fault2String( Fault _fault ) {
+    static const char * const s_names[FAULT_COUNT] = {"drop", "duplicate", "corrupt", "nack", "delay", "disconnect", "reset"};
+    return s_names[static_cast<size_t>(_fault)];
+}
+bool Stm32FaultInjector::draw( Fault _fault ) {
+    size_t index = static_cast<size_t>(_fault);
+    bool hit = m_rates.perMille[index] && std::uniform_int_distribution<uint32_t>(0, PERMILLE - 1)(m_random) < m_rates.perMille[index];
+    if (hit)
+        m_injected[index]++;
+    return hit;
+}
+size_t Stm32FaultInjector::pick( size_t _count ) {
+    return std::uniform_int_distribution<size_t>(0, _count - 1)(m_random);
+}
+/// Drop, duplicate and corrupt faults on a transfer
+void Stm32FaultInjector::mangle( std::vector<uint8_t> &_buf ) {
+    size_t units = _buf.size() / m_unit;
+    if (units && draw(Fault::Drop)) {
+        auto at = _buf.begin() + static_cast<long>(pick(units) * m_unit);
+        _buf.erase(at, at + static_cast<long>(m_unit));
+        units--;
+    }
+    if (units && draw(Fault::Duplicate)) {
+        size_t at = pick(units) * m_unit;
+        std::vector<uint8_t> unit(_buf.begin() + static_cast<long>(at), _buf.begin() + static_cast<long>(at + m_unit));
+        _buf.insert(_buf.begin() + static_cast<long>(at), unit.begin(), unit.end());
+    }
+    if (!_buf.empty() && draw(Fault::Corrupt))
+        _buf[pick(_buf.size())] ^= static_cast<uint8_t>(1u << pick(8));
+}
+/*!
+ * Function: findAck
+ * @return size_t offset of the first ACK byte, on CAN of the first one byte
+ * frame carrying it, _buf.size() if there is none.
+ */
+size_t Stm32FaultInjector::findAck( const std::vector<uint8_t> &_buf ) const {
+    size_t at = 0;
+    for ( ; at + m_unit <= _buf.size(); at += m_unit ) {
+        if (m_variant == ProtocolVariant::Can) {
+            Stm32BootClient::CanFrame_t frame;
+            memcpy(&frame, &_buf[at], sizeof( frame ));
+            if (frame.dlc == 1 && frame.data[0] == ACK_CODE)
+                break;
+        } else if (_buf[at] == ACK_CODE) {
+            break;
+        }
+    }
+    return std::min(at, _buf.size());
+}
+/*!
+ * Function: parse
+ * Reads a campaign spec: comma separated name=value pairs, the fault names of
+ * fault2String() with per mille rates, runs, seed and timeout (ms).
+ *
+ * @return bool false on an unknown name or a missing value.
+ */
+bool Stm32FaultCampaign::parse( const std::string &_spec, Config_t &_config ) {
+    bool ok = true;
+    memset(&_config.rates, 0, sizeof( _config.rates ));
+    _config.runs = DEFAULT_RUNS;
+    _config.seed = 1;
+    _config.readTimeoutMs = DEFAULT_READ_TIMEOUT_MS;
+    size_t pos = 0;
+    while (ok && pos < _spec.size()) {
+        size_t end = _spec.find(',', pos);
+        std::string item = _spec.substr(pos, ( end == std::string::npos ) ? std::string::npos : end - pos);
+        size_t eq = item.find('=');
+        ok = eq != std::string::npos && eq + 1 < item.size();
+        if (ok) {
+            std::string name = item.substr(0, eq);
+            uint32_t value = static_cast<uint32_t>(strtoul(item.c_str() + eq + 1, nullptr, 0));
+            if (name == "runs") {
+                _config.runs = value;
+            } else if (name == "seed") {
+                _config.seed = value;
+            } else if (name == "timeout") {
+                _config.readTimeoutMs = value;
+            } else {
+                ok = false;
+                for ( size_t i = 0; i < Stm32FaultInjector::FAULT_COUNT; i++ ) {
+                    if (name == Stm32FaultInjector::fault2String(static_cast<Stm32FaultInjector::Fault>(i))) {
+                        _config.rates.perMille[i] = std::min(value, PERMILLE);
+                        ok = true;
+                    }
+                }
+            }
+        }
+        pos = ( end == std::string::npos ) ? _spec.size() : end + 1;
+    }
+    return ok;
+}
+/*!
+ * Function: run
+ * Syncs over a clean link, then runs the commands _config.runs times with the
+ * faults on.
+ *
+ * @return bool true if every command recovered and nothing came back wrong.
+ */
+template<Stm32BootClient::ProtocolVariant Variant>
+bool Stm32FaultCampaign::run( const Config_t &_config, std::ostream &_out ) {
+    typedef Stm32BootFaultIo<Variant> Io;
+    typedef Stm32BootClientT<Io> Client;
+    Stm32JobPlan::FlashTiming_t timing;
+    Stm32JobPlan::findFlashTiming(Stm32BootClient::chipId2McuType(Stm32JobPlan::DEFAULT_CHIP_ID), timing);
+    Stm32JobPlan::LinkProfile_t link = Stm32JobPlan::linkProfile(Variant, 0, false);
+    Stm32MockTarget & target = Io::target();
+    Stm32FaultInjector & injector = Io::injector();
+    Stm32FaultInjector::Rates_t clean;
+    memset(&clean, 0, sizeof( clean ));
+    target = Stm32MockTarget(Variant, Stm32JobPlan::DEFAULT_CHIP_ID, timing.flashSize);
+    injector.setRates(clean);
+    injector.setSeed(_config.seed);
+    injector.setReadTimeout(_config.readTimeoutMs);
+    _out << "Fault campaign: " << link.name << " at " << link.bitRate << " bit/s, " << _config.runs << " runs, seed " <<
+        _config.seed << ", read timeout " << _config.readTimeoutMs << " ms." << std::endl;
+    if (Client::checkMcuPresence() != Stm32BootClient::ErrorCode::ACK_OK || Client::negotiateCaps() != Stm32BootClient::ErrorCode::OK) {
+        _out << "No session over the clean link." << std::endl;
+        return false;
+    }
+    std::vector<Result_t> results(OP_COUNT);
+    injector.setRates(_config.rates);
+    injector.resetCounts();
+    for ( uint32_t run = 0; run < _config.runs; run++ ) {
+        for ( size_t op = 0; op < OP_COUNT; op++ ) {
+            Result_t & result = results[op];
+            bool wrong = false;
+            uint8_t salt = static_cast<uint8_t>(run);
+            target.resetStats();
+            auto err = execute<Client>(static_cast<Op>(op), target, salt, wrong);
+            uint64_t spentUs = Stm32JobPlan::estimate(target.stats(), link, timing).totalUs();
+            uint32_t tries = 0;
+            result.runs++;
+            if (err == Stm32BootClient::ErrorCode::OK) {
+                result.firstTry++;
+                result.cleanUs += spentUs;
+            }
+            while (err != Stm32BootClient::ErrorCode::OK && tries++ < MAX_RECOVERY_TRIES) {
+                target.resetStats();
+                err = Client::checkMcuPresence();
+                if (err == Stm32BootClient::ErrorCode::ACK_OK)
+                    err = Client::negotiateCaps();
+                if (err == Stm32BootClient::ErrorCode::OK)
+                    err = execute<Client>(static_cast<Op>(op), target, salt, wrong);
+                spentUs += Stm32JobPlan::estimate(target.stats(), link, timing).totalUs();
+                if (err == Stm32BootClient::ErrorCode::OK) {
+                    result.recovered++;
+                    result.recoveryUs.push_back(spentUs);
+                }
+            }
+            if (err != Stm32BootClient::ErrorCode::OK)
+                result.lost++;
+            if (wrong)
+                result.wrong++;
+        }
+    }
+    _out << "Faults per mille of transfers, injected:";
+    for ( size_t i = 0; i < Stm32FaultInjector::FAULT_COUNT; i++ ) {
+        Stm32FaultInjector::Fault fault = static_cast<Stm32FaultInjector::Fault>(i);
+        _out << " " << Stm32FaultInjector::fault2String(fault) << " " << _config.rates.perMille[i] << " x" << injector.injected(fault);
+    }
+    _out << std::endl;
+    bool ok = true;
+    for ( size_t op = 0; op < OP_COUNT; op++ ) {
+        print(results[op], static_cast<Op>(op), _out);
+        ok = ok && !results[op].lost && !results[op].wrong;
+    }
+    return ok;
+}
+/*!
+ * Function: execute
+ * Sends one command of the campaign and checks its result against the target
+ * memory. Erase and write start from a page prepared behind the link's back,
+ * so an earlier failure doesn't show up as a later wrong result.
+ *
+ * @param _salt varies the written data from run to run.
+ * @param _wrong set if the command succeeded with a wrong result.
+ *
+ * @return Stm32BootClient::ErrorCode OK on success.
+ */
+template<class Client>
+Stm32BootClient::ErrorCode Stm32FaultCampaign::execute( Op _op, Stm32MockTarget &_target, uint8_t _salt, bool &_wrong ) {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    Stm32BootClient::McuDescription_t descr = Client::mcuType2Description(Stm32BootClient::chipId2McuType(Stm32JobPlan::DEFAULT_CHIP_ID));
+    size_t offset = static_cast<size_t>(CAMPAIGN_PAGE) * descr.flashPageSize;
+    uint8_t * page = &_target.flash()[offset];
+    uint8_t data[Stm32BootClient::MAX_WRITE_BLOCK_SIZE];
+    _wrong = false;
+    switch (_op) {
+    case Op::Get: {
+        Stm32BootClient::CommandGetResponse_t resp;
+        err = Client::commandGet(resp);
+        break;
+    }
+    case Op::GvRps: {
+        Stm32BootClient::CommandGvRpsResponse_t resp;
+        err = Client::commandGvRps(resp);
+        break;
+    }
+    case Op::GetId: {
+        Stm32BootClient::CommandGetIdResponse_t resp;
+        err = Client::commandGetId(resp);
+        _wrong = err == Stm32BootClient::ErrorCode::OK && resp.getId() != Stm32JobPlan::DEFAULT_CHIP_ID;
+        break;
+    }
+    case Op::ErasePage: {
+        uint16_t pageNum = CAMPAIGN_PAGE;
+        std::fill(page, page + descr.flashPageSize, 0);
+        err = Client::erasePages(&pageNum, 1);
+        _wrong = err == Stm32BootClient::ErrorCode::OK && std::count(page, page + descr.flashPageSize, 0xff) != descr.flashPageSize;
+        break;
+    }
+    case Op::WriteMemory:
+        for ( size_t i = 0; i < sizeof( data ); i++ )
+            data[i] = static_cast<uint8_t>(i * 31 + _salt);
+        std::fill(page, page + descr.flashPageSize, 0xff);
+        err = Client::writeMemory(data, descr.flashBegin + static_cast<uint32_t>(offset), sizeof( data ));
+        _wrong = err == Stm32BootClient::ErrorCode::OK && memcmp(page, data, sizeof( data )) != 0;
+        break;
+    case Op::ReadMemory:
+        err = Client::commandReadMemory(data, descr.flashBegin + static_cast<uint32_t>(offset), sizeof( data ));
+        _wrong = err == Stm32BootClient::ErrorCode::OK && memcmp(page, data, sizeof( data )) != 0;
+        break;
+    }
+    return err;
+}
+const char * Stm32FaultCampaign::op2String( Op _op ) {
+    static const char * const s_names[OP_COUNT] = {"Get", "GvRps", "GetId", "Erase", "WriteMemory", "ReadMemory"};
+    return s_names[static_cast<size_t>(_op)];
+}
+/// One line per command: success rate, outcome counts, clean and recovery time
+void Stm32FaultCampaign::print( const Result_t &_result, Op _op, std::ostream &_out ) {
+    std::vector<uint64_t> sorted(_result.recoveryUs);
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t sum = 0;
+    for ( auto us : sorted )
+        sum += us;
+    uint32_t succeeded = _result.firstTry + _result.recovered;
+    _out << op2String(_op) << ": " << _result.runs << " runs, success " <<
+        ( _result.runs ? succeeded * 100u / _result.runs : 0 ) << "%, " << _result.firstTry << " first try, " <<
+        _result.recovered << " recovered, " << _result.lost << " lost, " << _result.wrong << " wrong; clean " <<
+        ( _result.firstTry ? _result.cleanUs / _result.firstTry : 0 ) << " us";
+    if (!sorted.empty()) {
+        _out << ", recovery mean " << sum / sorted.size() / 1000 << " ms, p95 " << sorted[( sorted.size() - 1 ) * 95 / 100] / 1000 <<
+            " ms, max " << sorted.back() / 1000 << " ms";
+    }
+    _out << "." << std::endl;
+}
+/// The clients over the lossy link and the campaign for each protocol variant
+template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::Usart>>;
+template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::I2c>>;
+template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::Spi>>;
+template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::Can>>;
+template bool Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::Usart>( const Config_t &, std::ostream & );
+template bool Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::I2c>( const Config_t &, std::ostream & );
+template bool Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::Spi>( const Config_t &, std::ostream & );
+template bool Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::Can>( const Config_t &, std::ostream & );
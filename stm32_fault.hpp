@@ -0,0 +1,162 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_mock_target.hpp"
+#include "stm32_plan.hpp"
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+/*!
+ * Host side only: a lossy link between the client and a Stm32MockTarget.
+ * Every write() and read() of the client may drop, duplicate or corrupt a byte
+ * (a frame on CAN), turn an ACK into a NACK, hold a reply back past the read
+ * timeout, break off mid-frame with an IO error or reset the target, each with
+ * its own probability. A short read is charged the read timeout in the target
+ * statistics, so Stm32JobPlan prices what a fault costs on a real link.
+ */
+class Stm32FaultInjector {
+public:
+    typedef Stm32BootClient::ProtocolVariant ProtocolVariant;
+    enum class Fault : uint8_t {
+        Drop,
+        Duplicate,
+        Corrupt,
+        Nack,
+        DelayAck,
+        Disconnect,
+        Reset,
+    };
+    static const size_t FAULT_COUNT = 7;
+    /// Per mille of the transfers
+    typedef struct Rates_t {
+        uint32_t perMille[FAULT_COUNT];
+    }
+    Rates_t;
+    Stm32FaultInjector( Stm32MockTarget &_target, ProtocolVariant _variant );
+    void setRates( const Rates_t &_rates ) {
+        m_rates = _rates;
+    }
+    void setSeed( uint32_t _seed ) {
+        m_random.seed(_seed);
+    }
+    void setReadTimeout( uint32_t _ms ) {
+        m_readTimeoutMs = _ms;
+    }
+    uint32_t injected( Fault _fault ) const {
+        return m_injected[static_cast<size_t>(_fault)];
+    }
+    void resetCounts();
+    Stm32BootClient::ErrorCode write( const uint8_t * _src, size_t _size, size_t * _written );
+    Stm32BootClient::ErrorCode read( uint8_t * _dst, size_t _size, size_t * _read );
+    void flush();
+    void reset();
+    static const char * fault2String( Fault _fault );
+private:
+    bool draw( Fault _fault );
+    size_t pick( size_t _count );
+    void mangle( std::vector<uint8_t> &_buf );
+    size_t findAck( const std::vector<uint8_t> &_buf ) const;
+    Stm32MockTarget & m_target;
+    ProtocolVariant m_variant;
+    size_t m_unit;                  /// a byte, on CAN a CanFrame_t record
+    Rates_t m_rates;
+    std::mt19937 m_random;
+    uint32_t m_readTimeoutMs;
+    std::vector<uint8_t> m_late;    /// reply bytes held back for the next read
+    uint32_t m_injected[FAULT_COUNT];
+};
+/*!
+ * Transport policy for Stm32BootClientT: Stm32BootMockIo with a
+ * Stm32FaultInjector in the way. It shares the target of Stm32BootMockIo.
+ */
+template<Stm32BootClient::ProtocolVariant Variant>
+class Stm32BootFaultIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Variant;
+    static Stm32MockTarget & target() {
+        return Stm32BootMockIo<Variant>::target();
+    }
+    static Stm32FaultInjector & injector() {
+        static Stm32FaultInjector s_injector(target(), Variant);
+        return s_injector;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        return injector().write(static_cast<const uint8_t *>(_src), _size, _written);
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        return injector().read(static_cast<uint8_t *>(_dst), _size, _read);
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        injector().flush();
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static void setResetLine( bool _level ) {
+        if (!_level)
+            injector().reset();
+    }
+    static void setBootLine( bool ) {}
+    static void delay( uint32_t _delay ) {
+        target().addDelay(_delay);
+    }
+    /// Counts the read timeouts charged to the target as well
+    static uint32_t getTickMs() {
+        return Stm32BootMockIo<Variant>::getTickMs();
+    }
+};
+extern template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::Usart>>;
+extern template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::I2c>>;
+extern template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::Spi>>;
+extern template class Stm32BootClientT<Stm32BootFaultIo<Stm32BootClient::ProtocolVariant::Can>>;
+/*!
+ * Host side only: recovery measurement (--faults). Every run sends each
+ * command once over the lossy link. When it fails the host does what a
+ * flasher does: resets the target, syncs, negotiates the session again and
+ * retries, up to MAX_RECOVERY_TRIES times. Per command it reports how often it
+ * succeeded and what recovery cost, priced like --plan prices a job; results
+ * which came back OK but differ from the target memory are counted as wrong.
+ */
+class Stm32FaultCampaign {
+public:
+    enum class Op : uint8_t {
+        Get,
+        GvRps,
+        GetId,
+        ErasePage,
+        WriteMemory,
+        ReadMemory,
+    };
+    static const size_t OP_COUNT = 6;
+    static const uint32_t MAX_RECOVERY_TRIES = 5;
+    typedef struct Config_t {
+        Stm32FaultInjector::Rates_t rates;
+        uint32_t runs;
+        uint32_t seed;
+        uint32_t readTimeoutMs;
+    }
+    Config_t;
+    typedef struct Result_t {
+        uint32_t runs;
+        uint32_t firstTry;              /// succeeded without recovery
+        uint32_t recovered;
+        uint32_t lost;                  /// still failing after MAX_RECOVERY_TRIES
+        uint32_t wrong;                 /// OK but the data doesn't match the target
+        uint64_t cleanUs;               /// sum over the first try successes
+        std::vector<uint64_t> recoveryUs;   /// from the failed try to the success
+    }
+    Result_t;
+    static bool parse( const std::string &_spec, Config_t &_config );
+    template<Stm32BootClient::ProtocolVariant Variant>
+    static bool run( const Config_t &_config, std::ostream &_out );
+    static const char * op2String( Op _op );
+private:
+    template<class Client>
+    static Stm32BootClient::ErrorCode execute( Op _op, Stm32MockTarget &_target, uint8_t _salt, bool &_wrong );
+    static void print( const Result_t &_result, Op _op, std::ostream &_out );
+};
+#endif
@@ -0,0 +1,111 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "stm32_io.hpp"
+#include "included_macro.hpp"
+#include <string.h>
+/*!
+ * Handoff from the bootloader to the application with Go instead of a reset:
+ * no RESET pulse, no BOOT0 toggling and no reset delays. Go takes the initial
+ * stack pointer from the address and the reset handler from the word after
+ * it, so the address is the vector table: flashBegin of the family for a
+ * flash image, the load address for a RAM stub. The bootloader ACKs the
+ * address before it jumps; the application may then be confirmed by waiting
+ * for its alive banner on the USART, bytes it sends right after start-up
+ * while reinitialising the port are skipped. Like the core it never
+ * allocates and throws nothing.
+ */
+template<class Client>
+class Stm32Handoff {
+public:
+    typedef Stm32BootBase::ErrorCode ErrorCode;
+    typedef typename Client::Transport Io;
+    static const size_t MAX_BANNER = 64;
+    typedef struct Result_t {
+        uint32_t goMs;              /// Go sent until the jump was acknowledged
+        uint32_t aliveMs;           /// Go sent until the banner was seen
+        uint32_t skipped;           /// bytes received before the banner
+        bool alive;                 /// the banner was seen
+    }
+    Result_t;
+    static uint32_t applicationAddress( Stm32BootBase::McuType _type );
+    static ErrorCode go( uint32_t _addr, const uint8_t * _banner, size_t _size, uint32_t _timeoutMs, Result_t &_result );
+    static ErrorCode readByte( uint8_t &_byte, uint32_t _start, uint32_t _timeoutMs );
+};
+/*!
+ * Function: applicationAddress
+ * @return uint32_t the vector table of a flash image on the family.
+ */
+template<class Client>
+uint32_t Stm32Handoff<Client>::applicationAddress( Stm32BootBase::McuType _type ) {
+    return Client::mcuType2Description(_type).flashBegin;
+}
+/*!
+ * Function: go
+ * Starts the application and optionally waits for its banner. The session
+ * ends with the acknowledged Go.
+ *
+ * @param _addr vector table of the application, see applicationAddress().
+ * @param _banner bytes the application sends once it runs, nullptr not to wait.
+ * @param _size of the banner, up to MAX_BANNER; USART only.
+ * @param _timeoutMs how long after Go the banner may take, the read timeout
+ *        of the transport comes on top of it.
+ * @param _result timing of the handoff.
+ *
+ * @return Stm32BootClient::ErrorCode SERIAL_RD_SIZE if the banner didn't come.
+ */
+template<class Client>
+typename Stm32Handoff<Client>::ErrorCode Stm32Handoff<Client>::go( uint32_t _addr, const uint8_t * _banner, size_t _size,
+                                                                  uint32_t _timeoutMs, Result_t &_result ) {
+    uint32_t start = Stm32BootLowIo::getTickMs();
+    bool wait = _banner && _size;
+    ErrorCode err = ErrorCode::OK;
+    memset(&_result, 0, sizeof( _result ));
+    if (wait && ( _size > MAX_BANNER || Io::PROTOCOL_VARIANT != Stm32BootBase::ProtocolVariant::Usart ))
+        err = ErrorCode::FAILED;
+    if (err == ErrorCode::OK)
+        err = Client::commandGo(_addr);
+    _result.goMs = Stm32BootLowIo::getTickMs() - start;
+    if (err == ErrorCode::OK && wait) {
+        uint8_t window[MAX_BANNER];
+        size_t seen = 0;
+        bool found = false;
+        while (!found && err == ErrorCode::OK) {
+            uint8_t byte;
+            err = readByte(byte, start, _timeoutMs);
+            if (err == ErrorCode::OK) {
+                if (seen == _size)
+                    memmove(window, window + 1, _size - 1);
+                else
+                    seen++;
+                window[seen - 1] = byte;
+                _result.skipped++;
+                found = seen == _size && memcmp(window, _banner, _size) == 0;
+            }
+        }
+        if (found) {
+            _result.alive = true;
+            _result.skipped -= static_cast<uint32_t>(_size);
+            _result.aliveMs = Stm32BootLowIo::getTickMs() - start;
+        }
+    }
+    return err;
+}
+/*!
+ * Function: readByte
+ * Reads one byte of whatever runs on the target now, timeouts of the link
+ * only mean it has nothing to say yet.
+ *
+ * @param _start getTickMs() the deadline counts from.
+ *
+ * @return Stm32BootClient::ErrorCode SERIAL_RD_SIZE after _timeoutMs.
+ */
+template<class Client>
+typename Stm32Handoff<Client>::ErrorCode Stm32Handoff<Client>::readByte( uint8_t &_byte, uint32_t _start, uint32_t _timeoutMs ) {
+    size_t rd = 0;
+    do {
+        Io::read(&_byte, 1, &rd);
+    } while (rd != 1 && Stm32BootLowIo::getTickMs() - _start < _timeoutMs);
+    return ( rd == 1 ) ? ErrorCode::OK : ErrorCode::SERIAL_RD_SIZE;
+}
+#endif
@@ -0,0 +1,305 @@
+/*!
+/brief Firmware image parser and flat index used by the host tools.
+*/
+#include "stm32_image.hpp"
+#include "included_macro.hpp"
+#include <algorithm>
+#include <string.h>
+
+static const char s_indexMagic[8] = {'S', '3', '2', 'I', 'M', 'G', 'X', '\0'};
+
+static size_t alignUp( size_t _value, size_t _align ) {
+    return ( _value + _align - 1 ) / _align * _align;
+}
+Stm32ImageIndex::Stm32ImageIndex()
+    : m_data(nullptr)
+    , m_size(0) {}
+/*!
+ * Function: attach
+ * Uses external memory (mapped file for instance) as the index. The memory must
+ * outlive the object.
+ *
+ * @param _data pointer to the index.
+ * @param _size size of the index.
+ *
+ * @return bool true if the index is consistent.
+ */
+bool Stm32ImageIndex::attach( const uint8_t * _data, size_t _size ) {
+    m_data = _data;
+    m_size = _size;
+    if (!isValid()) {
+        m_data = nullptr;
+        m_size = 0;
+    }
+    return m_data != nullptr;
+}
+/*!
+ * Function: adopt
+ * Takes the content of the buffer as the index, the buffer is left empty.
+ *
+ * @param _buffer built index.
+ */
+void Stm32ImageIndex::adopt( std::vector<uint8_t> &_buffer ) {
+    m_own.swap(_buffer);
+    _buffer.clear();
+    attach(m_own.data(), m_own.size());
+}
+/*!
+ * Function: isValid
+ * An index mapped from a shared cache directory may be truncated or corrupt,
+ * so every table and all the segment data must lie within the index, and the
+ * page ranges within the address space, before anything is read through them.
+ *
+ * @return bool true if the index can be used.
+ */
+bool Stm32ImageIndex::isValid() const {
+    bool result = m_data && m_size >= sizeof( Header_t );
+    if (result) {
+        const Header_t & hdr = header();
+        uint64_t tables = sizeof( Header_t ) + static_cast<uint64_t>(hdr.segmentCount) * sizeof( Segment_t ) +
+            static_cast<uint64_t>(hdr.geometryCount) * sizeof( Geometry_t );
+        result = !memcmp(hdr.magic, s_indexMagic, sizeof( s_indexMagic )) && hdr.version == VERSION && hdr.totalSize == m_size &&
+            tables <= m_size;
+        for ( uint32_t i = 0; i < hdr.segmentCount && result; i++ ) {
+            const Segment_t & seg = segment(i);
+            result = seg.dataOffset >= tables && seg.dataOffset + ( seg.size + 3ull ) / 4 * 4 <= m_size &&
+                seg.addr + static_cast<uint64_t>(seg.size) <= 0x100000000ull;
+        }
+        const Geometry_t * geo = reinterpret_cast<const Geometry_t *>(m_data + sizeof( Header_t ) +
+            hdr.segmentCount * sizeof( Segment_t ));
+        for ( uint32_t i = 0; i < hdr.geometryCount && result; i++ ) {
+            result = geo[i].pageSize &&
+                geo[i].firstPage + static_cast<uint64_t>(geo[i].pageCount) <= ( 0x100000000ull - geo[i].flashBegin ) / geo[i].pageSize;
+        }
+    }
+    return result;
+}
+const Stm32ImageIndex::Header_t & Stm32ImageIndex::header() const {
+    configASSERT(m_data);
+    return *reinterpret_cast<const Header_t *>(m_data);
+}
+const Stm32ImageIndex::Segment_t & Stm32ImageIndex::segment( size_t _idx ) const {
+    configASSERT(_idx < header().segmentCount);
+    return reinterpret_cast<const Segment_t *>(m_data + sizeof( Header_t ))[_idx];
+}
+const uint8_t * Stm32ImageIndex::segmentData( size_t _idx ) const {
+    return m_data + segment(_idx).dataOffset;
+}
+const Stm32ImageIndex::Geometry_t * Stm32ImageIndex::findGeometry( uint32_t _flashBegin, uint32_t _pageSize ) const {
+    const Geometry_t * geo = reinterpret_cast<const Geometry_t *>(m_data + sizeof( Header_t ) +
+        header().segmentCount * sizeof( Segment_t ));
+    const Geometry_t * result = nullptr;
+    for ( uint32_t i = 0; i < header().geometryCount && !result; i++ ) {
+        if (geo[i].flashBegin == _flashBegin && geo[i].pageSize == _pageSize)
+            result = &geo[i];
+    }
+    return result;
+}
+uint64_t Stm32ImageIndex::fnv1a64( const void * _src, size_t _size, uint64_t _hash ) {
+    const uint8_t * p = static_cast<const uint8_t *>(_src);
+    while (_size--) {
+        _hash ^= *p++;
+        _hash *= 0x100000001b3ull;
+    }
+    return _hash;
+}
+bool Stm32Image::isHexName( const std::string &_fname ) {
+    std::string ext;
+    size_t dot = _fname.rfind('.');
+    if (dot != std::string::npos) {
+        ext = _fname.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    }
+    return ext == "hex" || ext == "ihex";
+}
+const std::vector<Stm32Image::Segment_t> & Stm32Image::segments() const {
+    return m_segments;
+}
+/*!
+ * Function: parse
+ * Parses file content into the list of segments sorted by address.
+ *
+ * @param _file file content.
+ * @param _isHex true for Intel HEX, raw binary otherwise.
+ * @param _binBase where a raw binary is placed.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32Image::parse( const std::vector<uint8_t> &_file, bool _isHex, uint32_t _binBase ) {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    m_segments.clear();
+    if (_isHex) {
+        err = parseHex(_file);
+    } else if (!_file.empty()) {
+        addData(_binBase, _file.data(), _file.size());
+    }
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        mergeSegments();
+    }
+    return err;
+}
+static int hexNibble( uint8_t _c ) {
+    int result = -1;
+    if (_c >= '0' && _c <= '9')
+        result = _c - '0';
+    else if (_c >= 'a' && _c <= 'f')
+        result = _c - 'a' + 10;
+    else if (_c >= 'A' && _c <= 'F')
+        result = _c - 'A' + 10;
+    return result;
+}
+Stm32BootClient::ErrorCode Stm32Image::parseHex( const std::vector<uint8_t> &_file ) {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    uint32_t base = 0;
+    bool eof = false;
+    size_t pos = 0;
+    while (pos < _file.size() && !eof && err == Stm32BootClient::ErrorCode::OK) {
+        uint8_t c = _file[pos++];
+        if (c != ':')
+            continue; // line endings and garbage between records
+        uint8_t rec[4 + 255 + 1];
+        size_t len = 0;
+        while (pos + 1 < _file.size() && len < sizeof( rec )) {
+            int hi = hexNibble(_file[pos]);
+            int lo = hexNibble(_file[pos + 1]);
+            if (hi < 0 || lo < 0)
+                break;
+            rec[len++] = static_cast<uint8_t>(( hi << 4 ) | lo);
+            pos += 2;
+        }
+        uint8_t sum = 0;
+        for ( size_t i = 0; i < len; i++ ) {
+            sum = static_cast<uint8_t>(sum + rec[i]);
+        }
+        if (len < 5 || len != static_cast<size_t>(rec[0]) + 5 || sum != 0) {
+            err = Stm32BootClient::ErrorCode::FILE_FAILED;
+        } else {
+            uint32_t offset = static_cast<uint32_t>(( rec[1] << 8 ) | rec[2]);
+            switch (rec[3]) {
+            case 0x00:
+                addData(base + offset, &rec[4], rec[0]);
+                break;
+            case 0x01:
+                eof = true;
+                break;
+            case 0x02:
+                base = static_cast<uint32_t>(( rec[4] << 8 ) | rec[5]) << 4;
+                break;
+            case 0x04:
+                base = static_cast<uint32_t>(( rec[4] << 8 ) | rec[5]) << 16;
+                break;
+            default:
+                break; // start address records are not needed
+            }
+        }
+    }
+    return err;
+}
+void Stm32Image::addData( uint32_t _addr, const uint8_t * _src, size_t _size ) {
+    if (!m_segments.empty()) {
+        Segment_t & last = m_segments.back();
+        if (last.addr + last.data.size() == _addr) {
+            last.data.insert(last.data.end(), _src, _src + _size);
+            return;
+        }
+    }
+    Segment_t seg;
+    seg.addr = _addr;
+    seg.data.assign(_src, _src + _size);
+    m_segments.push_back(seg);
+}
+/*!
+ * Function: mergeSegments
+ * Sorts segments and joins touching or overlapping ones, later data wins.
+ */
+void Stm32Image::mergeSegments() {
+    std::stable_sort(m_segments.begin(), m_segments.end(), []( const Segment_t &_a, const Segment_t &_b ) {
+        return _a.addr < _b.addr;
+    });
+    std::vector<Segment_t> merged;
+    for ( auto & seg : m_segments ) {
+        if (!merged.empty() && merged.back().addr + merged.back().data.size() >= seg.addr) {
+            Segment_t & last = merged.back();
+            size_t offset = seg.addr - last.addr;
+            if (offset + seg.data.size() > last.data.size())
+                last.data.resize(offset + seg.data.size(), 0xff);
+            std::copy(seg.data.begin(), seg.data.end(), last.data.begin() + static_cast<std::ptrdiff_t>(offset));
+        } else {
+            merged.push_back(seg);
+        }
+    }
+    m_segments.swap(merged);
+}
+/*!
+ * Function: buildIndex
+ * Builds the flat index: header, segment table, geometry table and segment
+ * data. There is a geometry for every distinct page layout of the known MCUs.
+ *
+ * @param _key hash of the source the image was parsed from.
+ * @param _index output buffer.
+ */
+void Stm32Image::buildIndex( uint64_t _key, std::vector<uint8_t> &_index ) const {
+    std::vector<Stm32ImageIndex::Geometry_t> geos;
+    for ( size_t t = 0; t < Stm32BootClient::mcuTypeCount(); t++ ) {
+        auto descr = Stm32BootClient::mcuType2Description(static_cast<Stm32BootClient::McuType>(t));
+        bool known = false;
+        for ( auto & g : geos ) {
+            known = known || ( g.flashBegin == descr.flashBegin && g.pageSize == descr.flashPageSize );
+        }
+        if (!known) {
+            Stm32ImageIndex::Geometry_t geo;
+            memset(&geo, 0, sizeof( geo ));
+            geo.flashBegin = descr.flashBegin;
+            geo.pageSize = descr.flashPageSize;
+            geos.push_back(geo);
+        }
+    }
+    size_t size = sizeof( Stm32ImageIndex::Header_t ) + m_segments.size() * sizeof( Stm32ImageIndex::Segment_t ) +
+        geos.size() * sizeof( Stm32ImageIndex::Geometry_t );
+    std::vector<Stm32ImageIndex::Segment_t> segs;
+    uint32_t imageSize = 0;
+    for ( auto & seg : m_segments ) {
+        Stm32ImageIndex::Segment_t rec;
+        rec.addr = seg.addr;
+        rec.size = static_cast<uint32_t>(seg.data.size());
+        rec.dataOffset = static_cast<uint32_t>(size);
+        rec.reserved = 0;
+        imageSize += rec.size;
+        size += alignUp(seg.data.size(), 8);
+        segs.push_back(rec);
+    }
+    for ( auto & geo : geos ) {
+        uint32_t first = 0xffffffff;
+        uint32_t last = 0;
+        for ( auto & seg : m_segments ) {
+            if (seg.addr >= geo.flashBegin && seg.addr - geo.flashBegin < FLASH_SPAN && !seg.data.empty()) {
+                first = std::min(first, ( seg.addr - geo.flashBegin ) / geo.pageSize);
+                last = std::max(last, static_cast<uint32_t>(( seg.addr - geo.flashBegin + seg.data.size() - 1 ) / geo.pageSize));
+            }
+        }
+        geo.firstPage = ( first == 0xffffffff ) ? 0 : first;
+        geo.pageCount = ( first == 0xffffffff ) ? 0 : last - first + 1;
+    }
+    _index.assign(size, 0);
+    Stm32ImageIndex::Header_t hdr;
+    memcpy(hdr.magic, s_indexMagic, sizeof( hdr.magic ));
+    hdr.version = Stm32ImageIndex::VERSION;
+    hdr.segmentCount = static_cast<uint32_t>(segs.size());
+    hdr.geometryCount = static_cast<uint32_t>(geos.size());
+    hdr.imageSize = imageSize;
+    hdr.key = _key;
+    hdr.totalSize = static_cast<uint32_t>(size);
+    hdr.reserved = 0;
+    memcpy(_index.data(), &hdr, sizeof( hdr ));
+    uint8_t * p = _index.data() + sizeof( hdr );
+    if (!segs.empty())
+        memcpy(p, segs.data(), segs.size() * sizeof( segs[0] ));
+    p += segs.size() * sizeof( Stm32ImageIndex::Segment_t );
+    if (!geos.empty())
+        memcpy(p, geos.data(), geos.size() * sizeof( geos[0] ));
+    for ( size_t i = 0; i < segs.size(); i++ ) {
+        uint8_t * dst = _index.data() + segs[i].dataOffset;
+        memset(dst, 0xff, alignUp(segs[i].size, 4));
+        memcpy(dst, m_segments[i].data.data(), segs[i].size);
+    }
+}
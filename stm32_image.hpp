@@ -0,0 +1,78 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include <inttypes.h>
+#include <string>
+#include <vector>
+/*!
+ * Firmware image in the form the client consumes it: a sparse list of segments
+ * plus the range of pages it touches for every known flash geometry. The index
+ * is one flat little-endian buffer with offsets only, so it can be mapped from
+ * a file as is.
+ */
+class Stm32ImageIndex {
+public:
+    static const uint32_t VERSION = 2;
+    typedef struct Header_t {
+        char magic[8];
+        uint32_t version;
+        uint32_t segmentCount;
+        uint32_t geometryCount;
+        uint32_t imageSize;         /// payload bytes in all segments
+        uint64_t key;               /// hash of the source file
+        uint32_t totalSize;         /// size of the whole index
+        uint32_t reserved;
+    }
+    Header_t;
+    typedef struct Segment_t {
+        uint32_t addr;
+        uint32_t size;              /// real size, data is padded with 0xff up to a word
+        uint32_t dataOffset;
+        uint32_t reserved;
+    }
+    Segment_t;
+    typedef struct Geometry_t {
+        uint32_t flashBegin;
+        uint32_t pageSize;
+        uint32_t firstPage;         /// first page touched by the image
+        uint32_t pageCount;         /// pages from firstPage to the last touched one
+    }
+    Geometry_t;
+    Stm32ImageIndex();
+    bool attach( const uint8_t * _data, size_t _size );
+    void adopt( std::vector<uint8_t> &_buffer );
+    bool isValid() const;
+    const Header_t & header() const;
+    const Segment_t & segment( size_t _idx ) const;
+    const uint8_t * segmentData( size_t _idx ) const;
+    const Geometry_t * findGeometry( uint32_t _flashBegin, uint32_t _pageSize ) const;
+    static uint64_t fnv1a64( const void * _src, size_t _size, uint64_t _hash = FNV_OFFSET );
+private:
+    static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+    std::vector<uint8_t> m_own;
+    const uint8_t * m_data;
+    size_t m_size;
+};
+/*!
+ * Parser of .bin and Intel .hex files, builds Stm32ImageIndex.
+ */
+class Stm32Image {
+public:
+    static const uint32_t DEFAULT_BIN_BASE = 0x08000000;
+    typedef struct Segment_t {
+        uint32_t addr;
+        std::vector<uint8_t> data;
+    }
+    Segment_t;
+    Stm32BootClient::ErrorCode parse( const std::vector<uint8_t> &_file, bool _isHex, uint32_t _binBase = DEFAULT_BIN_BASE );
+    void buildIndex( uint64_t _key, std::vector<uint8_t> &_index ) const;
+    const std::vector<Segment_t> & segments() const;
+    static bool isHexName( const std::string &_fname );
+private:
+    static const uint32_t FLASH_SPAN = 0x00100000;
+    Stm32BootClient::ErrorCode parseHex( const std::vector<uint8_t> &_file );
+    void addData( uint32_t _addr, const uint8_t * _src, size_t _size );
+    void mergeSegments();
+    std::vector<Segment_t> m_segments;
+};
+#endif
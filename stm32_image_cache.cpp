@@ -0,0 +1,107 @@
+/*!
+/brief Persistent cache of parsed firmware images.
+*/
+#include "stm32_image_cache.hpp"
+#include "stm32_decompress.hpp"
+#include <fstream>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Stm32ImageCache::Stm32ImageCache( const std::string &_dir )
+    : m_dir(_dir) {}
+Stm32ImageCache::~Stm32ImageCache() {
+    for ( auto & map : m_maps ) {
+        munmap(map.addr, map.size);
+    }
+}
+/*!
+ * Function: load
+ * Loads an image. On a cache hit the index is mapped from the cache directory
+ * and the file is only hashed, on a miss it is parsed and the index is stored.
+ * Without the cache directory the index is always built in memory. The index
+ * stays valid while the cache object exists.
+ *
+ * @param _fname .bin or .hex file, possibly compressed, see Stm32Decompressor.
+ * @param _binBase where a raw binary is placed.
+ * @param _index result.
+ * @param _hit optional, set to true on a cache hit.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32ImageCache::load( const std::string &_fname, uint32_t _binBase, Stm32ImageIndex &_index, bool * _hit ) {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    std::vector<uint8_t> content;
+    if (_hit)
+        *_hit = false;
+    err = Stm32Decompressor::readAll(_fname, content);
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        bool isHex = Stm32Image::isHexName(Stm32Decompressor::plainName(_fname));
+        uint64_t key = Stm32ImageIndex::fnv1a64(&_binBase, sizeof( _binBase ));
+        key = Stm32ImageIndex::fnv1a64(&isHex, sizeof( isHex ), key);
+        key = Stm32ImageIndex::fnv1a64(content.data(), content.size(), key);
+        if (!m_dir.empty() && mapEntry(key, _index)) {
+            if (_hit)
+                *_hit = true;
+        } else {
+            Stm32Image image;
+            err = image.parse(content, isHex, _binBase);
+            if (err == Stm32BootClient::ErrorCode::OK) {
+                std::vector<uint8_t> data;
+                image.buildIndex(key, data);
+                if (!m_dir.empty()) {
+                    storeEntry(key, data); // a failed store only costs the next run a parse
+                }
+                _index.adopt(data);
+                err = _index.isValid() ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+            }
+        }
+    }
+    return err;
+}
+std::string Stm32ImageCache::entryName( uint64_t _key ) const {
+    char name[32];
+    snprintf(name, sizeof( name ), "%016llx.idx", static_cast<unsigned long long>(_key));
+    return m_dir + "/" + name;
+}
+bool Stm32ImageCache::mapEntry( uint64_t _key, Stm32ImageIndex &_index ) {
+    bool result = false;
+    int fd = open(entryName(_key).c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_t size = static_cast<size_t>(st.st_size);
+            void * addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                result = _index.attach(static_cast<const uint8_t *>(addr), size) && _index.header().key == _key;
+                if (result) {
+                    Mapping_t map = {addr, size};
+                    m_maps.push_back(map);
+                } else {
+                    munmap(addr, size);
+                }
+            }
+        }
+        close(fd);
+    }
+    return result;
+}
+Stm32BootClient::ErrorCode Stm32ImageCache::storeEntry( uint64_t _key, const std::vector<uint8_t> &_data ) {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    std::string name = entryName(_key);
+    std::string tmp = name + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(_data.data()), static_cast<std::streamsize>(_data.size()));
+        err = file ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+    }
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        err = ( rename(tmp.c_str(), name.c_str()) == 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+    }
+    if (err != Stm32BootClient::ErrorCode::OK) {
+        remove(tmp.c_str());
+    }
+    return err;
+}
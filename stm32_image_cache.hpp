@@ -0,0 +1,30 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_image.hpp"
+#include <string>
+#include <vector>
+/*!
+ * Content-addressed cache of image indexes. The key is a hash of the source
+ * file, entries are files <key>.idx in the cache directory, published with an
+ * atomic rename so several stations can share one directory.
+ */
+class Stm32ImageCache {
+public:
+    explicit Stm32ImageCache( const std::string &_dir = std::string() );
+    ~Stm32ImageCache();
+    Stm32BootClient::ErrorCode load( const std::string &_fname, uint32_t _binBase, Stm32ImageIndex &_index, bool * _hit = nullptr );
+private:
+    Stm32ImageCache( const Stm32ImageCache & );
+    Stm32ImageCache & operator=( const Stm32ImageCache & );
+    typedef struct Mapping_t {
+        void * addr;
+        size_t size;
+    }
+    Mapping_t;
+    std::string entryName( uint64_t _key ) const;
+    bool mapEntry( uint64_t _key, Stm32ImageIndex &_index );
+    Stm32BootClient::ErrorCode storeEntry( uint64_t _key, const std::vector<uint8_t> &_data );
+    std::string m_dir;
+    std::vector<Mapping_t> m_maps;
+};
+#endif
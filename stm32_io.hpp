@@ -2,6 +2,7 @@
 #ifdef __cplusplus
 #include "stm32_boot_client.hpp"
 #include "included_macro.hpp"
+#include "stm32_trace.hpp"
 #include <inttypes.h>
 
 class Stm32BootLowIo {
@@ -11,23 +12,81 @@ public:
         Bus0,
         Bus1
     };
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Stm32BootClient::ProtocolVariant::Usart;
     static Stm32BootClient::ErrorCode init();
     static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr );
     static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr );
     static Stm32BootClient::ErrorCode deinit();
     static Stm32BootClient::ErrorCode flush();
+    /// PC only: waits up to the read timeout for a byte, then takes what has arrived, for Stm32BootRxThreadIo
+    static Stm32BootClient::ErrorCode readSome( void * _dst, size_t _size, size_t * _read );
     static void setResetLine( bool _level );
     static void setBootLine( bool _level );
     static void delay( uint32_t _delay );
     static void setSerialBus( Bus _code );
+    static Bus getSerialBus();
     static int getCurrentBusIdx();
+    /// The same on a given bus, for hosts with several (Stm32BootBusIo), the selected one is left alone
+    static Stm32BootClient::ErrorCode init( Bus _bus );
+    static Stm32BootClient::ErrorCode write( Bus _bus, const void * _src, size_t _size, size_t * _written );
+    static Stm32BootClient::ErrorCode read( Bus _bus, void * _dst, size_t _size, size_t * _read );
+    static Stm32BootClient::ErrorCode flush( Bus _bus );
+    static void setResetLine( Bus _bus, bool _level );
+    static void setBootLine( Bus _bus, bool _level );
+    static uint32_t getTickMs();
     static void reset() {
         setResetLine(false);
-        delayMs(10); // no, its not a magic, it's physics!
+        delay(10); // no, its not a magic, it's physics!
         setResetLine(true);
     }
 protected:
 private:
     static Bus m_bus;
 };
+/*!
+ * Transport policy for Stm32BootClientT bound to one bus of Stm32BootLowIo.
+ * Each bus gets its own client with its own session, so the buses can be
+ * driven at the same time (Stm32BusScheduler) and switching between them
+ * re-initialises nothing. init() opens only this bus.
+ */
+template<Stm32BootLowIo::Bus B>
+class Stm32BootBusIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Stm32BootClient::ProtocolVariant::Usart;
+    static Stm32BootClient::ErrorCode init() {
+        return Stm32BootLowIo::init(B);
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        return Stm32BootLowIo::write(B, _src, _size, _written);
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        return Stm32BootLowIo::read(B, _dst, _size, _read);
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        return Stm32BootLowIo::flush(B);
+    }
+    static void setResetLine( bool _level ) {
+        Stm32BootLowIo::setResetLine(B, _level);
+    }
+    static void setBootLine( bool _level ) {
+        Stm32BootLowIo::setBootLine(B, _level);
+    }
+    static void delay( uint32_t _delay ) {
+        Stm32BootLowIo::delay(_delay);
+    }
+    static uint32_t getTickMs() {
+        return Stm32BootLowIo::getTickMs();
+    }
+};
+template<Stm32BootLowIo::Bus B>
+struct Stm32TraceBus<Stm32BootBusIo<B>> {
+    static const int8_t value = static_cast<int8_t>(B);
+};
+typedef Stm32BootClientT<Stm32BootBusIo<Stm32BootLowIo::Bus::Bus0>> Stm32BootBus0Client;
+typedef Stm32BootClientT<Stm32BootBusIo<Stm32BootLowIo::Bus::Bus1>> Stm32BootBus1Client;
+extern template class Stm32BootClientT<Stm32BootBusIo<Stm32BootLowIo::Bus::Bus0>>;
+extern template class Stm32BootClientT<Stm32BootBusIo<Stm32BootLowIo::Bus::Bus1>>;
 #endif
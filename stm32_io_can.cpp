@@ -0,0 +1,220 @@
+/*!
+/brief CAN bootloader link over a Linux SocketCAN raw socket.
+*/
+#include "stm32_io_can.hpp"
+#ifdef __linux__
+#include "stm32_boot_client_impl.hpp"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+Stm32CanLink::Stm32CanLink()
+    : m_timeoutMs(100)
+    , m_fd(-1)
+    , m_rxHead(0)
+    , m_rxTail(0) {}
+Stm32CanLink::~Stm32CanLink() {
+    close();
+}
+/*!
+ * Function: configure
+ * Sets the interface, takes effect on the next open().
+ *
+ * @param _ifname e.g. can0 or vcan0.
+ * @param _timeoutMs deadline of a single read or write.
+ */
+void Stm32CanLink::configure( const std::string &_ifname, uint32_t _timeoutMs ) {
+    if (_ifname != m_ifname)
+        close();
+    m_ifname = _ifname;
+    m_timeoutMs = _timeoutMs;
+}
+/*!
+ * Function: open
+ * Binds a raw socket to the interface. An open socket is kept as it is, so
+ * the next node on the bus doesn't cost a new socket.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32CanLink::open() {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    if (m_fd < 0) {
+        err = Stm32BootClient::ErrorCode::SERIAL_CANT_OPEN;
+        unsigned ifindex = if_nametoindex(m_ifname.c_str());
+        m_fd = ifindex ? socket(PF_CAN, SOCK_RAW, CAN_RAW) : -1;
+        if (m_fd >= 0) {
+            struct can_filter filter;
+            filter.can_id = 0;
+            filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | ( CAN_SFF_MASK & ~0xffu );
+            struct sockaddr_can addr;
+            memset(&addr, 0, sizeof( addr ));
+            addr.can_family = AF_CAN;
+            addr.can_ifindex = static_cast<int>(ifindex);
+            if (setsockopt(m_fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof( filter )) == 0 &&
+                bind(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof( addr )) == 0) {
+                err = Stm32BootClient::ErrorCode::OK;
+            } else {
+                close();
+            }
+        }
+    }
+    m_rxHead = m_rxTail = 0;
+    return err;
+}
+Stm32BootClient::ErrorCode Stm32CanLink::close() {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    if (m_fd >= 0) {
+        err = ( ::close(m_fd) == 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+        m_fd = -1;
+    }
+    return err;
+}
+/*!
+ * Function: write
+ * Puts CanFrame_t records on the bus, up to BATCH_FRAMES per sendmmsg(). A
+ * full TX queue (ENOBUFS) is waited out until the deadline.
+ *
+ * @param _src CanFrame_t records.
+ * @param _size size of the records in bytes.
+ * @param _written how many bytes of records were actually sent.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32CanLink::write( const void * _src, size_t _size, size_t * _written ) {
+    configASSERT(_src && !( _size % sizeof( Stm32BootClient::CanFrame_t ) ));
+    auto deadline = Clock_t::now() + std::chrono::milliseconds(m_timeoutMs);
+    auto err = ( m_fd >= 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
+    const Stm32BootClient::CanFrame_t * src = static_cast<const Stm32BootClient::CanFrame_t *>(_src);
+    size_t count = _size / sizeof( Stm32BootClient::CanFrame_t );
+    size_t done = 0;
+    while (done < count && err == Stm32BootClient::ErrorCode::OK) {
+        struct can_frame frames[BATCH_FRAMES];
+        struct iovec iov[BATCH_FRAMES];
+        struct mmsghdr msgs[BATCH_FRAMES];
+        size_t batch = ( count - done < BATCH_FRAMES ) ? count - done : BATCH_FRAMES;
+        memset(frames, 0, sizeof( frames ));
+        memset(msgs, 0, sizeof( msgs ));
+        for ( size_t i = 0; i < batch; i++ ) {
+            frames[i].can_id = src[done + i].id & CAN_SFF_MASK;
+            frames[i].can_dlc = ( src[done + i].dlc < CAN_MAX_DLEN ) ? src[done + i].dlc : CAN_MAX_DLEN;
+            memcpy(frames[i].data, src[done + i].data, frames[i].can_dlc);
+            iov[i].iov_base = &frames[i];
+            iov[i].iov_len = sizeof( frames[i] );
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int sent = sendmmsg(m_fd, msgs, static_cast<unsigned>(batch), MSG_DONTWAIT);
+        if (sent > 0) {
+            done += static_cast<size_t>(sent);
+        } else if (sent < 0 && ( errno == ENOBUFS || errno == EAGAIN || errno == EINTR )) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock_t::now()).count();
+            struct pollfd pfd = { m_fd, POLLOUT, 0 };
+            if (left <= 0)
+                err = Stm32BootClient::ErrorCode::SERIAL_WR_SIZE;
+            else if (errno == ENOBUFS)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1)); // CAN drivers don't signal POLLOUT on ENOBUFS
+            else
+                poll(&pfd, 1, static_cast<int>(left));
+        } else {
+            err = Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
+        }
+    }
+    if (_written)
+        *_written = done * sizeof( Stm32BootClient::CanFrame_t );
+    STM32_TRACE(BytesWritten, done * sizeof( Stm32BootClient::CanFrame_t ));
+    return err;
+}
+/*!
+ * Function: read
+ * Hands out received CanFrame_t records; fewer and OK are returned when the
+ * deadline passes, the same way a serial port times out.
+ *
+ * @param _dst room for CanFrame_t records.
+ * @param _size size of the room in bytes.
+ * @param _read how many bytes of records were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32CanLink::read( void * _dst, size_t _size, size_t * _read ) {
+    configASSERT(_dst && !( _size % sizeof( Stm32BootClient::CanFrame_t ) ));
+    auto deadline = Clock_t::now() + std::chrono::milliseconds(m_timeoutMs);
+    auto err = Stm32BootClient::ErrorCode::OK;
+    Stm32BootClient::CanFrame_t * dst = static_cast<Stm32BootClient::CanFrame_t *>(_dst);
+    size_t count = _size / sizeof( Stm32BootClient::CanFrame_t );
+    size_t done = 0;
+    while (done < count && err == Stm32BootClient::ErrorCode::OK) {
+        if (m_rxHead == m_rxTail) {
+            err = receive(deadline);
+            if (m_rxHead == m_rxTail)
+                break;
+        }
+        dst[done++] = m_rx[m_rxHead++];
+    }
+    if (_read)
+        *_read = done * sizeof( Stm32BootClient::CanFrame_t );
+    STM32_TRACE(BytesRead, done * sizeof( Stm32BootClient::CanFrame_t ));
+    if (done < count)
+        STM32_TRACE(Timeout, ( count - done ) * sizeof( Stm32BootClient::CanFrame_t ));
+    return err;
+}
+/*!
+ * Function: flush
+ * Drops the frames received so far, those waiting in the socket too.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32CanLink::flush() {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    do {
+        m_rxHead = m_rxTail = 0;
+        err = ( m_fd >= 0 ) ? receive(Clock_t::now()) : Stm32BootClient::ErrorCode::OK;
+    } while (err == Stm32BootClient::ErrorCode::OK && m_rxHead != m_rxTail);
+    m_rxHead = m_rxTail = 0;
+    return err;
+}
+/*!
+ * Function: receive
+ * Waits until the deadline for frames and takes up to BATCH_FRAMES of them
+ * with one recvmmsg().
+ *
+ * @return Stm32BootClient::ErrorCode OK also when nothing came.
+ */
+Stm32BootClient::ErrorCode Stm32CanLink::receive( Clock_t::time_point _deadline ) {
+    auto err = ( m_fd >= 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
+    m_rxHead = m_rxTail = 0;
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(_deadline - Clock_t::now()).count();
+        struct pollfd pfd = { m_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, ( left > 0 ) ? static_cast<int>(left) : 0) > 0) {
+            struct can_frame frames[BATCH_FRAMES];
+            struct iovec iov[BATCH_FRAMES];
+            struct mmsghdr msgs[BATCH_FRAMES];
+            memset(msgs, 0, sizeof( msgs ));
+            for ( size_t i = 0; i < BATCH_FRAMES; i++ ) {
+                iov[i].iov_base = &frames[i];
+                iov[i].iov_len = sizeof( frames[i] );
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int got = recvmmsg(m_fd, msgs, BATCH_FRAMES, MSG_DONTWAIT, nullptr);
+            if (got < 0 && errno != EAGAIN && errno != EINTR)
+                err = Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
+            for ( int i = 0; i < got; i++ ) {
+                Stm32BootClient::CanFrame_t &rx = m_rx[m_rxTail++];
+                rx.id = static_cast<uint16_t>(frames[i].can_id & CAN_SFF_MASK);
+                rx.dlc = ( frames[i].can_dlc < CAN_MAX_DLEN ) ? frames[i].can_dlc : CAN_MAX_DLEN;
+                memcpy(rx.data, frames[i].data, rx.dlc);
+            }
+        }
+    }
+    return err;
+}
+/// The first CAN interface, see Stm32BootCanClient
+template class Stm32BootClientT<Stm32BootCanIo<0>>;
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+#if defined(__cplusplus) && defined(__linux__)
+#include "stm32_boot_client.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+/*!
+ * Host side only: a SocketCAN raw socket carrying the CAN bootloader protocol
+ * (AN3154). The bit rate belongs to the interface, 125 kbit/s for the ROM
+ * bootloader: ip link set can0 type can bitrate 125000. Batches of frames go
+ * out with one sendmmsg() and come in with one recvmmsg(), the kernel filter
+ * passes only standard data frames with 8 bit IDs, which is all the
+ * bootloader uses. The socket stays open across sessions, so several nodes
+ * on one bus can be programmed one after another.
+ */
+class Stm32CanLink {
+public:
+    Stm32CanLink();
+    ~Stm32CanLink();
+    void configure( const std::string &_ifname, uint32_t _timeoutMs = 100 );
+    Stm32BootClient::ErrorCode open();
+    Stm32BootClient::ErrorCode close();
+    Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written );
+    Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read );
+    Stm32BootClient::ErrorCode flush();
+private:
+    Stm32CanLink( const Stm32CanLink & );
+    Stm32CanLink & operator=( const Stm32CanLink & );
+    typedef std::chrono::steady_clock Clock_t;
+    static const size_t BATCH_FRAMES = 32;
+    Stm32BootClient::ErrorCode receive( Clock_t::time_point _deadline );
+    std::string m_ifname;
+    uint32_t m_timeoutMs;
+    int m_fd;
+    Stm32BootClient::CanFrame_t m_rx[BATCH_FRAMES];
+    size_t m_rxHead;
+    size_t m_rxTail;
+};
+/*!
+ * Transport policy for Stm32BootClientT over a Stm32CanLink. CAN has no
+ * RESET and BOOT0 lines, the node is put into the bootloader by other means.
+ * Id tells interfaces apart.
+ */
+template<unsigned Id>
+class Stm32BootCanIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Stm32BootClient::ProtocolVariant::Can;
+    static Stm32CanLink & link() {
+        static Stm32CanLink s_link;
+        return s_link;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        return link().open();
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        return link().close();
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        return link().write(_src, _size, _written);
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        return link().read(_dst, _size, _read);
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        return link().flush();
+    }
+    static void setResetLine( bool ) {}
+    static void setBootLine( bool ) {}
+    static void delay( uint32_t _delay ) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(_delay));
+    }
+    static uint32_t getTickMs() {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
+/// Client over the first CAN interface
+typedef Stm32BootClientT<Stm32BootCanIo<0>> Stm32BootCanClient;
+extern template class Stm32BootClientT<Stm32BootCanIo<0>>;
+#endif
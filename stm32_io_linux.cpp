@@ -0,0 +1,228 @@
+/*!
+/brief SPI and I2C bootloader links over Linux spidev and i2c-dev.
+*/
+#include "stm32_io_linux.hpp"
+#ifdef __linux__
+#include "stm32_boot_client_impl.hpp"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include <linux/spi/spidev.h>
+
+/*!
+ * Function: set
+ * Writes "0" or "1" to the value file, the pin must already be exported
+ * and set to output.
+ *
+ * @param _level true - high level, false - low level.
+ */
+void Stm32SysfsGpio::set( bool _level ) {
+    if (!m_path.empty()) {
+        int fd = ::open(m_path.c_str(), O_WRONLY);
+        if (fd >= 0) {
+            const char value = _level ? '1' : '0';
+            if (::write(fd, &value, 1) != 1) {
+                // nothing to do, the next sync will fail and tell the user
+            }
+            ::close(fd);
+        }
+    }
+}
+
+Stm32SpiDevLink::Stm32SpiDevLink()
+    : m_speedHz(1000000)
+    , m_fd(-1) {}
+Stm32SpiDevLink::~Stm32SpiDevLink() {
+    close();
+}
+/*!
+ * Function: configure
+ * Sets the device, takes effect on the next open().
+ *
+ * @param _path e.g. /dev/spidev0.0.
+ * @param _speedHz SCK frequency, the bootloader needs it below its SPI limit.
+ */
+void Stm32SpiDevLink::configure( const std::string &_path, uint32_t _speedHz ) {
+    m_path = _path;
+    m_speedHz = _speedHz;
+}
+Stm32BootClient::ErrorCode Stm32SpiDevLink::open() {
+    auto err = Stm32BootClient::ErrorCode::SERIAL_CANT_OPEN;
+    close();
+    m_fd = ::open(m_path.c_str(), O_RDWR);
+    if (m_fd >= 0) {
+        uint8_t mode = SPI_MODE_0;
+        uint8_t bits = 8;
+        if (ioctl(m_fd, SPI_IOC_WR_MODE, &mode) == 0 && ioctl(m_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == 0 &&
+            ioctl(m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &m_speedHz) == 0) {
+            err = Stm32BootClient::ErrorCode::OK;
+        } else {
+            close();
+        }
+    }
+    return err;
+}
+Stm32BootClient::ErrorCode Stm32SpiDevLink::close() {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    if (m_fd >= 0) {
+        err = ( ::close(m_fd) == 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+        m_fd = -1;
+    }
+    return err;
+}
+/*!
+ * Function: transfer
+ * One chip select cycle. Either direction may be null: spidev clocks out
+ * zeros when there is nothing to send and drops what comes back when there
+ * is nowhere to put it.
+ */
+Stm32BootClient::ErrorCode Stm32SpiDevLink::transfer( const void * _tx, void * _rx, size_t _size ) {
+    struct spi_ioc_transfer xfer;
+    memset(&xfer, 0, sizeof( xfer ));
+    xfer.tx_buf = reinterpret_cast<uintptr_t>(_tx);
+    xfer.rx_buf = reinterpret_cast<uintptr_t>(_rx);
+    xfer.len = static_cast<uint32_t>(_size);
+    xfer.speed_hz = m_speedHz;
+    xfer.bits_per_word = 8;
+    return ( ioctl(m_fd, SPI_IOC_MESSAGE(1), &xfer) >= 0 ) ? Stm32BootClient::ErrorCode::OK :
+        Stm32BootClient::ErrorCode::FAILED;
+}
+/*!
+ * Function: write
+ * Clocks the buffer out in one transfer, whatever comes back is not data.
+ *
+ * @param _src a pointer to the source buffer.
+ * @param _size number of bytes to be written.
+ * @param _written how many bytes were actually written.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32SpiDevLink::write( const void * _src, size_t _size, size_t * _written ) {
+    configASSERT(_src);
+    auto err = ( m_fd >= 0 ) ? transfer(_src, nullptr, _size) : Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
+    if (_written)
+        *_written = ( err == Stm32BootClient::ErrorCode::OK ) ? _size : 0;
+    STM32_TRACE(BytesWritten, _size);
+    return err;
+}
+/*!
+ * Function: read
+ * Clocks _size bytes in. SPI never times out, a target with nothing to say
+ * answers 0xa5, the client's ACK polling takes care of that.
+ *
+ * @param _dst a pointer to the destination buffer.
+ * @param _size number of bytes to be read.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32SpiDevLink::read( void * _dst, size_t _size, size_t * _read ) {
+    configASSERT(_dst);
+    auto err = ( m_fd >= 0 ) ? transfer(nullptr, _dst, _size) : Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
+    if (_read)
+        *_read = ( err == Stm32BootClient::ErrorCode::OK ) ? _size : 0;
+    STM32_TRACE(BytesRead, _size);
+    return err;
+}
+Stm32BootClient::ErrorCode Stm32SpiDevLink::flush() {
+    return Stm32BootClient::ErrorCode::OK; // nothing is buffered
+}
+
+Stm32I2cDevLink::Stm32I2cDevLink()
+    : m_address(0)
+    , m_fd(-1) {}
+Stm32I2cDevLink::~Stm32I2cDevLink() {
+    close();
+}
+/*!
+ * Function: configure
+ * Sets the adapter and the bootloader address, takes effect on the next open().
+ *
+ * @param _path e.g. /dev/i2c-1.
+ * @param _address 7 bit bootloader address, see AN2606 for the device.
+ */
+void Stm32I2cDevLink::configure( const std::string &_path, uint8_t _address ) {
+    m_path = _path;
+    m_address = _address;
+}
+Stm32BootClient::ErrorCode Stm32I2cDevLink::open() {
+    auto err = Stm32BootClient::ErrorCode::SERIAL_CANT_OPEN;
+    close();
+    m_fd = ::open(m_path.c_str(), O_RDWR);
+    if (m_fd >= 0) {
+        if (ioctl(m_fd, I2C_SLAVE, static_cast<unsigned long>(m_address)) == 0) {
+            err = Stm32BootClient::ErrorCode::OK;
+        } else {
+            close();
+        }
+    }
+    return err;
+}
+Stm32BootClient::ErrorCode Stm32I2cDevLink::close() {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    if (m_fd >= 0) {
+        err = ( ::close(m_fd) == 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+        m_fd = -1;
+    }
+    return err;
+}
+/*!
+ * Function: write
+ * Sends the buffer as one write transaction.
+ *
+ * @param _src a pointer to the source buffer.
+ * @param _size number of bytes to be written.
+ * @param _written how many bytes were actually written.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32I2cDevLink::write( const void * _src, size_t _size, size_t * _written ) {
+    configASSERT(_src);
+    auto err = Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
+    size_t wr = 0;
+    if (m_fd >= 0) {
+        ssize_t n = ::write(m_fd, _src, _size);
+        wr = ( n > 0 ) ? static_cast<size_t>(n) : 0;
+        err = Stm32BootClient::ErrorCode::OK; // a NACKed address shows up as a short count
+    }
+    if (_written)
+        *_written = wr;
+    STM32_TRACE(BytesWritten, wr);
+    return err;
+}
+/*!
+ * Function: read
+ * Reads the buffer in one read transaction. The target NACKs its address
+ * while it is busy, that is reported as a short read, not as an error.
+ *
+ * @param _dst a pointer to the destination buffer.
+ * @param _size number of bytes to be read.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32I2cDevLink::read( void * _dst, size_t _size, size_t * _read ) {
+    configASSERT(_dst);
+    auto err = Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
+    size_t rd = 0;
+    if (m_fd >= 0) {
+        ssize_t n = ::read(m_fd, _dst, _size);
+        rd = ( n > 0 ) ? static_cast<size_t>(n) : 0;
+        err = Stm32BootClient::ErrorCode::OK;
+    }
+    if (_read)
+        *_read = rd;
+    STM32_TRACE(BytesRead, rd);
+    if (rd < _size)
+        STM32_TRACE(Timeout, _size - rd);
+    return err;
+}
+Stm32BootClient::ErrorCode Stm32I2cDevLink::flush() {
+    return Stm32BootClient::ErrorCode::OK; // nothing is buffered
+}
+/// The first SPI and I2C links, see Stm32BootSpiClient and Stm32BootI2cClient
+template class Stm32BootClientT<Stm32BootDevIo<Stm32SpiDevLink, 0>>;
+template class Stm32BootClientT<Stm32BootDevIo<Stm32I2cDevLink, 0>>;
+#endif
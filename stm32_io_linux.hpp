@@ -0,0 +1,115 @@
+#pragma once
+#if defined(__cplusplus) && defined(__linux__)
+#include "stm32_boot_client.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+/*!
+ * Host side only: Linux character devices for the SPI (AN4286) and I2C
+ * (AN4221) bootloaders. Both links expose the same calls, so one policy,
+ * Stm32BootDevIo, binds either of them to the client.
+ */
+/// One GPIO through its sysfs value file, an empty path makes it a no-op
+class Stm32SysfsGpio {
+public:
+    void configure( const std::string &_valuePath ) {
+        m_path = _valuePath;
+    }
+    void set( bool _level );
+private:
+    std::string m_path;
+};
+/// Full duplex spidev link, mode 0, 8 bit, MSB first
+class Stm32SpiDevLink {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Stm32BootClient::ProtocolVariant::Spi;
+    Stm32SpiDevLink();
+    ~Stm32SpiDevLink();
+    void configure( const std::string &_path, uint32_t _speedHz = 1000000 );
+    Stm32BootClient::ErrorCode open();
+    Stm32BootClient::ErrorCode close();
+    Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written );
+    Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read );
+    Stm32BootClient::ErrorCode flush();
+private:
+    Stm32SpiDevLink( const Stm32SpiDevLink & );
+    Stm32SpiDevLink & operator=( const Stm32SpiDevLink & );
+    Stm32BootClient::ErrorCode transfer( const void * _tx, void * _rx, size_t _size );
+    std::string m_path;
+    uint32_t m_speedHz;
+    int m_fd;
+};
+/// i2c-dev link, every write() or read() is one bus transaction to the bootloader address
+class Stm32I2cDevLink {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Stm32BootClient::ProtocolVariant::I2c;
+    Stm32I2cDevLink();
+    ~Stm32I2cDevLink();
+    void configure( const std::string &_path, uint8_t _address );
+    Stm32BootClient::ErrorCode open();
+    Stm32BootClient::ErrorCode close();
+    Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written );
+    Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read );
+    Stm32BootClient::ErrorCode flush();
+private:
+    Stm32I2cDevLink( const Stm32I2cDevLink & );
+    Stm32I2cDevLink & operator=( const Stm32I2cDevLink & );
+    std::string m_path;
+    uint8_t m_address;
+    int m_fd;
+};
+/*!
+ * Transport policy for Stm32BootClientT over a device link. The protocol
+ * variant comes from the link, RESET and BOOT0 are driven through sysfs
+ * GPIOs if configured. Id tells links of the same kind apart.
+ */
+template<class Link, unsigned Id>
+class Stm32BootDevIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Link::PROTOCOL_VARIANT;
+    static Link & link() {
+        static Link s_link;
+        return s_link;
+    }
+    static Stm32SysfsGpio & resetGpio() {
+        static Stm32SysfsGpio s_gpio;
+        return s_gpio;
+    }
+    static Stm32SysfsGpio & bootGpio() {
+        static Stm32SysfsGpio s_gpio;
+        return s_gpio;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        return link().open();
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        return link().close();
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        return link().write(_src, _size, _written);
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        return link().read(_dst, _size, _read);
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        return link().flush();
+    }
+    static void setResetLine( bool _level ) {
+        resetGpio().set(_level);
+    }
+    static void setBootLine( bool _level ) {
+        bootGpio().set(_level);
+    }
+    static void delay( uint32_t _delay ) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(_delay));
+    }
+    static uint32_t getTickMs() {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
+typedef Stm32BootClientT<Stm32BootDevIo<Stm32SpiDevLink, 0>> Stm32BootSpiClient;
+typedef Stm32BootClientT<Stm32BootDevIo<Stm32I2cDevLink, 0>> Stm32BootI2cClient;
+extern template class Stm32BootClientT<Stm32BootDevIo<Stm32SpiDevLink, 0>>;
+extern template class Stm32BootClientT<Stm32BootDevIo<Stm32I2cDevLink, 0>>;
+#endif
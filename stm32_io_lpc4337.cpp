@@ -2,10 +2,14 @@
   /brief Platform-dependent function to handle serial port.
   */
 #include "stm32_io.hpp"
+#include "stm32_bus_scheduler.hpp"
+#include "stm32_boot_client_impl.hpp"
 #include "lpc43xx_gpio.h"
 #include "lpc43xx_scu.h"
 #include "drivers\serial\lpc43xx_serial.hpp"
 #include "modules\measurements\meas_core_calc.hpp"
+#include "task.h"
+#include "semphr.h"
 #include <stdio.h>
 
 static const GpioSetup_t s_busGpio[] = {
@@ -34,14 +38,16 @@ int Stm32BootLowIo::getCurrentBusIdx() {
     configASSERT(busIdx > -1 && busIdx < ARRAY_SIZE(s_busGpio));
     return busIdx;
 }
-static Lpc43xxSerialDriver * getCurrentSerial() {
-    auto p = s_busSerial[Stm32BootLowIo::getCurrentBusIdx()];
+static Lpc43xxSerialDriver * getSerial( Stm32BootLowIo::Bus _bus ) {
+    auto busIdx = static_cast<int>(_bus);
+    configASSERT(busIdx > -1 && busIdx < ARRAY_SIZE(s_busSerial));
+    auto p = s_busSerial[busIdx];
     configASSERT(p);
     return p;
 }
 /*!
  * Function: init 
- * Initializes serial port.
+ * Initializes serial ports of all buses.
  * 
  * @return Stm32BootClient::ErrorCode 
  */
@@ -49,15 +55,24 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::init() {
     configASSERT(ARRAY_SIZE(s_busSerial) == MeasCore::Calc::instance()->getUpdatableUnitCount());
     configASSERT(ARRAY_SIZE(s_busSerial) == MeasCore::Calc::instance()->getUpdatableUnitCount());
     for ( auto i = 0; i < ARRAY_SIZE(s_busSerial); i++ ) {
-        auto p = s_busSerial[i];
-        configASSERT(p);
-        AbstractSerialDriver::TSettings settings;
-        settings.parameters.parity = AbstractSerialDriver::pEVEN;
-        p->close();
-        configASSERT(p->open(&settings) == rvOK);
+        init(static_cast<Bus>(i));
     }
     return Stm32BootClient::ErrorCode::OK;
 }
+/*!
+ * Function: init 
+ * Initializes the serial port of one bus, the other one keeps running.
+ * 
+ * @return Stm32BootClient::ErrorCode 
+ */
+Stm32BootClient::ErrorCode Stm32BootLowIo::init( Bus _bus ) {
+    auto p = getSerial(_bus);
+    AbstractSerialDriver::TSettings settings;
+    settings.parameters.parity = AbstractSerialDriver::pEVEN;
+    p->close();
+    configASSERT(p->open(&settings) == rvOK);
+    return Stm32BootClient::ErrorCode::OK;
+}
 /*!
  * Function: write 
  * Write data to serial port.
@@ -69,10 +84,14 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::init() {
  * @return Stm32BootClient::ErrorCode 
  */
 Stm32BootClient::ErrorCode Stm32BootLowIo::write( const void * _src, size_t _size, size_t * _written ) {
+    return write(m_bus, _src, _size, _written);
+}
+Stm32BootClient::ErrorCode Stm32BootLowIo::write( Bus _bus, const void * _src, size_t _size, size_t * _written ) {
     configASSERT(_src);
-    auto result = getCurrentSerial()->write(static_cast<const uint8_t *>(_src), _size, 100);
+    auto result = getSerial(_bus)->write(static_cast<const uint8_t *>(_src), _size, 100);
     if (_written)
         *_written = _size;
+    STM32_TRACE_BUS(_bus, BytesWritten, _size);
     return result == rvOK ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
 }
 /*!
@@ -86,7 +105,16 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::write( const void * _src, size_t _siz
  * @return Stm32BootClient::ErrorCode 
  */
 Stm32BootClient::ErrorCode Stm32BootLowIo::read( void * _dst, size_t _size, size_t * _read ) {
-    auto result = getCurrentSerial()->read(static_cast<uint8_t *>(_dst), _size, *_read, 100);
+    return read(m_bus, _dst, _size, _read);
+}
+Stm32BootClient::ErrorCode Stm32BootLowIo::read( Bus _bus, void * _dst, size_t _size, size_t * _read ) {
+    size_t rd = 0;
+    auto result = getSerial(_bus)->read(static_cast<uint8_t *>(_dst), _size, rd, 100);
+    if (_read)
+        *_read = rd;
+    STM32_TRACE_BUS(_bus, BytesRead, rd);
+    if (rd < _size)
+        STM32_TRACE_BUS(_bus, Timeout, _size - rd);
     return result == rvOK ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
 }
 /*!
@@ -100,7 +128,10 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::deinit() {
     return result;
 }
 Stm32BootClient::ErrorCode Stm32BootLowIo::flush() {
-    getCurrentSerial()->flush();
+    return flush(m_bus);
+}
+Stm32BootClient::ErrorCode Stm32BootLowIo::flush( Bus _bus ) {
+    getSerial(_bus)->flush();
     return Stm32BootClient::ErrorCode::OK;
 }
 /*!
@@ -110,8 +141,11 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::flush() {
  * @param _level true - hight level, false - low level
  */
 void Stm32BootLowIo::setResetLine( bool _level ) {
+    setResetLine(m_bus, _level);
+}
+void Stm32BootLowIo::setResetLine( Bus _bus, bool _level ) {
     GPIO_SetUpArray(s_busGpio, ARRAY_SIZE(s_busGpio));
-    GPIO_WritePinValue(s_busGpio[getCurrentBusIdx() * 2], _level ? 1 : 0);
+    GPIO_WritePinValue(s_busGpio[static_cast<int>(_bus) * 2], _level ? 1 : 0);
 }
 /*!
  * Function: setBootLine 
@@ -121,8 +155,11 @@ void Stm32BootLowIo::setResetLine( bool _level ) {
  * @param _level true - high level, false - low level;
  */
 void Stm32BootLowIo::setBootLine( bool _level ) {
+    setBootLine(m_bus, _level);
+}
+void Stm32BootLowIo::setBootLine( Bus _bus, bool _level ) {
     GPIO_SetUpArray(s_busGpio, ARRAY_SIZE(s_busGpio));
-    GPIO_WritePinValue(s_busGpio[getCurrentBusIdx() * 2 + 1], _level ? 1 : 0);
+    GPIO_WritePinValue(s_busGpio[static_cast<int>(_bus) * 2 + 1], _level ? 1 : 0);
 }
 /*!
  * Function: delay 
@@ -137,3 +174,58 @@ void Stm32BootLowIo::setSerialBus( Bus _code ) {
     configASSERT(_code != Bus::Undefined);
     m_bus = _code;
 }
+Stm32BootLowIo::Bus Stm32BootLowIo::getSerialBus() {
+    return m_bus;
+}
+/*!
+ * Function: getTickMs
+ * Milliseconds since the scheduler start, used to timestamp trace records.
+ *
+ * @return uint32_t
+ */
+uint32_t Stm32BootLowIo::getTickMs() {
+    return static_cast<uint32_t>(xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+static const uint32_t WORKER_STACK_WORDS = 512;
+static StaticTask_t s_workerTask[Stm32BusScheduler::MAX_BUSES];
+static StackType_t s_workerStack[Stm32BusScheduler::MAX_BUSES][WORKER_STACK_WORDS];
+static StaticSemaphore_t s_workerDoneBuf[Stm32BusScheduler::MAX_BUSES];
+static SemaphoreHandle_t s_workerDone[Stm32BusScheduler::MAX_BUSES];
+typedef struct Worker_t {
+    void ( *entry )( void * );
+    void * arg;
+    size_t idx;
+}
+Worker_t;
+static Worker_t s_worker[Stm32BusScheduler::MAX_BUSES];
+static void workerTask( void * _worker ) {
+    Worker_t * worker = static_cast<Worker_t *>(_worker);
+    worker->entry(worker->arg);
+    xSemaphoreGive(s_workerDone[worker->idx]);
+    vTaskDelete(nullptr);
+}
+/*!
+ * Function: startWorker
+ * Bus workers of Stm32BusScheduler are static FreeRTOS tasks at the priority
+ * of the caller, which sleeps on a semaphore until they are done.
+ *
+ * @return bool false if the task can't be created.
+ */
+bool Stm32BusScheduler::startWorker( size_t _idx, void ( *_entry )( void * ), void * _arg ) {
+    configASSERT(_idx < MAX_BUSES);
+    if (!s_workerDone[_idx])
+        s_workerDone[_idx] = xSemaphoreCreateBinaryStatic(&s_workerDoneBuf[_idx]);
+    s_worker[_idx].entry = _entry;
+    s_worker[_idx].arg = _arg;
+    s_worker[_idx].idx = _idx;
+    TaskHandle_t task = xTaskCreateStatic(workerTask, "stm32bus", WORKER_STACK_WORDS, &s_worker[_idx],
+                                          uxTaskPriorityGet(nullptr), s_workerStack[_idx], &s_workerTask[_idx]);
+    return task != nullptr;
+}
+void Stm32BusScheduler::joinWorker( size_t _idx ) {
+    configASSERT(_idx < MAX_BUSES);
+    xSemaphoreTake(s_workerDone[_idx], portMAX_DELAY);
+}
+/// One client per bus, see Stm32BootBusIo
+template class Stm32BootClientT<Stm32BootBusIo<Stm32BootLowIo::Bus::Bus0>>;
+template class Stm32BootClientT<Stm32BootBusIo<Stm32BootLowIo::Bus::Bus1>>;
\ No newline at end of file
@@ -0,0 +1,386 @@
+/*!
+/brief Serial port over TCP: raw socket or RFC 2217 device servers.
+*/
+#include "stm32_io_net.hpp"
+#include "stm32_boot_client_impl.hpp"
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+static const uint8_t TELNET_IAC = 255;
+static const uint8_t TELNET_DONT = 254;
+static const uint8_t TELNET_DO = 253;
+static const uint8_t TELNET_WONT = 252;
+static const uint8_t TELNET_WILL = 251;
+static const uint8_t TELNET_SB = 250;
+static const uint8_t TELNET_SE = 240;
+static const uint8_t TELNET_BINARY = 0;
+static const uint8_t TELNET_SGA = 3;
+static const uint8_t COM_PORT_OPTION = 44;
+static const uint8_t CPO_SET_BAUDRATE = 1;
+static const uint8_t CPO_SET_DATASIZE = 2;
+static const uint8_t CPO_SET_PARITY = 3;
+static const uint8_t CPO_SET_STOPSIZE = 4;
+static const uint8_t CPO_SET_CONTROL = 5;
+static const uint8_t CPO_PURGE_DATA = 12;
+static const uint8_t CPO_PARITY_EVEN = 3;
+static const uint8_t CPO_DTR_ON = 8;
+static const uint8_t CPO_DTR_OFF = 9;
+static const uint8_t CPO_RTS_ON = 11;
+static const uint8_t CPO_RTS_OFF = 12;
+static const uint8_t CPO_PURGE_BOTH = 3;
+
+Stm32NetLink::Stm32NetLink()
+    : m_port(0)
+    , m_mode(Mode::Raw)
+    , m_timeoutMs(100)
+    , m_fd(-1)
+    , m_rxState(RxState::Data)
+    , m_rxVerb(0)
+    , m_rxHead(0)
+    , m_rxTail(0) {}
+Stm32NetLink::~Stm32NetLink() {
+    close();
+}
+/*!
+ * Function: configure
+ * Sets where to connect, takes effect on the next open().
+ *
+ * @param _host device server name or address.
+ * @param _port TCP port of the serial channel.
+ * @param _mode raw TCP or RFC 2217.
+ * @param _timeoutMs deadline of a single read or write.
+ */
+void Stm32NetLink::configure( const std::string &_host, uint16_t _port, Mode _mode, uint32_t _timeoutMs ) {
+    m_host = _host;
+    m_port = _port;
+    m_mode = _mode;
+    m_timeoutMs = _timeoutMs;
+}
+/*!
+ * Function: open
+ * Connects and, in RFC 2217 mode, negotiates the options and sets 115200 8E1
+ * in a single segment. The server's answers are dropped by the receive filter,
+ * so opening costs no round trip.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32NetLink::open() {
+    auto err = Stm32BootClient::ErrorCode::SERIAL_CANT_OPEN;
+    close();
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof( hints ));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo * list = nullptr;
+    std::string port = std::to_string(m_port);
+    if (getaddrinfo(m_host.c_str(), port.c_str(), &hints, &list) == 0) {
+        for ( struct addrinfo * ai = list; ai && m_fd < 0; ai = ai->ai_next ) {
+            m_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (m_fd >= 0 && connect(m_fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+        }
+        freeaddrinfo(list);
+    }
+    if (m_fd >= 0) {
+        int on = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ));
+        m_rxState = RxState::Data;
+        m_rxHead = m_rxTail = 0;
+        err = Stm32BootClient::ErrorCode::OK;
+        if (m_mode == Mode::Rfc2217) {
+            const uint8_t baud[] = {
+                static_cast<uint8_t>(BAUDRATE >> 24), static_cast<uint8_t>(BAUDRATE >> 16),
+                static_cast<uint8_t>(BAUDRATE >> 8), static_cast<uint8_t>(BAUDRATE)
+            };
+            const uint8_t setup[] = {
+                TELNET_IAC, TELNET_WILL, COM_PORT_OPTION,
+                TELNET_IAC, TELNET_WILL, TELNET_BINARY,
+                TELNET_IAC, TELNET_DO, TELNET_BINARY,
+                TELNET_IAC, TELNET_WILL, TELNET_SGA,
+                TELNET_IAC, TELNET_DO, TELNET_SGA,
+                TELNET_IAC, TELNET_SB, COM_PORT_OPTION, CPO_SET_BAUDRATE, baud[0], baud[1], baud[2], baud[3], TELNET_IAC, TELNET_SE,
+                TELNET_IAC, TELNET_SB, COM_PORT_OPTION, CPO_SET_DATASIZE, 8, TELNET_IAC, TELNET_SE,
+                TELNET_IAC, TELNET_SB, COM_PORT_OPTION, CPO_SET_PARITY, CPO_PARITY_EVEN, TELNET_IAC, TELNET_SE,
+                TELNET_IAC, TELNET_SB, COM_PORT_OPTION, CPO_SET_STOPSIZE, 1, TELNET_IAC, TELNET_SE,
+            };
+            err = sendAll(setup, sizeof( setup ), Clock_t::now() + std::chrono::milliseconds(m_timeoutMs));
+        }
+    }
+    return err;
+}
+Stm32BootClient::ErrorCode Stm32NetLink::close() {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    if (m_fd >= 0) {
+        err = ( ::close(m_fd) == 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+        m_fd = -1;
+    }
+    return err;
+}
+/*!
+ * Function: write
+ * Sends the buffer as one segment, 0xff is doubled in RFC 2217 mode.
+ *
+ * @param _src a pointer to the source buffer.
+ * @param _size number of bytes to be written.
+ * @param _written how many bytes were actually written, counted before escaping.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32NetLink::write( const void * _src, size_t _size, size_t * _written ) {
+    configASSERT(_src);
+    auto deadline = Clock_t::now() + std::chrono::milliseconds(m_timeoutMs);
+    auto err = Stm32BootClient::ErrorCode::OK;
+    const uint8_t * src = static_cast<const uint8_t *>(_src);
+    size_t done = 0;
+    if (m_mode == Mode::Raw) {
+        err = sendAll(src, _size, deadline);
+        done = ( err == Stm32BootClient::ErrorCode::OK ) ? _size : 0;
+    } else {
+        uint8_t txBuff[TX_BUFFER_SIZE];
+        while (done < _size && err == Stm32BootClient::ErrorCode::OK) {
+            size_t len = 0;
+            size_t taken = 0;
+            while (done + taken < _size && len + 2 <= sizeof( txBuff )) {
+                uint8_t b = src[done + taken++];
+                txBuff[len++] = b;
+                if (b == TELNET_IAC)
+                    txBuff[len++] = TELNET_IAC;
+            }
+            err = sendAll(txBuff, len, deadline);
+            if (err == Stm32BootClient::ErrorCode::OK)
+                done += taken;
+        }
+    }
+    if (_written)
+        *_written = done;
+    STM32_TRACE(BytesWritten, done);
+    return err;
+}
+/*!
+ * Function: read
+ * Reads up to _size bytes; fewer bytes and OK are returned when the deadline
+ * passes, the same way a serial port times out.
+ *
+ * @param _dst a pointer to the destanation buffer.
+ * @param _size number of bytes to be read.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32NetLink::read( void * _dst, size_t _size, size_t * _read ) {
+    configASSERT(_dst);
+    auto deadline = Clock_t::now() + std::chrono::milliseconds(m_timeoutMs);
+    auto err = Stm32BootClient::ErrorCode::OK;
+    uint8_t * dst = static_cast<uint8_t *>(_dst);
+    size_t done = 0;
+    while (done < _size && err == Stm32BootClient::ErrorCode::OK) {
+        if (m_rxHead == m_rxTail) {
+            err = receive(deadline);
+            if (m_rxHead == m_rxTail)
+                break;
+        }
+        size_t chunk = m_rxTail - m_rxHead;
+        if (chunk > _size - done)
+            chunk = _size - done;
+        memcpy(dst + done, &m_rx[m_rxHead], chunk);
+        m_rxHead += chunk;
+        done += chunk;
+    }
+    if (_read)
+        *_read = done;
+    STM32_TRACE(BytesRead, done);
+    if (done < _size)
+        STM32_TRACE(Timeout, _size - done);
+    return err;
+}
+/*!
+ * Function: readSome
+ * Takes what has been received, waiting up to the timeout only if nothing
+ * has. For Stm32BootRxThreadIo, whose thread is the only one receiving then:
+ * flush() isn't called while it runs. Not traced, Stm32RxPump traces what
+ * the protocol gets.
+ *
+ * @param _dst a pointer to the destanation buffer.
+ * @param _size size of the buffer.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32NetLink::readSome( void * _dst, size_t _size, size_t * _read ) {
+    configASSERT(_dst);
+    auto err = Stm32BootClient::ErrorCode::OK;
+    if (m_rxHead == m_rxTail)
+        err = receive(Clock_t::now() + std::chrono::milliseconds(m_timeoutMs));
+    size_t chunk = m_rxTail - m_rxHead;
+    if (chunk > _size)
+        chunk = _size;
+    memcpy(_dst, &m_rx[m_rxHead], chunk);
+    m_rxHead += chunk;
+    if (_read)
+        *_read = chunk;
+    return err;
+}
+/*!
+ * Function: flush
+ * Drops everything received so far; RFC 2217 servers are asked to purge their
+ * buffers too.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32NetLink::flush() {
+    auto err = Stm32BootClient::ErrorCode::OK;
+    m_rxHead = m_rxTail = 0;
+    if (m_mode == Mode::Rfc2217) {
+        err = sendComPortOption(CPO_PURGE_DATA, &CPO_PURGE_BOTH, 1);
+    }
+    while (err == Stm32BootClient::ErrorCode::OK && m_fd >= 0) {
+        m_rxHead = m_rxTail = 0;
+        err = receive(Clock_t::now());
+        if (m_rxHead == m_rxTail)
+            break;
+    }
+    m_rxHead = m_rxTail = 0;
+    return err;
+}
+void Stm32NetLink::setDtr( bool _on ) {
+    if (m_mode == Mode::Rfc2217) {
+        uint8_t value = _on ? CPO_DTR_ON : CPO_DTR_OFF;
+        sendComPortOption(CPO_SET_CONTROL, &value, 1);
+    }
+}
+void Stm32NetLink::setRts( bool _on ) {
+    if (m_mode == Mode::Rfc2217) {
+        uint8_t value = _on ? CPO_RTS_ON : CPO_RTS_OFF;
+        sendComPortOption(CPO_SET_CONTROL, &value, 1);
+    }
+}
+Stm32BootClient::ErrorCode Stm32NetLink::sendAll( const uint8_t * _src, size_t _size, Clock_t::time_point _deadline ) {
+    auto err = ( m_fd >= 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
+    while (_size && err == Stm32BootClient::ErrorCode::OK) {
+        ssize_t sent = send(m_fd, _src, _size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            _src += sent;
+            _size -= static_cast<size_t>(sent);
+        } else if (sent < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(_deadline - Clock_t::now()).count();
+            struct pollfd pfd = { m_fd, POLLOUT, 0 };
+            if (left <= 0 || poll(&pfd, 1, static_cast<int>(left)) <= 0)
+                err = Stm32BootClient::ErrorCode::SERIAL_WR_SIZE;
+        } else {
+            err = Stm32BootClient::ErrorCode::SERIAL_WR_FAILED;
+        }
+    }
+    return err;
+}
+/*!
+ * Function: receive
+ * Waits until the deadline for data and appends it to the empty receive
+ * buffer, Telnet commands are filtered out. Returns OK with no data on the
+ * deadline.
+ */
+Stm32BootClient::ErrorCode Stm32NetLink::receive( Clock_t::time_point _deadline ) {
+    auto err = ( m_fd >= 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
+    m_rxHead = m_rxTail = 0;
+    while (err == Stm32BootClient::ErrorCode::OK && m_rxTail == 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(_deadline - Clock_t::now()).count();
+        struct pollfd pfd = { m_fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, left > 0 ? static_cast<int>(left) : 0);
+        if (ready <= 0)
+            break;
+        ssize_t rd = recv(m_fd, m_rx, sizeof( m_rx ), MSG_DONTWAIT);
+        if (rd > 0) {
+#ifdef TCP_QUICKACK
+            int on = 1; // the server waits for nothing but our next command, don't delay its ACK
+            setsockopt(m_fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof( on ));
+#endif
+            m_rxTail = ( m_mode == Mode::Rfc2217 ) ? filterTelnet(m_rx, static_cast<size_t>(rd)) : static_cast<size_t>(rd);
+        } else if (rd == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )) {
+            err = Stm32BootClient::ErrorCode::SERIAL_RD_FAILED;
+        }
+    }
+    return err;
+}
+Stm32BootClient::ErrorCode Stm32NetLink::sendComPortOption( uint8_t _option, const uint8_t * _value, size_t _size ) {
+    uint8_t txBuff[16];
+    size_t len = 0;
+    txBuff[len++] = TELNET_IAC;
+    txBuff[len++] = TELNET_SB;
+    txBuff[len++] = COM_PORT_OPTION;
+    txBuff[len++] = _option;
+    for ( size_t i = 0; i < _size && len + 4 <= sizeof( txBuff ); i++ ) {
+        txBuff[len++] = _value[i];
+        if (_value[i] == TELNET_IAC)
+            txBuff[len++] = TELNET_IAC;
+    }
+    txBuff[len++] = TELNET_IAC;
+    txBuff[len++] = TELNET_SE;
+    return sendAll(txBuff, len, Clock_t::now() + std::chrono::milliseconds(m_timeoutMs));
+}
+/*!
+ * Function: filterTelnet
+ * Removes Telnet commands from received data in place and undoubles 0xff.
+ * The state survives between calls, a command may be split across segments.
+ *
+ * @return size_t number of data bytes left in _buf.
+ */
+size_t Stm32NetLink::filterTelnet( uint8_t * _buf, size_t _size ) {
+    size_t out = 0;
+    for ( size_t i = 0; i < _size; i++ ) {
+        uint8_t b = _buf[i];
+        switch (m_rxState) {
+        case RxState::Data:
+            if (b == TELNET_IAC)
+                m_rxState = RxState::Iac;
+            else
+                _buf[out++] = b;
+            break;
+        case RxState::Iac:
+            if (b == TELNET_IAC) {
+                _buf[out++] = b;
+                m_rxState = RxState::Data;
+            } else if (b == TELNET_SB) {
+                m_rxState = RxState::Sub;
+            } else if (b >= TELNET_WILL) {
+                m_rxVerb = b;
+                m_rxState = RxState::Option;
+            } else {
+                m_rxState = RxState::Data;
+            }
+            break;
+        case RxState::Option:
+            answerOption(m_rxVerb, b);
+            m_rxState = RxState::Data;
+            break;
+        case RxState::Sub:
+            if (b == TELNET_IAC)
+                m_rxState = RxState::SubIac;
+            break;
+        case RxState::SubIac:
+            m_rxState = ( b == TELNET_SE ) ? RxState::Data : RxState::Sub;
+            break;
+        }
+    }
+    return out;
+}
+/*!
+ * Function: answerOption
+ * Refuses every option the server offers or asks for except the ones we have
+ * already offered ourselves, as RFC 854 requires.
+ */
+void Stm32NetLink::answerOption( uint8_t _verb, uint8_t _option ) {
+    bool known = _option == TELNET_BINARY || _option == TELNET_SGA || _option == COM_PORT_OPTION;
+    if (!known && ( _verb == TELNET_DO || _verb == TELNET_WILL )) {
+        uint8_t txBuff[] = { TELNET_IAC, static_cast<uint8_t>(( _verb == TELNET_DO ) ? TELNET_WONT : TELNET_DONT), _option };
+        sendAll(txBuff, sizeof( txBuff ), Clock_t::now() + std::chrono::milliseconds(m_timeoutMs));
+    }
+}
+/// The first network link, see Stm32BootNetClient
+template class Stm32BootClientT<Stm32BootNetIo<0>>;
@@ -0,0 +1,109 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+/*!
+ * Host side only: one TCP connection to a serial device server. Raw mode
+ * passes bytes as they are, RFC 2217 mode adds Telnet COM port control:
+ * line settings, DTR (MCU reset) and RTS (BOOT0), both active low as on
+ * the usual adapters. Every protocol phase the client writes goes out as
+ * one segment with Nagle off, every read or write has its own deadline.
+ */
+class Stm32NetLink {
+public:
+    enum class Mode : uint8_t {
+        Raw,
+        Rfc2217,
+    };
+    Stm32NetLink();
+    ~Stm32NetLink();
+    void configure( const std::string &_host, uint16_t _port, Mode _mode, uint32_t _timeoutMs = 100 );
+    Stm32BootClient::ErrorCode open();
+    Stm32BootClient::ErrorCode close();
+    Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written );
+    Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read );
+    Stm32BootClient::ErrorCode readSome( void * _dst, size_t _size, size_t * _read );
+    Stm32BootClient::ErrorCode flush();
+    void setDtr( bool _on );
+    void setRts( bool _on );
+private:
+    Stm32NetLink( const Stm32NetLink & );
+    Stm32NetLink & operator=( const Stm32NetLink & );
+    typedef std::chrono::steady_clock Clock_t;
+    enum class RxState : uint8_t {
+        Data,
+        Iac,
+        Option,
+        Sub,
+        SubIac,
+    };
+    static const uint32_t BAUDRATE = 115200;
+    static const size_t RX_BUFFER_SIZE = 512;
+    static const size_t TX_BUFFER_SIZE = 2 * ( Stm32BootClient::MAX_WRITE_BLOCK_SIZE + 2 );
+    Stm32BootClient::ErrorCode sendAll( const uint8_t * _src, size_t _size, Clock_t::time_point _deadline );
+    Stm32BootClient::ErrorCode receive( Clock_t::time_point _deadline );
+    Stm32BootClient::ErrorCode sendComPortOption( uint8_t _option, const uint8_t * _value, size_t _size );
+    size_t filterTelnet( uint8_t * _buf, size_t _size );
+    void answerOption( uint8_t _verb, uint8_t _option );
+    std::string m_host;
+    uint16_t m_port;
+    Mode m_mode;
+    uint32_t m_timeoutMs;
+    int m_fd;
+    RxState m_rxState;
+    uint8_t m_rxVerb;
+    uint8_t m_rx[RX_BUFFER_SIZE];
+    size_t m_rxHead;
+    size_t m_rxTail;
+};
+/*!
+ * Transport policy for Stm32BootClientT over a Stm32NetLink. Id tells links
+ * apart: Stm32BootClientT<Stm32BootNetIo<0>>, Stm32BootClientT<Stm32BootNetIo<1>>
+ * and so on are independent clients with their own connection and session.
+ */
+template<unsigned Id>
+class Stm32BootNetIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Stm32BootClient::ProtocolVariant::Usart;
+    static Stm32NetLink & link() {
+        static Stm32NetLink s_link;
+        return s_link;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        return link().open();
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        return link().close();
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        return link().write(_src, _size, _written);
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        return link().read(_dst, _size, _read);
+    }
+    static Stm32BootClient::ErrorCode readSome( void * _dst, size_t _size, size_t * _read ) {
+        return link().readSome(_dst, _size, _read);
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        return link().flush();
+    }
+    static void setResetLine( bool _level ) {
+        link().setDtr(!_level);
+    }
+    static void setBootLine( bool _level ) {
+        link().setRts(!_level);
+    }
+    static void delay( uint32_t _delay ) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(_delay));
+    }
+    static uint32_t getTickMs() {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
+/// Client over the first network link, more links instantiate Stm32BootNetIo<1>...
+typedef Stm32BootClientT<Stm32BootNetIo<0>> Stm32BootNetClient;
+extern template class Stm32BootClientT<Stm32BootNetIo<0>>;
+#endif
@@ -2,10 +2,18 @@
   /brief Platform-dependent function to handle serial port.
   */
 #include "stm32_io.hpp"
+#include "stm32_bus_scheduler.hpp"
+#if defined(_WIN32) || defined(__CYGWIN__)
 #include <windows.h>
 #include <stdio.h>
 #include <iostream>
+#include <thread>
 static HANDLE s_serialHandle;
+static HANDLE s_readEvent;  /// the port is overlapped, a receive thread may read while the protocol writes
+static HANDLE s_writeEvent;
+static std::thread s_workers[Stm32BusScheduler::MAX_BUSES];
+
+Stm32BootLowIo::Bus Stm32BootLowIo::m_bus = Stm32BootLowIo::Bus::Bus0;
 /*!
  * Function: init 
  * Initializes serial port.
@@ -19,11 +27,16 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::init() {
         GENERIC_READ | GENERIC_WRITE,
         0, NULL,
         OPEN_EXISTING,
-        0,
+        FILE_FLAG_OVERLAPPED,
         NULL
         );
     result = ( s_serialHandle == INVALID_HANDLE_VALUE ) ? Stm32BootClient::ErrorCode::SERIAL_CANT_OPEN :
         Stm32BootClient::ErrorCode::OK;
+    if (result == Stm32BootClient::ErrorCode::OK) {
+        s_readEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        s_writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        result = ( s_readEvent && s_writeEvent ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+    }
     if (result == Stm32BootClient::ErrorCode::OK) {
         DCB dcbSerialConfig;
         dcbSerialConfig.DCBlength = sizeof( dcbSerialConfig );
@@ -50,6 +63,23 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::init() {
     }
     return result;
 }
+/*!
+ * Function: transfer
+ * One overlapped ReadFile() or WriteFile() waited for, the timeouts of the
+ * port apply as without overlapping.
+ *
+ * @return BOOL zero on failure.
+ */
+static BOOL transfer( bool _write, void * _buf, size_t _size, DWORD * _done ) {
+    OVERLAPPED ov = {};
+    ov.hEvent = _write ? s_writeEvent : s_readEvent;
+    *_done = 0;
+    BOOL status = _write ? WriteFile(s_serialHandle, _buf, static_cast<DWORD>(_size), NULL, &ov) :
+        ReadFile(s_serialHandle, _buf, static_cast<DWORD>(_size), NULL, &ov);
+    if (status || GetLastError() == ERROR_IO_PENDING)
+        status = GetOverlappedResult(s_serialHandle, &ov, _done, TRUE);
+    return status;
+}
 /*!
  * Function: write 
  * Write data to serial port.
@@ -62,15 +92,10 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::init() {
  */
 Stm32BootClient::ErrorCode Stm32BootLowIo::write( const void * _src, size_t _size, size_t * _written ) {
     DWORD wr;
-    BOOL status = WriteFile(
-        s_serialHandle,
-        _src,
-        static_cast<DWORD>(_size),
-        reinterpret_cast<LPDWORD>(&wr),
-        NULL
-        );
+    BOOL status = transfer(true, const_cast<void *>(_src), _size, &wr);
     if (_written)
         *_written = wr;
+    STM32_TRACE(BytesWritten, wr);
 
     Stm32BootClient::ErrorCode result = ( status == 0 ) ? Stm32BootClient::ErrorCode::FAILED : Stm32BootClient::ErrorCode::OK;
     return result;
@@ -87,18 +112,41 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::write( const void * _src, size_t _siz
  */
 Stm32BootClient::ErrorCode Stm32BootLowIo::read( void * _dst, size_t _size, size_t * _read ) {
     DWORD rd;
-    BOOL status = ReadFile(
-        s_serialHandle,
-        _dst,
-        static_cast<DWORD>(_size),
-        reinterpret_cast<LPDWORD>(&rd),
-        NULL);
+    BOOL status = transfer(false, _dst, _size, &rd);
     if (_read) {
         *_read = rd;
     }
+    STM32_TRACE(BytesRead, rd);
+    if (rd < _size)
+        STM32_TRACE(Timeout, _size - rd);
     Stm32BootClient::ErrorCode result = ( status == 0 ) ? Stm32BootClient::ErrorCode::FAILED : Stm32BootClient::ErrorCode::OK;
     return result;
 }
+/*!
+ * Function: readSome
+ * Takes what the driver has received, at least one byte unless the read
+ * timeout passes first. Not traced, Stm32RxPump traces what the protocol gets.
+ *
+ * @param _dst a pointer to the destanation buffer.
+ * @param _size size of the buffer.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32BootLowIo::readSome( void * _dst, size_t _size, size_t * _read ) {
+    DWORD errors;
+    COMSTAT stat;
+    size_t size = 1;
+    if (ClearCommError(s_serialHandle, &errors, &stat) && stat.cbInQue > 1)
+        size = stat.cbInQue;
+    if (size > _size)
+        size = _size;
+    DWORD rd;
+    BOOL status = transfer(false, _dst, size, &rd);
+    if (_read)
+        *_read = rd;
+    return ( status == 0 ) ? Stm32BootClient::ErrorCode::FAILED : Stm32BootClient::ErrorCode::OK;
+}
 /*!
  * Function: deinit 
  * Deinitializes serial port.
@@ -108,8 +156,14 @@ Stm32BootClient::ErrorCode Stm32BootLowIo::read( void * _dst, size_t _size, size
 Stm32BootClient::ErrorCode Stm32BootLowIo::deinit() {
     Stm32BootClient::ErrorCode result;
     result = CloseHandle(s_serialHandle) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+    CloseHandle(s_readEvent);
+    CloseHandle(s_writeEvent);
     return result;
 }
+Stm32BootClient::ErrorCode Stm32BootLowIo::flush() {
+    BOOL status = PurgeComm(s_serialHandle, PURGE_RXCLEAR | PURGE_TXCLEAR);
+    return ( status == 0 ) ? Stm32BootClient::ErrorCode::FAILED : Stm32BootClient::ErrorCode::OK;
+}
 /*!
  * Function: setResetLine 
  * Control reset MCU line.
@@ -138,12 +192,50 @@ void Stm32BootLowIo::setBootLine( bool _level ) {
     std::cin.get();
 }
 /*!
- * Function: delayMs 
+ * Function: delay 
  * Performs delay.
  * 
  * @param _delay how many ms to wait.
  */
-void Stm32BootLowIo::delayMs( uint32_t _delay ) {
+void Stm32BootLowIo::delay( uint32_t _delay ) {
     Sleep(_delay);
 }
-
+/*!
+ * Function: setSerialBus
+ * There is only one serial port on PC, the bus is just remembered.
+ *
+ * @param _code bus to select.
+ */
+void Stm32BootLowIo::setSerialBus( Bus _code ) {
+    m_bus = _code;
+}
+Stm32BootLowIo::Bus Stm32BootLowIo::getSerialBus() {
+    return m_bus;
+}
+int Stm32BootLowIo::getCurrentBusIdx() {
+    return static_cast<int>(m_bus);
+}
+/*!
+ * Function: getTickMs
+ * Milliseconds since the system start, used to timestamp trace records.
+ *
+ * @return uint32_t
+ */
+uint32_t Stm32BootLowIo::getTickMs() {
+    return static_cast<uint32_t>(GetTickCount());
+}
+/*!
+ * Function: startWorker
+ * Bus workers of Stm32BusScheduler are threads on PC.
+ *
+ * @return bool true.
+ */
+bool Stm32BusScheduler::startWorker( size_t _idx, void ( *_entry )( void * ), void * _arg ) {
+    s_workers[_idx] = std::thread(_entry, _arg);
+    return true;
+}
+void Stm32BusScheduler::joinWorker( size_t _idx ) {
+    if (s_workers[_idx].joinable())
+        s_workers[_idx].join();
+}
+#endif
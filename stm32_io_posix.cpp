@@ -0,0 +1,236 @@
+/*!
+  /brief Platform-dependent function to handle serial port, the Linux counterpart of stm32_io_pc.cpp.
+  */
+#include "stm32_io.hpp"
+#include "stm32_bus_scheduler.hpp"
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+static const char SERIAL_PORT[] = "/dev/ttyUSB0";
+static const int READ_TIMEOUT_MS = 50;          /// the same timeouts as the COM port on PC
+static const int READ_TIMEOUT_PER_BYTE_MS = 10;
+static int s_serialFd = -1;
+static std::thread s_workers[Stm32BusScheduler::MAX_BUSES];
+
+Stm32BootLowIo::Bus Stm32BootLowIo::m_bus = Stm32BootLowIo::Bus::Bus0;
+/*!
+ * Function: waitReadable
+ * @return bool true if the port has data before _timeoutMs.
+ */
+static bool waitReadable( int _timeoutMs ) {
+    struct pollfd pfd = { s_serialFd, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, _timeoutMs > 0 ? _timeoutMs : 0);
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0;
+}
+/*!
+ * Function: init
+ * Initializes serial port: 115200 8E1, raw.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32BootLowIo::init() {
+    Stm32BootClient::ErrorCode result;
+    s_serialFd = open(SERIAL_PORT, O_RDWR | O_NOCTTY);
+    result = ( s_serialFd < 0 ) ? Stm32BootClient::ErrorCode::SERIAL_CANT_OPEN : Stm32BootClient::ErrorCode::OK;
+    if (result == Stm32BootClient::ErrorCode::OK) {
+        struct termios tio;
+        result = ( tcgetattr(s_serialFd, &tio) != 0 ) ? Stm32BootClient::ErrorCode::FAILED : Stm32BootClient::ErrorCode::OK;
+        if (result == Stm32BootClient::ErrorCode::OK) {
+            cfmakeraw(&tio);
+            tio.c_cflag |= CLOCAL | CREAD | PARENB;
+            tio.c_cflag &= ~static_cast<tcflag_t>(PARODD | CSTOPB);
+            tio.c_cc[VMIN] = 0; // reads return what has arrived, the timeouts are poll()'s
+            tio.c_cc[VTIME] = 0;
+            cfsetispeed(&tio, B115200);
+            cfsetospeed(&tio, B115200);
+            result = ( tcsetattr(s_serialFd, TCSANOW, &tio) != 0 ) ? Stm32BootClient::ErrorCode::FAILED :
+                Stm32BootClient::ErrorCode::OK;
+        }
+    }
+    return result;
+}
+/*!
+ * Function: write
+ * Write data to serial port.
+ *
+ * @param _src a pointer to the source buffer.
+ * @param _size number of bytes to be written.
+ * @param _written how many bytes were actually written.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32BootLowIo::write( const void * _src, size_t _size, size_t * _written ) {
+    const uint8_t * src = static_cast<const uint8_t *>(_src);
+    size_t done = 0;
+    Stm32BootClient::ErrorCode result = Stm32BootClient::ErrorCode::OK;
+    while (done < _size && result == Stm32BootClient::ErrorCode::OK) {
+        ssize_t wr = ::write(s_serialFd, src + done, _size - done);
+        if (wr > 0)
+            done += static_cast<size_t>(wr);
+        else if (wr < 0 && errno != EINTR)
+            result = Stm32BootClient::ErrorCode::FAILED;
+    }
+    if (_written)
+        *_written = done;
+    STM32_TRACE(BytesWritten, done);
+    return result;
+}
+/*!
+ * Function: read
+ * Read data from serial port.
+ *
+ * @param _dst a pointer to the destanation buffer.
+ * @param _size number of bytes to be read.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32BootLowIo::read( void * _dst, size_t _size, size_t * _read ) {
+    typedef std::chrono::steady_clock Clock_t;
+    auto deadline = Clock_t::now() + std::chrono::milliseconds(READ_TIMEOUT_MS + READ_TIMEOUT_PER_BYTE_MS * static_cast<int64_t>(_size));
+    uint8_t * dst = static_cast<uint8_t *>(_dst);
+    size_t done = 0;
+    Stm32BootClient::ErrorCode result = Stm32BootClient::ErrorCode::OK;
+    while (done < _size && result == Stm32BootClient::ErrorCode::OK) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock_t::now()).count();
+        if (!waitReadable(static_cast<int>(left)))
+            break;
+        ssize_t rd = ::read(s_serialFd, dst + done, _size - done);
+        if (rd > 0)
+            done += static_cast<size_t>(rd);
+        else if (rd < 0 && errno != EINTR && errno != EAGAIN)
+            result = Stm32BootClient::ErrorCode::FAILED;
+    }
+    if (_read) {
+        *_read = done;
+    }
+    STM32_TRACE(BytesRead, done);
+    if (done < _size)
+        STM32_TRACE(Timeout, _size - done);
+    return result;
+}
+/*!
+ * Function: readSome
+ * Takes what the driver has received, at least one byte unless the read
+ * timeout passes first. Not traced, Stm32RxPump traces what the protocol gets.
+ *
+ * @param _dst a pointer to the destanation buffer.
+ * @param _size size of the buffer.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32BootLowIo::readSome( void * _dst, size_t _size, size_t * _read ) {
+    Stm32BootClient::ErrorCode result = Stm32BootClient::ErrorCode::OK;
+    size_t done = 0;
+    if (waitReadable(READ_TIMEOUT_MS + READ_TIMEOUT_PER_BYTE_MS)) {
+        ssize_t rd = ::read(s_serialFd, _dst, _size);
+        if (rd > 0)
+            done = static_cast<size_t>(rd);
+        else if (rd < 0 && errno != EINTR && errno != EAGAIN)
+            result = Stm32BootClient::ErrorCode::FAILED;
+    }
+    if (_read)
+        *_read = done;
+    return result;
+}
+/*!
+ * Function: deinit
+ * Deinitializes serial port.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32BootLowIo::deinit() {
+    Stm32BootClient::ErrorCode result;
+    result = ( close(s_serialFd) == 0 ) ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FAILED;
+    s_serialFd = -1;
+    return result;
+}
+Stm32BootClient::ErrorCode Stm32BootLowIo::flush() {
+    return ( tcflush(s_serialFd, TCIOFLUSH) != 0 ) ? Stm32BootClient::ErrorCode::FAILED : Stm32BootClient::ErrorCode::OK;
+}
+/*!
+ * Function: setResetLine
+ * Control reset MCU line.
+ *
+ * @param _level true - hight level, false - low level
+ */
+void Stm32BootLowIo::setResetLine( bool _level ) {
+    if (!_level) {
+        std::cout << "Reset MCU, press ENTER...";
+        std::cin.get();
+    }
+}
+/*!
+ * Function: setBootLine
+ * Control boot line;
+ *
+ *
+ * @param _level true - high level, false - low level;
+ */
+void Stm32BootLowIo::setBootLine( bool _level ) {
+    if (_level) {
+        std::cout << "Set BOOT0 to high, press ENTER...";
+    } else {
+        std::cout << "Set BOOT0 to low, press ENTER...";
+    }
+    std::cin.get();
+}
+/*!
+ * Function: delay
+ * Performs delay.
+ *
+ * @param _delay how many ms to wait.
+ */
+void Stm32BootLowIo::delay( uint32_t _delay ) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(_delay));
+}
+/*!
+ * Function: setSerialBus
+ * There is only one serial port, the bus is just remembered.
+ *
+ * @param _code bus to select.
+ */
+void Stm32BootLowIo::setSerialBus( Bus _code ) {
+    m_bus = _code;
+}
+Stm32BootLowIo::Bus Stm32BootLowIo::getSerialBus() {
+    return m_bus;
+}
+int Stm32BootLowIo::getCurrentBusIdx() {
+    return static_cast<int>(m_bus);
+}
+/*!
+ * Function: getTickMs
+ * Milliseconds of a monotonic clock, used to timestamp trace records.
+ *
+ * @return uint32_t
+ */
+uint32_t Stm32BootLowIo::getTickMs() {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+/*!
+ * Function: startWorker
+ * Bus workers of Stm32BusScheduler are threads on Linux.
+ *
+ * @return bool true.
+ */
+bool Stm32BusScheduler::startWorker( size_t _idx, void ( *_entry )( void * ), void * _arg ) {
+    s_workers[_idx] = std::thread(_entry, _arg);
+    return true;
+}
+void Stm32BusScheduler::joinWorker( size_t _idx ) {
+    if (s_workers[_idx].joinable())
+        s_workers[_idx].join();
+}
+#endif
@@ -0,0 +1,275 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "included_macro.hpp"
+#include <string.h>
+/*!
+ * Target memory as a lazily loaded address space for tools that read many
+ * small scattered ranges: serial numbers, calibration data, configuration.
+ * Flash, RAM and system memory (the ranges of McuDescription_t) are cached in
+ * PAGE_SIZE pages. A miss reads the run of missing pages that starts with it,
+ * up to one full ReadMemory command, so neighbouring misses are coalesced and
+ * the pages after them are prefetched. Writes and erases through the view
+ * drop exactly the pages they touch, a new client session drops everything.
+ * Addresses outside the known ranges are read through, uncached. Like the
+ * core it never allocates: Lines pages live in the object.
+ */
+template<class Client, size_t Lines = 64>
+class Stm32MemoryView {
+public:
+    typedef Stm32BootBase::ErrorCode ErrorCode;
+    static const uint32_t PAGE_SIZE = 64;
+    static const uint32_t MAX_READ_SIZE = 256;     /// one ReadMemory command
+    typedef struct Stats_t {
+        uint32_t hits;              /// pages served from the cache
+        uint32_t misses;            /// pages which had to be read
+        uint32_t reads;             /// ReadMemory commands sent
+        uint32_t bytesRead;
+    }
+    Stats_t;
+    Stm32MemoryView();
+    ErrorCode read( void * _dst, uint32_t _addr, size_t _size );
+    ErrorCode write( const void * _src, uint32_t _addr, size_t _size );
+    ErrorCode erasePages( const uint16_t * _pages, size_t _count );
+    ErrorCode eraseAll();
+    void invalidate( uint32_t _addr, size_t _size );
+    void invalidateAll();
+    const Stats_t & stats() const {
+        return m_stats;
+    }
+private:
+    static_assert(Lines >= MAX_READ_SIZE / PAGE_SIZE, "a coalesced read must fit into the cache");
+    typedef struct Line_t {
+        uint32_t addr;
+        uint32_t used;              /// LRU stamp
+        bool valid;
+        uint8_t data[PAGE_SIZE];
+    }
+    Line_t;
+    void checkSession();
+    bool findRegion( uint32_t _addr, uint32_t &_begin, uint32_t &_end ) const;
+    Line_t * find( uint32_t _page );
+    Line_t * allocate( uint32_t _page );
+    ErrorCode fill( uint32_t _page, uint32_t _end );
+    Line_t m_lines[Lines];
+    uint8_t m_buf[MAX_READ_SIZE];
+    uint32_t m_clock;
+    uint32_t m_sessionId;
+    Stats_t m_stats;
+};
+
+template<class Client, size_t Lines>
+Stm32MemoryView<Client, Lines>::Stm32MemoryView()
+    : m_clock(0)
+    , m_sessionId(Client::sessionId()) {
+    memset(&m_stats, 0, sizeof( m_stats ));
+    invalidateAll();
+}
+/*!
+ * Function: read
+ * Copies target memory through the cache.
+ *
+ * @param _dst a pointer to the destination buffer.
+ * @param _addr start address, any alignment.
+ * @param _size number of bytes to be read.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+template<class Client, size_t Lines>
+Stm32BootBase::ErrorCode Stm32MemoryView<Client, Lines>::read( void * _dst, uint32_t _addr, size_t _size ) {
+    configASSERT(_dst);
+    auto err = ErrorCode::OK;
+    uint8_t * dst = static_cast<uint8_t *>(_dst);
+    checkSession();
+    while (_size && err == ErrorCode::OK) {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        size_t chunk = ( _size < MAX_READ_SIZE ) ? _size : MAX_READ_SIZE;
+        Line_t * line = nullptr;
+        if (findRegion(_addr, begin, end)) {
+            uint32_t page = _addr - ( _addr - begin ) % PAGE_SIZE;
+            line = find(page);
+            if (line) {
+                m_stats.hits++;
+            } else if (fill(page, end) == ErrorCode::OK) {
+                line = find(page);
+            }
+            if (line) {
+                size_t left = page + PAGE_SIZE - _addr;
+                chunk = ( _size < left ) ? _size : left;
+                memcpy(dst, &line->data[_addr - page], chunk);
+            } else if (chunk > end - _addr) {
+                chunk = end - _addr;
+            }
+        }
+        if (!line) {
+            // outside the known ranges or refused as a whole page, ask for just this piece
+            err = Client::commandReadMemory(dst, _addr, chunk);
+            m_stats.reads++;
+            m_stats.bytesRead += static_cast<uint32_t>(chunk);
+        }
+        dst += chunk;
+        _addr += static_cast<uint32_t>(chunk);
+        _size -= chunk;
+    }
+    return err;
+}
+/*!
+ * Function: write
+ * Writes through the client and drops the cached pages the range touches.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+template<class Client, size_t Lines>
+Stm32BootBase::ErrorCode Stm32MemoryView<Client, Lines>::write( const void * _src, uint32_t _addr, size_t _size ) {
+    checkSession();
+    auto err = Client::writeMemory(_src, _addr, _size);
+    invalidate(_addr, _size); // also after a failure, part of the range may have been written
+    return err;
+}
+/*!
+ * Function: erasePages
+ * Erases flash pages through the client and drops the cached pages in them.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+template<class Client, size_t Lines>
+Stm32BootBase::ErrorCode Stm32MemoryView<Client, Lines>::erasePages( const uint16_t * _pages, size_t _count ) {
+    checkSession();
+    auto err = Client::erasePages(_pages, _count);
+    const Stm32BootBase::SessionCaps_t & caps = Client::getCaps();
+    if (caps.valid && caps.mcuType != Stm32BootBase::McuType::Unknown) {
+        Stm32BootBase::McuDescription_t descr = Client::mcuType2Description(caps.mcuType);
+        for ( size_t i = 0; i < _count; i++ )
+            invalidate(descr.flashBegin + static_cast<uint32_t>(_pages[i]) * descr.flashPageSize, descr.flashPageSize);
+    } else {
+        invalidateAll();
+    }
+    return err;
+}
+/*!
+ * Function: eraseAll
+ * Mass erase through the client, RAM and system memory pages stay cached.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+template<class Client, size_t Lines>
+Stm32BootBase::ErrorCode Stm32MemoryView<Client, Lines>::eraseAll() {
+    checkSession();
+    auto err = Client::eraseAllMemory();
+    const Stm32BootBase::SessionCaps_t & caps = Client::getCaps();
+    if (caps.valid && caps.mcuType != Stm32BootBase::McuType::Unknown) {
+        invalidate(Client::mcuType2Description(caps.mcuType).flashBegin, caps.flashSize);
+    } else {
+        invalidateAll();
+    }
+    return err;
+}
+/*!
+ * Function: invalidate
+ * Drops every cached page overlapping the range, for changes made around
+ * the view.
+ */
+template<class Client, size_t Lines>
+void Stm32MemoryView<Client, Lines>::invalidate( uint32_t _addr, size_t _size ) {
+    for ( auto & line : m_lines ) {
+        if (line.valid && ( ( line.addr >= _addr ) ? line.addr - _addr < _size : _addr - line.addr < PAGE_SIZE ))
+            line.valid = false;
+    }
+}
+template<class Client, size_t Lines>
+void Stm32MemoryView<Client, Lines>::invalidateAll() {
+    for ( auto & line : m_lines ) {
+        line.valid = false;
+    }
+}
+/// A new sync may be another board or the same one after a reset, nothing cached holds
+template<class Client, size_t Lines>
+void Stm32MemoryView<Client, Lines>::checkSession() {
+    if (m_sessionId != Client::sessionId()) {
+        invalidateAll();
+        m_sessionId = Client::sessionId();
+    }
+}
+/*!
+ * Function: findRegion
+ * @return bool true if _addr is in flash, RAM or system memory of the
+ * session's MCU; pages are counted from _begin.
+ */
+template<class Client, size_t Lines>
+bool Stm32MemoryView<Client, Lines>::findRegion( uint32_t _addr, uint32_t &_begin, uint32_t &_end ) const {
+    bool found = false;
+    const Stm32BootBase::SessionCaps_t & caps = Client::getCaps();
+    if (caps.valid && caps.mcuType != Stm32BootBase::McuType::Unknown && !caps.rdpActive) {
+        Stm32BootBase::McuDescription_t descr = Client::mcuType2Description(caps.mcuType);
+        const uint32_t regions[][2] = {
+            { descr.flashBegin, descr.flashBegin + caps.flashSize },
+            { descr.ramBegin, descr.ramBegin + descr.ramSize },
+            { descr.blSysMemBegin, descr.blSysMemEnd + 1 },
+        };
+        for ( auto & region : regions ) {
+            if (!found && _addr >= region[0] && _addr < region[1]) {
+                _begin = region[0];
+                _end = region[1];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+template<class Client, size_t Lines>
+typename Stm32MemoryView<Client, Lines>::Line_t * Stm32MemoryView<Client, Lines>::find( uint32_t _page ) {
+    Line_t * result = nullptr;
+    for ( auto & line : m_lines ) {
+        if (line.valid && line.addr == _page) {
+            line.used = ++m_clock;
+            result = &line;
+        }
+    }
+    return result;
+}
+/// A free line or the least recently used one
+template<class Client, size_t Lines>
+typename Stm32MemoryView<Client, Lines>::Line_t * Stm32MemoryView<Client, Lines>::allocate( uint32_t _page ) {
+    Line_t * victim = &m_lines[0];
+    for ( auto & line : m_lines ) {
+        if (!line.valid || ( victim->valid && line.used < victim->used ))
+            victim = &line;
+        if (!victim->valid)
+            break;
+    }
+    victim->addr = _page;
+    victim->used = ++m_clock;
+    victim->valid = true;
+    return victim;
+}
+/*!
+ * Function: fill
+ * Reads _page together with the missing pages right after it, as many as
+ * one ReadMemory command takes and the region holds.
+ *
+ * @param _page page address, a miss.
+ * @param _end end of the region.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+template<class Client, size_t Lines>
+Stm32BootBase::ErrorCode Stm32MemoryView<Client, Lines>::fill( uint32_t _page, uint32_t _end ) {
+    auto err = ErrorCode::FAILED;
+    uint32_t size = 0;
+    while (size < MAX_READ_SIZE && _end - _page - size >= PAGE_SIZE && ( !size || !find(_page + size) ))
+        size += PAGE_SIZE;
+    if (size) {
+        err = Client::commandReadMemory(m_buf, _page, size);
+        m_stats.reads++;
+        if (err == ErrorCode::OK) {
+            m_stats.bytesRead += size;
+            for ( uint32_t offset = 0; offset < size; offset += PAGE_SIZE ) {
+                memcpy(allocate(_page + offset)->data, &m_buf[offset], PAGE_SIZE);
+                m_stats.misses++;
+            }
+        }
+    }
+    return err;
+}
+#endif
@@ -0,0 +1,650 @@
+/*!
+/brief Software STM32 bootloader for host tests of the USART, I2C, SPI and CAN protocol variants.
+*/
+#include "stm32_mock_target.hpp"
+#include "stm32_boot_client_impl.hpp"
+#include "stm32_ram_test.hpp"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <string.h>
+
+static const uint8_t ACK_CODE = 0x79;
+static const uint8_t NACK_CODE = 0x1f;
+static const uint8_t BUSY_CODE = 0x76;
+static const uint8_t USART_SYNC_CODE = 0x7f;
+static const uint8_t SPI_SOF_CODE = 0x5a;
+static const uint8_t SPI_DUMMY_CODE = 0xa5;
+static const uint8_t USART_BOOT_VERSION = 0x31;
+static const uint8_t BUS_BOOT_VERSION = 0x11;
+static const uint32_t PAYLOAD_ID = 0x4b434f4d; /// "MOCK"
+static const uint8_t s_usartCommands[] = {0x00, 0x01, 0x02, 0x11, 0x21, 0x31, 0x43, 0x44};
+static const uint8_t s_i2cCommands[] = {0x00, 0x01, 0x02, 0x11, 0x21, 0x31, 0x32, 0x44, 0x45};
+static const uint8_t s_spiCommands[] = {0x00, 0x01, 0x02, 0x11, 0x21, 0x31, 0x44};
+static const uint8_t s_canCommands[] = {0x00, 0x01, 0x02, 0x11, 0x21, 0x31, 0x43};
+
+Stm32MockTarget::Stm32MockTarget( ProtocolVariant _variant, uint16_t _chipId, uint32_t _flashSize )
+    : m_variant(_variant)
+    , m_chipId(_chipId)
+    , m_descr(Stm32BootClient::mcuType2Description(Stm32BootClient::chipId2McuType(_chipId)))
+    , m_flash(_flashSize, 0xff)
+    , m_ram(m_descr.ramSize, 0)
+    , m_stage(Stage::Sync)
+    , m_cmd(0)
+    , m_address(0)
+    , m_confirms(0)
+    , m_expected(0)
+    , m_busyPolls(3)
+    , m_pageEraseUs(0)
+    , m_massEraseUs(0)
+    , m_halfWordUs(0)
+    , m_delayedMs(0)
+    , m_goAddress(0)
+    , m_legacyErase(false)
+    , m_running(false)
+    , m_payload(false)
+    , m_reading(false) {
+    m_flashSizeReg[0] = static_cast<uint8_t>(_flashSize / 1024);
+    m_flashSizeReg[1] = static_cast<uint8_t>(_flashSize / 1024 >> 8);
+    reset();
+    resetStats();
+}
+/*!
+ * Function: reset
+ * RESET pulse with BOOT0 high: drops everything in flight and waits for the
+ * sync byte again. I2C has none, its bootloader takes commands right away.
+ */
+void Stm32MockTarget::reset() {
+    m_in.clear();
+    m_out.clear();
+    m_confirms = 0;
+    m_running = false;
+    m_payload = false;
+    m_stage = ( m_variant == ProtocolVariant::I2c ) ? Stage::Command : Stage::Sync;
+    m_expected = 0;
+}
+void Stm32MockTarget::resetStats() {
+    memset(&m_stats, 0, sizeof( m_stats ));
+    m_reading = false;
+}
+/*!
+ * Function: write
+ * Takes bytes from the host and runs the protocol as far as they allow. On
+ * SPI the host confirms every ACK or NACK it got, those bytes are dropped.
+ * On CAN the bytes are whole CanFrame_t records.
+ *
+ * @param _src a pointer to the source buffer.
+ * @param _size number of bytes written by the host.
+ */
+void Stm32MockTarget::write( const uint8_t * _src, size_t _size ) {
+    configASSERT(_src);
+    m_reading = false;
+    if (!m_running && m_variant == ProtocolVariant::Can) {
+        Stm32BootClient::CanFrame_t frame;
+        for ( size_t i = 0; i + sizeof( frame ) <= _size && !m_running; i += sizeof( frame ) ) {
+            memcpy(&frame, _src + i, sizeof( frame ));
+            m_stats.hostTransfers++;
+            m_stats.hostBytes += std::min<size_t>(frame.dlc, sizeof( frame.data ));
+            takeCanFrame(frame);
+        }
+    } else if (!m_running) {
+        m_stats.hostTransfers++;
+        m_stats.hostBytes += _size;
+        for ( size_t i = 0; i < _size; i++ ) {
+            if (m_confirms && _src[i] == ACK_CODE) {
+                m_confirms--;
+            } else {
+                m_in.push_back(_src[i]);
+            }
+        }
+        while (step()) {}
+    } else if (m_payload) {
+        m_in.insert(m_in.end(), _src, _src + _size);
+        while (takeMailbox()) {}
+    }
+}
+/*!
+ * Function: startPayload
+ * Go to RAM on USART with a vector table there, stack pointer and reset
+ * handler in RAM: plays a test payload which says Hello on the mailbox.
+ *
+ * @return bool true if the payload runs.
+ */
+bool Stm32MockTarget::startPayload() {
+    bool ok = m_variant == ProtocolVariant::Usart && m_goAddress >= m_descr.ramBegin && memory(m_goAddress, 8);
+    if (ok) {
+        const uint8_t * p = memory(m_goAddress, 8);
+        uint32_t sp = p[0] | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+        uint32_t entry = p[4] | static_cast<uint32_t>(p[5]) << 8 | static_cast<uint32_t>(p[6]) << 16 |
+                         static_cast<uint32_t>(p[7]) << 24;
+        uint32_t ramEnd = m_descr.ramBegin + m_descr.ramSize;
+        ok = sp > m_descr.ramBegin && sp <= ramEnd && ( entry & 1 ) && entry >= m_descr.ramBegin && entry < ramEnd;
+    }
+    if (ok) {
+        uint8_t frame[Stm32Mailbox::MAX_FRAME];
+        const uint8_t hello[] = {
+            Stm32Mailbox::MAILBOX_VERSION, static_cast<uint8_t>(PAYLOAD_ID), static_cast<uint8_t>(PAYLOAD_ID >> 8),
+            static_cast<uint8_t>(PAYLOAD_ID >> 16), static_cast<uint8_t>(PAYLOAD_ID >> 24)
+        };
+        size_t size = Stm32Mailbox::assemble(frame, Stm32Mailbox::Message::Hello, hello, sizeof( hello ));
+        m_out.insert(m_out.end(), frame, frame + size);
+    }
+    return ok;
+}
+/*!
+ * Function: takeMailbox
+ * Answers a Run of the host: every test of the played payload passes and
+ * returns its arguments.
+ *
+ * @return bool true if input was consumed.
+ */
+bool Stm32MockTarget::takeMailbox() {
+    bool progress = false;
+    if (!m_in.empty() && m_in.front() != Stm32Mailbox::MAILBOX_SOF) {
+        m_in.pop_front();
+        progress = true;
+    } else if (m_in.size() >= 4 && m_in.size() >= m_in[2] + 4u) {
+        uint8_t size = m_in[2];
+        uint8_t x = static_cast<uint8_t>(m_in[1] ^ size);
+        uint8_t data[Stm32Mailbox::MAX_DATA + 1];
+        for ( size_t i = 0; i < size; i++ ) {
+            data[i + 1] = m_in[3 + i];
+            x ^= m_in[3 + i];
+        }
+        bool ok = x == m_in[3 + size] && m_in[1] == static_cast<uint8_t>(Stm32Mailbox::Message::Run) && size >= 1 &&
+                  size < Stm32Mailbox::MAX_DATA;
+        m_in.erase(m_in.begin(), m_in.begin() + size + 4);
+        if (ok) {
+            uint8_t frame[Stm32Mailbox::MAX_FRAME];
+            data[0] = data[1];  // test number
+            data[1] = 0;        // passed, the arguments follow
+            size_t frameSize = Stm32Mailbox::assemble(frame, Stm32Mailbox::Message::Result, data, size + 1u);
+            m_out.insert(m_out.end(), frame, frame + frameSize);
+        }
+        progress = true;
+    }
+    return progress;
+}
+/*!
+ * Function: read
+ * Hands the pending reply to the host. An SPI master always gets what it
+ * clocks, the dummy byte 0xa5 once the reply is exhausted; USART and I2C get
+ * a short count as on a timeout or a NACKed address.
+ *
+ * @param _dst a pointer to the destination buffer.
+ * @param _size number of bytes the host asks for.
+ *
+ * @return size_t how many bytes were delivered.
+ */
+size_t Stm32MockTarget::read( uint8_t * _dst, size_t _size ) {
+    configASSERT(_dst);
+    size_t rd = 0;
+    if (!m_reading)
+        m_stats.roundTrips++;
+    m_reading = true;
+    while (rd < _size && !m_out.empty()) {
+        _dst[rd++] = m_out.front();
+        m_out.pop_front();
+    }
+    if (m_variant == ProtocolVariant::Spi) {
+        while (rd < _size)
+            _dst[rd++] = SPI_DUMMY_CODE;
+    }
+    if (m_variant == ProtocolVariant::Can) {
+        Stm32BootClient::CanFrame_t frame;
+        for ( size_t i = 0; i + sizeof( frame ) <= rd; i += sizeof( frame ) ) {
+            memcpy(&frame, _dst + i, sizeof( frame ));
+            m_stats.targetTransfers++;
+            m_stats.targetBytes += std::min<size_t>(frame.dlc, sizeof( frame.data ));
+        }
+    } else {
+        m_stats.targetTransfers++;
+        m_stats.targetBytes += rd;
+    }
+    return rd;
+}
+void Stm32MockTarget::flush() {
+    m_out.clear();
+}
+/*!
+ * Function: step
+ * Runs one protocol phase if enough input has arrived.
+ *
+ * @return bool true if input was consumed.
+ */
+bool Stm32MockTarget::step() {
+    bool progress = false;
+    switch (m_stage) {
+    case Stage::Sync:
+        if (!m_in.empty()) {
+            uint8_t sync = ( m_variant == ProtocolVariant::Spi ) ? SPI_SOF_CODE : USART_SYNC_CODE;
+            if (m_in.front() == sync) {
+                answer(ACK_CODE);
+                m_stage = Stage::Command;
+            }
+            m_in.pop_front();
+            progress = true;
+        }
+        break;
+    case Stage::Command:
+        progress = takeCommand();
+        break;
+    case Stage::Address:
+        if (m_in.size() >= 5) {
+            progress = true;
+            m_stage = Stage::Command;
+            if (takeAddress() && memory(m_address, 1)) {
+                answer(ACK_CODE);
+                switch (static_cast<Stm32BootClient::Command>(m_cmd)) {
+                case Stm32BootClient::Command::ReadMemory:
+                    m_stage = Stage::ReadCount;
+                    break;
+                case Stm32BootClient::Command::Go:
+                    m_goAddress = m_address;
+                    m_running = true;
+                    m_payload = startPayload();
+                    if (!m_payload && m_variant == ProtocolVariant::Usart && !m_appOutput.empty()) {
+                        m_out.push_back(0x00); // the application reinitialises the port
+                        m_out.insert(m_out.end(), m_appOutput.begin(), m_appOutput.end());
+                    }
+                    break;
+                default:
+                    m_stage = Stage::WriteData;
+                    break;
+                }
+            } else {
+                answer(NACK_CODE);
+            }
+        }
+        break;
+    case Stage::ReadCount:
+        if (m_in.size() >= 2) {
+            size_t count = m_in[0] + 1u;
+            bool ok = ( m_in[0] ^ m_in[1] ) == 0xff && memory(m_address, count);
+            m_in.erase(m_in.begin(), m_in.begin() + 2);
+            answer(ok ? ACK_CODE : NACK_CODE);
+            if (ok)
+                sendData(memory(m_address, count), count);
+            m_stage = Stage::Command;
+            progress = true;
+        }
+        break;
+    case Stage::WriteData:
+        if (!m_in.empty() && m_in.size() >= m_in[0] + 3u) {
+            size_t count = m_in[0] + 1u;
+            uint8_t x = m_in[0];
+            for ( size_t i = 1; i <= count; i++ )
+                x ^= m_in[i];
+            uint8_t * p = memory(m_address, count);
+            bool ok = x == m_in[count + 1] && p;
+            if (ok) {
+                bool isFlash = m_address >= m_descr.flashBegin && m_address < m_descr.flashBegin + m_flash.size();
+                for ( size_t i = 0; i < count; i++ )
+                    p[i] = isFlash ? static_cast<uint8_t>(p[i] & m_in[i + 1]) : m_in[i + 1];
+                if (isFlash)
+                    program(count);
+            }
+            m_in.erase(m_in.begin(), m_in.begin() + static_cast<long>(count + 2));
+            if (ok && m_cmd == static_cast<uint8_t>(Stm32BootClient::Command::WriteMemNs))
+                answerBusy();
+            else
+                answer(ok ? ACK_CODE : NACK_CODE);
+            m_stage = Stage::Command;
+            progress = true;
+        }
+        break;
+    case Stage::Erase:
+        if (m_in.size() >= 2) {
+            bool ok = true;
+            size_t used = 2;
+            if (m_in[0] == 0xff) {
+                ok = m_in[1] == 0x00;
+                if (ok)
+                    eraseAll();
+            } else {
+                used = m_in[0] + 3u;
+                if (m_in.size() >= used) {
+                    uint8_t x = 0;
+                    for ( size_t i = 0; i < used - 1; i++ )
+                        x ^= m_in[i];
+                    ok = x == m_in[used - 1];
+                    for ( size_t i = 1; ok && i < used - 1; i++ )
+                        erasePage(m_in[i]);
+                } else {
+                    used = 0;
+                }
+            }
+            if (used) {
+                m_in.erase(m_in.begin(), m_in.begin() + static_cast<long>(used));
+                answer(ok ? ACK_CODE : NACK_CODE);
+                m_stage = Stage::Command;
+                progress = true;
+            }
+        }
+        break;
+    case Stage::ExtErase:
+        if (m_in.size() >= 3) {
+            uint16_t n = static_cast<uint16_t>(m_in[0] << 8 | m_in[1]);
+            size_t used = ( n >= Stm32BootClient::EXT_BANK2_ERASE ) ? 3 : 2 * ( n + 1u ) + 3;
+            if (m_in.size() >= used) {
+                uint8_t x = 0;
+                for ( size_t i = 0; i < used - 1; i++ )
+                    x ^= m_in[i];
+                bool ok = x == m_in[used - 1];
+                if (ok && n >= Stm32BootClient::EXT_BANK2_ERASE) {
+                    eraseAll();
+                }
+                for ( size_t i = 2; ok && n < Stm32BootClient::EXT_BANK2_ERASE && i < used - 1; i += 2 )
+                    erasePage(static_cast<uint32_t>(m_in[i] << 8 | m_in[i + 1]));
+                m_in.erase(m_in.begin(), m_in.begin() + static_cast<long>(used));
+                if (ok && m_cmd == static_cast<uint8_t>(Stm32BootClient::Command::ExtEraseNs))
+                    answerBusy();
+                else
+                    answer(ok ? ACK_CODE : NACK_CODE);
+                m_stage = Stage::Command;
+                progress = true;
+            }
+        }
+        break;
+    }
+    return progress;
+}
+/*!
+ * Function: takeCommand
+ * Decodes a command frame, 0x5a first on SPI, and answers the ones without
+ * further phases right away.
+ *
+ * @return bool true if input was consumed.
+ */
+bool Stm32MockTarget::takeCommand() {
+    bool progress = false;
+    if (m_variant == ProtocolVariant::Spi && !m_in.empty() && m_in.front() != SPI_SOF_CODE) {
+        m_in.pop_front(); // line noise between frames
+        progress = true;
+    } else if (m_in.size() >= ( ( m_variant == ProtocolVariant::Spi ) ? 3u : 2u )) {
+        if (m_variant == ProtocolVariant::Spi)
+            m_in.pop_front();
+        m_cmd = m_in[0];
+        bool ok = ( m_in[0] ^ m_in[1] ) == 0xff && isSupported(m_cmd);
+        m_in.erase(m_in.begin(), m_in.begin() + 2);
+        progress = true;
+        answer(ok ? ACK_CODE : NACK_CODE);
+        if (ok) {
+            m_stats.commands[m_cmd]++;
+            switch (static_cast<Stm32BootClient::Command>(m_cmd)) {
+            case Stm32BootClient::Command::Get:
+            case Stm32BootClient::Command::GvRps:
+            case Stm32BootClient::Command::Getid:
+                sendInfo();
+                break;
+            case Stm32BootClient::Command::Erase:
+                m_stage = Stage::Erase;
+                break;
+            case Stm32BootClient::Command::ExtErase:
+            case Stm32BootClient::Command::ExtEraseNs:
+                m_stage = Stage::ExtErase;
+                break;
+            default:
+                m_stage = Stage::Address;
+                break;
+            }
+        }
+    }
+    return progress;
+}
+/*!
+ * Function: takeCanFrame
+ * CAN variant: the frame ID is the command, arguments are in the payload,
+ * Write Memory data and Erase page numbers follow in separate frames.
+ *
+ * @param _frame frame from the host.
+ */
+void Stm32MockTarget::takeCanFrame( const Stm32BootClient::CanFrame_t &_frame ) {
+    if (m_stage == Stage::Sync) {
+        if (_frame.id == Stm32BootClient::CAN_SYNC_ID) {
+            m_cmd = static_cast<uint8_t>(Stm32BootClient::CAN_SYNC_ID);
+            answer(ACK_CODE);
+            m_stage = Stage::Command;
+        }
+    } else if (m_stage == Stage::WriteData || m_stage == Stage::Erase) {
+        uint16_t id = ( m_stage == Stage::WriteData ) ? Stm32BootClient::CAN_DATA_ID : m_cmd;
+        if (_frame.id == id) {
+            m_in.insert(m_in.end(), _frame.data, _frame.data + std::min<size_t>(_frame.dlc, sizeof( _frame.data )));
+            if (m_in.size() >= m_expected) {
+                if (m_stage == Stage::WriteData) {
+                    uint8_t * p = memory(m_address, m_expected);
+                    bool isFlash = m_address >= m_descr.flashBegin && m_address < m_descr.flashBegin + m_flash.size();
+                    for ( size_t i = 0; i < m_expected; i++ )
+                        p[i] = isFlash ? static_cast<uint8_t>(p[i] & m_in[i]) : m_in[i];
+                    if (isFlash)
+                        program(m_expected);
+                } else {
+                    for ( size_t i = 0; i < m_expected; i++ )
+                        erasePage(m_in[i]);
+                }
+                m_in.clear();
+                answer(ACK_CODE);
+                m_stage = Stage::Command;
+            }
+        }
+    } else if (_frame.id <= 0xff) {
+        static const uint8_t s_argSize[] = {0x00, 0, 0x01, 0, 0x02, 0, 0x11, 5, 0x21, 4, 0x31, 5, 0x43, 1};
+        m_cmd = static_cast<uint8_t>(_frame.id);
+        bool ok = isSupported(m_cmd);
+        for ( size_t i = 0; i < sizeof( s_argSize ); i += 2 ) {
+            if (s_argSize[i] == m_cmd)
+                ok = ok && _frame.dlc == s_argSize[i + 1];
+        }
+        m_address = static_cast<uint32_t>(_frame.data[0]) << 24 | static_cast<uint32_t>(_frame.data[1]) << 16 |
+            static_cast<uint32_t>(_frame.data[2]) << 8 | _frame.data[3];
+        m_expected = _frame.data[4] + 1u;
+        switch (static_cast<Stm32BootClient::Command>(m_cmd)) {
+        case Stm32BootClient::Command::ReadMemory:
+            ok = ok && memory(m_address, m_expected);
+            break;
+        case Stm32BootClient::Command::WriteMem:
+        case Stm32BootClient::Command::Go:
+            ok = ok && memory(m_address, ( m_cmd == static_cast<uint8_t>(Stm32BootClient::Command::Go) ) ? 1 : m_expected);
+            break;
+        default:
+            break;
+        }
+        answer(ok ? ACK_CODE : NACK_CODE);
+        if (ok) {
+            m_stats.commands[m_cmd]++;
+            switch (static_cast<Stm32BootClient::Command>(m_cmd)) {
+            case Stm32BootClient::Command::ReadMemory:
+                sendData(memory(m_address, m_expected), m_expected);
+                answer(ACK_CODE);
+                break;
+            case Stm32BootClient::Command::Go:
+                m_goAddress = m_address;
+                m_running = true;
+                break;
+            case Stm32BootClient::Command::WriteMem:
+                m_in.clear();
+                m_stage = Stage::WriteData;
+                break;
+            case Stm32BootClient::Command::Erase:
+                if (_frame.data[0] == 0xff) {
+                    eraseAll();
+                    answer(ACK_CODE);
+                } else {
+                    m_expected = _frame.data[0] + 1u;
+                    m_in.clear();
+                    m_stage = Stage::Erase;
+                }
+                break;
+            default:
+                sendInfo();
+                break;
+            }
+        }
+    }
+}
+/*!
+ * Function: sendInfo
+ * Reply of Get, Get Version & Read Protection Status or Get ID with the
+ * closing ACK. On CAN every byte of Get goes in its own frame as AN3154 shows.
+ */
+void Stm32MockTarget::sendInfo() {
+    uint8_t reply[2 + sizeof( s_i2cCommands )];
+    size_t len = 0;
+    uint8_t version = ( m_variant == ProtocolVariant::Usart ) ? USART_BOOT_VERSION : BUS_BOOT_VERSION;
+    switch (static_cast<Stm32BootClient::Command>(m_cmd)) {
+    case Stm32BootClient::Command::Get: {
+        size_t count;
+        const uint8_t * list = commandList(count);
+        len = 2;
+        for ( size_t i = 0; i < count; i++ ) {
+            if (isSupported(list[i]))
+                reply[len++] = list[i];
+        }
+        reply[0] = static_cast<uint8_t>(len - 2); // N = number of bytes to follow - 1
+        reply[1] = version;
+        break;
+    }
+    case Stm32BootClient::Command::GvRps:
+        reply[len++] = version;
+        reply[len++] = 0;
+        reply[len++] = 0;
+        break;
+    default:
+        reply[len++] = 1;
+        reply[len++] = static_cast<uint8_t>(m_chipId >> 8);
+        reply[len++] = static_cast<uint8_t>(m_chipId);
+        break;
+    }
+    if (m_variant == ProtocolVariant::Can && m_cmd == static_cast<uint8_t>(Stm32BootClient::Command::Get)) {
+        for ( size_t i = 0; i < len; i++ )
+            sendData(&reply[i], 1);
+    } else {
+        sendData(reply, len);
+    }
+    answer(ACK_CODE);
+}
+/*!
+ * Function: takeAddress
+ * Pops the four address bytes and their XOR.
+ *
+ * @return bool true if the checksum matches.
+ */
+bool Stm32MockTarget::takeAddress() {
+    uint8_t b[5];
+    for ( auto &x : b ) {
+        x = m_in.front();
+        m_in.pop_front();
+    }
+    m_address = static_cast<uint32_t>(b[0]) << 24 | static_cast<uint32_t>(b[1]) << 16 |
+        static_cast<uint32_t>(b[2]) << 8 | b[3];
+    return ( b[0] ^ b[1] ^ b[2] ^ b[3] ) == b[4];
+}
+/// ACK or NACK, on SPI after a dummy byte and to be confirmed by the host, on CAN in a frame of its own
+void Stm32MockTarget::answer( uint8_t _code ) {
+    if (m_variant == ProtocolVariant::Can) {
+        sendData(&_code, 1);
+        return;
+    }
+    if (m_variant == ProtocolVariant::Spi) {
+        m_out.push_back(SPI_DUMMY_CODE);
+        m_confirms++;
+    }
+    m_out.push_back(_code);
+}
+/// No-Stretch commands report BUSY while the flash operation runs
+void Stm32MockTarget::answerBusy() {
+    for ( uint32_t i = 0; i < m_busyPolls; i++ )
+        m_out.push_back(BUSY_CODE);
+    answer(ACK_CODE);
+}
+void Stm32MockTarget::sendData( const uint8_t * _src, size_t _size ) {
+    if (m_variant == ProtocolVariant::Can) {
+        // frames with the command as ID, 8 bytes each
+        for ( size_t pos = 0; pos < _size; pos += 8 ) {
+            Stm32BootClient::CanFrame_t frame;
+            memset(&frame, 0, sizeof( frame ));
+            frame.id = m_cmd;
+            frame.dlc = static_cast<uint8_t>(std::min<size_t>(_size - pos, sizeof( frame.data )));
+            memcpy(frame.data, _src + pos, frame.dlc);
+            const uint8_t * raw = reinterpret_cast<const uint8_t *>(&frame);
+            m_out.insert(m_out.end(), raw, raw + sizeof( frame ));
+        }
+        return;
+    }
+    if (m_variant == ProtocolVariant::Spi)
+        m_out.push_back(SPI_DUMMY_CODE);
+    m_out.insert(m_out.end(), _src, _src + _size);
+}
+/*!
+ * Function: memory
+ * Maps a target address range to the flash, the RAM or the flash size register.
+ *
+ * @return uint8_t* nullptr if the range is not entirely inside one of them.
+ */
+uint8_t * Stm32MockTarget::memory( uint32_t _address, size_t _size ) {
+    uint8_t * p = nullptr;
+    if (_address >= m_descr.flashBegin && _address - m_descr.flashBegin + _size <= m_flash.size()) {
+        p = &m_flash[_address - m_descr.flashBegin];
+    } else if (_address >= m_descr.ramBegin && _address - m_descr.ramBegin + _size <= m_ram.size()) {
+        p = &m_ram[_address - m_descr.ramBegin];
+    } else if (_address == m_descr.flashSizeReg && _size <= sizeof( m_flashSizeReg )) {
+        p = m_flashSizeReg;
+    }
+    return p;
+}
+void Stm32MockTarget::erasePage( uint32_t _page ) {
+    size_t begin = static_cast<size_t>(_page) * m_descr.flashPageSize;
+    if (begin < m_flash.size()) {
+        std::fill(m_flash.begin() + static_cast<long>(begin),
+                  m_flash.begin() + static_cast<long>(std::min(begin + m_descr.flashPageSize, m_flash.size())), 0xff);
+        m_stats.pagesErased++;
+        busy(m_pageEraseUs);
+    }
+}
+void Stm32MockTarget::eraseAll() {
+    std::fill(m_flash.begin(), m_flash.end(), 0xff);
+    m_stats.massErases++;
+    busy(m_massEraseUs);
+}
+void Stm32MockTarget::program( size_t _size ) {
+    m_stats.bytesProgrammed += _size;
+    busy(static_cast<uint64_t>(m_halfWordUs) * ( ( _size + 1 ) / 2 ));
+}
+/// The ACK is held back for that long: the host blocks in write() like it blocks reading the ACK from a real part
+void Stm32MockTarget::busy( uint64_t _us ) {
+    if (_us)
+        std::this_thread::sleep_for(std::chrono::microseconds(_us));
+}
+/// Every command the bootloader of the variant may have
+const uint8_t * Stm32MockTarget::commandList( size_t &_count ) const {
+    const uint8_t * list = s_usartCommands;
+    _count = sizeof( s_usartCommands );
+    if (m_variant == ProtocolVariant::I2c) {
+        list = s_i2cCommands;
+        _count = sizeof( s_i2cCommands );
+    } else if (m_variant == ProtocolVariant::Spi) {
+        list = s_spiCommands;
+        _count = sizeof( s_spiCommands );
+    } else if (m_variant == ProtocolVariant::Can) {
+        list = s_canCommands;
+        _count = sizeof( s_canCommands );
+    }
+    return list;
+}
+/// Command set of this target, legacy Erase and Extended Erase exclude each other
+bool Stm32MockTarget::isSupported( uint8_t _cmd ) const {
+    size_t count;
+    const uint8_t * list = commandList(count);
+    bool result = std::find(list, list + count, _cmd) != list + count;
+    if (_cmd == static_cast<uint8_t>(Stm32BootClient::Command::Erase))
+        result = result && ( m_legacyErase || m_variant == ProtocolVariant::Can );
+    if (_cmd == static_cast<uint8_t>(Stm32BootClient::Command::ExtErase))
+        result = result && !m_legacyErase;
+    return result;
+}
+/// The three mock clients, see Stm32BootMockUsartClient and friends
+template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart>>;
+template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::I2c>>;
+template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Spi>>;
+template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Can>>;
+template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart, 1>>;
@@ -0,0 +1,221 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+/*!
+ * Host side only: a software STM32 ROM bootloader speaking the USART, I2C,
+ * SPI or CAN variant of the protocol, so the client can be exercised without a
+ * board. It knows Get, GvRps, GetId, ReadMemory, Go, WriteMemory, Erase and
+ * Extended Erase, plus the I2C No-Stretch commands, which answer BUSY a few
+ * times before ACK. Flash behaves like NOR: writing only clears bits. Erase
+ * and program take no time unless setFlashTime() says otherwise.
+ */
+class Stm32MockTarget {
+public:
+    typedef Stm32BootClient::ProtocolVariant ProtocolVariant;
+    /// Work seen by the target since construction or resetStats(), Stm32JobPlan turns it into time
+    typedef struct Stats_t {
+        uint32_t commands[0x100];   /// accepted commands by code
+        size_t hostBytes;           /// from the host, CAN payload only
+        size_t targetBytes;         /// to the host, SPI dummies included, CAN payload only
+        size_t hostTransfers;       /// write() calls, CAN frames
+        size_t targetTransfers;     /// read() calls, CAN frames
+        size_t roundTrips;          /// the host turned from writing to reading
+        size_t pagesErased;
+        size_t massErases;
+        size_t bytesProgrammed;     /// into flash
+        uint32_t delayMs;           /// host waits, see Stm32BootMockIo::delay()
+    }
+    Stats_t;
+    explicit Stm32MockTarget( ProtocolVariant _variant, uint16_t _chipId = 0x0440, uint32_t _flashSize = 0x10000 );
+    void reset();
+    void write( const uint8_t * _src, size_t _size );
+    size_t read( uint8_t * _dst, size_t _size );
+    void flush();
+    size_t pending() const {
+        return m_out.size();
+    }
+    std::vector<uint8_t> & flash() {
+        return m_flash;
+    }
+    void setLegacyErase( bool _legacy ) {
+        m_legacyErase = _legacy;
+    }
+    void setBusyPolls( uint32_t _polls ) {
+        m_busyPolls = _polls;
+    }
+    /// Erase and program block the host for as long as on a real part, see Stm32JobPlan::FlashTiming_t
+    void setFlashTime( uint32_t _pageEraseUs, uint32_t _massEraseUs, uint32_t _halfWordUs ) {
+        m_pageEraseUs = _pageEraseUs;
+        m_massEraseUs = _massEraseUs;
+        m_halfWordUs = _halfWordUs;
+    }
+    /// What the played application sends after Go to flash, e.g. its alive banner
+    void setAppOutput( const std::vector<uint8_t> &_output ) {
+        m_appOutput = _output;
+    }
+    bool isRunning() const {
+        return m_running;
+    }
+    uint32_t getGoAddress() const {
+        return m_goAddress;
+    }
+    const Stats_t & stats() const {
+        return m_stats;
+    }
+    void resetStats();
+    void addDelay( uint32_t _ms ) {
+        m_stats.delayMs += _ms;
+        m_delayedMs += _ms;
+    }
+    /// Delays since construction, resetStats() leaves them
+    uint32_t delayedMs() const {
+        return m_delayedMs;
+    }
+private:
+    enum class Stage : uint8_t {
+        Sync,
+        Command,
+        Address,
+        ReadCount,
+        WriteData,
+        Erase,
+        ExtErase,
+    };
+    bool step();
+    bool takeCommand();
+    bool takeAddress();
+    bool startPayload();
+    bool takeMailbox();
+    void takeCanFrame( const Stm32BootClient::CanFrame_t &_frame );
+    void sendInfo();
+    void answer( uint8_t _code );
+    void answerBusy();
+    void sendData( const uint8_t * _src, size_t _size );
+    uint8_t * memory( uint32_t _address, size_t _size );
+    void erasePage( uint32_t _page );
+    void eraseAll();
+    void program( size_t _size );
+    void busy( uint64_t _us );
+    const uint8_t * commandList( size_t &_count ) const;
+    bool isSupported( uint8_t _cmd ) const;
+    ProtocolVariant m_variant;
+    uint16_t m_chipId;
+    Stm32BootClient::McuDescription_t m_descr;
+    std::vector<uint8_t> m_flash;
+    std::vector<uint8_t> m_ram;
+    std::vector<uint8_t> m_appOutput;
+    uint8_t m_flashSizeReg[2];
+    std::deque<uint8_t> m_in;
+    std::deque<uint8_t> m_out;
+    Stage m_stage;
+    uint8_t m_cmd;
+    uint32_t m_address;
+    uint32_t m_confirms;
+    size_t m_expected;
+    uint32_t m_busyPolls;
+    uint32_t m_pageEraseUs;
+    uint32_t m_massEraseUs;
+    uint32_t m_halfWordUs;
+    uint32_t m_delayedMs;
+    uint32_t m_goAddress;
+    bool m_legacyErase;
+    bool m_running;
+    bool m_payload;             /// Go went to a test payload in RAM, the mailbox is served
+    bool m_reading;
+    Stats_t m_stats;
+};
+/*!
+ * Transport policy for Stm32BootClientT over a Stm32MockTarget. RESET goes to
+ * the target, BOOT0 is ignored since it always starts in the bootloader, and
+ * delays take no time, they are only counted in the target statistics. Id
+ * tells several targets of a variant apart, each with its own client. The
+ * target is locked, readSome() may poll it from a Stm32BootRxThreadIo thread.
+ */
+template<Stm32BootClient::ProtocolVariant Variant, unsigned Id = 0>
+class Stm32BootMockIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Variant;
+    static const uint32_t POLL_US = 50;
+    static Stm32MockTarget & target() {
+        static Stm32MockTarget s_target(Variant);
+        return s_target;
+    }
+    static std::mutex & lock() {
+        static std::mutex s_lock;
+        return s_lock;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        std::lock_guard<std::mutex> guard(lock());
+        target().write(static_cast<const uint8_t *>(_src), _size);
+        if (_written)
+            *_written = _size;
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        std::lock_guard<std::mutex> guard(lock());
+        size_t rd = target().read(static_cast<uint8_t *>(_dst), _size);
+        if (_read)
+            *_read = rd;
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    /// The target answers at once, so the timeout is one poll
+    static Stm32BootClient::ErrorCode readSome( void * _dst, size_t _size, size_t * _read ) {
+        size_t rd = 0;
+        {
+            std::lock_guard<std::mutex> guard(lock());
+            if (target().pending())
+                rd = target().read(static_cast<uint8_t *>(_dst), _size);
+        }
+        if (!rd)
+            std::this_thread::sleep_for(std::chrono::microseconds(POLL_US));
+        if (_read)
+            *_read = rd;
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        std::lock_guard<std::mutex> guard(lock());
+        target().flush();
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static void setResetLine( bool _level ) {
+        if (!_level) {
+            std::lock_guard<std::mutex> guard(lock());
+            target().reset();
+        }
+    }
+    static void setBootLine( bool ) {}
+    static void delay( uint32_t _delay ) {
+        target().addDelay(_delay);
+    }
+    /// Host time plus the delays, which take no time here
+    static uint32_t getTickMs() {
+        std::lock_guard<std::mutex> guard(lock());
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count()) + target().delayedMs();
+    }
+};
+template<Stm32BootClient::ProtocolVariant Variant, unsigned Id>
+const uint32_t Stm32BootMockIo<Variant, Id>::POLL_US;
+typedef Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart>> Stm32BootMockUsartClient;
+typedef Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::I2c>> Stm32BootMockI2cClient;
+typedef Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Spi>> Stm32BootMockSpiClient;
+typedef Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Can>> Stm32BootMockCanClient;
+/// The unit on the second bus, for Stm32BusScheduler runs against two targets
+typedef Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart, 1>> Stm32BootMockUsart1Client;
+extern template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart>>;
+extern template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::I2c>>;
+extern template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Spi>>;
+extern template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Can>>;
+extern template class Stm32BootClientT<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart, 1>>;
+#endif
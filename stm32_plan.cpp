@@ -0,0 +1,110 @@
+/*!
+/brief Flash time estimate from the work a Stm32MockTarget has seen.
+*/
+#include "stm32_plan.hpp"
+
+/// Datasheet typical values, the bootloader programs by half-word on F0 and F1
+static const struct {
+    Stm32BootClient::McuType type;
+    Stm32JobPlan::FlashTiming_t timing;
+} s_flashTimings[] = {
+    { Stm32BootClient::McuType::Stm32F05xxx_F030x8, { "STM32F0", 0x10000, 30000, 30000, 53 } },
+    { Stm32BootClient::McuType::Stm32F09xxx, { "STM32F0", 0x40000, 30000, 30000, 53 } },
+    { Stm32BootClient::McuType::Stm32F10xxx_lowDensity, { "STM32F1", 0x8000, 30000, 30000, 52 } },
+    { Stm32BootClient::McuType::Stm32F10xxx_mediumDensity, { "STM32F1", 0x20000, 30000, 30000, 52 } },
+    { Stm32BootClient::McuType::Stm32F10xxx_highDensity, { "STM32F1", 0x80000, 30000, 30000, 52 } },
+    { Stm32BootClient::McuType::Stm32F10xxx_mediumDensityVl, { "STM32F1", 0x20000, 30000, 30000, 52 } },
+    { Stm32BootClient::McuType::Stm32F10xxx_highDensityVl, { "STM32F1", 0x80000, 30000, 30000, 52 } },
+};
+
+/*!
+ * Function: linkProfile
+ * Cost model of the link the job would run on.
+ *
+ * @param _variant protocol variant of the transport.
+ * @param _bitRate bit rate, 0 for the usual one of the variant.
+ * @param _network USART through a serial device server.
+ *
+ * @return Stm32JobPlan::LinkProfile_t
+ */
+Stm32JobPlan::LinkProfile_t Stm32JobPlan::linkProfile( Stm32BootClient::ProtocolVariant _variant, uint32_t _bitRate,
+                                                       bool _network ) {
+    LinkProfile_t link = { "USART 8E1", 115200, 11, 0, 1000 };
+    switch (_variant) {
+    case Stm32BootClient::ProtocolVariant::I2c:
+        link = { "I2C", 400000, 9, 20, 100 };
+        break;
+    case Stm32BootClient::ProtocolVariant::Spi:
+        link = { "SPI", 1000000, 8, 0, 50 };
+        break;
+    case Stm32BootClient::ProtocolVariant::Can:
+        link = { "CAN", 125000, 9, 55, 200 }; // 47 bits of a standard frame, stuff bits included
+        break;
+    default:
+        if (_network)
+            link = { "USART 8E1 over TCP", 115200, 11, 0, 3000 };
+        break;
+    }
+    if (_bitRate)
+        link.bitRate = _bitRate;
+    return link;
+}
+/*!
+ * Function: findFlashTiming
+ * @return bool false for an MCU type without timings.
+ */
+bool Stm32JobPlan::findFlashTiming( Stm32BootClient::McuType _type, FlashTiming_t &_timing ) {
+    bool found = false;
+    for ( auto & entry : s_flashTimings ) {
+        if (entry.type == _type) {
+            _timing = entry.timing;
+            found = true;
+        }
+    }
+    return found;
+}
+/*!
+ * Function: estimate
+ * Prices the target statistics: bits on the wire at the link bit rate, a
+ * turnaround per round trip, erase and program times of the family and the
+ * delays the client asked for.
+ *
+ * @return Stm32JobPlan::Estimate_t
+ */
+Stm32JobPlan::Estimate_t Stm32JobPlan::estimate( const Stm32MockTarget::Stats_t &_stats, const LinkProfile_t &_link,
+                                                 const FlashTiming_t &_timing ) {
+    Estimate_t result;
+    uint64_t bits = static_cast<uint64_t>(_stats.hostBytes + _stats.targetBytes) * _link.bitsPerByte +
+        static_cast<uint64_t>(_stats.hostTransfers + _stats.targetTransfers) * _link.transferBits;
+    result.wireUs = bits * 1000000u / _link.bitRate;
+    result.turnaroundUs = static_cast<uint64_t>(_stats.roundTrips) * _link.turnaroundUs;
+    result.eraseUs = static_cast<uint64_t>(_stats.pagesErased) * _timing.pageEraseUs +
+        static_cast<uint64_t>(_stats.massErases) * _timing.massEraseUs;
+    result.programUs = static_cast<uint64_t>(( _stats.bytesProgrammed + 1 ) / 2) * _timing.halfWordUs;
+    result.delayUs = static_cast<uint64_t>(_stats.delayMs) * 1000u;
+    return result;
+}
+/*!
+ * Function: print
+ * Command sequence summary, traffic and the predicted duration with its
+ * breakdown.
+ */
+void Stm32JobPlan::print( const Stm32MockTarget::Stats_t &_stats, const LinkProfile_t &_link, const FlashTiming_t &_timing,
+                          std::ostream &_out ) {
+    Estimate_t est = estimate(_stats, _link, _timing);
+    _out << "Plan: " << _link.name << " at " << _link.bitRate << " bit/s, " << _timing.family << " flash timings." << std::endl;
+    _out << "Commands:";
+    for ( size_t i = 0; i < sizeof( _stats.commands ) / sizeof( _stats.commands[0] ); i++ ) {
+        if (_stats.commands[i])
+            _out << " 0x" << std::hex << i << std::dec << " x" << _stats.commands[i];
+    }
+    _out << std::endl;
+    _out << "Bytes on the wire: " << _stats.hostBytes << " to the target, " << _stats.targetBytes << " back, in " <<
+        _stats.hostTransfers + _stats.targetTransfers << " transfers." << std::endl;
+    _out << "Round trips: " << _stats.roundTrips << std::endl;
+    _out << "Flash: " << _stats.pagesErased << " pages erased, " << _stats.massErases << " mass erases, " <<
+        _stats.bytesProgrammed << " bytes programmed." << std::endl;
+    _out << "Predicted: wire " << est.wireUs / 1000 << " ms, turnarounds " << est.turnaroundUs / 1000 << " ms, erase " <<
+        est.eraseUs / 1000 << " ms, program " << est.programUs / 1000 << " ms, delays " << est.delayUs / 1000 <<
+        " ms, total " << est.totalUs() / 1000 << " ms." << std::endl;
+}
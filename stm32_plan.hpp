@@ -0,0 +1,47 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_mock_target.hpp"
+#include <ostream>
+/*!
+ * Host side only: flash time estimate of a job. The job runs as it is against
+ * Stm32MockTarget (--plan), the work the target saw is priced with a link
+ * profile and the flash timings of the MCU family. Real runs print their
+ * measured time, the profiles and timings are what to tune when they disagree.
+ */
+class Stm32JobPlan {
+public:
+    typedef struct LinkProfile_t {
+        const char * name;
+        uint32_t bitRate;
+        uint16_t bitsPerByte;       /// character framing, 11 for 8E1
+        uint16_t transferBits;      /// per write() or read(): I2C START, address and STOP, CAN frame overhead
+        uint32_t turnaroundUs;      /// per round trip: USB serial latency, network, driver wake up
+    }
+    LinkProfile_t;
+    typedef struct FlashTiming_t {
+        const char * family;
+        uint32_t flashSize;         /// largest part of the family, the mock target gets that much flash
+        uint32_t pageEraseUs;
+        uint32_t massEraseUs;
+        uint32_t halfWordUs;        /// program time of 16 bits
+    }
+    FlashTiming_t;
+    typedef struct Estimate_t {
+        uint64_t wireUs;
+        uint64_t turnaroundUs;
+        uint64_t eraseUs;
+        uint64_t programUs;
+        uint64_t delayUs;
+        uint64_t totalUs() const {
+            return wireUs + turnaroundUs + eraseUs + programUs + delayUs;
+        }
+    }
+    Estimate_t;
+    static const uint16_t DEFAULT_CHIP_ID = 0x0440;
+    static LinkProfile_t linkProfile( Stm32BootClient::ProtocolVariant _variant, uint32_t _bitRate, bool _network );
+    static bool findFlashTiming( Stm32BootClient::McuType _type, FlashTiming_t &_timing );
+    static Estimate_t estimate( const Stm32MockTarget::Stats_t &_stats, const LinkProfile_t &_link, const FlashTiming_t &_timing );
+    static void print( const Stm32MockTarget::Stats_t &_stats, const LinkProfile_t &_link, const FlashTiming_t &_timing,
+                       std::ostream &_out );
+};
+#endif
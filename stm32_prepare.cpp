@@ -0,0 +1,139 @@
+/*!
+/brief Host side image preparation which doesn't need the target.
+*/
+#include "stm32_prepare.hpp"
+#include "included_macro.hpp"
+#include <chrono>
+#include <string.h>
+
+Stm32PreparedImage::Stm32PreparedImage()
+    : m_cacheHit(false)
+    , m_prepTimeMs(0) {
+    m_packStats = PackStats_t();
+}
+/*!
+ * Function: prepare
+ * Loads the image (through the cache), plans erase for every known flash
+ * geometry and assembles all Write Memory frames.
+ *
+ * @param _fname .bin or .hex file.
+ * @param _binBase where a raw binary is placed.
+ * @param _cache image cache, must outlive this object.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+Stm32BootClient::ErrorCode Stm32PreparedImage::prepare( const std::string &_fname, uint32_t _binBase, Stm32ImageCache &_cache ) {
+    auto start = std::chrono::steady_clock::now();
+    auto err = _cache.load(_fname, _binBase, m_image, &m_cacheHit);
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        planErase();
+        assembleFrames();
+    }
+    m_prepTimeMs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    return err;
+}
+const Stm32ImageIndex & Stm32PreparedImage::image() const {
+    return m_image;
+}
+const Stm32PreparedImage::ErasePlan_t * Stm32PreparedImage::findErasePlan( Stm32BootClient::McuType _type ) const {
+    const ErasePlan_t * result = nullptr;
+    if (_type != Stm32BootClient::McuType::Unknown) {
+        auto descr = Stm32BootClient::mcuType2Description(_type);
+        for ( auto & plan : m_erasePlans ) {
+            if (plan.flashBegin == descr.flashBegin && plan.pageSize == descr.flashPageSize)
+                result = &plan;
+        }
+    }
+    return result;
+}
+const std::vector<Stm32BootClient::WriteFrame_t> & Stm32PreparedImage::frames() const {
+    return m_frames;
+}
+const Stm32PreparedImage::PackStats_t & Stm32PreparedImage::packStats() const {
+    return m_packStats;
+}
+bool Stm32PreparedImage::isCacheHit() const {
+    return m_cacheHit;
+}
+uint32_t Stm32PreparedImage::prepTimeMs() const {
+    return m_prepTimeMs;
+}
+/*!
+ * Function: planErase
+ * Every page touched by the image is erased, pages out of the image are kept.
+ * Above MASS_ERASE_PAGE_THRESHOLD pages mass erase is faster, which is only
+ * reported: what is erased beyond the image is up to the user.
+ */
+void Stm32PreparedImage::planErase() {
+    m_erasePlans.clear();
+    for ( size_t t = 0; t < Stm32BootClient::mcuTypeCount(); t++ ) {
+        auto descr = Stm32BootClient::mcuType2Description(static_cast<Stm32BootClient::McuType>(t));
+        if (findErasePlan(static_cast<Stm32BootClient::McuType>(t)))
+            continue;
+        ErasePlan_t plan;
+        plan.flashBegin = descr.flashBegin;
+        plan.pageSize = descr.flashPageSize;
+        const Stm32ImageIndex::Geometry_t * geo = m_image.findGeometry(plan.flashBegin, plan.pageSize);
+        configASSERT(geo);
+        for ( uint32_t page = geo->firstPage; page < geo->firstPage + geo->pageCount; page++ ) {
+            uint32_t pageBegin = plan.flashBegin + page * plan.pageSize;
+            bool touched = false;
+            for ( uint32_t i = 0; i < m_image.header().segmentCount && !touched; i++ ) {
+                const Stm32ImageIndex::Segment_t & seg = m_image.segment(i);
+                touched = seg.addr < pageBegin + plan.pageSize && seg.addr + seg.size > pageBegin;
+            }
+            if (touched)
+                plan.pages.push_back(static_cast<uint16_t>(page));
+        }
+        plan.massEraseFaster = plan.pages.size() > MASS_ERASE_PAGE_THRESHOLD;
+        m_erasePlans.push_back(plan);
+    }
+}
+/*!
+ * Function: assembleFrames
+ * Packs the image into as few Write Memory frames as possible. Every touched
+ * page is erased before writing, so blank bytes need no frame. A frame starts
+ * word aligned at the next byte to be written and takes everything up to
+ * MAX_WRITE_BLOCK_SIZE bytes on, gaps of up to MAX_GAP_FILL bytes between
+ * segments are filled with the erased value. Frames never share a word, so
+ * no flash word is programmed twice.
+ */
+void Stm32PreparedImage::assembleFrames() {
+    m_frames.clear();
+    m_packStats = PackStats_t();
+    Stm32BootClient::WriteFrame_t frame;
+    uint8_t * data = &frame.dataPhase[1];
+    uint32_t begin = 0;
+    uint32_t size = 0; // up to the last byte to be written
+    for ( uint32_t i = 0; i < m_image.header().segmentCount; i++ ) {
+        const Stm32ImageIndex::Segment_t & seg = m_image.segment(i);
+        const uint8_t * src = m_image.segmentData(i);
+        for ( uint32_t offset = 0; offset < seg.size; offset++ ) {
+            if (src[offset] == ERASED_VALUE)
+                continue;
+            uint32_t addr = seg.addr + offset;
+            if (size && ( addr - begin >= Stm32BootClient::MAX_WRITE_BLOCK_SIZE || addr - ( begin + size ) > MAX_GAP_FILL )) {
+                addFrame(frame, begin, size);
+                size = 0;
+            }
+            if (!size) {
+                begin = addr & ~3u;
+                memset(data, ERASED_VALUE, Stm32BootClient::MAX_WRITE_BLOCK_SIZE);
+            }
+            data[addr - begin] = src[offset];
+            size = addr - begin + 1;
+            m_packStats.payloadBytes++;
+        }
+    }
+    if (size)
+        addFrame(frame, begin, size);
+}
+/// Pads the frame data up to a word and keeps the frame
+void Stm32PreparedImage::addFrame( Stm32BootClient::WriteFrame_t &_frame, uint32_t _addr, uint32_t _size ) {
+    uint32_t padded = ( _size + 3 ) & ~3u;
+    Stm32BootClient::assembleWriteFrame(_frame, &_frame.dataPhase[1], _addr, padded);
+    m_frames.push_back(_frame);
+    m_packStats.frames++;
+    m_packStats.frameBytes += padded;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_image_cache.hpp"
+#include <string>
+#include <vector>
+/*!
+ * Host side work that doesn't need the target: image loading, erase planning
+ * for every known flash geometry and Write Memory frames assembled in advance.
+ * It is meant to run on a worker thread while the target is being synced.
+ */
+class Stm32PreparedImage {
+public:
+    typedef struct ErasePlan_t {
+        uint32_t flashBegin;
+        uint32_t pageSize;
+        bool massEraseFaster;       /// a hint only: -e would take less time, but erases pages outside the image
+        std::vector<uint16_t> pages;
+    }
+    ErasePlan_t;
+    /// How well the image filled its Write Memory frames
+    typedef struct PackStats_t {
+        uint32_t frames;
+        uint32_t payloadBytes;      /// image bytes which are not blank
+        uint32_t frameBytes;        /// data bytes sent, gap fill and word padding included
+        uint32_t fillPercent() const {
+            return frameBytes ? static_cast<uint32_t>(100ull * payloadBytes / frameBytes) : 100;
+        }
+    }
+    PackStats_t;
+    Stm32PreparedImage();
+    Stm32BootClient::ErrorCode prepare( const std::string &_fname, uint32_t _binBase, Stm32ImageCache &_cache );
+    const Stm32ImageIndex & image() const;
+    const ErasePlan_t * findErasePlan( Stm32BootClient::McuType _type ) const;
+    const std::vector<Stm32BootClient::WriteFrame_t> & frames() const;
+    const PackStats_t & packStats() const;
+    bool isCacheHit() const;
+    uint32_t prepTimeMs() const;
+private:
+    static const size_t MASS_ERASE_PAGE_THRESHOLD = 16;
+    static const uint32_t MAX_GAP_FILL = 64;    /// a longer gap costs more on the wire than a frame of its own
+    static const uint8_t ERASED_VALUE = 0xff;
+    void planErase();
+    void assembleFrames();
+    void addFrame( Stm32BootClient::WriteFrame_t &_frame, uint32_t _addr, uint32_t _size );
+    Stm32ImageIndex m_image;
+    std::vector<ErasePlan_t> m_erasePlans;
+    std::vector<Stm32BootClient::WriteFrame_t> m_frames;
+    PackStats_t m_packStats;
+    bool m_cacheHit;
+    uint32_t m_prepTimeMs;
+};
+#endif
@@ -0,0 +1,254 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "stm32_handoff.hpp"
+#include "included_macro.hpp"
+#include <string.h>
+/*!
+ * Mailbox between the host and a test payload running from SRAM, on the link
+ * of the bootloader with its line settings (USART 8E1 at the synced baud
+ * rate). A message in either direction is a frame:
+ * MAILBOX_SOF, type, N (0..MAX_DATA), N data bytes, XOR of type, N and data.
+ * Hello   payload -> host once it runs: MAILBOX_VERSION, payload id (4 bytes, LSB first).
+ * Run     host -> payload: test number, arguments.
+ * Result  payload -> host for every Run: test number, status (0 passed), result data.
+ */
+class Stm32Mailbox {
+public:
+    enum class Message : uint8_t {
+        Hello = 0x01,
+        Run = 0x02,
+        Result = 0x03,
+    };
+    static const uint8_t MAILBOX_SOF = 0xa5;
+    static const uint8_t MAILBOX_VERSION = 1;
+    static const size_t MAX_DATA = 250;
+    static const size_t MAX_FRAME = MAX_DATA + 4;
+    /// Builds a frame into _dst (MAX_FRAME bytes), returns its size
+    static size_t assemble( uint8_t * _dst, Message _type, const uint8_t * _data, size_t _size ) {
+        configASSERT(_size <= MAX_DATA);
+        uint8_t x = static_cast<uint8_t>(static_cast<uint8_t>(_type) ^ _size);
+        _dst[0] = MAILBOX_SOF;
+        _dst[1] = static_cast<uint8_t>(_type);
+        _dst[2] = static_cast<uint8_t>(_size);
+        for ( size_t i = 0; i < _size; i++ ) {
+            _dst[3 + i] = _data[i];
+            x ^= _data[i];
+        }
+        _dst[3 + _size] = x;
+        return _size + 4;
+    }
+};
+/*!
+ * End of line tests without a flash cycle: a test payload is written into
+ * SRAM with Write Memory and started with Go, its results come back through
+ * the Stm32Mailbox, then a reset with BOOT0 high returns the MCU to the
+ * bootloader, in a new session, for production flashing. The payload must fit
+ * into RAM outside the area the bootloader uses (blRamBegin..blRamEnd) and
+ * start with its initial stack pointer and reset handler, Go takes them from
+ * the load address and the word after it. USART only: the other variants
+ * have no byte stream the payload could answer on. Like the core it never
+ * allocates and throws nothing.
+ */
+template<class Client>
+class Stm32RamTest : public Stm32Mailbox {
+public:
+    typedef Stm32BootBase::ErrorCode ErrorCode;
+    typedef typename Client::Transport Io;
+    static const uint32_t HELLO_TIMEOUT_MS = 1000;
+    typedef struct Hello_t {
+        uint8_t version;
+        uint32_t payloadId;
+    }
+    Hello_t;
+    typedef struct Result_t {
+        uint8_t test;
+        uint8_t status;             /// 0 passed
+        uint8_t size;
+        uint8_t data[MAX_DATA - 2];
+    }
+    Result_t;
+    Stm32RamTest();
+    ErrorCode load( const void * _payload, size_t _size );
+    ErrorCode start( Hello_t &_hello );
+    ErrorCode run( uint8_t _test, const void * _args, size_t _size, Result_t &_result, uint32_t _timeoutMs );
+    ErrorCode finish();
+    uint32_t loadAddress() const {
+        return m_addr;
+    }
+    static uint32_t findLoadAddress( const Stm32BootBase::McuDescription_t &_descr, size_t _size );
+private:
+    ErrorCode send( Message _type, const uint8_t * _data, size_t _size );
+    ErrorCode receive( Message _type, uint32_t _timeoutMs );
+    uint32_t m_addr;                /// where the payload is, 0 if none
+    bool m_running;
+    uint8_t m_size;                 /// of the last message received
+    uint8_t m_data[MAX_DATA];
+};
+template<class Client>
+Stm32RamTest<Client>::Stm32RamTest()
+    : m_addr(0)
+    , m_running(false)
+    , m_size(0) {}
+/*!
+ * Function: findLoadAddress
+ * @return uint32_t the lowest word aligned RAM address the payload fits at
+ * without touching the RAM of the bootloader, 0 if there is none.
+ */
+template<class Client>
+uint32_t Stm32RamTest<Client>::findLoadAddress( const Stm32BootBase::McuDescription_t &_descr, size_t _size ) {
+    uint64_t ramEnd = static_cast<uint64_t>(_descr.ramBegin) + _descr.ramSize;
+    uint64_t candidates[] = { _descr.ramBegin, ( static_cast<uint64_t>(_descr.blRamEnd) + 4 ) & ~3ull };
+    uint32_t result = 0;
+    for ( uint64_t addr : candidates ) {
+        bool clear = addr + _size <= _descr.blRamBegin || addr > _descr.blRamEnd;
+        if (!result && _size && addr >= _descr.ramBegin && addr + _size <= ramEnd && clear)
+            result = static_cast<uint32_t>(addr);
+    }
+    return result;
+}
+/*!
+ * Function: load
+ * Writes the payload into RAM of the session's MCU and reads it back.
+ *
+ * @param _payload vector table first.
+ * @param _size in bytes.
+ *
+ * @return Stm32BootClient::ErrorCode FAILED without a USART session or if the
+ *         payload doesn't fit.
+ */
+template<class Client>
+typename Stm32RamTest<Client>::ErrorCode Stm32RamTest<Client>::load( const void * _payload, size_t _size ) {
+    configASSERT(_payload);
+    const Stm32BootBase::SessionCaps_t & caps = Client::getCaps();
+    ErrorCode err = ErrorCode::FAILED;
+    m_addr = 0;
+    if (Io::PROTOCOL_VARIANT == Stm32BootBase::ProtocolVariant::Usart && caps.valid && !caps.rdpActive && _size >= 8) {
+        m_addr = findLoadAddress(Client::mcuType2Description(caps.mcuType), _size);
+        if (m_addr) {
+            err = Client::writeMemory(_payload, m_addr, _size);
+            if (err == ErrorCode::OK)
+                err = Client::verifyMemory(_payload, m_addr, _size);
+        }
+    }
+    return err;
+}
+/*!
+ * Function: start
+ * Starts the loaded payload and waits for its Hello. The bootloader session
+ * ends here.
+ *
+ * @param _hello what the payload said.
+ *
+ * @return Stm32BootClient::ErrorCode FAILED on another mailbox version.
+ */
+template<class Client>
+typename Stm32RamTest<Client>::ErrorCode Stm32RamTest<Client>::start( Hello_t &_hello ) {
+    ErrorCode err = m_addr ? Client::commandGo(m_addr) : ErrorCode::FAILED;
+    if (err == ErrorCode::OK) {
+        m_running = true;
+        err = receive(Message::Hello, HELLO_TIMEOUT_MS);
+    }
+    if (err == ErrorCode::OK) {
+        err = ( m_size >= 5 && m_data[0] == MAILBOX_VERSION ) ? ErrorCode::OK : ErrorCode::FAILED;
+        _hello.version = m_data[0];
+        _hello.payloadId = m_data[1] | static_cast<uint32_t>(m_data[2]) << 8 | static_cast<uint32_t>(m_data[3]) << 16 |
+                           static_cast<uint32_t>(m_data[4]) << 24;
+    }
+    return err;
+}
+/*!
+ * Function: run
+ * Runs one test of the started payload.
+ *
+ * @param _test test number, the payload defines them.
+ * @param _args arguments of the test, up to MAX_DATA - 1 bytes.
+ * @param _size of the arguments.
+ * @param _result what the payload answered.
+ * @param _timeoutMs how long the test may take.
+ *
+ * @return Stm32BootClient::ErrorCode OK if the payload answered, the test
+ *         result is in _result.status.
+ */
+template<class Client>
+typename Stm32RamTest<Client>::ErrorCode Stm32RamTest<Client>::run( uint8_t _test, const void * _args, size_t _size,
+                                                                    Result_t &_result, uint32_t _timeoutMs ) {
+    uint8_t data[MAX_DATA];
+    ErrorCode err = ( m_running && _size < MAX_DATA ) ? ErrorCode::OK : ErrorCode::FAILED;
+    if (err == ErrorCode::OK) {
+        data[0] = _test;
+        if (_size)
+            memcpy(&data[1], _args, _size);
+        err = send(Message::Run, data, _size + 1);
+    }
+    if (err == ErrorCode::OK)
+        err = receive(Message::Result, _timeoutMs);
+    if (err == ErrorCode::OK) {
+        err = ( m_size >= 2 && m_data[0] == _test ) ? ErrorCode::OK : ErrorCode::FAILED;
+        _result.test = m_data[0];
+        _result.status = m_data[1];
+        _result.size = static_cast<uint8_t>(( m_size >= 2 ) ? m_size - 2 : 0);
+        memcpy(_result.data, &m_data[2], _result.size);
+    }
+    return err;
+}
+/*!
+ * Function: finish
+ * Resets the MCU into the bootloader and opens a new session on it.
+ *
+ * @return Stm32BootClient::ErrorCode
+ */
+template<class Client>
+typename Stm32RamTest<Client>::ErrorCode Stm32RamTest<Client>::finish() {
+    m_running = false;
+    m_addr = 0;
+    Io::flush();
+    ErrorCode err = Client::checkMcuPresence();
+    if (err == ErrorCode::ACK_OK)
+        err = Client::negotiateCaps();
+    return err;
+}
+template<class Client>
+typename Stm32RamTest<Client>::ErrorCode Stm32RamTest<Client>::send( Message _type, const uint8_t * _data, size_t _size ) {
+    uint8_t frame[MAX_FRAME];
+    size_t size = assemble(frame, _type, _data, _size);
+    size_t written = 0;
+    ErrorCode err = Io::write(frame, size, &written);
+    if (err == ErrorCode::OK && written != size)
+        err = ErrorCode::SERIAL_WR_SIZE;
+    return err;
+}
+/*!
+ * Function: receive
+ * Waits for a message of the type, frames with another type or a bad
+ * checksum are dropped: the payload may print anything before its Hello.
+ *
+ * @return Stm32BootClient::ErrorCode SERIAL_RD_SIZE on timeout.
+ */
+template<class Client>
+typename Stm32RamTest<Client>::ErrorCode Stm32RamTest<Client>::receive( Message _type, uint32_t _timeoutMs ) {
+    uint32_t start = Stm32BootLowIo::getTickMs();
+    bool found = false;
+    ErrorCode err = ErrorCode::OK;
+    while (!found && err == ErrorCode::OK) {
+        uint8_t head[3] = {0};
+        while (err == ErrorCode::OK && head[0] != MAILBOX_SOF)
+            err = Stm32Handoff<Client>::readByte(head[0], start, _timeoutMs);
+        for ( size_t i = 1; i < sizeof( head ) && err == ErrorCode::OK; i++ )
+            err = Stm32Handoff<Client>::readByte(head[i], start, _timeoutMs);
+        uint8_t x = static_cast<uint8_t>(head[1] ^ head[2]);
+        for ( size_t i = 0; i < head[2] && i < MAX_DATA && err == ErrorCode::OK; i++ ) {
+            err = Stm32Handoff<Client>::readByte(m_data[i], start, _timeoutMs);
+            x ^= m_data[i];
+        }
+        uint8_t check = 0;
+        if (err == ErrorCode::OK)
+            err = Stm32Handoff<Client>::readByte(check, start, _timeoutMs);
+        if (err == ErrorCode::OK && head[2] <= MAX_DATA && check == x && head[1] == static_cast<uint8_t>(_type)) {
+            m_size = head[2];
+            found = true;
+        }
+    }
+    return err;
+}
+#endif
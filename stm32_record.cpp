@@ -0,0 +1,272 @@
+/*!
+/brief Session logs: recording of transport calls and their replay.
+*/
+#include "stm32_record.hpp"
+#include "stm32_boot_client_impl.hpp"
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <string.h>
+
+static const char s_logMagic[4] = {'S', '3', '2', 'R'};
+static const uint32_t SPIN_BELOW_US = 2000;    /// sleep() overshoots, the last stretch is spun
+
+/// LEB128: 7 bits per byte, low first, the high bit set on all but the last
+static void putVarint( std::vector<uint8_t> &_out, uint32_t _value ) {
+    while (_value >= 0x80) {
+        _out.push_back(static_cast<uint8_t>(_value | 0x80));
+        _value >>= 7;
+    }
+    _out.push_back(static_cast<uint8_t>(_value));
+}
+static bool getVarint( const std::vector<uint8_t> &_in, size_t &_pos, uint32_t &_value ) {
+    _value = 0;
+    for ( uint32_t shift = 0; _pos < _in.size() && shift < 35; shift += 7 ) {
+        uint8_t b = _in[_pos++];
+        _value |= static_cast<uint32_t>(b & 0x7f) << shift;
+        if (!( b & 0x80 ))
+            return true;
+    }
+    return false;
+}
+
+Stm32BootClient::ErrorCode Stm32SessionLog::save( const std::string &_fname, Stm32BootClient::ProtocolVariant _variant,
+                                                  const std::vector<Record_t> &_records ) {
+    std::vector<uint8_t> out(s_logMagic, s_logMagic + sizeof( s_logMagic ));
+    out.push_back(static_cast<uint8_t>(VERSION));
+    out.push_back(static_cast<uint8_t>(_variant));
+    out.push_back(0);
+    out.push_back(0);
+    for ( auto & rec : _records ) {
+        out.push_back(static_cast<uint8_t>(rec.event));
+        out.push_back(static_cast<uint8_t>(rec.err));
+        putVarint(out, rec.gapUs);
+        putVarint(out, rec.durationUs);
+        putVarint(out, rec.arg);
+        putVarint(out, static_cast<uint32_t>(rec.data.size()));
+        out.insert(out.end(), rec.data.begin(), rec.data.end());
+    }
+    std::ofstream file(_fname.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(out.data()), static_cast<std::streamsize>(out.size()));
+    return file ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+}
+/*!
+ * Function: readVariant
+ * Reads the protocol variant from the header, to pick the transport the log
+ * is replayed on.
+ *
+ * @return Stm32BootClient::ErrorCode FILE_FAILED if the file can't be read,
+ * isn't a log of this version or names no known variant.
+ */
+Stm32BootClient::ErrorCode Stm32SessionLog::readVariant( const std::string &_fname, Stm32BootClient::ProtocolVariant &_variant ) {
+    std::ifstream file(_fname.c_str(), std::ios::in | std::ios::binary);
+    char head[8];
+    bool ok = file.read(head, sizeof( head )) && !memcmp(head, s_logMagic, sizeof( s_logMagic )) &&
+        static_cast<uint8_t>(head[4]) == VERSION && static_cast<uint8_t>(head[5]) <= static_cast<uint8_t>(Stm32BootClient::ProtocolVariant::Can);
+    if (ok)
+        _variant = static_cast<Stm32BootClient::ProtocolVariant>(head[5]);
+    return ok ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+}
+/*!
+ * Function: load
+ * @param _variant PROTOCOL_VARIANT of the transport replaying the log.
+ *
+ * @return Stm32BootClient::ErrorCode FILE_FAILED if the file can't be read,
+ * has another version, was recorded on another variant or ends inside a record.
+ */
+Stm32BootClient::ErrorCode Stm32SessionLog::load( const std::string &_fname, Stm32BootClient::ProtocolVariant _variant,
+                                                  std::vector<Record_t> &_records ) {
+    std::ifstream file(_fname.c_str(), std::ios::in | std::ios::binary);
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    bool ok = in.size() >= 8 && !memcmp(in.data(), s_logMagic, sizeof( s_logMagic )) && in[4] == VERSION &&
+        in[5] == static_cast<uint8_t>(_variant); // the framing of the records is the variant's
+    size_t pos = 8;
+    _records.clear();
+    while (ok && pos < in.size()) {
+        Record_t rec;
+        uint32_t size = 0;
+        ok = pos + 2 <= in.size();
+        if (ok) {
+            rec.event = static_cast<Event>(in[pos++]);
+            rec.err = static_cast<Stm32BootClient::ErrorCode>(in[pos++]);
+            ok = getVarint(in, pos, rec.gapUs) && getVarint(in, pos, rec.durationUs) && getVarint(in, pos, rec.arg) &&
+                getVarint(in, pos, size) && size <= in.size() - pos;
+        }
+        if (ok) {
+            rec.data.assign(in.begin() + static_cast<long>(pos), in.begin() + static_cast<long>(pos + size));
+            pos += size;
+            _records.push_back(rec);
+        }
+    }
+    return ok ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+}
+const char * Stm32SessionLog::eventName( Event _event ) {
+    static const char * const name[] = {
+        "?",
+        "INIT",
+        "DEINIT",
+        "WRITE",
+        "READ",
+        "FLUSH",
+        "RESET",
+        "BOOT0",
+        "DELAY",
+    };
+    size_t index = static_cast<size_t>(_event);
+    return ( index < sizeof( name ) / sizeof( name[0] ) ) ? name[index] : name[0];
+}
+
+Stm32SessionRecorder::Stm32SessionRecorder()
+    : m_callStart(std::chrono::steady_clock::now())
+    , m_lastEnd(m_callStart) {}
+void Stm32SessionRecorder::begin( Stm32SessionLog::Event _event ) {
+    m_callStart = std::chrono::steady_clock::now();
+    m_current.event = _event;
+    m_current.gapUs = sinceUs(m_lastEnd);
+}
+void Stm32SessionRecorder::end( Stm32BootClient::ErrorCode _err, uint32_t _arg, const void * _data, size_t _size ) {
+    const uint8_t * data = static_cast<const uint8_t *>(_data);
+    m_current.durationUs = sinceUs(m_callStart);
+    m_current.err = _err;
+    m_current.arg = _arg;
+    m_current.data.assign(data, data + ( data ? _size : 0 ));
+    m_records.push_back(m_current);
+    m_lastEnd = std::chrono::steady_clock::now();
+}
+uint32_t Stm32SessionRecorder::sinceUs( std::chrono::steady_clock::time_point _from ) const {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - _from).count());
+}
+
+Stm32SessionPlayer::Stm32SessionPlayer()
+    : m_pos(0)
+    , m_speed(1)
+    , m_diverged(false)
+    , m_divergedEvent(Stm32SessionLog::Event::Init)
+    , m_waitedUs(0) {}
+/*!
+ * Function: start
+ * @param _records the session, see Stm32SessionLog::load().
+ * @param _speed link time is divided by it, 0 to skip it.
+ */
+void Stm32SessionPlayer::start( const std::vector<Stm32SessionLog::Record_t> &_records, uint32_t _speed ) {
+    m_records = _records;
+    m_pos = 0;
+    m_speed = _speed;
+    m_diverged = false;
+    m_waitedUs = 0;
+    m_start = m_lastCall = std::chrono::steady_clock::now();
+}
+/*!
+ * Function: call
+ * Replays a call without data: init, flush, line changes, delays.
+ *
+ * @param _arg line level or delay in ms, must be the recorded one.
+ *
+ * @return Stm32BootClient::ErrorCode the recorded result, FAILED once diverged.
+ */
+Stm32BootClient::ErrorCode Stm32SessionPlayer::call( Stm32SessionLog::Event _event, uint32_t _arg ) {
+    const Stm32SessionLog::Record_t * rec = next(_event, _arg);
+    return rec ? rec->err : Stm32BootClient::ErrorCode::FAILED;
+}
+/*!
+ * Function: write
+ * The client must write the recorded bytes, it is told what the link took then.
+ *
+ * @return Stm32BootClient::ErrorCode the recorded result, FAILED once diverged.
+ */
+Stm32BootClient::ErrorCode Stm32SessionPlayer::write( const void * _src, size_t _size, size_t * _written ) {
+    const Stm32SessionLog::Record_t * rec = next(Stm32SessionLog::Event::Write, 0);
+    if (rec && ( rec->data.size() != _size || ( _size && memcmp(rec->data.data(), _src, _size) ) )) {
+        m_diverged = true;
+        m_divergedEvent = Stm32SessionLog::Event::Write;
+        m_pos--; // the record the client didn't match
+        rec = nullptr;
+    }
+    *_written = rec ? rec->arg : 0;
+    return rec ? rec->err : Stm32BootClient::ErrorCode::FAILED;
+}
+/*!
+ * Function: read
+ * Hands the recorded reply to the client, it must ask for as many bytes as it
+ * did then.
+ *
+ * @return Stm32BootClient::ErrorCode the recorded result, FAILED once diverged.
+ */
+Stm32BootClient::ErrorCode Stm32SessionPlayer::read( void * _dst, size_t _size, size_t * _read ) {
+    const Stm32SessionLog::Record_t * rec = next(Stm32SessionLog::Event::Read, static_cast<uint32_t>(_size));
+    *_read = 0;
+    if (rec && rec->data.size() <= _size) {
+        if (!rec->data.empty())
+            memcpy(_dst, rec->data.data(), rec->data.size());
+        *_read = rec->data.size();
+    }
+    return rec ? rec->err : Stm32BootClient::ErrorCode::FAILED;
+}
+/// The recorded call in turn, after its link time, nullptr if the client made another call
+const Stm32SessionLog::Record_t * Stm32SessionPlayer::next( Stm32SessionLog::Event _event, uint32_t _arg ) {
+    const Stm32SessionLog::Record_t * rec = nullptr;
+    bool argChecked = _event != Stm32SessionLog::Event::Write && _event != Stm32SessionLog::Event::Init &&
+        _event != Stm32SessionLog::Event::Deinit && _event != Stm32SessionLog::Event::Flush;
+    if (!m_diverged && m_pos < m_records.size() && m_records[m_pos].event == _event &&
+        ( !argChecked || m_records[m_pos].arg == _arg )) {
+        rec = &m_records[m_pos++];
+        if (m_speed)
+            waitUs(rec->durationUs / m_speed);
+    } else if (!m_diverged) {
+        m_diverged = true;
+        m_divergedEvent = _event;
+    }
+    m_lastCall = std::chrono::steady_clock::now();
+    return rec;
+}
+void Stm32SessionPlayer::waitUs( uint32_t _us ) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(_us);
+    if (_us > SPIN_BELOW_US)
+        std::this_thread::sleep_for(std::chrono::microseconds(_us - SPIN_BELOW_US / 2));
+    while (std::chrono::steady_clock::now() < deadline) {}
+    m_waitedUs += _us;
+}
+/*!
+ * Function: print
+ * Where the replay stopped and the recorded times against the replayed ones,
+ * host time is what the client itself spent between transport calls.
+ */
+void Stm32SessionPlayer::print( std::ostream &_out ) const {
+    uint64_t gapUs = 0;
+    uint64_t linkUs = 0;
+    for ( auto & rec : m_records ) {
+        gapUs += rec.gapUs;
+        linkUs += rec.durationUs;
+    }
+    uint64_t totalUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(m_lastCall - m_start).count());
+    _out << "Replay: " << m_pos << " of " << m_records.size() << " records";
+    if (m_diverged && m_pos < m_records.size() && m_records[m_pos].event == m_divergedEvent) {
+        _out << ", diverged: " << Stm32SessionLog::eventName(m_divergedEvent) << " with other " <<
+            ( ( m_divergedEvent == Stm32SessionLog::Event::Write ) ? "bytes" : "arguments" ) << " than recorded";
+    } else if (m_diverged) {
+        _out << ", diverged: " << Stm32SessionLog::eventName(m_divergedEvent) << " instead of " <<
+            ( ( m_pos < m_records.size() ) ? Stm32SessionLog::eventName(m_records[m_pos].event) : "the end" );
+    }
+    _out << "." << std::endl;
+    _out << "Recorded: total " << ( gapUs + linkUs ) / 1000 << " ms, link " << linkUs / 1000 << " ms, host " << gapUs / 1000 <<
+        " ms." << std::endl;
+    _out << "Replayed: total " << totalUs / 1000 << " ms, link " << m_waitedUs / 1000 << " ms at speed x" << m_speed <<
+        ", host " << ( totalUs - std::min(totalUs, m_waitedUs) ) / 1000 << " ms." << std::endl;
+}
+/// Recording over every transport of stm32bootpc and replay of each protocol variant
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootLowIo>>;
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootNetIo<0>>>;
+#ifdef __linux__
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootDevIo<Stm32SpiDevLink, 0>>>;
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootDevIo<Stm32I2cDevLink, 0>>>;
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootCanIo<0>>>;
+#endif
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart>>>;
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::I2c>>>;
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Spi>>>;
+template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Can>>>;
+template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::Usart>>;
+template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::I2c>>;
+template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::Spi>>;
+template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::Can>>;
@@ -0,0 +1,224 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "stm32_io.hpp"
+#include "stm32_io_net.hpp"
+#include "stm32_io_linux.hpp"
+#include "stm32_io_can.hpp"
+#include "stm32_mock_target.hpp"
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+/*!
+ * Host side only: a session log, every transport call of the client with its
+ * timing. gapUs is the time the host spent between two calls, durationUs the
+ * time inside the call: the link and the target. On disk the records are
+ * varint coded after an 8 byte header, a session of a few thousand calls
+ * takes a few kilobytes beyond the payload.
+ */
+class Stm32SessionLog {
+public:
+    enum class Event : uint8_t {
+        Init = 1,
+        Deinit,
+        Write,
+        Read,
+        Flush,
+        ResetLine,
+        BootLine,
+        Delay,
+    };
+    typedef struct Record_t {
+        Event event;
+        Stm32BootClient::ErrorCode err;
+        uint32_t gapUs;
+        uint32_t durationUs;
+        uint32_t arg;               /// Write: bytes written, Read: bytes asked for, line level, delay in ms
+        std::vector<uint8_t> data;  /// Write: bytes sent, Read: bytes received
+    }
+    Record_t;
+    static const uint8_t VERSION = 1;
+    static Stm32BootClient::ErrorCode save( const std::string &_fname, Stm32BootClient::ProtocolVariant _variant,
+                                            const std::vector<Record_t> &_records );
+    static Stm32BootClient::ErrorCode readVariant( const std::string &_fname, Stm32BootClient::ProtocolVariant &_variant );
+    static Stm32BootClient::ErrorCode load( const std::string &_fname, Stm32BootClient::ProtocolVariant _variant,
+                                            std::vector<Record_t> &_records );
+    static const char * eventName( Event _event );
+};
+/// Collects the records of Stm32BootRecordIo
+class Stm32SessionRecorder {
+public:
+    Stm32SessionRecorder();
+    void begin( Stm32SessionLog::Event _event );
+    void end( Stm32BootClient::ErrorCode _err, uint32_t _arg, const void * _data = nullptr, size_t _size = 0 );
+    const std::vector<Stm32SessionLog::Record_t> & records() const {
+        return m_records;
+    }
+private:
+    uint32_t sinceUs( std::chrono::steady_clock::time_point _from ) const;
+    std::vector<Stm32SessionLog::Record_t> m_records;
+    Stm32SessionLog::Record_t m_current;
+    std::chrono::steady_clock::time_point m_callStart;
+    std::chrono::steady_clock::time_point m_lastEnd;
+};
+/*!
+ * Transport policy for Stm32BootClientT: any other transport with every call
+ * recorded (--record).
+ */
+template<class Io>
+class Stm32BootRecordIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Io::PROTOCOL_VARIANT;
+    static Stm32SessionRecorder & recorder() {
+        static Stm32SessionRecorder s_recorder;
+        return s_recorder;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        recorder().begin(Stm32SessionLog::Event::Init);
+        auto err = Io::init();
+        recorder().end(err, 0);
+        return err;
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        recorder().begin(Stm32SessionLog::Event::Deinit);
+        auto err = Io::deinit();
+        recorder().end(err, 0);
+        return err;
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        size_t written = 0;
+        recorder().begin(Stm32SessionLog::Event::Write);
+        auto err = Io::write(_src, _size, &written);
+        recorder().end(err, static_cast<uint32_t>(written), _src, _size);
+        if (_written)
+            *_written = written;
+        return err;
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        size_t rd = 0;
+        recorder().begin(Stm32SessionLog::Event::Read);
+        auto err = Io::read(_dst, _size, &rd);
+        recorder().end(err, static_cast<uint32_t>(_size), _dst, rd);
+        if (_read)
+            *_read = rd;
+        return err;
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        recorder().begin(Stm32SessionLog::Event::Flush);
+        auto err = Io::flush();
+        recorder().end(err, 0);
+        return err;
+    }
+    static void setResetLine( bool _level ) {
+        recorder().begin(Stm32SessionLog::Event::ResetLine);
+        Io::setResetLine(_level);
+        recorder().end(Stm32BootClient::ErrorCode::OK, _level);
+    }
+    static void setBootLine( bool _level ) {
+        recorder().begin(Stm32SessionLog::Event::BootLine);
+        Io::setBootLine(_level);
+        recorder().end(Stm32BootClient::ErrorCode::OK, _level);
+    }
+    static void delay( uint32_t _delay ) {
+        recorder().begin(Stm32SessionLog::Event::Delay);
+        Io::delay(_delay);
+        recorder().end(Stm32BootClient::ErrorCode::OK, _delay);
+    }
+    /// Host time, not recorded
+    static uint32_t getTickMs() {
+        return Io::getTickMs();
+    }
+};
+/*!
+ * Feeds a session log back to the client. Every call must be the one that
+ * was recorded, with the same bytes written, or the replay diverges and the
+ * transport fails from there on. The time a call took on the link is waited
+ * out, divided by the speed factor, 0 runs without waiting; host time is not
+ * replayed, it is what is being measured.
+ */
+class Stm32SessionPlayer {
+public:
+    Stm32SessionPlayer();
+    void start( const std::vector<Stm32SessionLog::Record_t> &_records, uint32_t _speed );
+    Stm32BootClient::ErrorCode call( Stm32SessionLog::Event _event, uint32_t _arg = 0 );
+    Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written );
+    Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read );
+    bool isDiverged() const {
+        return m_diverged;
+    }
+    void print( std::ostream &_out ) const;
+private:
+    const Stm32SessionLog::Record_t * next( Stm32SessionLog::Event _event, uint32_t _arg );
+    void waitUs( uint32_t _us );
+    std::vector<Stm32SessionLog::Record_t> m_records;
+    size_t m_pos;
+    uint32_t m_speed;
+    bool m_diverged;
+    Stm32SessionLog::Event m_divergedEvent;     /// the call made instead of the recorded one
+    uint64_t m_waitedUs;
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::time_point m_lastCall;
+};
+/// Transport policy for Stm32BootClientT replaying a log of the variant (--replay)
+template<Stm32BootClient::ProtocolVariant Variant>
+class Stm32BootReplayIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Variant;
+    static Stm32SessionPlayer & player() {
+        static Stm32SessionPlayer s_player;
+        return s_player;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        return player().call(Stm32SessionLog::Event::Init);
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        return player().call(Stm32SessionLog::Event::Deinit);
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        size_t written;
+        auto err = player().write(_src, _size, &written);
+        if (_written)
+            *_written = written;
+        return err;
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        size_t rd;
+        auto err = player().read(_dst, _size, &rd);
+        if (_read)
+            *_read = rd;
+        return err;
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        return player().call(Stm32SessionLog::Event::Flush);
+    }
+    static void setResetLine( bool _level ) {
+        player().call(Stm32SessionLog::Event::ResetLine, _level);
+    }
+    static void setBootLine( bool _level ) {
+        player().call(Stm32SessionLog::Event::BootLine, _level);
+    }
+    static void delay( uint32_t _delay ) {
+        player().call(Stm32SessionLog::Event::Delay, _delay);
+    }
+    static uint32_t getTickMs() {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootLowIo>>;
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootNetIo<0>>>;
+#ifdef __linux__
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootDevIo<Stm32SpiDevLink, 0>>>;
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootDevIo<Stm32I2cDevLink, 0>>>;
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootCanIo<0>>>;
+#endif
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart>>>;
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::I2c>>>;
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Spi>>>;
+extern template class Stm32BootClientT<Stm32BootRecordIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Can>>>;
+extern template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::Usart>>;
+extern template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::I2c>>;
+extern template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::Spi>>;
+extern template class Stm32BootClientT<Stm32BootReplayIo<Stm32BootClient::ProtocolVariant::Can>>;
+#endif
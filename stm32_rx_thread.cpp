@@ -0,0 +1,146 @@
+/*!
+/brief Receive thread between the port and the protocol, see stm32_rx_thread.hpp.
+*/
+#include "stm32_rx_thread.hpp"
+#include "stm32_boot_client_impl.hpp"
+#include <chrono>
+#include <string.h>
+
+const uint32_t Stm32RxPump::SPIN_US;   /// bound to std::chrono::microseconds by reference
+Stm32RxPump::Stm32RxPump()
+    : m_readSome(nullptr)
+    , m_timeoutMs(100)
+    , m_stop(false)
+    , m_error(static_cast<uint8_t>(Stm32BootClient::ErrorCode::OK))
+    , m_sleeping(false) {
+    memset(&m_stats, 0, sizeof( m_stats ));
+}
+Stm32RxPump::~Stm32RxPump() {
+    stop();
+}
+/*!
+ * Function: start
+ * Starts the reader thread on an open transport, the ring starts empty and
+ * the statistics from zero.
+ *
+ * @param _readSome the transport's readSome().
+ */
+void Stm32RxPump::start( ReadSome_t _readSome ) {
+    configASSERT(_readSome);
+    stop();
+    m_readSome = _readSome;
+    m_ring.drop();
+    m_error.store(static_cast<uint8_t>(Stm32BootClient::ErrorCode::OK));
+    memset(&m_stats, 0, sizeof( m_stats ));
+    m_stop.store(false);
+    m_thread = std::thread(&Stm32RxPump::run, this);
+}
+/*!
+ * Function: stop
+ * Stops the reader thread, it returns within the timeout of readSome(). The
+ * transport may be closed and the statistics printed after it.
+ */
+void Stm32RxPump::stop() {
+    m_stop.store(true);
+    if (m_thread.joinable())
+        m_thread.join();
+}
+void Stm32RxPump::run() {
+    uint8_t chunk[CHUNK_SIZE];
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        size_t room = m_ring.space();
+        if (!room) {
+            m_stats.stalls++; // the protocol doesn't read what it asked for
+            std::this_thread::sleep_for(std::chrono::microseconds(SPIN_US));
+            continue;
+        }
+        size_t rd = 0;
+        auto err = m_readSome(chunk, ( room < CHUNK_SIZE ) ? room : CHUNK_SIZE, &rd);
+        if (err != Stm32BootClient::ErrorCode::OK) {
+            m_error.store(static_cast<uint8_t>(err));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } else if (rd) {
+            m_ring.push(chunk, rd);
+            m_stats.chunks++;
+            m_stats.bytes += rd;
+            size_t fill = RING_SIZE - m_ring.space();
+            if (fill > m_stats.maxFill)
+                m_stats.maxFill = fill;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_sleeping)
+                m_arrived.notify_one();
+        }
+    }
+}
+/*!
+ * Function: read
+ * Reads from the ring; fewer bytes and OK are returned after the timeout, the
+ * same way a serial port times out.
+ *
+ * @param _dst a pointer to the destanation buffer.
+ * @param _size number of bytes to be read.
+ * @param _read how many bytes were actually read.
+ *
+ * @return Stm32BootClient::ErrorCode the last error of the transport if the
+ *         read came short.
+ */
+Stm32BootClient::ErrorCode Stm32RxPump::read( void * _dst, size_t _size, size_t * _read ) {
+    typedef std::chrono::steady_clock Clock_t;
+    configASSERT(_dst);
+    uint8_t * dst = static_cast<uint8_t *>(_dst);
+    auto start = Clock_t::now();
+    auto err = Stm32BootClient::ErrorCode::OK;
+    m_stats.reads++;
+    size_t done = m_ring.pop(dst, _size);
+    if (done == _size) {
+        m_stats.fromMemory++;
+    } else {
+        auto spinEnd = start + std::chrono::microseconds(SPIN_US);
+        while (done < _size && Clock_t::now() < spinEnd)
+            done += m_ring.pop(dst + done, _size - done);
+        if (done == _size) {
+            m_stats.afterSpin++;
+        } else {
+            auto deadline = start + std::chrono::milliseconds(m_timeoutMs);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleeping = true;
+            bool late = false;
+            while (done < _size && !late) {
+                done += m_ring.pop(dst + done, _size - done);
+                if (done < _size)
+                    late = m_arrived.wait_until(lock, deadline) == std::cv_status::timeout;
+            }
+            if (done < _size)
+                done += m_ring.pop(dst + done, _size - done);
+            m_sleeping = false;
+            if (done == _size)
+                m_stats.afterSleep++;
+        }
+    }
+    if (done < _size) {
+        m_stats.timeouts++;
+        err = static_cast<Stm32BootClient::ErrorCode>(m_error.exchange(static_cast<uint8_t>(Stm32BootClient::ErrorCode::OK)));
+        STM32_TRACE(Timeout, _size - done);
+    }
+    if (_read)
+        *_read = done;
+    STM32_TRACE(BytesRead, done);
+    return err;
+}
+/*!
+ * Function: flush
+ * Drops everything received so far. Bytes the reader thread is pushing at
+ * the moment still come, as from a UART which is receiving.
+ */
+void Stm32RxPump::flush() {
+    m_ring.drop();
+}
+void Stm32RxPump::print( std::ostream &_out ) const {
+    _out << "Rx thread: " << m_stats.reads << " reads, " << m_stats.fromMemory << " from memory, " << m_stats.afterSpin <<
+        " after spinning, " << m_stats.afterSleep << " after sleeping, " << m_stats.timeouts << " timed out." << std::endl;
+    _out << "Rx ring: " << m_stats.bytes << " bytes in " << m_stats.chunks << " chunks, " << m_stats.maxFill << " of " <<
+        RING_SIZE << " bytes used at most, " << m_stats.stalls << " stalls." << std::endl;
+}
+template class Stm32BootClientT<Stm32BootRxThreadIo<Stm32BootLowIo>>;
+template class Stm32BootClientT<Stm32BootRxThreadIo<Stm32BootNetIo<0>>>;
+template class Stm32BootClientT<Stm32BootRxThreadIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart>>>;
@@ -0,0 +1,116 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "stm32_spsc_ring.hpp"
+#include "stm32_io.hpp"
+#include "stm32_io_net.hpp"
+#include "stm32_mock_target.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+/*!
+ * Host side only: a reader thread drains the transport into a Stm32SpscRing
+ * and the protocol reads from memory. What has arrived is taken at once, for
+ * the rest the protocol thread spins for SPIN_US, then sleeps until the
+ * reader thread has pushed enough or the read timeout is over. Replies which
+ * come while the protocol thread is descheduled wait in the ring instead of
+ * the driver. The transport's readSome() waits up to its own timeout for the
+ * first byte and returns whatever has arrived after it; it may run while the
+ * protocol thread writes.
+ */
+class Stm32RxPump {
+public:
+    typedef Stm32BootClient::ErrorCode ( * ReadSome_t )( void * _dst, size_t _size, size_t * _read );
+    static const size_t RING_SIZE = 4096;
+    static const size_t CHUNK_SIZE = 512;
+    static const uint32_t SPIN_US = 50;
+    typedef struct Stats_t {
+        uint64_t reads;             /// read() calls of the protocol
+        uint64_t fromMemory;        /// served from the ring at once
+        uint64_t afterSpin;         /// served while spinning
+        uint64_t afterSleep;        /// the protocol thread had to sleep
+        uint64_t timeouts;          /// short reads
+        uint64_t chunks;            /// readSome() calls with data
+        uint64_t bytes;
+        uint64_t stalls;            /// the ring was full, the reader thread waited
+        size_t maxFill;             /// most bytes waiting in the ring
+    }
+    Stats_t;
+    Stm32RxPump();
+    ~Stm32RxPump();
+    void setTimeout( uint32_t _ms ) {
+        m_timeoutMs = _ms;
+    }
+    void start( ReadSome_t _readSome );
+    void stop();
+    Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read );
+    void flush();
+    /// Statistics of the last start(), after stop()
+    void print( std::ostream &_out ) const;
+private:
+    Stm32RxPump( const Stm32RxPump & );
+    Stm32RxPump & operator=( const Stm32RxPump & );
+    void run();
+    ReadSome_t m_readSome;
+    uint32_t m_timeoutMs;
+    Stm32SpscRing<RING_SIZE> m_ring;
+    std::atomic<bool> m_stop;
+    std::atomic<uint8_t> m_error;   /// ErrorCode of the last failed readSome(), OK if none
+    std::mutex m_mutex;
+    std::condition_variable m_arrived;
+    bool m_sleeping;                /// under m_mutex
+    std::thread m_thread;
+    Stats_t m_stats;
+};
+/*!
+ * Transport policy for Stm32BootClientT: any USART-like transport with a
+ * readSome() behind a Stm32RxPump (--rx_thread). flush() drops what has
+ * arrived from the ring, the transport is left to the reader thread.
+ */
+template<class Io>
+class Stm32BootRxThreadIo {
+public:
+    static const Stm32BootClient::ProtocolVariant PROTOCOL_VARIANT = Io::PROTOCOL_VARIANT;
+    static Stm32RxPump & pump() {
+        static Stm32RxPump s_pump;
+        return s_pump;
+    }
+    static Stm32BootClient::ErrorCode init() {
+        auto err = Io::init();
+        if (err == Stm32BootClient::ErrorCode::OK)
+            pump().start(Io::readSome);
+        return err;
+    }
+    static Stm32BootClient::ErrorCode deinit() {
+        pump().stop();
+        return Io::deinit();
+    }
+    static Stm32BootClient::ErrorCode write( const void * _src, size_t _size, size_t * _written = nullptr ) {
+        return Io::write(_src, _size, _written);
+    }
+    static Stm32BootClient::ErrorCode read( void * _dst, size_t _size, size_t * _read = nullptr ) {
+        return pump().read(_dst, _size, _read);
+    }
+    static Stm32BootClient::ErrorCode flush() {
+        pump().flush();
+        return Stm32BootClient::ErrorCode::OK;
+    }
+    static void setResetLine( bool _level ) {
+        Io::setResetLine(_level);
+    }
+    static void setBootLine( bool _level ) {
+        Io::setBootLine(_level);
+    }
+    static void delay( uint32_t _delay ) {
+        Io::delay(_delay);
+    }
+    static uint32_t getTickMs() {
+        return Io::getTickMs();
+    }
+};
+extern template class Stm32BootClientT<Stm32BootRxThreadIo<Stm32BootLowIo>>;
+extern template class Stm32BootClientT<Stm32BootRxThreadIo<Stm32BootNetIo<0>>>;
+extern template class Stm32BootClientT<Stm32BootRxThreadIo<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart>>>;
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+#ifdef __cplusplus
+#include "included_macro.hpp"
+#include <atomic>
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+/*!
+ * Byte ring for exactly one producer and one consumer, a thread or an
+ * interrupt on each side, without locks. Both indices only grow, each side
+ * writes its own and reads the other one: the producer publishes the bytes
+ * with a release store of the head, the consumer frees the space with a
+ * release store of the tail. Size must be a power of two. Like the core it
+ * never allocates and throws nothing.
+ */
+template<size_t Size>
+class Stm32SpscRing {
+public:
+    static_assert(Size && ( Size & ( Size - 1 ) ) == 0, "Size must be a power of two");
+    Stm32SpscRing()
+        : m_head(0)
+        , m_tail(0) {}
+    /// Consumer side: bytes ready to be popped
+    size_t available() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+    }
+    /// Producer side: bytes which can be pushed
+    size_t space() const {
+        return Size - ( m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire) );
+    }
+    size_t push( const uint8_t * _src, size_t _size );
+    size_t pop( uint8_t * _dst, size_t _size );
+    /// Consumer side: drops everything pushed so far
+    void drop() {
+        m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+private:
+    std::atomic<size_t> m_head;     /// written by the producer only
+    std::atomic<size_t> m_tail;     /// written by the consumer only
+    uint8_t m_data[Size];
+};
+/*!
+ * Function: push
+ * Producer side: copies as much as fits.
+ *
+ * @return size_t bytes pushed.
+ */
+template<size_t Size>
+size_t Stm32SpscRing<Size>::push( const uint8_t * _src, size_t _size ) {
+    configASSERT(_src || !_size);
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t free = Size - ( head - m_tail.load(std::memory_order_acquire) );
+    size_t count = ( _size < free ) ? _size : free;
+    size_t pos = head & ( Size - 1 );
+    size_t first = ( count < Size - pos ) ? count : Size - pos;
+    memcpy(&m_data[pos], _src, first);
+    memcpy(&m_data[0], _src + first, count - first);
+    m_head.store(head + count, std::memory_order_release);
+    return count;
+}
+/*!
+ * Function: pop
+ * Consumer side: copies out as much as has arrived, up to _size.
+ *
+ * @return size_t bytes popped.
+ */
+template<size_t Size>
+size_t Stm32SpscRing<Size>::pop( uint8_t * _dst, size_t _size ) {
+    configASSERT(_dst || !_size);
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t ready = m_head.load(std::memory_order_acquire) - tail;
+    size_t count = ( _size < ready ) ? _size : ready;
+    size_t pos = tail & ( Size - 1 );
+    size_t first = ( count < Size - pos ) ? count : Size - pos;
+    memcpy(_dst, &m_data[pos], first);
+    memcpy(_dst + first, &m_data[0], count - first);
+    m_tail.store(tail + count, std::memory_order_release);
+    return count;
+}
+#endif
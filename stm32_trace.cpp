@@ -0,0 +1,51 @@
+/*!
+/brief Binary event ring, see stm32_trace.hpp.
+*/
+#include "stm32_trace.hpp"
+#ifdef STM32_BOOT_TRACE
+#include "stm32_io.hpp"
+#include <atomic>
+
+static Stm32Trace::Record_t s_ring[Stm32Trace::RING_SIZE];
+static std::atomic<uint32_t> s_head(0);
+/*!
+ * Function: record
+ * Takes the next slot with one atomic increment and fills it in. The oldest
+ * record is overwritten when the ring is full.
+ *
+ * @param _event what happened.
+ * @param _arg event specific argument.
+ * @param _bus Stm32BootLowIo::Bus it happened on or SELECTED_BUS.
+ */
+void Stm32Trace::record( Event _event, uint16_t _arg, int8_t _bus ) {
+    uint32_t idx = s_head.fetch_add(1, std::memory_order_relaxed);
+    Record_t & rec = s_ring[idx & ( RING_SIZE - 1 )];
+    rec.timestamp = Stm32BootLowIo::getTickMs();
+    rec.event = static_cast<uint8_t>(_event);
+    rec.bus = ( _bus == SELECTED_BUS ) ? static_cast<int8_t>(Stm32BootLowIo::getSerialBus()) : _bus;
+    rec.arg = _arg;
+}
+/*!
+ * Function: snapshot
+ * Copies records oldest first. Records being written at the same moment may
+ * come out half updated, the ring is meant to be dumped when the update is over.
+ *
+ * @param _dst destination.
+ * @param _max capacity of _dst in records.
+ *
+ * @return size_t number of records copied.
+ */
+size_t Stm32Trace::snapshot( Record_t * _dst, size_t _max ) {
+    uint32_t head = s_head.load(std::memory_order_acquire);
+    uint32_t count = ( head < RING_SIZE ) ? head : RING_SIZE;
+    if (count > _max)
+        count = static_cast<uint32_t>(_max);
+    for ( uint32_t i = 0; i < count; i++ ) {
+        _dst[i] = s_ring[( head - count + i ) & ( RING_SIZE - 1 )];
+    }
+    return count;
+}
+void Stm32Trace::clear() {
+    s_head.store(0, std::memory_order_release);
+}
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+#ifdef __cplusplus
+#include <inttypes.h>
+#include <stddef.h>
+/*!
+ * Allocation-free binary event ring for diagnosing slow or failing updates on
+ * the target. Writers never lock or wait, several tasks can record at the same
+ * time. Built only with STM32_BOOT_TRACE defined, otherwise STM32_TRACE()
+ * expands to nothing and the ring doesn't exist.
+ */
+class Stm32Trace {
+public:
+    enum class Event : uint8_t {
+        CommandSent = 0x01,     /// arg: command code
+        Ack = 0x02,             /// arg: BUSY bytes polled before the ACK
+        Nack = 0x03,            /// arg: 0, 1 for the second NACK
+        BytesWritten = 0x04,    /// arg: number of bytes
+        BytesRead = 0x05,       /// arg: number of bytes
+        Timeout = 0x06,         /// arg: number of bytes missing
+        Error = 0x07,           /// arg: Stm32BootClient::ErrorCode
+        Sync = 0x08,            /// arg: 0
+    };
+    typedef struct Record_t {
+        uint32_t timestamp;     /// ms, Stm32BootLowIo::getTickMs()
+        uint8_t event;
+        int8_t bus;             /// Stm32BootLowIo::Bus, see Stm32TraceBus
+        uint16_t arg;
+    }
+    Record_t;
+    typedef struct DumpHeader_t {
+        char magic[4];          /// "S32T"
+        uint32_t count;         /// records following the header, oldest first
+    }
+    DumpHeader_t;
+    static const uint32_t RING_SIZE = 512; /// power of 2
+    static const int8_t SELECTED_BUS = -2;  /// stamp with the bus Stm32BootLowIo has selected
+    static void record( Event _event, uint16_t _arg, int8_t _bus = SELECTED_BUS );
+    static size_t snapshot( Record_t * _dst, size_t _max );
+    static void clear();
+};
+/*!
+ * Bus the events of a Stm32BootClientT<Io> are stamped with. Policies bound to
+ * one bus say which, see Stm32BootBusIo, the others leave it to the selection.
+ */
+template<class Io>
+struct Stm32TraceBus {
+    static const int8_t value = Stm32Trace::SELECTED_BUS;
+};
+#ifdef STM32_BOOT_TRACE
+#define STM32_TRACE( _event, _arg ) Stm32Trace::record(Stm32Trace::Event::_event, static_cast<uint16_t>(_arg))
+/// For a given bus, which may run while another one is selected
+#define STM32_TRACE_BUS( _bus, _event, _arg ) Stm32Trace::record(Stm32Trace::Event::_event, static_cast<uint16_t>(_arg), \
+                                                                 static_cast<int8_t>(_bus))
+#else
+#define STM32_TRACE( _event, _arg ) ( (void)0 )
+#define STM32_TRACE_BUS( _bus, _event, _arg ) ( (void)0 )
+#endif
+#endif
@@ -0,0 +1,129 @@
+/*!
+/brief Decoder of Stm32Trace dumps.
+*/
+#include "stm32_trace_decode.hpp"
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <string.h>
+
+static const char s_dumpMagic[4] = {'S', '3', '2', 'T'};
+
+Stm32BootClient::ErrorCode Stm32TraceDecoder::save( const std::string &_fname, const std::vector<Stm32Trace::Record_t> &_records ) {
+    std::ofstream file(_fname.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    Stm32Trace::DumpHeader_t hdr;
+    memcpy(hdr.magic, s_dumpMagic, sizeof( hdr.magic ));
+    hdr.count = static_cast<uint32_t>(_records.size());
+    file.write(reinterpret_cast<const char *>(&hdr), sizeof( hdr ));
+    if (!_records.empty()) {
+        file.write(reinterpret_cast<const char *>(_records.data()),
+            static_cast<std::streamsize>(_records.size() * sizeof( _records[0] )));
+    }
+    return file ? Stm32BootClient::ErrorCode::OK : Stm32BootClient::ErrorCode::FILE_FAILED;
+}
+Stm32BootClient::ErrorCode Stm32TraceDecoder::load( const std::string &_fname, std::vector<Stm32Trace::Record_t> &_records ) {
+    auto err = Stm32BootClient::ErrorCode::FILE_FAILED;
+    std::ifstream file(_fname.c_str(), std::ios::in | std::ios::binary);
+    Stm32Trace::DumpHeader_t hdr;
+    if (file.read(reinterpret_cast<char *>(&hdr), sizeof( hdr )) && !memcmp(hdr.magic, s_dumpMagic, sizeof( hdr.magic ))) {
+        _records.resize(hdr.count);
+        if (hdr.count == 0 || file.read(reinterpret_cast<char *>(_records.data()),
+                static_cast<std::streamsize>(hdr.count * sizeof( _records[0] )))) {
+            err = Stm32BootClient::ErrorCode::OK;
+        }
+    }
+    return err;
+}
+const char * Stm32TraceDecoder::eventName( uint8_t _event ) {
+    static const char * const name[] = {
+        "?",
+        "CMD",
+        "ACK",
+        "NACK",
+        "TX",
+        "RX",
+        "TIMEOUT",
+        "ERROR",
+        "SYNC",
+    };
+    return ( _event < sizeof( name ) / sizeof( name[0] ) ) ? name[_event] : name[0];
+}
+void Stm32TraceDecoder::printTimeline( const std::vector<Stm32Trace::Record_t> &_records, std::ostream &_out ) {
+    uint32_t start = _records.empty() ? 0 : _records.front().timestamp;
+    for ( auto & rec : _records ) {
+        _out << std::setw(8) << ( rec.timestamp - start ) << " ms  bus" << static_cast<int>(rec.bus) << "  " <<
+            std::setw(7) << std::left << eventName(rec.event) << std::right;
+        switch (static_cast<Stm32Trace::Event>(rec.event)) {
+        case Stm32Trace::Event::CommandSent:
+            _out << " 0x" << std::hex << std::setw(2) << std::setfill('0') << rec.arg << std::setfill(' ') << std::dec;
+            break;
+        case Stm32Trace::Event::Error:
+            _out << " " << Stm32BootClient::errorCode2String(static_cast<Stm32BootClient::ErrorCode>(rec.arg));
+            break;
+        case Stm32Trace::Event::Ack:
+            if (rec.arg)
+                _out << " after " << rec.arg << " BUSY";
+            break;
+        case Stm32Trace::Event::Sync:
+            break;
+        default:
+            _out << " " << rec.arg;
+        }
+        _out << std::endl;
+    }
+}
+/*!
+ * Function: printStatistics
+ * A transaction lasts from the command sent to the last event before the next
+ * command on the same bus. Times are summed per bus and command code.
+ */
+void Stm32TraceDecoder::printStatistics( const std::vector<Stm32Trace::Record_t> &_records, std::ostream &_out ) {
+    struct Stat_t {
+        uint32_t count;
+        uint32_t total;
+        uint32_t min;
+        uint32_t max;
+        uint32_t nacks;
+        uint32_t timeouts;
+    };
+    std::map<std::pair<int, int>, Stat_t> stats;
+    std::map<int, const Stm32Trace::Record_t *> open;
+    std::map<int, uint32_t> lastSeen;
+    auto close = [&stats, &open, &lastSeen]( int _bus ) {
+        auto it = open.find(_bus);
+        if (it != open.end() && it->second) {
+            Stat_t & st = stats[std::make_pair(_bus, static_cast<int>(it->second->arg))];
+            uint32_t duration = lastSeen[_bus] - it->second->timestamp;
+            st.min = ( st.count == 0 || duration < st.min ) ? duration : st.min;
+            st.max = ( duration > st.max ) ? duration : st.max;
+            st.total += duration;
+            st.count++;
+            it->second = nullptr;
+        }
+    };
+    for ( auto & rec : _records ) {
+        int bus = rec.bus;
+        if (rec.event == static_cast<uint8_t>(Stm32Trace::Event::CommandSent)) {
+            close(bus);
+            open[bus] = &rec;
+        } else if (open[bus]) {
+            Stat_t & st = stats[std::make_pair(bus, static_cast<int>(open[bus]->arg))];
+            if (rec.event == static_cast<uint8_t>(Stm32Trace::Event::Nack))
+                st.nacks++;
+            if (rec.event == static_cast<uint8_t>(Stm32Trace::Event::Timeout))
+                st.timeouts++;
+        }
+        lastSeen[bus] = rec.timestamp;
+    }
+    for ( auto & it : open ) {
+        close(it.first);
+    }
+    _out << "bus  cmd   count  min ms  avg ms  max ms  nacks  timeouts" << std::endl;
+    for ( auto & it : stats ) {
+        const Stat_t & st = it.second;
+        _out << std::setw(3) << it.first.first << "  0x" << std::hex << std::setw(2) << std::setfill('0') << it.first.second <<
+            std::dec << std::setfill(' ') << std::setw(7) << st.count << std::setw(8) << st.min << std::setw(8) <<
+            ( st.count ? st.total / st.count : 0 ) << std::setw(8) << st.max << std::setw(7) << st.nacks <<
+            std::setw(10) << st.timeouts << std::endl;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#ifdef __cplusplus
+#include "stm32_boot_client.hpp"
+#include "stm32_trace.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+/*!
+ * Host side only: turns Stm32Trace dumps into readable timelines and
+ * per-command round trip statistics.
+ */
+class Stm32TraceDecoder {
+public:
+    static Stm32BootClient::ErrorCode save( const std::string &_fname, const std::vector<Stm32Trace::Record_t> &_records );
+    static Stm32BootClient::ErrorCode load( const std::string &_fname, std::vector<Stm32Trace::Record_t> &_records );
+    static void printTimeline( const std::vector<Stm32Trace::Record_t> &_records, std::ostream &_out );
+    static void printStatistics( const std::vector<Stm32Trace::Record_t> &_records, std::ostream &_out );
+    static const char * eventName( uint8_t _event );
+};
+#endif
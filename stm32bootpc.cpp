@@ -1,33 +1,127 @@
 #include "stm32bootpc.hpp"
+#include <future>
 #include <iostream>
-#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <thread>
 #include <string.h>
 #include <getopt.h>
+#include <limits.h>
+#include <unistd.h>
+static const uint32_t NET_TIMEOUT_MS = 1000;  /// a network round trip on top of the serial one
+static const uint32_t CAN_TIMEOUT_MS = 1000;  /// 125 kbit/s and flash erase behind a single ACK frame
+static const uint32_t RAM_TEST_TIMEOUT_MS = 10000;    /// one test of the RAM payload
+static const uint32_t RX_THREAD_TIMEOUT_MS = 100;   /// a read of the protocol from the receive thread of the local port
+static void ( * s_cancel )() = nullptr;    /// cancel() of the client of the running session
 static bool checkSettings( Settings_t _settings ) {
     (void)_settings;
     return true;
 }
 static void printHelp() {
     std::cout << "Usage:" << std::endl <<
-        "-e, --erase                      erase all flash memory.\n"
+        "-e, --erase                      erase all flash memory, otherwise only the pages the job writes.\n"
         "-p, --program_bin filename.bin   program filename.bin to flash.\n"
-        "-r, --read_bin filename.bin      read a flash to filename.bin.\n" << std::endl;
+        "-r, --read_bin filename.bin      read a flash to filename.bin.\n"
+        "-s, --stream_bin filename.bin    program filename.bin streaming it from the disk. The pages it\n"
+        "                                 reaches are not known in advance, so it needs -e.\n"
+        "                                 -p and -s also take .gz, .zst and .xz files, decoded on the fly.\n"
+        "-v, --verify                     verify the image block by block while programming. Bootloaders\n"
+        "                                 without Get Checksum read every block back, which takes about as\n"
+        "                                 long as writing it once more.\n"
+        "-d, --data address:filename.bin  write filename.bin at address after the image, e.g. option bytes or\n"
+        "                                 calibration data, padded with 0xff to whole words; may be repeated.\n"
+        "                                 Option bytes reset the MCU, so they come last: no -r or Go after them.\n"
+        "                                 -e, -p, -s, -d and -r run in this order in one session, then Go.\n"
+        "    --no_go                      leave the MCU in the bootloader at the end of the job.\n"
+        "    --go_addr address            vector table Go starts, flash begin of the family by default.\n"
+        "    --alive banner[,ms]          after Go wait up to ms (500 by default) for the application to send banner\n"
+        "                                 on the USART, text or hex bytes as 0x55aa..., and report the start-up time.\n"
+        "    --ram_test payload.bin[:n,...] before the flash steps load the test payload into RAM, start it, run\n"
+        "                                 tests n (1 by default) through the USART mailbox, see stm32_ram_test.hpp,\n"
+        "                                 and reset back into the bootloader. A failed test stops the job.\n"
+        "    --progress                   show the progress of erase, write, verify and read on stderr.\n"
+        "                                 Ctrl-C stops the job between two commands, a second one kills it.\n"
+        "-c, --cache_dir dir              keep parsed images in dir to skip parsing next time.\n"
+        "-t, --trace_decode file.trace    print the timeline and statistics of a trace dump and exit.\n"
+        "-T, --trace_out file.trace       save the trace ring after the job (built with STM32_BOOT_TRACE).\n"
+        "-n, --net host:port              use a serial device server instead of the local port.\n"
+        "    --rfc2217                    the device server speaks RFC 2217, it also drives RESET and BOOT0.\n"
+        "    --spi /dev/spidevB.C[:hz]    use the SPI bootloader, 1 MHz by default.\n"
+        "    --i2c /dev/i2c-N:address     use the I2C bootloader at the given 7 bit address.\n"
+        "    --gpio reset_value,boot_value sysfs GPIO value files for RESET and BOOT0 with --spi or --i2c.\n"
+        "    --mock usart|i2c|spi|can     talk to the built-in software bootloader, no hardware needed.\n"
+        "    --can ifname                 use the CAN bootloader over SocketCAN, e.g. can0 at 125 kbit/s.\n"
+        "    --can_nodes count            program count nodes on the CAN bus one after another, not with\n"
+        "                                 --record or --daemon.\n"
+        "    --can_mock_target ifname     act as a CAN bootloader on ifname (e.g. vcan0) until Go, for tests.\n"
+        "    --plan[=chip_id]             run the job without hardware and predict its duration on the selected\n"
+        "                                 link, for chip_id (0x440 by default).\n"
+        "    --faults spec                measure error recovery over a lossy link to the software bootloader of\n"
+        "                                 --mock (usart by default). spec: drop, duplicate, corrupt, nack, delay,\n"
+        "                                 disconnect, reset in per mille of transfers, runs, seed, timeout (ms),\n"
+        "                                 e.g. drop=5,nack=5,reset=1,runs=200.\n"
+        "    --buses[=chip_id]            program the -p image into the units on both buses at the same time,\n"
+        "                                 on PC two --mock usart targets with the flash timings of chip_id.\n"
+        "    --rx_thread                  read the local port, -n or --mock usart on a thread of its own into a\n"
+        "                                 ring the protocol takes its replies from, and print how they came.\n"
+        "                                 Not with --record.\n"
+        "    --record file.s32r           save every transport call of the session with its timing.\n"
+        "    --replay file.s32r[:speed]   run the session against a recorded one instead of a link, waiting out\n"
+        "                                 the recorded link time divided by speed (1 by default, 0 not at all).\n"
+        "    --daemon path.sock           keep the link open and serve the jobs of local clients on a Unix socket.\n"
+        "                                 A request is one line of job options (-e, -p, -s, -v, -d, -r, --no_go),\n"
+        "                                 the reply its status lines and \"END result\". File names are opened by\n"
+        "                                 the daemon. The session stays synced between jobs run with --no_go,\n"
+        "                                 prepared images stay in memory until their file changes.\n"
+        "                                 \"shutdown\" stops the daemon.\n"
+        "    --submit path.sock           send the job given by the other options to the daemon, relative file\n"
+        "                                 names made absolute here.\n" << std::endl;
 }
+static const struct option s_longOptions[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "erase", no_argument, NULL, 'e' },
+    { "program_bin", required_argument, NULL, 'p' },
+    { "read_bin", required_argument, NULL, 'r' },
+    { "stream_bin", required_argument, NULL, 's' },
+    { "verify", no_argument, NULL, 'v' },
+    { "data", required_argument, NULL, 'd' },
+    { "cache_dir", required_argument, NULL, 'c' },
+    { "trace_decode", required_argument, NULL, 't' },
+    { "trace_out", required_argument, NULL, 'T' },
+    { "net", required_argument, NULL, 'n' },
+    { "rfc2217", no_argument, NULL, 'R' },
+    { "spi", required_argument, NULL, 'S' },
+    { "i2c", required_argument, NULL, 'I' },
+    { "gpio", required_argument, NULL, 'G' },
+    { "mock", required_argument, NULL, 'M' },
+    { "can", required_argument, NULL, 'C' },
+    { "can_nodes", required_argument, NULL, 'N' },
+    { "can_mock_target", required_argument, NULL, 'X' },
+    { "plan", optional_argument, NULL, 'P' },
+    { "faults", required_argument, NULL, 'F' },
+    { "buses", optional_argument, NULL, 'B' },
+    { "progress", no_argument, NULL, 'O' },
+    { "record", required_argument, NULL, 'W' },
+    { "replay", required_argument, NULL, 'Y' },
+    { "no_go", no_argument, NULL, 'K' },
+    { "ram_test", required_argument, NULL, 'Z' },
+    { "go_addr", required_argument, NULL, 'A' },
+    { "alive", required_argument, NULL, 'L' },
+    { "daemon", required_argument, NULL, 'D' },
+    { "submit", required_argument, NULL, 'U' },
+    { "rx_thread", no_argument, NULL, 'H' },
+    {0, 0, 0, 0},
+};
+static const char s_shortOptions[] = "ep:r:s:vd:c:t:T:n:";
 Settings_t parseCommandLine( int argc, char * argv[] ) {
     /// TODO Add code
     Settings_t result;
     if (argc > 1) {
-        const struct option long_options[] = {
-            { "help", no_argument, NULL, 'h' },
-            { "erase", no_argument, NULL, 'e' },
-            { "program_bin", required_argument, NULL, 'p' },
-            { "read_bin", required_argument, NULL, 'r' },
-            {0, 0, 0, 0},
-        };
         int option_index;
         int c;
-        while (( c = getopt_long(argc, argv, "ep:r:", long_options, &option_index) ) != -1) {
-            std::cout << "c " << c << std::endl;
+        optind = 0; // the daemon parses a command line per job
+        while (( c = getopt_long(argc, argv, s_shortOptions, s_longOptions, &option_index) ) != -1) {
             switch (c) {
             case 'e':
                 result.erase = true;
@@ -38,8 +132,170 @@ Settings_t parseCommandLine( int argc, char * argv[] ) {
                 break;
             case 'r':
                 result.read = true;
+                result.readFname = optarg;
+                break;
+            case 's':
+                result.stream = true;
                 result.fname = optarg;
                 break;
+            case 'v':
+                result.verify = true;
+                break;
+            case 'd': {
+                std::string spec = optarg;
+                size_t colon = spec.find(':');
+                DataBlock_t block;
+                block.addr = static_cast<uint32_t>(strtoul(spec.c_str(), nullptr, 0));
+                if (colon == std::string::npos || block.addr % 4) {
+                    printHelp();
+                } else {
+                    block.fname = spec.substr(colon + 1);
+                    result.data.push_back(block);
+                }
+                break;
+            }
+            case 'c':
+                result.cacheDir = optarg;
+                break;
+            case 't':
+                result.traceIn = optarg;
+                break;
+            case 'T':
+                result.traceOut = optarg;
+                break;
+            case 'n': {
+                std::string addr = optarg;
+                size_t colon = addr.rfind(':');
+                const char * port = ( colon == std::string::npos ) ? "" : addr.c_str() + colon + 1;
+                char * end = nullptr;
+                unsigned long value = strtoul(port, &end, 10);
+                result.netHost = addr.substr(0, colon);
+                // digits only: strtoul takes a sign, spaces and a suffix, and the cast would wrap 70000 to 4464
+                if (*port < '0' || *port > '9' || *end || !value || value > 0xffff) {
+                    std::cout << "--net takes host:port, the port from 1 to 65535." << std::endl;
+                    printHelp();
+                    result.netPort = 0; // the link fails to open, the local port is not taken instead
+                } else {
+                    result.netPort = static_cast<uint16_t>(value);
+                }
+                break;
+            }
+            case 'R':
+                result.rfc2217 = true;
+                break;
+            case 'S': {
+                std::string dev = optarg;
+                size_t colon = dev.rfind(':');
+                result.spiDev = dev.substr(0, colon);
+                if (colon != std::string::npos)
+                    result.spiSpeedHz = static_cast<uint32_t>(strtoul(dev.c_str() + colon + 1, nullptr, 10));
+                break;
+            }
+            case 'I': {
+                std::string dev = optarg;
+                size_t colon = dev.rfind(':');
+                if (colon == std::string::npos) {
+                    printHelp();
+                } else {
+                    result.i2cDev = dev.substr(0, colon);
+                    result.i2cAddress = static_cast<uint8_t>(strtoul(dev.c_str() + colon + 1, nullptr, 0));
+                }
+                break;
+            }
+            case 'G': {
+                std::string paths = optarg;
+                size_t comma = paths.find(',');
+                if (comma == std::string::npos) {
+                    printHelp();
+                } else {
+                    result.resetGpio = paths.substr(0, comma);
+                    result.bootGpio = paths.substr(comma + 1);
+                }
+                break;
+            }
+            case 'M':
+                result.mock = optarg;
+                break;
+            case 'C':
+                result.canIf = optarg;
+                break;
+            case 'N':
+                result.canNodes = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+                break;
+            case 'X':
+                result.canMockTarget = optarg;
+                break;
+            case 'P':
+                result.plan = true;
+                if (optarg)
+                    result.planChipId = static_cast<uint16_t>(strtoul(optarg, nullptr, 0));
+                break;
+            case 'F':
+                result.faults = optarg;
+                break;
+            case 'O':
+                result.progress = true;
+                break;
+            case 'B':
+                result.buses = true;
+                if (optarg)
+                    result.planChipId = static_cast<uint16_t>(strtoul(optarg, nullptr, 0));
+                break;
+            case 'W':
+                result.recordOut = optarg;
+                break;
+            case 'Y': {
+                std::string log = optarg;
+                size_t colon = log.rfind(':');
+                result.replayIn = log.substr(0, colon);
+                if (colon != std::string::npos)
+                    result.replaySpeed = static_cast<uint32_t>(strtoul(log.c_str() + colon + 1, nullptr, 10));
+                break;
+            }
+            case 'K':
+                result.go = false;
+                break;
+            case 'A':
+                result.goAddress = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+                break;
+            case 'L': {
+                std::string spec = optarg;
+                size_t comma = spec.rfind(',');
+                if (comma != std::string::npos) {
+                    result.aliveTimeoutMs = static_cast<uint32_t>(strtoul(spec.c_str() + comma + 1, nullptr, 10));
+                    spec.erase(comma);
+                }
+                result.aliveBanner.clear();
+                if (spec.compare(0, 2, "0x") == 0) {
+                    for ( size_t pos = 2; pos + 1 < spec.size(); pos += 2 ) {
+                        result.aliveBanner.push_back(static_cast<uint8_t>(strtoul(spec.substr(pos, 2).c_str(), nullptr, 16)));
+                    }
+                } else {
+                    result.aliveBanner.assign(spec.begin(), spec.end());
+                }
+                break;
+            }
+            case 'Z': {
+                std::string spec = optarg;
+                size_t colon = spec.find(':');
+                result.ramPayload.fname = spec.substr(0, colon);
+                result.ramTests.clear();
+                for ( size_t pos = colon; pos != std::string::npos; pos = spec.find(',', pos + 1) ) {
+                    result.ramTests.push_back(static_cast<uint8_t>(strtoul(spec.c_str() + pos + 1, nullptr, 0)));
+                }
+                if (result.ramTests.empty())
+                    result.ramTests.push_back(1);
+                break;
+            }
+            case 'D':
+                result.daemonSocket = optarg;
+                break;
+            case 'U':
+                result.submitSocket = optarg;
+                break;
+            case 'H':
+                result.rxThread = true;
+                break;
             default:
                 printHelp();
             }
@@ -48,106 +304,948 @@ Settings_t parseCommandLine( int argc, char * argv[] ) {
     }
     return result;
 }
+template<class Client>
 int tryDetectMcu( Stm32BootClient::McuType &_mcy ) {
-    /// TODO Fixe this
-    (void)_mcy;
     std::cout << "Try to detect MCU.\n";
     std::cout << "Try to find any MCU at first...";
-    Stm32BootClient::ErrorCode err = Stm32BootClient::instance()->checkMcuPresence();
+    Stm32BootClient::ErrorCode err = Client::checkMcuPresence();
     std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
     if (err != Stm32BootClient::ErrorCode::ACK_OK) {
         std::cout << "No MCU found!" << std::endl;
     } else {
         std::cout << "OK! Some MCU found, try to found out type." << std::endl;
-        std::cout << "Get MCU's bootloader info...";
-        Stm32BootClient::CommandGetResponse_t getresp;
-        err = Stm32BootClient::commandGet(getresp);
+        std::cout << "Get MCU's bootloader capabilities...";
+        err = Client::negotiateCaps();
         std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-        if (err == Stm32BootClient::ErrorCode::OK) {
-            std::cout << "Boot ver.: " << getresp.getBootVerStr() << std::endl;
+        const Stm32BootClient::SessionCaps_t & caps = Client::getCaps();
+        if (caps.valid) {
+            std::cout << "Boot ver.: " << ( caps.bootVer >> 4 ) << "." << ( caps.bootVer & 0x0f ) << std::endl;
             std::cout << "List of supported commands: ";
-            for ( size_t i = 0; i < getresp.getCommandListSize(); i++ ) {
-                std::cout << std::hex << "0x" << static_cast<int>(getresp.getCommand(i)) << " " << std::dec;
+            for ( int i = 0; i < 0x100; i++ ) {
+                if (caps.isCommandSupported(static_cast<Stm32BootClient::Command>(i))) {
+                    std::cout << std::hex << "0x" << i << " " << std::dec;
+                }
             }
-            std::cout << std::endl << "Get Chip Id...";
-            Stm32BootClient::CommandGetIdResponse_t chipid;
-            err = Stm32BootClient::commandGetId(chipid);
+            std::cout << std::endl << "Chip Id: 0x" << std::hex << caps.chipId << std::dec << std::endl;
+            std::cout << "MCU Type: " << Stm32BootClient::mcuType2String(caps.mcuType) << std::endl;
+            if (caps.rdpActive) {
+                std::cout << "Read protection is active." << std::endl;
+            }
+        }
+        if (err == Stm32BootClient::ErrorCode::OK) {
+            _mcy = caps.mcuType;
+            if (!caps.rdpActive)
+                std::cout << "\tFlash size: " << caps.flashSize << " bytes." << std::endl;
+        }
+    }
+    return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+}
+/*!
+ * Function: runJob 
+ * Runs the steps of the job in the session opened by tryDetectMcu(), each 
+ * one only if asked for: RAM tests, erase, program with verification, stream, data 
+ * blocks, read back. Then starts the application with Go unless --no_go and 
+ * waits for its banner if one is given. Flash is erased once, page by page 
+ * for what the image and the data blocks touch unless -e is given, which -s 
+ * requires. 
+ * Under read protection only detecting and reading pass, a job which would 
+ * write or start the application fails. 
+ * 
+ * @param _settings the job.
+ * @param _image prepared image or nullptr.
+ * @param _timer takes a step after each of them.
+ * 
+ * @return int 0 on success.
+ */
+template<class Client>
+int runJob( const Settings_t &_settings, const Stm32PreparedImage * _image, Stm32JobTimer &_timer ) {
+    const Stm32BootClient::SessionCaps_t & caps = Client::getCaps();
+    Stm32BootClient::ErrorCode err = Stm32BootClient::ErrorCode::OK;
+    if (!_settings.ramPayload.fname.empty()) {
+        err = runRamTests<Client>(_settings);
+        _timer.step("ram test");
+    }
+    bool writes = _settings.erase || _settings.program || _settings.stream || !_settings.data.empty();
+    // Go is on by default, a job which writes nothing asks for it only with --go_addr or --alive
+    bool start = _settings.go && ( writes || _settings.goAddress || !_settings.aliveBanner.empty() );
+    if (caps.rdpActive && err == Stm32BootClient::ErrorCode::OK && ( writes || start )) {
+        std::cout << "Read protection active, nothing was written and the MCU was not started." << std::endl;
+        err = Stm32BootClient::ErrorCode::FAILED;
+    }
+    if (!caps.rdpActive && err == Stm32BootClient::ErrorCode::OK) {
+        const Stm32PreparedImage::ErasePlan_t * plan = _image ? _image->findErasePlan(caps.mcuType) : nullptr;
+        // erasing outside the image is the user's call: only -e, which -s needs as it knows no pages in advance
+        bool massErase = _settings.erase;
+        std::vector<uint16_t> pages;
+        if (plan && !massErase)
+            pages = plan->pages;
+        if (_settings.stream && !massErase) {
+            std::cout << "-s doesn't know the pages it will write, add -e to erase the whole flash first." << std::endl;
+            err = Stm32BootClient::ErrorCode::FAILED;
+        }
+        if (_image && !plan && !massErase) {
+            std::cout << "No page layout of the MCU to erase the image by, use -e to erase the whole flash." << std::endl;
+            err = Stm32BootClient::ErrorCode::FAILED;
+        }
+        Stm32BootClient::McuDescription_t descr = Client::mcuType2Description(caps.mcuType);
+        uint32_t flashEnd = descr.flashBegin + caps.flashSize;
+        for ( const DataBlock_t & block : _settings.data ) {
+            // option bytes and RAM need no erase
+            if (descr.flashPageSize && block.addr >= descr.flashBegin && block.addr < flashEnd) {
+                uint32_t end = std::min(block.addr + static_cast<uint32_t>(block.content.size()), flashEnd);
+                for ( uint32_t page = ( block.addr - descr.flashBegin ) / descr.flashPageSize;
+                      descr.flashBegin + page * descr.flashPageSize < end; page++ )
+                    pages.push_back(static_cast<uint16_t>(page));
+            }
+        }
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+        if (err == Stm32BootClient::ErrorCode::OK && massErase) {
+            std::cout << "Try to erase whole flash...";
+            err = Client::eraseAllMemory();
             std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-            if (err == Stm32BootClient::ErrorCode::OK) {
-                std::cout << "0x" << std::hex << chipid.getId() << std::dec << std::endl;
-                Stm32BootClient::McuType mcutype = Stm32BootClient::chipId2McuType(chipid.getId());
-                std::cout << "MCU Type: " << Stm32BootClient::mcuType2String(mcutype) << std::endl;
-                std::cout << "Read MCU Specs...";
-                Stm32BootClient::McuSpecificInfo_t spec;
-                err = Stm32BootClient::readMcuSpecificInfo(chipid.getId(), spec);
-                std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-                if (err == Stm32BootClient::ErrorCode::OK) {
-                    std::cout << "\tFlash size: " << spec.flashSize << " bytes." << std::endl;
-
-                    std::cout << "Allocate buffer for file...";
-                    uint8_t * fbuff = new uint8_t[spec.flashSize];
-                    if (fbuff) {
-//                      std::cout << "Reading from flash to file...";
-//                      err = Stm32BootClient::readMemory(fbuff, 0x08000000, spec.flashSize);
-//                      std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-//                      std::cout << "Writing file..." << std::endl;
-//                      std::ofstream ofile;
-//                      ofile.open("read_by_me.bin", std::ios::out | std::ios::binary);
-//                      ofile.write(reinterpret_cast<const char *>(fbuff), spec.flashSize);
-//                      ofile.close();
-
-
-
-//                      std::cout << "Reading file from disk...";
-//                      std::ifstream ifile;
-//                      ifile.open("test_by_iar.bin", std::ios::in | std::ios::binary);
-//                      ifile.seekg(0, std::ios::end);
-//                      size_t length = ifile.tellg();
-//                      ifile.seekg(0, std::ios::beg);
-//                      std::cout << "size " << length;
-//                      ifile.read(reinterpret_cast<char *>(fbuff), length);
-//                      ifile.close();
-//                      std::cout << "Triyng to write to flash...";
-//                      err = Stm32BootClient::writeMemory(fbuff, 0x08000000, length);
-//                      std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-
-
-//                      memset(fbuff, 0xff, spec.flashSize);
-//                      std::cout << "Try to fill whole flash with 0's...";
-//                      err = Stm32BootClient::writeMemory(fbuff, 0x08000000, spec.flashSize);
-//                      std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-
-                        std::cout << "Try to erase whole flash..." << std::endl;
-                        err = Stm32BootClient::eraseAllMemory();
-                        std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-                        delete [] fbuff;
-                    }
-
-                    std::cout << "Try Go...";
-                    err = Stm32BootClient::commandGo(0x08000000);
-                    std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
-                }
+            _timer.step("erase");
+        } else if (err == Stm32BootClient::ErrorCode::OK && !pages.empty()) {
+            std::cout << "Try to erase " << pages.size() << " pages...";
+            err = Client::erasePages(pages.data(), pages.size());
+            std::cout << Stm32BootClient::errorCode2String(err);
+            if (plan && plan->massEraseFaster)
+                std::cout << " (-e would be faster if nothing outside the image has to stay)";
+            std::cout << std::endl;
+            _timer.step("erase");
+        }
+        if (_image && err == Stm32BootClient::ErrorCode::OK) {
+            const Stm32PreparedImage::PackStats_t & pack = _image->packStats();
+            std::cout << ( _settings.verify ? "Writing and verifying " : "Writing " ) << pack.payloadBytes << " bytes in " <<
+                pack.frames << " frames, " << pack.fillPercent() << "% filled...";
+            err = Client::writeFrames(_image->frames().data(), _image->frames().size(), _settings.verify);
+            std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
+            _timer.step(_settings.verify ? "program+verify" : "program");
+        }
+        if (_settings.stream && err == Stm32BootClient::ErrorCode::OK) {
+            Stm32Decompressor input;
+            size_t written = 0;
+            std::cout << "Streaming " << _settings.fname << " to flash...";
+            err = input.open(_settings.fname);
+            if (err == Stm32BootClient::ErrorCode::OK)
+                err = Client::writeMemoryStream(Stm32Decompressor::source, &input, Stm32Image::DEFAULT_BIN_BASE, &written);
+            if (err == Stm32BootClient::ErrorCode::OK)
+                err = input.status(); // a truncated archive ends the stream early, not with a read error
+            std::cout << Stm32BootClient::errorCode2String(err) << ", " << written << " bytes" << std::endl;
+            _timer.step("stream");
+        }
+        for ( size_t i = 0; i < _settings.data.size() && err == Stm32BootClient::ErrorCode::OK; i++ ) {
+            const DataBlock_t & block = _settings.data[i];
+            std::cout << "Writing " << block.fname << " to 0x" << std::hex << block.addr << std::dec << "...";
+            err = _settings.verify ? Client::writeMemoryVerified(block.content.data(), block.addr, block.content.size()) :
+                Client::writeMemory(block.content.data(), block.addr, block.content.size());
+            std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
+            if (i + 1 == _settings.data.size() || err != Stm32BootClient::ErrorCode::OK)
+                _timer.step("data");
+        }
+    }
+    if (err == Stm32BootClient::ErrorCode::CANCELLED) {
+        const Stm32BootClient::Progress_t & progress = Client::progress();
+        std::cout << "Cancelled before 0x" << std::hex << progress.address.load() << std::dec << ", " <<
+            progress.done.load() << " of " << progress.total.load() <<
+            " done. The bootloader waits for the next command, the MCU was not started." << std::endl;
+    }
+    int result = ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+    if (result == 0 && !_settings.readFname.empty()) {
+        result = readFlash<Client>(_settings.readFname);
+        _timer.step("read");
+    }
+    if (result == 0 && !caps.rdpActive && _settings.go) {
+        typedef Stm32Handoff<Client> Handoff;
+        uint32_t addr = _settings.goAddress ? _settings.goAddress : Handoff::applicationAddress(caps.mcuType);
+        typename Handoff::Result_t handoff;
+        std::cout << "Try Go to 0x" << std::hex << addr << std::dec << "...";
+        err = Handoff::go(addr, _settings.aliveBanner.data(), _settings.aliveBanner.size(), _settings.aliveTimeoutMs, handoff);
+        if (handoff.alive) {
+            std::cout << "alive after " << handoff.aliveMs << " ms, " << handoff.skipped << " bytes before the banner" << std::endl;
+        } else if (err == Stm32BootClient::ErrorCode::SERIAL_RD_SIZE) {
+            std::cout << "no banner within " << _settings.aliveTimeoutMs << " ms" << std::endl;
+        } else {
+            std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
+        }
+        _timer.step(_settings.aliveBanner.empty() ? "go" : "go+alive");
+        result = ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+    }
+    return result;
+}
+/*!
+ * Function: runRamTests 
+ * Loads the test payload into RAM, starts it, runs the tests and resets the 
+ * MCU back into the bootloader, in a new session, for the flash steps. 
+ * 
+ * @return Stm32BootClient::ErrorCode FAILED if a test failed.
+ */
+template<class Client>
+Stm32BootClient::ErrorCode runRamTests( const Settings_t &_settings ) {
+    Stm32RamTest<Client> harness;
+    const DataBlock_t & payload = _settings.ramPayload;
+    std::cout << "Loading the test payload into RAM...";
+    Stm32BootClient::ErrorCode err = harness.load(payload.content.data(), payload.content.size());
+    std::cout << Stm32BootClient::errorCode2String(err);
+    if (harness.loadAddress())
+        std::cout << " at 0x" << std::hex << harness.loadAddress() << std::dec;
+    std::cout << std::endl;
+    bool started = ( err == Stm32BootClient::ErrorCode::OK );
+    bool passed = true;
+    if (started) {
+        typename Stm32RamTest<Client>::Hello_t hello;
+        std::cout << "Starting it...";
+        err = harness.start(hello);
+        std::cout << Stm32BootClient::errorCode2String(err);
+        if (err == Stm32BootClient::ErrorCode::OK)
+            std::cout << ", payload 0x" << std::hex << hello.payloadId << std::dec;
+        std::cout << std::endl;
+    }
+    for ( size_t i = 0; i < _settings.ramTests.size() && err == Stm32BootClient::ErrorCode::OK; i++ ) {
+        typename Stm32RamTest<Client>::Result_t result;
+        std::cout << "Test " << static_cast<unsigned>(_settings.ramTests[i]) << "...";
+        err = harness.run(_settings.ramTests[i], nullptr, 0, result, RAM_TEST_TIMEOUT_MS);
+        if (err != Stm32BootClient::ErrorCode::OK) {
+            std::cout << Stm32BootClient::errorCode2String(err);
+        } else if (result.status) {
+            std::cout << "failed, status " << static_cast<unsigned>(result.status);
+            passed = false;
+        } else {
+            std::cout << "passed";
+        }
+        for ( size_t j = 0; j < result.size && err == Stm32BootClient::ErrorCode::OK; j++ ) {
+            std::cout << ( j ? " " : ", " ) << std::hex << static_cast<unsigned>(result.data[j]) << std::dec;
+        }
+        std::cout << std::endl;
+    }
+    if (started) {
+        std::cout << "Back to the bootloader...";
+        Stm32BootClient::ErrorCode back = harness.finish();
+        std::cout << Stm32BootClient::errorCode2String(back) << std::endl;
+        if (err == Stm32BootClient::ErrorCode::OK)
+            err = back;
+    }
+    if (err == Stm32BootClient::ErrorCode::OK && !passed) {
+        std::cout << "A test failed, the flash steps are skipped." << std::endl;
+        err = Stm32BootClient::ErrorCode::FAILED;
+    }
+    return err;
+}
+/*!
+ * Function: readFlash 
+ * Saves the whole flash of the session's MCU through a memory view.
+ * 
+ * @param _fname binary file to be written.
+ * 
+ * @return int 0 on success.
+ */
+template<class Client>
+int readFlash( const std::string &_fname ) {
+    const Stm32BootClient::SessionCaps_t & caps = Client::getCaps();
+    Stm32BootClient::ErrorCode err = Stm32BootClient::ErrorCode::FAILED;
+    if (caps.rdpActive) {
+        std::cout << "Read protection is active, flash can't be read." << std::endl;
+    } else {
+        Stm32MemoryView<Client> view;
+        std::vector<uint8_t> content(caps.flashSize);
+        uint32_t begin = Stm32BootClient::mcuType2Description(caps.mcuType).flashBegin;
+        std::cout << "Reading " << content.size() << " bytes of flash...";
+        err = view.read(content.data(), begin, content.size());
+        std::cout << Stm32BootClient::errorCode2String(err) << ", " << view.stats().reads << " reads" << std::endl;
+        if (err == Stm32BootClient::ErrorCode::OK) {
+            FILE * file = fopen(_fname.c_str(), "wb");
+            if (!file || fwrite(content.data(), 1, content.size(), file) != content.size())
+                err = Stm32BootClient::ErrorCode::FILE_FAILED;
+            if (file && fclose(file) != 0)
+                err = Stm32BootClient::ErrorCode::FILE_FAILED;
+            std::cout << "Saving " << _fname << "..." << Stm32BootClient::errorCode2String(err) << std::endl;
+        }
+    }
+    return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+}
+/*!
+ * Function: updateUnit 
+ * A Stm32BusScheduler job: syncs, erases what the image needs, programs it 
+ * and starts the unit, quietly, the other bus is busy at the same time. 
+ * 
+ * @param _image Stm32PreparedImage.
+ * 
+ * @return Stm32BootClient::ErrorCode
+ */
+template<class Client>
+Stm32BootClient::ErrorCode updateUnit( void * _image ) {
+    const Stm32PreparedImage * image = static_cast<const Stm32PreparedImage *>(_image);
+    Stm32BootClient::ErrorCode err = Client::init();
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        err = Client::checkMcuPresence();
+        if (err == Stm32BootClient::ErrorCode::ACK_OK)
+            err = Client::negotiateCaps();
+    }
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        const Stm32PreparedImage::ErasePlan_t * plan = image->findErasePlan(Client::getCaps().mcuType);
+        // only the pages of the image, calibration and EEPROM emulation pages stay
+        if (!plan) {
+            err = Stm32BootClient::ErrorCode::FAILED;
+        } else if (!plan->pages.empty()) {
+            err = Client::erasePages(plan->pages.data(), plan->pages.size());
+        }
+    }
+    if (err == Stm32BootClient::ErrorCode::OK)
+        err = Client::writeFrames(image->frames().data(), image->frames().size(), false);
+    if (err == Stm32BootClient::ErrorCode::OK)
+        err = Client::commandGo(Stm32Handoff<Client>::applicationAddress(Client::getCaps().mcuType));
+    return err;
+}
+/*!
+ * Function: runBuses 
+ * Programs the image into two units at once through Stm32BusScheduler and 
+ * compares the time with doing them one after another. On PC the units are 
+ * software bootloaders which take as long to erase and program as the MCU 
+ * of the chip id. 
+ * 
+ * @return int 0 if both units were updated.
+ */
+int runBuses( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation ) {
+    typedef Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart, 0> Io0;
+    typedef Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart, 1> Io1;
+    Stm32JobPlan::FlashTiming_t timing;
+    Stm32BootClient::ErrorCode err = Stm32BootClient::ErrorCode::FAILED;
+    if (!_settings.program || _settings.mock != "usart") {
+        std::cout << "--buses takes a -p image and --mock usart." << std::endl;
+    } else if (!Stm32JobPlan::findFlashTiming(Stm32BootClient::chipId2McuType(_settings.planChipId), timing)) {
+        std::cout << "No flash timings for chip id 0x" << std::hex << _settings.planChipId << std::dec << std::endl;
+    } else {
+        err = _preparation.get();
+        std::cout << "Preparing " << _settings.fname << "..." << Stm32BootClient::errorCode2String(err) << std::endl;
+    }
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        Stm32BusScheduler scheduler;
+        Io0::target() = Stm32MockTarget(Io0::PROTOCOL_VARIANT, _settings.planChipId, timing.flashSize);
+        Io1::target() = Stm32MockTarget(Io1::PROTOCOL_VARIANT, _settings.planChipId, timing.flashSize);
+        Io0::target().setFlashTime(timing.pageEraseUs, timing.massEraseUs, timing.halfWordUs);
+        Io1::target().setFlashTime(timing.pageEraseUs, timing.massEraseUs, timing.halfWordUs);
+        scheduler.submit(Stm32BootLowIo::Bus::Bus0, updateUnit<Stm32BootClientT<Io0>>, &_prepared);
+        scheduler.submit(Stm32BootLowIo::Bus::Bus1, updateUnit<Stm32BootClientT<Io1>>, &_prepared);
+        std::cout << "Updating both buses..." << std::endl;
+        err = scheduler.run();
+        uint32_t sequentialMs = 0;
+        for ( auto bus : { Stm32BootLowIo::Bus::Bus0, Stm32BootLowIo::Bus::Bus1 } ) {
+            const Stm32BusScheduler::Slot_t & slot = scheduler.slot(bus);
+            std::cout << "Bus " << static_cast<int>(bus) << ": " << Stm32BootClient::errorCode2String(slot.result) << ", " <<
+                slot.endMs - slot.startMs << " ms" << std::endl;
+            sequentialMs += slot.endMs - slot.startMs;
+        }
+        std::cout << "Both buses: " << scheduler.elapsedMs() << " ms, one after another: " << sequentialMs << " ms." << std::endl;
+    }
+    return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+}
+/*!
+ * Function: runFaultCampaign 
+ * Measures how the client recovers from link faults, see Stm32FaultCampaign.
+ * 
+ * @return int 0 if every command recovered with the right result.
+ */
+int runFaultCampaign( const Settings_t &_settings ) {
+    Stm32FaultCampaign::Config_t config;
+    bool ok = Stm32FaultCampaign::parse(_settings.faults, config);
+    if (!ok) {
+        printHelp();
+    } else if (_settings.mock == "i2c") {
+        ok = Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::I2c>(config, std::cout);
+    } else if (_settings.mock == "spi") {
+        ok = Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::Spi>(config, std::cout);
+    } else if (_settings.mock == "can") {
+        ok = Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::Can>(config, std::cout);
+    } else {
+        ok = Stm32FaultCampaign::run<Stm32BootClient::ProtocolVariant::Usart>(config, std::cout);
+    }
+    return ok ? 0 : -1;
+}
+/*!
+ * Function: loadData 
+ * Reads the -d blocks and the RAM test payload before the session, a missing 
+ * file must not leave a half programmed MCU behind. 
+ * 
+ * @return int 0 on success.
+ */
+int loadData( Settings_t &_settings ) {
+    Stm32BootClient::ErrorCode err = Stm32BootClient::ErrorCode::OK;
+    size_t count = _settings.data.size() + ( _settings.ramPayload.fname.empty() ? 0 : 1 );
+    for ( size_t i = 0; i < count && err == Stm32BootClient::ErrorCode::OK; i++ ) {
+        DataBlock_t & block = ( i < _settings.data.size() ) ? _settings.data[i] : _settings.ramPayload;
+        err = Stm32Decompressor::readAll(block.fname, block.content);
+        if (err == Stm32BootClient::ErrorCode::OK && block.content.empty())
+            err = Stm32BootClient::ErrorCode::FILE_FAILED;
+        block.content.resize(( block.content.size() + 3 ) & ~static_cast<size_t>(3), 0xff);
+        std::cout << "Loading " << block.fname << "..." << Stm32BootClient::errorCode2String(err) << ", " <<
+            block.content.size() << " bytes" << std::endl;
+    }
+    return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+}
+/*!
+ * Function: decodeTrace 
+ * Prints a trace dump saved by saveTrace() or pulled out of the target.
+ * 
+ * @return int 0 on success.
+ */
+int decodeTrace( const std::string &_fname ) {
+    std::vector<Stm32Trace::Record_t> records;
+    Stm32BootClient::ErrorCode err = Stm32TraceDecoder::load(_fname, records);
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        Stm32TraceDecoder::printTimeline(records, std::cout);
+        std::cout << std::endl;
+        Stm32TraceDecoder::printStatistics(records, std::cout);
+    } else {
+        std::cout << "Can't load " << _fname << ": " << Stm32BootClient::errorCode2String(err) << std::endl;
+    }
+    return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+}
+/*!
+ * Function: serveCanMockTarget 
+ * Runs the software CAN bootloader on a SocketCAN interface until the host 
+ * sends Go, so the CAN path can be tested end to end on vcan.
+ * 
+ * @return int 0 on success.
+ */
+int serveCanMockTarget( const std::string &_ifname ) {
+#ifndef __linux__
+    std::cout << "--can_mock_target needs Linux." << std::endl;
+    (void)_ifname;
+    return -1;
+#else
+    Stm32CanLink link;
+    Stm32MockTarget target(Stm32BootClient::ProtocolVariant::Can);
+    link.configure(_ifname, CAN_TIMEOUT_MS);
+    Stm32BootClient::ErrorCode err = link.open();
+    std::cout << "Serving the CAN bootloader on " << _ifname << "..." << Stm32BootClient::errorCode2String(err) << std::endl;
+    while (err == Stm32BootClient::ErrorCode::OK && !target.isRunning()) {
+        Stm32BootClient::CanFrame_t frame;
+        size_t rd;
+        err = link.read(&frame, sizeof( frame ), &rd);
+        if (rd) {
+            target.write(reinterpret_cast<const uint8_t *>(&frame), rd);
+            uint8_t out[32 * sizeof( Stm32BootClient::CanFrame_t )];
+            size_t count;
+            while (err == Stm32BootClient::ErrorCode::OK && ( count = target.read(out, sizeof( out )) ) != 0) {
+                err = link.write(out, count, nullptr);
             }
         }
     }
+    if (target.isRunning())
+        std::cout << "Go 0x" << std::hex << target.getGoAddress() << std::dec << std::endl;
     return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+#endif
 }
+int saveTrace( const std::string &_fname ) {
+    std::vector<Stm32Trace::Record_t> records;
+#ifdef STM32_BOOT_TRACE
+    records.resize(Stm32Trace::RING_SIZE);
+    records.resize(Stm32Trace::snapshot(records.data(), records.size()));
+#else
+    std::cout << "Tracing is not built in, define STM32_BOOT_TRACE." << std::endl;
+#endif
+    std::cout << "Saving " << records.size() << " trace records...";
+    Stm32BootClient::ErrorCode err = Stm32TraceDecoder::save(_fname, records);
+    std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
+    return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+}
+template<class Client>
 int initBootLoader() {
     std::cout << "Initializing bootloader module...";
-    Stm32BootClient::ErrorCode err = Stm32BootClient::instance()->init();
+    Stm32BootClient::ErrorCode err = Client::init();
     std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
     return ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
 }
+/// Ctrl-C: the job stops at the next block boundary, the next Ctrl-C kills the process
+static void onInterrupt( int ) {
+    std::signal(SIGINT, SIG_DFL);
+    if (s_cancel)
+        s_cancel();
+}
+/*!
+ * Function: showProgress 
+ * Polls the progress of the client until _stop and keeps one status line up 
+ * to date on stderr. The client never waits for it. 
+ */
+template<class Client>
+void showProgress( const std::atomic<bool> &_stop ) {
+    const Stm32BootClient::Progress_t & progress = Client::progress();
+    while (!_stop.load()) {
+        auto phase = static_cast<Stm32BootClient::Phase>(progress.phase.load());
+        if (phase != Stm32BootClient::Phase::Idle) {
+            uint32_t total = progress.total.load();
+            std::cerr << "\r" << Stm32BootClient::phase2String(phase) << " " << progress.done.load();
+            if (total)
+                std::cerr << "/" << total;
+            std::cerr << ( phase == Stm32BootClient::Phase::Erase ? " pages" : " bytes" ) << ", " << progress.retries.load() <<
+                " retries   " << std::flush;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+Stm32JobTimer::Stm32JobTimer()
+    : m_start(std::chrono::steady_clock::now())
+    , m_mark(m_start) {}
+void Stm32JobTimer::step( const char * _name ) {
+    auto now = std::chrono::steady_clock::now();
+    Step_t step = { _name, std::chrono::duration_cast<std::chrono::milliseconds>(now - m_mark).count() };
+    m_steps.push_back(step);
+    m_mark = now;
+}
+void Stm32JobTimer::print( std::ostream &_out ) const {
+    // the total is what --plan predicts, to check the link profile and flash timings against
+    _out << "Measured:";
+    for ( const Step_t & step : m_steps ) {
+        _out << " " << step.name << " " << step.ms << " ms,";
+    }
+    _out << " total " << std::chrono::duration_cast<std::chrono::milliseconds>(m_mark - m_start).count() << " ms." << std::endl;
+}
+/*!
+ * Function: runSession 
+ * Opens the link, detects the MCU once, waits for the prepared image and runs 
+ * the whole job in that session.
+ * 
+ * @return int 0 on success.
+ */
+template<class Client>
+int runSession( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation ) {
+    Stm32JobTimer timer;
+    std::atomic<bool> stop(false);
+    std::thread monitor;
+    Client::clearCancel();
+    s_cancel = Client::cancel;
+    std::signal(SIGINT, onInterrupt);
+    if (_settings.progress)
+        monitor = std::thread(showProgress<Client>, std::cref(stop));
+    int result = initBootLoader<Client>();
+    timer.step("open");
+    if (result == 0) {
+        if (_settings.mcuType == Stm32BootClient::McuType::Unknown) {
+            result = tryDetectMcu<Client>(_settings.mcuType);
+            timer.step("detect");
+        }
+    }
+    if (_settings.program && _preparation.valid()) { // the next --can_nodes node takes the image as it is
+        Stm32BootClient::ErrorCode err = _preparation.get();
+        std::cout << "Preparing " << _settings.fname << "..." << Stm32BootClient::errorCode2String(err) <<
+            ( _prepared.isCacheHit() ? " (cached), " : ", " ) << _prepared.prepTimeMs() << " ms" << std::endl;
+        if (err != Stm32BootClient::ErrorCode::OK)
+            result = -1;
+        timer.step("prepare");
+    }
+    if (result == 0) {
+        result = runJob<Client>(_settings, _settings.program ? &_prepared : nullptr, timer);
+    }
+    stop.store(true);
+    if (monitor.joinable()) {
+        monitor.join();
+        std::cerr << std::endl;
+    }
+    std::signal(SIGINT, SIG_DFL);
+    s_cancel = nullptr;
+    if (!_settings.plan) {
+        timer.print(std::cout);
+    }
+    return result;
+}
+/*!
+ * Function: runLink 
+ * Runs the session over the transport, recorded if a log file is given, or 
+ * serves the jobs of the daemon on it. 
+ * 
+ * @return int 0 on success.
+ */
+template<class Io>
+int runLink( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation ) {
+    int result;
+    if (!_settings.daemonSocket.empty()) {
+        result = serveJobs<Stm32BootClientT<Io>>(_settings);
+    } else if (_settings.recordOut.empty()) {
+        result = runSession<Stm32BootClientT<Io>>(_settings, _prepared, _preparation);
+    } else {
+        typedef Stm32BootRecordIo<Io> RecordIo;
+        result = runSession<Stm32BootClientT<RecordIo>>(_settings, _prepared, _preparation);
+        Stm32BootClient::ErrorCode err = Stm32SessionLog::save(_settings.recordOut, Io::PROTOCOL_VARIANT,
+            RecordIo::recorder().records());
+        std::cout << "Saving the session to " << _settings.recordOut << "..." << Stm32BootClient::errorCode2String(err) <<
+            ", " << RecordIo::recorder().records().size() << " calls" << std::endl;
+    }
+    return result;
+}
+/*!
+ * Function: runRxThreadLink 
+ * --rx_thread: runs the session, or serves the jobs of the daemon, with a 
+ * receive thread between the transport and the protocol, then reports how 
+ * the reads were served. 
+ * 
+ * @param _timeoutMs how long a read of the protocol may wait.
+ * 
+ * @return int 0 on success.
+ */
+template<class Io>
+int runRxThreadLink( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation,
+                     uint32_t _timeoutMs ) {
+    typedef Stm32BootRxThreadIo<Io> ThreadIo;
+    int result;
+    ThreadIo::pump().setTimeout(_timeoutMs);
+    if (!_settings.daemonSocket.empty()) {
+        result = serveJobs<Stm32BootClientT<ThreadIo>>(_settings);
+    } else {
+        result = runSession<Stm32BootClientT<ThreadIo>>(_settings, _prepared, _preparation);
+    }
+    ThreadIo::pump().stop();
+    ThreadIo::pump().print(std::cout);
+    return result;
+}
+/*!
+ * Function: runDaemonJob 
+ * Runs one job of the daemon. A session left up by the previous job is 
+ * checked with GvRps instead of resetting and syncing the MCU again. 
+ * 
+ * @param _args job options.
+ * @param _daemon keeps the prepared images.
+ * @param _warm true if the session is up, updated for the next job.
+ * 
+ * @return int 0 on success.
+ */
+template<class Client>
+int runDaemonJob( const std::vector<std::string> &_args, Stm32Daemon &_daemon, bool &_warm ) {
+    std::vector<std::string> words(_args);
+    std::vector<char *> argv;
+    words.insert(words.begin(), "stm32bootpc");
+    for ( std::string & word : words ) {
+        argv.push_back(&word[0]);
+    }
+    argv.push_back(nullptr);
+    Settings_t job = parseCommandLine(static_cast<int>(words.size()), argv.data());
+    if (!job.mock.empty() || !job.netHost.empty() || !job.spiDev.empty() || !job.i2cDev.empty() || !job.canIf.empty() ||
+        !job.daemonSocket.empty() || !job.submitSocket.empty() || !job.recordOut.empty() || !job.replayIn.empty() ||
+        !job.traceIn.empty() || !job.canMockTarget.empty() || !job.faults.empty() || job.plan || job.buses || job.rxThread) {
+        std::cout << "Only job options are taken, the link belongs to the daemon." << std::endl;
+        return -1;
+    }
+    Stm32JobTimer timer;
+    int result = 0;
+    if (_warm) {
+        Stm32BootClient::CommandGvRpsResponse_t resp;
+        Stm32BootClient::ErrorCode err = Client::commandGvRps(resp);
+        std::cout << "Session from the last job..." << Stm32BootClient::errorCode2String(err) << std::endl;
+        _warm = ( err == Stm32BootClient::ErrorCode::OK );
+        timer.step("check");
+    }
+    if (!_warm) {
+        result = tryDetectMcu<Client>(job.mcuType);
+        timer.step("detect");
+    }
+    const Stm32PreparedImage * image = nullptr;
+    if (result == 0 && job.program) {
+        bool kept = false;
+        Stm32BootClient::ErrorCode err = _daemon.prepareImage(job.fname, image, kept);
+        std::cout << "Preparing " << job.fname << "..." << Stm32BootClient::errorCode2String(err);
+        if (kept) {
+            std::cout << " (in memory)" << std::endl;
+        } else if (image) {
+            std::cout << ( image->isCacheHit() ? " (cached), " : ", " ) << image->prepTimeMs() << " ms" << std::endl;
+        } else {
+            std::cout << std::endl;
+        }
+        result = ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+        timer.step("prepare");
+    }
+    if (result == 0)
+        result = loadData(job);
+    if (result == 0)
+        result = runJob<Client>(job, image, timer);
+    // after Go the MCU runs the application, or the next board is on the fixture
+    _warm = Client::getCaps().valid && !( result == 0 && job.go );
+    timer.print(std::cout);
+    return result;
+}
+/*!
+ * Function: serveJobs 
+ * --daemon: opens the link once and runs the jobs of local clients on it 
+ * until one of them asks for shutdown. 
+ * 
+ * @return int 0 after a shutdown request.
+ */
+template<class Client>
+int serveJobs( const Settings_t &_settings ) {
+    Stm32Daemon daemon(_settings.cacheDir);
+    bool warm = false;
+    int result = initBootLoader<Client>();
+    if (result == 0) {
+        std::cout << "Listening on " << _settings.daemonSocket << "...";
+        Stm32BootClient::ErrorCode err = daemon.open(_settings.daemonSocket);
+        std::cout << Stm32BootClient::errorCode2String(err) << std::endl;
+        result = ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+    }
+    if (result == 0) {
+        Stm32BootClient::ErrorCode err = daemon.serve([&daemon, &warm]( const std::vector<std::string> &_args, std::ostream &_out ) {
+            // the status of the job goes to the client
+            std::streambuf * console = std::cout.rdbuf(_out.rdbuf());
+            int jobResult = runDaemonJob<Client>(_args, daemon, warm);
+            std::cout.rdbuf(console);
+            std::cout << "Job";
+            for ( const std::string & arg : _args ) {
+                std::cout << " " << arg;
+            }
+            std::cout << ": " << jobResult << std::endl;
+            return jobResult;
+        });
+        result = ( err == Stm32BootClient::ErrorCode::OK ) ? 0 : -1;
+    }
+    daemon.close();
+    Client::deinit();
+    return result;
+}
+/*!
+ * Function: absolutePath 
+ * @return std::string _path taken from the working directory, as it is if 
+ *         already absolute or the directory is unknown.
+ */
+static std::string absolutePath( const std::string &_path ) {
+    char cwd[PATH_MAX];
+    bool relative = !_path.empty() && _path[0] != '/';
+    return ( relative && getcwd(cwd, sizeof( cwd )) ) ? std::string(cwd) + "/" + _path : _path;
+}
+/*!
+ * Function: submitJob 
+ * --submit: sends the other options of the command line to the daemon as 
+ * one job and prints its status lines as they come. Files are named by 
+ * absolute paths, the daemon runs in a directory of its own. 
+ * 
+ * @param _path of the daemon socket.
+ * 
+ * @return int the result of the job, -1 if the daemon can't be reached.
+ */
+int submitJob( int argc, char * argv[], const std::string &_path ) {
+    std::vector<std::string> words(argv, argv + argc);
+    std::vector<bool> keep(words.size(), true);
+    std::vector<std::string> args;
+    int result = -1;
+    int option_index;
+    int c;
+    // parsed once more to find the arguments in any spelling of the options, argv is in order since the first time
+    optind = 0;
+    opterr = 0; // the first parse has reported them
+    while (( c = getopt_long(argc, argv, s_shortOptions, s_longOptions, &option_index) ) != -1) {
+        if (!optarg)
+            continue;
+        size_t word = static_cast<size_t>(optind - 1);
+        size_t at = static_cast<size_t>(optarg - argv[word]); // 0 if the argument is a word of its own
+        std::string value = optarg;
+        size_t colon = value.find(':');
+        switch (c) {
+        case 'U':
+            keep[word] = false;
+            keep[word - 1] = keep[word - 1] && at;
+            break;
+        case 'p':
+        case 'r':
+        case 's':
+        case 'c':
+        case 'T':
+            value = absolutePath(value);
+            break;
+        case 'd':
+            if (colon != std::string::npos)
+                value = value.substr(0, colon + 1) + absolutePath(value.substr(colon + 1));
+            break;
+        case 'Z':
+            value = absolutePath(value.substr(0, colon)) + ( ( colon != std::string::npos ) ? value.substr(colon) : "" );
+            break;
+        default:
+            break;
+        }
+        words[word] = words[word].substr(0, at) + value;
+    }
+    opterr = 1;
+    for ( size_t i = 1; i < words.size(); i++ ) {
+        if (keep[i])
+            args.push_back(words[i]);
+    }
+    Stm32BootClient::ErrorCode err = Stm32Daemon::submit(_path, args, std::cout, result);
+    if (err != Stm32BootClient::ErrorCode::OK) {
+        std::cout << "Submitting to " << _path << "..." << Stm32BootClient::errorCode2String(err) << std::endl;
+        result = -1;
+    }
+    return result;
+}
+/*!
+ * Function: replaySession 
+ * Loads the log for the replay transport of the variant, runs the session 
+ * against it and reports where the time went. 
+ * 
+ * @return int 0 if the session succeeded and followed the recording.
+ */
+template<Stm32BootClient::ProtocolVariant Variant>
+int replaySession( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation ) {
+    typedef Stm32BootReplayIo<Variant> Io;
+    std::vector<Stm32SessionLog::Record_t> records;
+    Stm32BootClient::ErrorCode err = Stm32SessionLog::load(_settings.replayIn, Io::PROTOCOL_VARIANT, records);
+    std::cout << "Loading " << _settings.replayIn << "..." << Stm32BootClient::errorCode2String(err) << std::endl;
+    int result = -1;
+    if (err == Stm32BootClient::ErrorCode::OK) {
+        Io::player().start(records, _settings.replaySpeed);
+        result = runSession<Stm32BootClientT<Io>>(_settings, _prepared, _preparation);
+        Io::player().print(std::cout);
+        if (Io::player().isDiverged())
+            result = -1;
+    }
+    return result;
+}
+/*!
+ * Function: planJob 
+ * Runs the session against the software bootloader of the variant, with the 
+ * flash of the planned MCU, and prices what the target has seen. 
+ * 
+ * @param _bitRate of the selected link, 0 for the usual one of the variant.
+ * 
+ * @return int 0 if the job would succeed.
+ */
+template<Stm32BootClient::ProtocolVariant Variant>
+int planJob( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation,
+             uint32_t _bitRate ) {
+    typedef Stm32BootMockIo<Variant> Io;
+    Stm32JobPlan::FlashTiming_t timing;
+    int result = -1;
+    if (!Stm32JobPlan::findFlashTiming(Stm32BootClient::chipId2McuType(_settings.planChipId), timing)) {
+        std::cout << "No flash timings for chip id 0x" << std::hex << _settings.planChipId << std::dec << std::endl;
+    } else {
+        Io::target() = Stm32MockTarget(Variant, _settings.planChipId, timing.flashSize);
+        result = runSession<Stm32BootClientT<Io>>(_settings, _prepared, _preparation);
+        Stm32JobPlan::print(Io::target().stats(), Stm32JobPlan::linkProfile(Variant, _bitRate, !_settings.netHost.empty()),
+            timing, std::cout);
+    }
+    return result;
+}
 int main( int argc, char * argv[] ) {
     Settings_t settings;
     int result = 0;
     std::cout << "STM32F0(1,2,3,4) bootloader client software.\n";
-    result = initBootLoader();
-    if (result == 0) {
-        settings = parseCommandLine(argc, argv);
-        if (settings.mcuType == Stm32BootClient::McuType::Unknown) {
-            result = tryDetectMcu(settings.mcuType);
+    settings = parseCommandLine(argc, argv);
+    if (!settings.submitSocket.empty()) {
+        return submitJob(argc, argv, settings.submitSocket);
+    }
+    if (!settings.traceIn.empty()) {
+        return decodeTrace(settings.traceIn);
+    }
+    if (!settings.canMockTarget.empty()) {
+        return serveCanMockTarget(settings.canMockTarget);
+    }
+    if (!settings.faults.empty()) {
+        return runFaultCampaign(settings);
+    }
+    if (loadData(settings) != 0) {
+        return -1;
+    }
+    Stm32ImageCache cache(settings.cacheDir);
+    Stm32PreparedImage prepared;
+    std::future<Stm32BootClient::ErrorCode> preparation;
+    if (settings.program) {
+        // image work doesn't need the target, let it go while the target is being synced
+        preparation = std::async(std::launch::async, [&settings, &cache, &prepared]() {
+            return prepared.prepare(settings.fname, Stm32Image::DEFAULT_BIN_BASE, cache);
+        });
+    }
+    if (!settings.replayIn.empty()) {
+        Stm32BootClient::ProtocolVariant variant = Stm32BootClient::ProtocolVariant::Usart;
+        if (Stm32SessionLog::readVariant(settings.replayIn, variant) != Stm32BootClient::ErrorCode::OK) {
+            std::cout << "Loading " << settings.replayIn << "..." <<
+                Stm32BootClient::errorCode2String(Stm32BootClient::ErrorCode::FILE_FAILED) << std::endl;
+            result = -1;
+        } else if (variant == Stm32BootClient::ProtocolVariant::I2c) {
+            result = replaySession<Stm32BootClient::ProtocolVariant::I2c>(settings, prepared, preparation);
+        } else if (variant == Stm32BootClient::ProtocolVariant::Spi) {
+            result = replaySession<Stm32BootClient::ProtocolVariant::Spi>(settings, prepared, preparation);
+        } else if (variant == Stm32BootClient::ProtocolVariant::Can) {
+            result = replaySession<Stm32BootClient::ProtocolVariant::Can>(settings, prepared, preparation);
+        } else {
+            result = replaySession<Stm32BootClient::ProtocolVariant::Usart>(settings, prepared, preparation);
+        }
+    } else if (settings.buses) {
+        result = runBuses(settings, prepared, preparation);
+    } else if (settings.plan) {
+        // the variant the job would use, in the order links are picked below, nothing is opened
+        std::string variant = settings.mock;
+        if (variant.empty())
+            variant = !settings.canIf.empty() ? "can" : !settings.spiDev.empty() ? "spi" : !settings.i2cDev.empty() ? "i2c" : "usart";
+        if (variant == "i2c") {
+            result = planJob<Stm32BootClient::ProtocolVariant::I2c>(settings, prepared, preparation, 0);
+        } else if (variant == "spi") {
+            result = planJob<Stm32BootClient::ProtocolVariant::Spi>(settings, prepared, preparation,
+                settings.spiDev.empty() ? 0 : settings.spiSpeedHz);
+        } else if (variant == "can") {
+            result = planJob<Stm32BootClient::ProtocolVariant::Can>(settings, prepared, preparation, 0);
+        } else {
+            result = planJob<Stm32BootClient::ProtocolVariant::Usart>(settings, prepared, preparation, 0);
+        }
+    } else if (settings.mock == "usart") {
+        // the played application answers --alive
+        typedef Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Usart> Io;
+        Io::target().setAppOutput(settings.aliveBanner);
+        if (settings.rxThread) {
+            result = runRxThreadLink<Io>(settings, prepared, preparation, RX_THREAD_TIMEOUT_MS);
+        } else {
+            result = runLink<Io>(settings, prepared, preparation);
+        }
+    } else if (settings.mock == "i2c") {
+        result = runLink<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::I2c>>(settings, prepared, preparation);
+    } else if (settings.mock == "spi") {
+        result = runLink<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Spi>>(settings, prepared, preparation);
+    } else if (settings.mock == "can") {
+        result = runLink<Stm32BootMockIo<Stm32BootClient::ProtocolVariant::Can>>(settings, prepared, preparation);
+#ifdef __linux__
+    } else if (!settings.canIf.empty()) {
+        if (settings.canNodes > 1 && ( !settings.recordOut.empty() || !settings.daemonSocket.empty() )) {
+            // a log replays one session, the daemon serves one node
+            std::cout << "--can_nodes takes no --record or --daemon." << std::endl;
+            result = -1;
+        } else {
+            Stm32BootCanIo<0>::link().configure(settings.canIf, CAN_TIMEOUT_MS);
+            result = runLink<Stm32BootCanIo<0>>(settings, prepared, preparation);
         }
+        // the socket stays open, every node gets its own sync and session, with progress and Ctrl-C
+        for ( uint32_t node = 1; node < settings.canNodes && result == 0; node++ ) {
+            std::cout << "Put CAN node " << node + 1 << " into the bootloader, press ENTER...";
+            std::cin.get();
+            settings.mcuType = Stm32BootClient::McuType::Unknown;
+            result = runSession<Stm32BootCanClient>(settings, prepared, preparation);
+        }
+    } else if (!settings.spiDev.empty()) {
+        typedef Stm32BootDevIo<Stm32SpiDevLink, 0> Io;
+        Io::link().configure(settings.spiDev, settings.spiSpeedHz);
+        Io::resetGpio().configure(settings.resetGpio);
+        Io::bootGpio().configure(settings.bootGpio);
+        result = runLink<Io>(settings, prepared, preparation);
+    } else if (!settings.i2cDev.empty()) {
+        typedef Stm32BootDevIo<Stm32I2cDevLink, 0> Io;
+        Io::link().configure(settings.i2cDev, settings.i2cAddress);
+        Io::resetGpio().configure(settings.resetGpio);
+        Io::bootGpio().configure(settings.bootGpio);
+        result = runLink<Io>(settings, prepared, preparation);
+#else
+    } else if (!settings.canIf.empty() || !settings.spiDev.empty() || !settings.i2cDev.empty()) {
+        std::cout << "--can, --spi and --i2c need Linux." << std::endl;
+        result = -1;
+#endif
+    } else if (settings.netHost.empty()) {
+        if (settings.rxThread) {
+            result = runRxThreadLink<Stm32BootLowIo>(settings, prepared, preparation, RX_THREAD_TIMEOUT_MS);
+        } else {
+            result = runLink<Stm32BootLowIo>(settings, prepared, preparation);
+        }
+    } else {
+        Stm32BootNetIo<0>::link().configure(settings.netHost, settings.netPort,
+            settings.rfc2217 ? Stm32NetLink::Mode::Rfc2217 : Stm32NetLink::Mode::Raw, NET_TIMEOUT_MS);
+        if (settings.rxThread) {
+            result = runRxThreadLink<Stm32BootNetIo<0>>(settings, prepared, preparation, NET_TIMEOUT_MS);
+        } else {
+            result = runLink<Stm32BootNetIo<0>>(settings, prepared, preparation);
+        }
+    }
+    if (!settings.traceOut.empty()) {
+        saveTrace(settings.traceOut);
     }
     return result;
 }
@@ -1,19 +1,153 @@
 #pragma once
 #ifdef __cplusplus
 #include "stm32_boot_client.hpp"
+#include "stm32_prepare.hpp"
+#include "stm32_trace_decode.hpp"
+#include "stm32_io_net.hpp"
+#include "stm32_io_linux.hpp"
+#include "stm32_io_can.hpp"
+#include "stm32_mock_target.hpp"
+#include "stm32_decompress.hpp"
+#include "stm32_plan.hpp"
+#include "stm32_memory_view.hpp"
+#include "stm32_fault.hpp"
+#include "stm32_record.hpp"
+#include "stm32_bus_scheduler.hpp"
+#include "stm32_daemon.hpp"
+#include "stm32_ram_test.hpp"
+#include "stm32_handoff.hpp"
+#include "stm32_rx_thread.hpp"
+#include <future>
+#include <chrono>
+#include <ostream>
+/// A raw blob for -d: option bytes, calibration or configuration data
+typedef struct DataBlock_t {
+    uint32_t addr;
+    std::string fname;
+    std::vector<uint8_t> content;
+}DataBlock_t;
 typedef struct Settings_t {
     Stm32BootClient::McuType mcuType;
     bool program : 1;
     bool read : 1;
     bool erase : 1;
+    bool stream : 1;
+    bool verify : 1;
+    bool rfc2217 : 1;
+    bool plan : 1;              /// run the job against the software bootloader and predict its duration
+    bool buses : 1;             /// update the units on both buses at the same time
+    bool progress : 1;          /// show the progress of long operations on stderr
+    bool go : 1;                /// start the MCU at the end of the job, otherwise the session stays up
+    bool rxThread : 1;          /// read the USART link on a thread of its own, see Stm32BootRxThreadIo
     std::string fname;
+    std::string readFname;      /// -r, may come with -p or -s in the same job
+    std::vector<DataBlock_t> data;  /// written after the image, in command line order
+    DataBlock_t ramPayload;     /// test payload run from RAM before the flash steps, addr unused
+    std::vector<uint8_t> ramTests;  /// test numbers to run on it
+    std::vector<uint8_t> aliveBanner;   /// the started application sends it, empty not to wait
+    uint32_t aliveTimeoutMs;
+    uint32_t goAddress;         /// vector table for Go, 0 for flashBegin of the family
+    std::string cacheDir;
+    std::string traceIn;        /// trace dump to be decoded, no target needed
+    std::string traceOut;       /// where to save the trace ring after the job
+    std::string netHost;        /// serial device server, empty for the local port
+    uint16_t netPort;
+    std::string spiDev;         /// spidev node, SPI bootloader instead of USART
+    uint32_t spiSpeedHz;
+    std::string i2cDev;         /// i2c-dev node, I2C bootloader instead of USART
+    uint8_t i2cAddress;
+    std::string resetGpio;      /// sysfs value files driving RESET and BOOT0 on SPI and I2C
+    std::string bootGpio;
+    std::string mock;           /// usart, i2c, spi or can: talk to the software bootloader
+    std::string canIf;          /// SocketCAN interface, CAN bootloader instead of USART
+    uint32_t canNodes;          /// nodes to be programmed one after another on canIf
+    std::string canMockTarget;  /// serve the software bootloader on this interface instead of being the host
+    uint16_t planChipId;        /// MCU the plan is made for
+    std::string faults;         /// fault campaign spec, see Stm32FaultCampaign::parse()
+    std::string recordOut;      /// session log to be written
+    std::string replayIn;       /// session log to run against instead of a link
+    uint32_t replaySpeed;       /// divides the recorded link time, 0 skips it
+    std::string daemonSocket;   /// serve jobs of local clients on this Unix socket
+    std::string submitSocket;   /// send the job to the daemon on this Unix socket
     Settings_t()
         : mcuType(Stm32BootClient::McuType::Unknown)
         , program(false)
         , read(false)
-        , erase(false) {}
+        , erase(false)
+        , stream(false)
+        , verify(false)
+        , rfc2217(false)
+        , plan(false)
+        , buses(false)
+        , progress(false)
+        , go(true)
+        , rxThread(false)
+        , aliveTimeoutMs(500)
+        , goAddress(0)
+        , netPort(0)
+        , spiSpeedHz(1000000)
+        , i2cAddress(0)
+        , canNodes(1)
+        , planChipId(Stm32JobPlan::DEFAULT_CHIP_ID)
+        , replaySpeed(1) {}
 }Settings_t;
+/*!
+ * Wall time of the steps of a job run in one session, a step lasts from the
+ * end of the previous one.
+ */
+class Stm32JobTimer {
+public:
+    Stm32JobTimer();
+    void step( const char * _name );
+    void print( std::ostream &_out ) const;
+private:
+    typedef struct Step_t {
+        const char * name;
+        int64_t ms;
+    }
+    Step_t;
+    std::vector<Step_t> m_steps;
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::time_point m_mark;
+};
+template<class Client>
+int initBootLoader();
+template<class Client>
 int tryDetectMcu( Stm32BootClient::McuType &_mcy );
+template<class Client>
+int runJob( const Settings_t &_settings, const Stm32PreparedImage * _image, Stm32JobTimer &_timer );
+template<class Client>
+int readFlash( const std::string &_fname );
+template<class Client>
+void showProgress( const std::atomic<bool> &_stop );
+template<class Client>
+int runSession( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation );
+template<class Io>
+int runLink( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation );
+template<class Io>
+int runRxThreadLink( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation,
+                     uint32_t _timeoutMs );
+template<Stm32BootClient::ProtocolVariant Variant>
+int replaySession( Settings_t &_settings, const std::vector<Stm32SessionLog::Record_t> &_records, Stm32PreparedImage &_prepared,
+                   std::future<Stm32BootClient::ErrorCode> &_preparation );
+template<Stm32BootClient::ProtocolVariant Variant>
+int planJob( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation,
+             uint32_t _bitRate );
+int decodeTrace( const std::string &_fname );
+int saveTrace( const std::string &_fname );
+int serveCanMockTarget( const std::string &_ifname );
+int runFaultCampaign( const Settings_t &_settings );
+int loadData( Settings_t &_settings );
+template<class Client>
+Stm32BootClient::ErrorCode runRamTests( const Settings_t &_settings );
+template<class Client>
+Stm32BootClient::ErrorCode updateUnit( void * _image );
+int runBuses( Settings_t &_settings, Stm32PreparedImage &_prepared, std::future<Stm32BootClient::ErrorCode> &_preparation );
+template<class Client>
+int runDaemonJob( const std::vector<std::string> &_args, Stm32Daemon &_daemon, bool &_warm );
+template<class Client>
+int serveJobs( const Settings_t &_settings );
+int submitJob( int argc, char * argv[], const std::string &_path );
 int main( int argc, char * argv[] );
 Settings_t parseCommandLine( int argc, char * argv[] );
 #endif